@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "PROCESS VALIDATION", false },
+	{ "QUEUE BOUNDED", false },
+	{ "ALL INSTRUCTIONS ARRIVED", false },
+	{ "DONE INSTRUCTION", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_PROCESS_VALIDATION,
+	STEP_QUEUE_BOUNDED,
+	STEP_ALL_INSTRUCTIONS_ARRIVED,
+	STEP_DONE_INSTRUCTION,
+};
+
+#define MASTER_DOMAIN "unix:/tmp/wimp-test-10-master.sock"
+#define PROCESS_DOMAIN "unix:/tmp/wimp-test-10-process.sock"
+#define HIGH_WATERMARK 16
+#define LOW_WATERMARK 4
+#define FLOW_INSTRUCTION_COUNT 1000
+#define MASTER_AWAY_MS 200
+#define FILL_TIMEOUT_MS 5000
+
+/*
+* This is an example client main. It sends far more than the master lets it run ahead by, then waits to exit.
+*/
+int client_main_entry(int argc, char** argv)
+{
+	wimp_log("Test process!\n");
+
+	//Create a server local to this thread, only allowing the socket transport
+	wimp_init_local_server("test_process", PROCESS_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the master process that called this thread
+	RecieverArgs args = wimp_get_reciever_args("test_process", MASTER_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("master", PROCESS_DOMAIN, 0, args);
+
+	//Add the master process to the table for tracking
+	wimp_process_table_add(&server->ptable, "master", MASTER_DOMAIN, 0, WIMP_Process_Parent, NULL);
+
+	//Accept the connection to the test_process->master reciever, started by the master thread
+	wimp_server_process_accept(server, 1, "master");
+
+	//Each instruction carries its index so the master can check the order
+	for (int32_t i = 0; i < FLOW_INSTRUCTION_COUNT; ++i)
+	{
+		wimp_add_local_server("master", "data", &i, sizeof(int32_t));
+	}
+	wimp_add_local_server("master", "done", NULL, 0);
+	wimp_server_send_instructions(server);
+
+	//Keep sending as the master grants credits, until it exits this process
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+			if (strcmp(meta.instr, WIMP_INSTRUCTION_EXIT) == 0)
+			{
+				disconnect = true;
+			}
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_flush(server, 10);
+	}
+
+	//This should also shut down the reciever
+	wimp_log("Client thread closed\n");
+	wimp_close_local_server();
+
+	return 0;
+}
+
+/*
+* This is the entry for the lib. For this test, as will not be started from a separate executable this will be the only entry point used.
+*/
+int client_main_lib_entry(WimpMainEntry entry)
+{
+	int res = client_main_entry(entry->argc, entry->argv);
+	wimp_free_entry(entry);
+	return res;
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//Start the client process
+	WimpMainEntry entry = wimp_get_entry(0);
+	wimp_start_library_process("test_process", (MAIN_FUNC_PTR)&client_main_lib_entry, P_UTHREAD_PRIORITY_LOW, entry);
+
+	//Start a local server for the master process, only allowing the socket transport
+	wimp_init_local_server("master", MASTER_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//The watermarks have to be set before the reciever offers its window
+	wimp_instr_queue_set_watermarks(&server->incomingmsg, HIGH_WATERMARK, LOW_WATERMARK);
+
+	//Start a reciever thread for the client process that the master started
+	RecieverArgs args = wimp_get_reciever_args("master", PROCESS_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("test_process", MASTER_DOMAIN, 0, args);
+
+	//Add the test process to the table for tracking
+	wimp_process_table_add(&server->ptable, "test_process", PROCESS_DOMAIN, 0, WIMP_Process_Child, NULL);
+
+	//Accept the connection to the master->test_process reciever, started by the test_process
+	wimp_server_process_accept(server, 1, "test_process");
+
+	if (wimp_server_check_process_listening(server, "test_process"))
+	{
+		wimp_log("Process validated!\n");
+		PASS_MATRIX[STEP_PROCESS_VALIDATION].status = true;
+	}
+
+	//Wait for the child to fill the queue up to the high watermark, then stay away.
+	//While the queue is left alone the child can only run a window past it
+	int32_t length = 0;
+	for (int32_t waited = 0; length < HIGH_WATERMARK && waited < FILL_TIMEOUT_MS; ++waited)
+	{
+		p_uthread_sleep(1);
+		length = wimp_instr_queue_get_length(&server->incomingmsg);
+	}
+	p_uthread_sleep(MASTER_AWAY_MS);
+	length = wimp_instr_queue_get_length(&server->incomingmsg);
+	wimp_log("Queue length while away: %d\n", length);
+	PASS_MATRIX[STEP_QUEUE_BOUNDED].status = length >= HIGH_WATERMARK && length <= HIGH_WATERMARK + (HIGH_WATERMARK - LOW_WATERMARK);
+
+	//Draining the queue lets the child send the rest
+	int32_t expected = 0;
+	bool in_order = true;
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+
+			if (strcmp(meta.instr, "data") == 0)
+			{
+				in_order &= meta.arg_bytes == sizeof(int32_t) && *(int32_t*)meta.args == expected;
+				expected++;
+			}
+			else if (strcmp(meta.instr, "done") == 0)
+			{
+				PASS_MATRIX[STEP_DONE_INSTRUCTION].status = true;
+				disconnect = true;
+			}
+
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_send_instructions(server);
+	}
+	PASS_MATRIX[STEP_ALL_INSTRUCTIONS_ARRIVED].status = in_order && expected == FLOW_INSTRUCTION_COUNT;
+
+	//Cleanup, which exits the child
+	wimp_log("Master thread closed\n");
+	wimp_close_local_server();
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 4);
+	return 0;
+}
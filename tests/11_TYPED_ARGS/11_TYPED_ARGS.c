@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <wimp.h>
+#include <wimp_test.h>
+#include "test_args.h"
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "PROCESS VALIDATION", false },
+	{ "FIXED LAYOUT", false },
+	{ "DECODED ARGUMENTS", false },
+	{ "PERFECT HASH LOOKUP", false },
+	{ "DONE INSTRUCTION", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_PROCESS_VALIDATION,
+	STEP_FIXED_LAYOUT,
+	STEP_DECODED_ARGUMENTS,
+	STEP_PERFECT_HASH_LOOKUP,
+	STEP_DONE_INSTRUCTION,
+};
+
+#define MASTER_DOMAIN "unix:/tmp/wimp-test-11-master.sock"
+#define PROCESS_DOMAIN "unix:/tmp/wimp-test-11-process.sock"
+
+/*
+* This is an example client main. It sends the typed instructions, then waits to exit.
+*/
+int client_main_entry(int argc, char** argv)
+{
+	wimp_log("Test process!\n");
+
+	//Create a server local to this thread, only allowing the socket transport
+	wimp_init_local_server("test_process", PROCESS_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the master process that called this thread
+	RecieverArgs args = wimp_get_reciever_args("test_process", MASTER_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("master", PROCESS_DOMAIN, 0, args);
+
+	//Add the master process to the table for tracking
+	wimp_process_table_add(&server->ptable, "master", MASTER_DOMAIN, 0, WIMP_Process_Parent, NULL);
+
+	//Accept the connection to the test_process->master reciever, started by the master thread
+	wimp_server_process_accept(server, 1, "master");
+
+	//The arguments are filled in as a struct and copied straight into the instruction
+	//reserved on the server
+	PlayerMoveArgs move = { 0 };
+	move.flags = 0x5a;
+	move.x = -12;
+	move.y = 345678;
+	move.speed = 2.5;
+	strcpy(move.name, "test_process");
+	for (int16_t i = 0; i < 5; ++i)
+	{
+		move.path[i] = (int16_t)(i * -1000);
+	}
+	player_move_add(server, "master", &move);
+	status_add(server, "master");
+	done_send("master");
+	wimp_server_send_instructions(server);
+
+	//Wait for the master to exit this process
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+			if (strcmp(meta.instr, WIMP_INSTRUCTION_EXIT) == 0)
+			{
+				disconnect = true;
+			}
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_flush(server, 10);
+	}
+
+	//This should also shut down the reciever
+	wimp_log("Client thread closed\n");
+	wimp_close_local_server();
+
+	return 0;
+}
+
+/*
+* Checks the arguments of the player_move instruction are the ones the child sent
+*/
+static void on_player_move(WimpInstrMeta meta, void* context)
+{
+	const PlayerMoveArgs* move = player_move_decode(meta);
+	bool path_matches = move != NULL;
+	for (int16_t i = 0; path_matches && i < 5; ++i)
+	{
+		path_matches = move->path[i] == (int16_t)(i * -1000);
+	}
+	PASS_MATRIX[STEP_DECODED_ARGUMENTS].status = path_matches
+		&& move->flags == 0x5a && move->x == -12 && move->y == 345678
+		&& move->speed == 2.5 && strcmp(move->name, "test_process") == 0;
+}
+
+/*
+* Counts the status instructions, which have no arguments
+*/
+static void on_status(WimpInstrMeta meta, void* context)
+{
+	(*(int32_t*)context)++;
+}
+
+/*
+* This is the entry for the lib. For this test, as will not be started from a separate executable this will be the only entry point used.
+*/
+int client_main_lib_entry(WimpMainEntry entry)
+{
+	int res = client_main_entry(entry->argc, entry->argv);
+	wimp_free_entry(entry);
+	return res;
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//Register the generated instructions before any server accepts, so they are sent by ID
+	bool registered = test_args_register();
+
+	//The fields are aligned to their size with explicit padding, and the struct to 8 bytes
+	PASS_MATRIX[STEP_FIXED_LAYOUT].status = registered
+		&& PLAYER_MOVE_ARGS_BYTES == 48 && sizeof(PlayerMoveArgs) == 48
+		&& offsetof(PlayerMoveArgs, x) == 4 && offsetof(PlayerMoveArgs, speed) == 16
+		&& offsetof(PlayerMoveArgs, name) == 24 && offsetof(PlayerMoveArgs, path) == 38;
+
+	//Every name in the IDL finds itself, and names that only share a hash slot don't
+	bool lookup_matches = test_args_lookup(PLAYER_MOVE_INSTRUCTION) == TEST_ARGS_PLAYER_MOVE
+		&& test_args_lookup(DONE_INSTRUCTION) == TEST_ARGS_DONE
+		&& test_args_lookup(STATUS_INSTRUCTION) == TEST_ARGS_STATUS
+		&& test_args_lookup(RESET_INSTRUCTION) == TEST_ARGS_RESET
+		&& test_args_lookup(SHUTDOWN_INSTRUCTION) == TEST_ARGS_SHUTDOWN
+		&& test_args_lookup("") == TEST_ARGS_UNKNOWN
+		&& test_args_lookup("player_mov") == TEST_ARGS_UNKNOWN
+		&& test_args_lookup("statuses") == TEST_ARGS_UNKNOWN
+		&& test_args_lookup(WIMP_INSTRUCTION_EXIT) == TEST_ARGS_UNKNOWN;
+
+	//Start the client process
+	WimpMainEntry entry = wimp_get_entry(0);
+	wimp_start_library_process("test_process", (MAIN_FUNC_PTR)&client_main_lib_entry, P_UTHREAD_PRIORITY_LOW, entry);
+
+	//Start a local server for the master process, only allowing the socket transport
+	wimp_init_local_server("master", MASTER_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the client process that the master started
+	RecieverArgs args = wimp_get_reciever_args("master", PROCESS_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("test_process", MASTER_DOMAIN, 0, args);
+
+	//Add the test process to the table for tracking
+	wimp_process_table_add(&server->ptable, "test_process", PROCESS_DOMAIN, 0, WIMP_Process_Child, NULL);
+
+	//Accept the connection to the master->test_process reciever, started by the test_process
+	wimp_server_process_accept(server, 1, "test_process");
+
+	if (wimp_server_check_process_listening(server, "test_process"))
+	{
+		wimp_log("Process validated!\n");
+		PASS_MATRIX[STEP_PROCESS_VALIDATION].status = true;
+	}
+
+	//The generated switch picks the handler, and done is left to the loop
+	TestArgsHandlers handlers = { 0 };
+	handlers.player_move = &on_player_move;
+	handlers.status = &on_status;
+	int32_t status_count = 0;
+
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+
+			if (!test_args_dispatch(meta, &handlers, &status_count) && meta.instr_id == wimp_instr_get_id(DONE_INSTRUCTION))
+			{
+				PASS_MATRIX[STEP_DONE_INSTRUCTION].status = true;
+				disconnect = true;
+			}
+
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_send_instructions(server);
+	}
+
+	PASS_MATRIX[STEP_PERFECT_HASH_LOOKUP].status = lookup_matches && status_count == 1;
+
+	//Cleanup, which exits the child
+	wimp_log("Master thread closed\n");
+	wimp_close_local_server();
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 5);
+	return 0;
+}
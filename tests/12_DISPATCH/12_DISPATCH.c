@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "PROCESS VALIDATION", false },
+	{ "HANDLED BY INSTRUCTION", false },
+	{ "FALLBACK HANDLER", false },
+	{ "DONE INSTRUCTION", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_PROCESS_VALIDATION,
+	STEP_HANDLED_BY_INSTRUCTION,
+	STEP_FALLBACK_HANDLER,
+	STEP_DONE_INSTRUCTION,
+};
+
+#define MASTER_DOMAIN "unix:/tmp/wimp-test-12-master.sock"
+#define PROCESS_DOMAIN "unix:/tmp/wimp-test-12-process.sock"
+#define COMMAND_COUNT 40
+#define DISPATCH_BUDGET 8
+
+/*
+* This is an example client main. It sends every command, then waits to exit.
+*/
+int client_main_entry(int argc, char** argv)
+{
+	wimp_log("Test process!\n");
+
+	//Create a server local to this thread, only allowing the socket transport
+	wimp_init_local_server("test_process", PROCESS_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the master process that called this thread
+	RecieverArgs args = wimp_get_reciever_args("test_process", MASTER_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("master", PROCESS_DOMAIN, 0, args);
+
+	//Add the master process to the table for tracking
+	wimp_process_table_add(&server->ptable, "master", MASTER_DOMAIN, 0, WIMP_Process_Parent, NULL);
+
+	//Accept the connection to the test_process->master reciever, started by the master thread
+	wimp_server_process_accept(server, 1, "master");
+
+	//Each command carries its index, so the handler can check it got the right one
+	char command[32];
+	for (int32_t i = 0; i < COMMAND_COUNT; ++i)
+	{
+		snprintf(command, sizeof(command), "command_%d", i);
+		wimp_add_local_server("master", command, &i, sizeof(int32_t));
+	}
+	wimp_add_local_server("master", "unhandled", NULL, 0);
+	wimp_add_local_server("master", "done", NULL, 0);
+	wimp_server_send_instructions(server);
+
+	//Wait for the master to exit this process
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+			if (strcmp(meta.instr, WIMP_INSTRUCTION_EXIT) == 0)
+			{
+				disconnect = true;
+			}
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_flush(server, 10);
+	}
+
+	//This should also shut down the reciever
+	wimp_log("Client thread closed\n");
+	wimp_close_local_server();
+
+	return 0;
+}
+
+/*
+* This is the entry for the lib. For this test, as will not be started from a separate executable this will be the only entry point used.
+*/
+int client_main_lib_entry(WimpMainEntry entry)
+{
+	int res = client_main_entry(entry->argc, entry->argv);
+	wimp_free_entry(entry);
+	return res;
+}
+
+/*
+* Counts the calls of each command handler, which is passed its own index as the context
+*/
+static int32_t command_calls[COMMAND_COUNT];
+static bool command_args_match = true;
+
+static void command_handler(WimpServer* server, WimpInstrMeta meta, void* context)
+{
+	int32_t index = (int32_t)(intptr_t)context;
+	command_args_match &= meta.arg_bytes == sizeof(int32_t) && *(int32_t*)meta.args == index;
+	command_calls[index]++;
+}
+
+static void fallback_handler(WimpServer* server, WimpInstrMeta meta, void* context)
+{
+	PASS_MATRIX[STEP_FALLBACK_HANDLER].status = strcmp(meta.instr, "unhandled") == 0;
+}
+
+static void done_handler(WimpServer* server, WimpInstrMeta meta, void* context)
+{
+	PASS_MATRIX[STEP_DONE_INSTRUCTION].status = true;
+	*(bool*)context = true;
+}
+
+/*
+* Sets the handler for each command in the range
+*/
+static void set_command_handlers(WimpServer* server, int32_t first, int32_t last)
+{
+	char command[32];
+	for (int32_t i = first; i < last; ++i)
+	{
+		snprintf(command, sizeof(command), "command_%d", i);
+		wimp_server_set_handler(server, command, &command_handler, (void*)(intptr_t)i);
+	}
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//Start a local server for the master process, only allowing the socket transport
+	wimp_init_local_server("master", MASTER_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//The first half are registered before the connections are accepted, so are sent by ID
+	bool disconnect = false;
+	set_command_handlers(server, 0, COMMAND_COUNT / 2);
+	wimp_server_set_handler(server, "done", &done_handler, &disconnect);
+	wimp_server_set_handler(server, NULL, &fallback_handler, NULL);
+
+	//Start the client process
+	WimpMainEntry entry = wimp_get_entry(0);
+	wimp_start_library_process("test_process", (MAIN_FUNC_PTR)&client_main_lib_entry, P_UTHREAD_PRIORITY_LOW, entry);
+
+	//Start a reciever thread for the client process that the master started
+	RecieverArgs args = wimp_get_reciever_args("master", PROCESS_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("test_process", MASTER_DOMAIN, 0, args);
+
+	//Add the test process to the table for tracking
+	wimp_process_table_add(&server->ptable, "test_process", PROCESS_DOMAIN, 0, WIMP_Process_Child, NULL);
+
+	//Accept the connection to the master->test_process reciever, started by the test_process
+	wimp_server_process_accept(server, 1, "test_process");
+
+	if (wimp_server_check_process_listening(server, "test_process"))
+	{
+		wimp_log("Process validated!\n");
+		PASS_MATRIX[STEP_PROCESS_VALIDATION].status = true;
+	}
+
+	//The second half are registered after, so are sent by name
+	set_command_handlers(server, COMMAND_COUNT / 2, COMMAND_COUNT);
+
+	while (!disconnect)
+	{
+		if (wimp_server_dispatch(server, DISPATCH_BUDGET) == 0)
+		{
+			p_uthread_sleep(1);
+		}
+		wimp_server_send_instructions(server);
+	}
+
+	bool handled_once = command_args_match;
+	for (int32_t i = 0; i < COMMAND_COUNT; ++i)
+	{
+		handled_once &= command_calls[i] == 1;
+	}
+	PASS_MATRIX[STEP_HANDLED_BY_INSTRUCTION].status = handled_once;
+
+	//Cleanup, which exits the child
+	wimp_log("Master thread closed\n");
+	wimp_close_local_server();
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 4);
+	return 0;
+}
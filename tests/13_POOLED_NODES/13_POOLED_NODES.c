@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "POOLED NODES", false },
+	{ "FREED ON ANOTHER THREAD", false },
+	{ "LARGE NODE", false },
+	{ "DONE", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_POOLED_NODES,
+	STEP_FREED_ON_ANOTHER_THREAD,
+	STEP_LARGE_NODE,
+	STEP_DONE,
+};
+
+#define POOL_ROUNDS 1000
+#define CROSS_THREAD_NODES (WIMP_POOL_BATCH_BLOCKS * 4)
+#define LARGE_ARG_BYTES ((WIMP_POOL_MIN_BYTES << WIMP_POOL_CLASS_COUNT) * 2)
+
+/*
+* Frees every node in the queue, then gives the cached blocks to the depot as a thread ending would
+*/
+static int freeing_thread(void* data)
+{
+	WimpInstrQueue* queue = (WimpInstrQueue*)data;
+	WimpInstrNode node = wimp_instr_queue_pop(queue);
+	while (node != NULL)
+	{
+		wimp_instr_node_free(node);
+		node = wimp_instr_queue_pop(queue);
+	}
+	wimp_pool_thread_release();
+	return 0;
+}
+
+/*
+* Creates nodes into the queue, all in the same size class
+*/
+static void fill_queue(WimpInstrQueue* queue, int32_t count)
+{
+	for (int32_t i = 0; i < count; ++i)
+	{
+		wimp_instr_queue_add_existing(queue, wimp_test_create_node("data", i));
+	}
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//Before any other thread is started, nodes freed and created again should
+	//come back from the pool, with only the first from the system allocator
+	WimpPoolStats before = wimp_pool_get_stats();
+	WimpInstrQueue pooled = wimp_create_instr_queue();
+	for (int32_t i = 0; i < POOL_ROUNDS; ++i)
+	{
+		wimp_instr_queue_add_existing(&pooled, wimp_instr_node_create("master", 0, "master", 0, "data", 0, &i, sizeof(int32_t)));
+		wimp_instr_node_free(wimp_instr_queue_pop(&pooled));
+	}
+	WimpPoolStats after = wimp_pool_get_stats();
+	PASS_MATRIX[STEP_POOLED_NODES].status = after.allocs - before.allocs == POOL_ROUNDS
+		&& after.system_allocs - before.system_allocs <= 1
+		&& after.frees - before.frees == POOL_ROUNDS;
+
+	//Nodes freed by another thread end up in the depot once it releases its
+	//cache, so creating as many again doesn't need the system allocator
+	fill_queue(&pooled, CROSS_THREAD_NODES);
+	PUThread* thread = p_uthread_create((PUThreadFunc)&freeing_thread, &pooled, true, "wimp-test-freeing");
+	p_uthread_join(thread);
+	p_uthread_unref(thread);
+
+	before = wimp_pool_get_stats();
+	fill_queue(&pooled, CROSS_THREAD_NODES);
+	after = wimp_pool_get_stats();
+	PASS_MATRIX[STEP_FREED_ON_ANOTHER_THREAD].status = after.allocs - before.allocs == CROSS_THREAD_NODES
+		&& after.system_allocs == before.system_allocs
+		&& after.depot_hits > before.depot_hits;
+
+	WimpInstrNode node = wimp_instr_queue_pop(&pooled);
+	while (node != NULL)
+	{
+		wimp_instr_node_free(node);
+		node = wimp_instr_queue_pop(&pooled);
+	}
+
+	//A node bigger than the largest class is its own system allocation
+	uint8_t* large = calloc(LARGE_ARG_BYTES, 1);
+	before = wimp_pool_get_stats();
+	node = wimp_instr_node_create("master", 0, "master", 0, "large", 0, large, LARGE_ARG_BYTES);
+	bool large_kept = node != NULL && wimp_instr_get_from_node(node).arg_bytes == LARGE_ARG_BYTES;
+	wimp_instr_node_free(node);
+	after = wimp_pool_get_stats();
+	PASS_MATRIX[STEP_LARGE_NODE].status = large_kept
+		&& after.system_allocs - before.system_allocs == 1
+		&& after.system_frees - before.system_frees == 1;
+	free(large);
+
+	wimp_instr_queue_free(pooled);
+	PASS_MATRIX[STEP_DONE].status = true;
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 4);
+	return 0;
+}
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "LANE ORDER", false },
+	{ "PINNED FRONT", false },
+	{ "PROCESS VALIDATION", false },
+	{ "CONTROL LANE", false },
+	{ "BULK LANE", false },
+	{ "DONE INSTRUCTION", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_LANE_ORDER,
+	STEP_PINNED_FRONT,
+	STEP_PROCESS_VALIDATION,
+	STEP_CONTROL_LANE,
+	STEP_BULK_LANE,
+	STEP_DONE_INSTRUCTION,
+};
+
+#define MASTER_DOMAIN "unix:/tmp/wimp-test-14-master.sock"
+#define PROCESS_DOMAIN "unix:/tmp/wimp-test-14-process.sock"
+#define HIGH_WATERMARK 16
+#define LOW_WATERMARK 4
+#define DATA_COUNT 200
+#define BULK_COUNT 20
+#define LANE_ROUNDS 10
+
+/*
+* This is an example client main. It sends every lane, the control instruction last, then waits to exit.
+*/
+int client_main_entry(int argc, char** argv)
+{
+	wimp_log("Test process!\n");
+
+	//Create a server local to this thread, only allowing the socket transport
+	wimp_init_local_server("test_process", PROCESS_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the master process that called this thread
+	RecieverArgs args = wimp_get_reciever_args("test_process", MASTER_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("master", PROCESS_DOMAIN, 0, args);
+
+	//Add the master process to the table for tracking
+	wimp_process_table_add(&server->ptable, "master", MASTER_DOMAIN, 0, WIMP_Process_Parent, NULL);
+
+	//Accept the connection to the test_process->master reciever, started by the master thread
+	wimp_server_process_accept(server, 1, "master");
+
+	//Added first, but waits for everything else
+	for (int32_t i = 0; i < BULK_COUNT; ++i)
+	{
+		wimp_add_local_server("master", "bulk", &i, sizeof(int32_t));
+	}
+
+	//Each instruction carries its index so the master can check the order
+	for (int32_t i = 0; i < DATA_COUNT; ++i)
+	{
+		wimp_add_local_server("master", "data", &i, sizeof(int32_t));
+	}
+	wimp_add_local_server("master", "done", NULL, 0);
+
+	//Added last, but goes in front of everything the window holds back
+	wimp_add_local_server("master", "urgent", NULL, 0);
+	wimp_server_send_instructions(server);
+
+	//Keep sending as the master grants credits, until it exits this process
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+			if (strcmp(meta.instr, WIMP_INSTRUCTION_EXIT) == 0)
+			{
+				disconnect = true;
+			}
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_flush(server, 10);
+	}
+
+	//This should also shut down the reciever
+	wimp_log("Client thread closed\n");
+	wimp_close_local_server();
+
+	return 0;
+}
+
+/*
+* This is the entry for the lib. For this test, as will not be started from a separate executable this will be the only entry point used.
+*/
+int client_main_lib_entry(WimpMainEntry entry)
+{
+	int res = client_main_entry(entry->argc, entry->argv);
+	wimp_free_entry(entry);
+	return res;
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//The lanes are set before anything is built, so apply to both processes
+	wimp_instr_set_priority("urgent", WIMP_INSTR_PRIORITY_CONTROL);
+	wimp_instr_set_priority("bulk", WIMP_INSTR_PRIORITY_BULK);
+
+	//Every lane is interleaved, added by the owner then pushed to the inbox,
+	//and comes back most important first, each lane in order
+	WimpInstrQueue lanes = wimp_create_instr_queue();
+	bool lanes_kept = true;
+	for (int32_t pushed = 0; pushed < 2; ++pushed)
+	{
+		for (int32_t i = 0; i < LANE_ROUNDS; ++i)
+		{
+			WimpInstrNode nodes[3] = { wimp_test_create_node("bulk", i), wimp_test_create_node("data", i), wimp_test_create_node("urgent", i) };
+			for (int32_t j = 0; j < 3; ++j)
+			{
+				if (pushed)
+				{
+					wimp_instr_queue_push_existing(&lanes, nodes[j]);
+				}
+				else
+				{
+					wimp_instr_queue_add_existing(&lanes, nodes[j]);
+				}
+			}
+		}
+		for (int32_t i = 0; i < LANE_ROUNDS; ++i)
+		{
+			lanes_kept &= wimp_test_pop_expected(&lanes, "urgent", i);
+		}
+		for (int32_t i = 0; i < LANE_ROUNDS; ++i)
+		{
+			lanes_kept &= wimp_test_pop_expected(&lanes, "data", i);
+		}
+		for (int32_t i = 0; i < LANE_ROUNDS; ++i)
+		{
+			lanes_kept &= wimp_test_pop_expected(&lanes, "bulk", i);
+		}
+		lanes_kept &= wimp_instr_queue_pop(&lanes) == NULL;
+	}
+	PASS_MATRIX[STEP_LANE_ORDER].status = lanes_kept;
+
+	//A pinned node stays in front of anything added after, whatever its lane
+	wimp_instr_queue_add_existing(&lanes, wimp_test_create_node("bulk", 0));
+	wimp_instr_queue_pin_front(&lanes);
+	wimp_instr_queue_add_existing(&lanes, wimp_test_create_node("urgent", 0));
+	wimp_instr_queue_add_existing(&lanes, wimp_test_create_node("bulk", 1));
+	PASS_MATRIX[STEP_PINNED_FRONT].status = wimp_test_pop_expected(&lanes, "bulk", 0)
+		&& wimp_test_pop_expected(&lanes, "urgent", 0)
+		&& wimp_test_pop_expected(&lanes, "bulk", 1)
+		&& wimp_instr_queue_pop(&lanes) == NULL;
+	wimp_instr_queue_free(lanes);
+
+	//Start the client process
+	WimpMainEntry entry = wimp_get_entry(0);
+	wimp_start_library_process("test_process", (MAIN_FUNC_PTR)&client_main_lib_entry, P_UTHREAD_PRIORITY_LOW, entry);
+
+	//Start a local server for the master process, only allowing the socket transport
+	wimp_init_local_server("master", MASTER_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//The watermarks have to be set before the reciever offers its window
+	wimp_instr_queue_set_watermarks(&server->incomingmsg, HIGH_WATERMARK, LOW_WATERMARK);
+
+	//Start a reciever thread for the client process that the master started
+	RecieverArgs args = wimp_get_reciever_args("master", PROCESS_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("test_process", MASTER_DOMAIN, 0, args);
+
+	//Add the test process to the table for tracking
+	wimp_process_table_add(&server->ptable, "test_process", PROCESS_DOMAIN, 0, WIMP_Process_Child, NULL);
+
+	//Accept the connection to the master->test_process reciever, started by the test_process
+	wimp_server_process_accept(server, 1, "test_process");
+
+	if (wimp_server_check_process_listening(server, "test_process"))
+	{
+		wimp_log("Process validated!\n");
+		PASS_MATRIX[STEP_PROCESS_VALIDATION].status = true;
+	}
+
+	//Draining the queue lets the child send the rest, the bulk instructions last
+	int32_t data_seen = 0;
+	int32_t bulk_seen = 0;
+	int32_t urgent_at = -1;
+	bool data_in_order = true;
+	bool bulk_after_data = true;
+	while (bulk_seen < BULK_COUNT)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+
+			if (strcmp(meta.instr, "data") == 0)
+			{
+				data_in_order &= *(int32_t*)meta.args == data_seen;
+				data_seen++;
+			}
+			else if (strcmp(meta.instr, "urgent") == 0)
+			{
+				urgent_at = data_seen + bulk_seen;
+			}
+			else if (strcmp(meta.instr, "bulk") == 0)
+			{
+				bulk_after_data &= data_seen == DATA_COUNT && *(int32_t*)meta.args == bulk_seen;
+				bulk_seen++;
+			}
+			else if (strcmp(meta.instr, "done") == 0)
+			{
+				PASS_MATRIX[STEP_DONE_INSTRUCTION].status = data_seen == DATA_COUNT;
+			}
+
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_send_instructions(server);
+	}
+	PASS_MATRIX[STEP_CONTROL_LANE].status = urgent_at == 0;
+	PASS_MATRIX[STEP_BULK_LANE].status = bulk_after_data && data_in_order;
+
+	//Cleanup, which exits the child
+	wimp_log("Master thread closed\n");
+	wimp_close_local_server();
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 6);
+	return 0;
+}
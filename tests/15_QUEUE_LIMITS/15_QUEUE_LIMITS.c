@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "DROP NEWEST", false },
+	{ "DROP OLDEST", false },
+	{ "DROP CLASS", false },
+	{ "BYTE LIMIT", false },
+	{ "EXIT NEVER DROPPED", false },
+	{ "BLOCK TIMEOUT", false },
+	{ "BLOCK UNTIL ROOM", false },
+	{ "PUSH UNBLOCKED", false },
+	{ "CONCURRENT PRODUCERS", false },
+	{ "COUNTS BY NAME", false },
+	{ "DONE", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_DROP_NEWEST,
+	STEP_DROP_OLDEST,
+	STEP_DROP_CLASS,
+	STEP_BYTE_LIMIT,
+	STEP_EXIT_NEVER_DROPPED,
+	STEP_BLOCK_TIMEOUT,
+	STEP_BLOCK_UNTIL_ROOM,
+	STEP_PUSH_UNBLOCKED,
+	STEP_CONCURRENT_PRODUCERS,
+	STEP_COUNTS_BY_NAME,
+	STEP_DONE,
+};
+
+#define LIMIT_LENGTH 32
+#define BLOCK_TIMEOUT_MS 50
+#define BLOCKED_PUSHES (LIMIT_LENGTH * 8)
+#define PRODUCER_THREADS 4
+#define PRODUCER_PUSHES 1000
+#define COUNTED_INSTRUCTIONS 10
+
+/*
+* Counts the watermarks a queue crosses, high and low separately
+*/
+static void on_watermark(void* context, bool high)
+{
+	int32_t* crossings = (int32_t*)context;
+	crossings[high ? 1 : 0]++;
+}
+
+/*
+* Pushes instructions to a queue that blocks until there is room, counting up
+*/
+static int blocked_producer(void* data)
+{
+	WimpInstrQueue* queue = (WimpInstrQueue*)data;
+	int32_t pushed = 0;
+	for (int32_t i = 0; i < BLOCKED_PUSHES; ++i)
+	{
+		pushed += wimp_instr_queue_push_existing(queue, wimp_test_create_node("data", i)) == WIMP_INSTRUCTION_SUCCESS;
+	}
+	wimp_pool_thread_release();
+	return pushed;
+}
+
+/*
+* Pushes instructions to a queue that drops the newest, as fast as it can
+*/
+static int racing_producer(void* data)
+{
+	WimpInstrQueue* queue = (WimpInstrQueue*)data;
+	int32_t pushed = 0;
+	for (int32_t i = 0; i < PRODUCER_PUSHES; ++i)
+	{
+		pushed += wimp_instr_queue_push_existing(queue, wimp_test_create_node("data", i)) == WIMP_INSTRUCTION_SUCCESS;
+	}
+	wimp_pool_thread_release();
+	return pushed;
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//Dropping the newest keeps what was there first
+	WimpInstrQueue queue = wimp_create_instr_queue();
+	wimp_instr_queue_set_limits(&queue, LIMIT_LENGTH, 0, WIMP_INSTR_OVERFLOW_DROP_NEWEST, 0);
+	int32_t dropped = 0;
+	for (int32_t i = 0; i < LIMIT_LENGTH * 2; ++i)
+	{
+		dropped += wimp_instr_queue_push_existing(&queue, wimp_test_create_node("data", i)) == WIMP_INSTRUCTION_DROPPED;
+	}
+	PASS_MATRIX[STEP_DROP_NEWEST].status = dropped == LIMIT_LENGTH
+		&& wimp_instr_queue_get_dropped(&queue) == LIMIT_LENGTH
+		&& wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH
+		&& wimp_test_pop_all(&queue, "data", 0) == LIMIT_LENGTH;
+	wimp_instr_queue_free(queue);
+
+	//Dropping the oldest keeps what was pushed last
+	queue = wimp_create_instr_queue();
+	wimp_instr_queue_set_limits(&queue, LIMIT_LENGTH, 0, WIMP_INSTR_OVERFLOW_DROP_OLDEST, 0);
+	dropped = 0;
+	for (int32_t i = 0; i < LIMIT_LENGTH * 2; ++i)
+	{
+		dropped += wimp_instr_queue_push_existing(&queue, wimp_test_create_node("data", i)) != WIMP_INSTRUCTION_SUCCESS;
+	}
+	PASS_MATRIX[STEP_DROP_OLDEST].status = dropped == 0
+		&& wimp_instr_queue_get_dropped(&queue) == LIMIT_LENGTH
+		&& wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH
+		&& wimp_test_pop_all(&queue, "data", LIMIT_LENGTH) == LIMIT_LENGTH;
+	wimp_instr_queue_free(queue);
+
+	//A limited queue filled with bulk instructions drops the oldest of them
+	//for any pushed after, most important first
+	int32_t crossings[2] = { 0, 0 };
+	queue = wimp_create_instr_queue();
+	wimp_instr_set_priority("bulk", WIMP_INSTR_PRIORITY_BULK);
+	wimp_instr_queue_set_watermarks(&queue, LIMIT_LENGTH / 2, 0);
+	wimp_instr_queue_set_watermark_callback(&queue, &on_watermark, crossings);
+	wimp_instr_queue_set_limits(&queue, LIMIT_LENGTH, 0, WIMP_INSTR_OVERFLOW_DROP_CLASS, 0);
+	for (int32_t i = 0; i < LIMIT_LENGTH; ++i)
+	{
+		wimp_instr_queue_push_existing(&queue, wimp_test_create_node("bulk", i));
+	}
+	for (int32_t i = 0; i < LIMIT_LENGTH / 2; ++i)
+	{
+		wimp_instr_queue_push_existing(&queue, wimp_test_create_node("data", i));
+	}
+	bool limits_kept = wimp_instr_queue_push_existing(&queue, wimp_test_create_node("bulk", LIMIT_LENGTH)) == WIMP_INSTRUCTION_SUCCESS
+		&& wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH
+		&& wimp_instr_queue_get_dropped(&queue) == LIMIT_LENGTH / 2 + 1;
+
+	//The data comes first, then the newest bulk instructions
+	int32_t queue_bytes = wimp_instr_queue_get_bytes(&queue);
+	int32_t popped_bytes = 0;
+	for (int32_t i = 0; i < LIMIT_LENGTH; ++i)
+	{
+		WimpInstrNode node = wimp_instr_queue_pop(&queue);
+		WimpInstrMeta meta = wimp_instr_get_from_node(node);
+		limits_kept &= i < LIMIT_LENGTH / 2
+			? strcmp(meta.instr, "data") == 0 && *(int32_t*)meta.args == i
+			: strcmp(meta.instr, "bulk") == 0 && *(int32_t*)meta.args == i + 1;
+		popped_bytes += (int32_t)wimp_instr_node_data(node).instruction_bytes;
+		wimp_instr_node_free(node);
+	}
+	limits_kept &= wimp_instr_queue_pop(&queue) == NULL && popped_bytes == queue_bytes && wimp_instr_queue_get_bytes(&queue) == 0;
+	wimp_instr_queue_free(queue);
+	PASS_MATRIX[STEP_DROP_CLASS].status = limits_kept && crossings[1] == 1 && crossings[0] == 1;
+
+	//A queue limited in bytes holds as many instructions as fit, and drops
+	//one that never would even under a policy that drops the oldest
+	WimpInstrNode sized = wimp_test_create_node("data", 0);
+	int32_t node_bytes = (int32_t)wimp_instr_node_data(sized).instruction_bytes;
+	wimp_instr_node_free(sized);
+	queue = wimp_create_instr_queue();
+	wimp_instr_queue_set_limits(&queue, 0, node_bytes * LIMIT_LENGTH, WIMP_INSTR_OVERFLOW_DROP_NEWEST, 0);
+	for (int32_t i = 0; i < LIMIT_LENGTH + 1; ++i)
+	{
+		wimp_instr_queue_push_existing(&queue, wimp_test_create_node("data", i));
+	}
+	bool bytes_kept = wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH
+		&& wimp_instr_queue_get_bytes(&queue) == node_bytes * LIMIT_LENGTH
+		&& wimp_instr_queue_get_dropped(&queue) == 1;
+	uint8_t large[256] = { 0 };
+	wimp_instr_queue_set_limits(&queue, 0, node_bytes, WIMP_INSTR_OVERFLOW_DROP_OLDEST, 0);
+	bytes_kept &= wimp_instr_queue_push_existing(&queue, wimp_instr_node_create("master", 0, "master", 0, "data", 0, large, sizeof(large))) == WIMP_INSTRUCTION_DROPPED
+		&& wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH
+		&& wimp_test_pop_all(&queue, "data", 0) == LIMIT_LENGTH;
+	PASS_MATRIX[STEP_BYTE_LIMIT].status = bytes_kept;
+	wimp_instr_queue_free(queue);
+
+	//Exit has to reach whoever pops, so a full queue still takes it
+	queue = wimp_create_instr_queue();
+	wimp_instr_queue_set_limits(&queue, LIMIT_LENGTH, 0, WIMP_INSTR_OVERFLOW_DROP_NEWEST, 0);
+	for (int32_t i = 0; i < LIMIT_LENGTH; ++i)
+	{
+		wimp_instr_queue_push_existing(&queue, wimp_test_create_node("data", i));
+	}
+	PASS_MATRIX[STEP_EXIT_NEVER_DROPPED].status = wimp_instr_queue_push_existing(&queue, wimp_instr_node_create("master", 0, "master", 0, WIMP_INSTRUCTION_EXIT, WIMP_INSTR_ID_EXIT, NULL, 0)) == WIMP_INSTRUCTION_SUCCESS
+		&& wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH + 1
+		&& wimp_instr_queue_get_dropped(&queue) == 0
+		&& wimp_instr_get_instruction_count(&queue, WIMP_INSTRUCTION_EXIT) == 1;
+	wimp_instr_queue_free(queue);
+
+	//With nothing popping, a blocked push waits out the timeout then drops
+	queue = wimp_create_instr_queue();
+	wimp_instr_queue_set_limits(&queue, LIMIT_LENGTH, 0, WIMP_INSTR_OVERFLOW_BLOCK, BLOCK_TIMEOUT_MS);
+	for (int32_t i = 0; i < LIMIT_LENGTH; ++i)
+	{
+		wimp_instr_queue_push_existing(&queue, wimp_test_create_node("data", i));
+	}
+	PTimeProfiler* profiler = p_time_profiler_new();
+	bool timed_out = wimp_instr_queue_push_existing(&queue, wimp_test_create_node("data", LIMIT_LENGTH)) == WIMP_INSTRUCTION_DROPPED;
+	puint64 waited_ms = p_time_profiler_elapsed_usecs(profiler) / 1000;
+	p_time_profiler_free(profiler);
+	PASS_MATRIX[STEP_BLOCK_TIMEOUT].status = timed_out && waited_ms >= BLOCK_TIMEOUT_MS - 1
+		&& wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH
+		&& wimp_test_pop_all(&queue, "data", 0) == LIMIT_LENGTH;
+
+	//Without a timeout the producer waits for the consumer to take what is
+	//there, so nothing is lost and the queue never goes past its limit
+	wimp_instr_queue_set_limits(&queue, LIMIT_LENGTH, 0, WIMP_INSTR_OVERFLOW_BLOCK, 0);
+	PUThread* thread = p_uthread_create((PUThreadFunc)&blocked_producer, &queue, true, "wimp-test-blocked");
+	int32_t expected = 0;
+	bool in_order = true;
+	while (expected < BLOCKED_PUSHES)
+	{
+		in_order &= wimp_instr_queue_get_length(&queue) <= LIMIT_LENGTH;
+		wimp_instr_queue_high_prio_lock(&queue);
+		WimpInstrNode node = wimp_instr_queue_pop(&queue);
+		wimp_instr_queue_high_prio_unlock(&queue);
+		if (node == NULL)
+		{
+			p_uthread_yield();
+			continue;
+		}
+		in_order &= *(int32_t*)wimp_instr_get_from_node(node).args == expected;
+		expected++;
+		wimp_instr_node_free(node);
+	}
+	int32_t pushed = p_uthread_join(thread);
+	p_uthread_unref(thread);
+	PASS_MATRIX[STEP_BLOCK_UNTIL_ROOM].status = in_order && pushed == BLOCKED_PUSHES && wimp_instr_queue_get_dropped(&queue) == 1;
+
+	//A push that can't block either hands the node back or goes over the limits
+	for (int32_t i = 0; i < LIMIT_LENGTH; ++i)
+	{
+		wimp_instr_queue_push_existing(&queue, wimp_test_create_node("data", i));
+	}
+	WimpInstrNode kept = wimp_test_create_node("data", LIMIT_LENGTH);
+	bool unblocked = wimp_instr_queue_push_unblocked(&queue, kept, false) == WIMP_INSTRUCTION_FULL
+		&& wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH
+		&& wimp_instr_queue_push_unblocked(&queue, kept, true) == WIMP_INSTRUCTION_SUCCESS
+		&& wimp_instr_queue_get_length(&queue) == LIMIT_LENGTH + 1
+		&& wimp_test_pop_all(&queue, "data", 0) == LIMIT_LENGTH + 1;
+	PASS_MATRIX[STEP_PUSH_UNBLOCKED].status = unblocked;
+	wimp_instr_queue_free(queue);
+
+	//Room is reserved atomically, so threads racing to fill the queue together
+	//never take it past its limit
+	queue = wimp_create_instr_queue();
+	wimp_instr_queue_set_limits(&queue, LIMIT_LENGTH, 0, WIMP_INSTR_OVERFLOW_DROP_NEWEST, 0);
+	PUThread* producers[PRODUCER_THREADS];
+	for (int32_t i = 0; i < PRODUCER_THREADS; ++i)
+	{
+		producers[i] = p_uthread_create((PUThreadFunc)&racing_producer, &queue, true, "wimp-test-racing");
+	}
+	pushed = 0;
+	for (int32_t i = 0; i < PRODUCER_THREADS; ++i)
+	{
+		pushed += p_uthread_join(producers[i]);
+		p_uthread_unref(producers[i]);
+	}
+	int32_t raced_length = wimp_instr_queue_get_length(&queue);
+	int32_t raced_popped = 0;
+	WimpInstrNode node = wimp_instr_queue_pop(&queue);
+	while (node != NULL)
+	{
+		raced_popped++;
+		wimp_instr_node_free(node);
+		node = wimp_instr_queue_pop(&queue);
+	}
+	PASS_MATRIX[STEP_CONCURRENT_PRODUCERS].status = pushed == LIMIT_LENGTH && raced_length == LIMIT_LENGTH
+		&& raced_popped == LIMIT_LENGTH
+		&& wimp_instr_queue_get_dropped(&queue) == PRODUCER_THREADS * PRODUCER_PUSHES - LIMIT_LENGTH;
+	wimp_instr_queue_free(queue);
+
+	//Registered instructions are counted as they come and go in a queue that
+	//asks for it, the ones that aren't are found by looking through the queue
+	wimp_instr_register("counted");
+	queue = wimp_create_instr_queue();
+	bool counts_kept = wimp_instr_queue_count_by_name(&queue) == WIMP_INSTRUCTION_SUCCESS;
+	for (int32_t i = 0; i < COUNTED_INSTRUCTIONS; ++i)
+	{
+		wimp_instr_queue_push_existing(&queue, wimp_test_create_node("counted", i));
+		wimp_instr_queue_add_existing(&queue, wimp_test_create_node("unregistered", i));
+	}
+	wimp_instr_queue_push_existing(&queue, wimp_test_create_node("unregistered", COUNTED_INSTRUCTIONS));
+	counts_kept &= wimp_instr_get_instruction_count(&queue, "counted") == COUNTED_INSTRUCTIONS
+		&& wimp_instr_get_instruction_count(&queue, "unregistered") == COUNTED_INSTRUCTIONS + 1
+		&& wimp_instr_get_instruction_count(&queue, WIMP_INSTRUCTION_EXIT) == 0;
+	for (int32_t i = 0; i < COUNTED_INSTRUCTIONS; ++i)
+	{
+		wimp_instr_node_free(wimp_instr_queue_pop(&queue));
+	}
+	counts_kept &= wimp_instr_get_instruction_count(&queue, "counted") + wimp_instr_get_instruction_count(&queue, "unregistered") == COUNTED_INSTRUCTIONS + 1;
+
+	//Taking everything leaves nothing counted, and it's counted again once put back
+	WimpInstrQueue batch;
+	memset(&batch, 0, sizeof(WimpInstrQueue));
+	wimp_instr_queue_take_all(&queue, &batch);
+	counts_kept &= wimp_instr_get_instruction_count(&queue, "counted") == 0
+		&& wimp_instr_get_instruction_count(&queue, "unregistered") == 0;
+	size_t batch_counted = wimp_instr_get_instruction_count(&batch, "counted");
+	wimp_instr_queue_prepend_queue(&queue, &batch);
+	counts_kept &= wimp_instr_get_instruction_count(&queue, "counted") == batch_counted
+		&& batch_counted + wimp_instr_get_instruction_count(&queue, "unregistered") == COUNTED_INSTRUCTIONS + 1;
+	PASS_MATRIX[STEP_COUNTS_BY_NAME].status = counts_kept;
+	wimp_instr_queue_free(queue);
+
+	PASS_MATRIX[STEP_DONE].status = true;
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 11);
+	return 0;
+}
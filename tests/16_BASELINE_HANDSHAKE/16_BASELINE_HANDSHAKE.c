@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "BASELINE REPLY", false },
+	{ "BASELINE AGREED", false },
+	{ "NAME WHERE IT WAS", false },
+	{ "INSTRUCTION SENT", false },
+	{ "INSTRUCTION RECIEVED", false },
+	{ "EXIT SENT", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_BASELINE_REPLY,
+	STEP_BASELINE_AGREED,
+	STEP_NAME_WHERE_IT_WAS,
+	STEP_INSTRUCTION_SENT,
+	STEP_INSTRUCTION_RECIEVED,
+	STEP_EXIT_SENT,
+};
+
+#define MASTER_DOMAIN "unix:/tmp/wimp-test-16-master.sock"
+#define PROCESS_DOMAIN "unix:/tmp/wimp-test-16-process.sock"
+#define OLD_PROCESS "old_process"
+#define MASTER_ARG 42
+#define PROCESS_ARG 24
+#define CONNECT_TRIES 100
+#define WAIT_TIMEOUT_MS 5000
+
+/*
+* Recieves until the buffer is full
+*/
+static bool receive_all(PSocket* socket, uint8_t* buffer, size_t bytes)
+{
+	size_t recieved = 0;
+	while (recieved < bytes)
+	{
+		pssize size = p_socket_receive(socket, (pchar*)&buffer[recieved], bytes - recieved, NULL);
+		if (size <= 0)
+		{
+			return false;
+		}
+		recieved += (size_t)size;
+	}
+	return true;
+}
+
+/*
+* Builds an instruction laid out as the first processes did, in host order: its size,
+* the destination, source and instruction names, then the size of the arguments and the arguments
+*
+* @return Returns the size of the instruction
+*/
+static int32_t build_baseline_instr(uint8_t* buffer, const char* dest, const char* source, const char* instr, int32_t arg)
+{
+	const char* names[3] = { dest, source, instr };
+	int32_t offset = sizeof(int32_t);
+	for (int32_t i = 0; i < 3; ++i)
+	{
+		size_t name_bytes = strlen(names[i]) + 1;
+		memcpy(&buffer[offset], names[i], name_bytes);
+		offset += (int32_t)name_bytes;
+	}
+	int32_t arg_bytes = sizeof(int32_t);
+	memcpy(&buffer[offset], &arg_bytes, sizeof(int32_t));
+	memcpy(&buffer[offset + sizeof(int32_t)], &arg, sizeof(int32_t));
+	offset += 2 * sizeof(int32_t);
+	memcpy(buffer, &offset, sizeof(int32_t));
+	return offset;
+}
+
+/*
+* Reads the next instruction in the first layout, skipping pings as the first recievers did,
+* and checks its names. The argument is only checked if it has one.
+*/
+static bool read_baseline_instr(PSocket* socket, const char* dest, const char* source, const char* instr, int32_t arg)
+{
+	int32_t size = 0;
+	while (receive_all(socket, (uint8_t*)&size, sizeof(int32_t)) && (size == 0 || size == WIMP_RECIEVER_PING))
+	{
+		size = 0;
+	}
+
+	uint8_t buffer[WIMP_MESSAGE_BUFFER_BYTES];
+	if (size <= (int32_t)sizeof(int32_t) || size > WIMP_MESSAGE_BUFFER_BYTES || !receive_all(socket, &buffer[sizeof(int32_t)], (size_t)size - sizeof(int32_t)))
+	{
+		return false;
+	}
+
+	const char* names[3] = { dest, source, instr };
+	size_t offset = sizeof(int32_t);
+	for (int32_t i = 0; i < 3; ++i)
+	{
+		size_t name_bytes = strlen(names[i]) + 1;
+		if (offset + name_bytes > (size_t)size || memcmp(&buffer[offset], names[i], name_bytes) != 0)
+		{
+			return false;
+		}
+		offset += name_bytes;
+	}
+
+	int32_t arg_bytes = -1;
+	int32_t sent_arg = 0;
+	memcpy(&arg_bytes, &buffer[offset], sizeof(int32_t));
+	if (arg_bytes == 0)
+	{
+		return offset + sizeof(int32_t) == (size_t)size;
+	}
+	memcpy(&sent_arg, &buffer[offset + sizeof(int32_t)], sizeof(int32_t));
+	return arg_bytes == sizeof(int32_t) && offset + 2 * sizeof(int32_t) == (size_t)size && sent_arg == arg;
+}
+
+/*
+* Acts as the reciever of a process from before the handshake extension, connecting to the master
+*/
+static int baseline_reciever(void* data)
+{
+	PSocket* socket = wimp_socket_unix_new();
+	bool connected = false;
+	for (int32_t i = 0; i < CONNECT_TRIES && !connected; ++i)
+	{
+		connected = wimp_socket_unix_connect(socket, MASTER_DOMAIN);
+		if (!connected)
+		{
+			p_uthread_sleep(10);
+		}
+	}
+
+	//The handshake as it was first laid out, in host order with nothing after the name
+	uint8_t buffer[WIMP_MESSAGE_BUFFER_BYTES];
+	int32_t header[2] = { WIMP_RECIEVER_HANDSHAKE, sizeof(OLD_PROCESS) };
+	memcpy(buffer, header, sizeof(header));
+	memcpy(&buffer[sizeof(header)], OLD_PROCESS, sizeof(OLD_PROCESS));
+	p_socket_send(socket, (const pchar*)buffer, sizeof(header) + sizeof(OLD_PROCESS), NULL);
+
+	//The reply is only the header, so anything after it is an instruction or a ping
+	int32_t reply[2] = { 0, -1 };
+	PASS_MATRIX[STEP_BASELINE_REPLY].status = connected
+		&& receive_all(socket, (uint8_t*)reply, sizeof(reply))
+		&& reply[0] == WIMP_RECIEVER_HANDSHAKE && reply[1] == 0;
+
+	PASS_MATRIX[STEP_INSTRUCTION_SENT].status = PASS_MATRIX[STEP_BASELINE_REPLY].status
+		&& read_baseline_instr(socket, OLD_PROCESS, "master", "hello", MASTER_ARG);
+	PASS_MATRIX[STEP_EXIT_SENT].status = PASS_MATRIX[STEP_INSTRUCTION_SENT].status
+		&& read_baseline_instr(socket, OLD_PROCESS, "master", WIMP_INSTRUCTION_EXIT, 0);
+
+	p_socket_close(socket, NULL);
+	p_socket_free(socket);
+	return 0;
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	WimpServer server;
+	wimp_create_server(&server, "master", MASTER_DOMAIN, 0);
+	wimp_process_table_add(&server.ptable, OLD_PROCESS, PROCESS_DOMAIN, 0, WIMP_Process_Child, NULL);
+
+	//The process acts as a server from before the extension
+	PSocket* old_server = wimp_socket_unix_new();
+	wimp_socket_unix_bind(old_server, PROCESS_DOMAIN);
+	p_socket_listen(old_server, NULL);
+
+	//Start a reciever thread for the process
+	RecieverArgs args = wimp_get_reciever_args("master", PROCESS_DOMAIN, 0, &server.incomingmsg, &server.active);
+	wimp_start_reciever_thread(OLD_PROCESS, MASTER_DOMAIN, 0, args);
+
+	//Read the handshake as the first servers did, the header then the name straight after
+	uint8_t buffer[WIMP_MESSAGE_BUFFER_BYTES];
+	memset(buffer, 0, sizeof(buffer));
+	PSocket* con = p_socket_accept(old_server, NULL);
+	pssize handshake_size = con != NULL ? p_socket_receive(con, (pchar*)buffer, sizeof(buffer), NULL) : -1;
+	int32_t header[2] = { 0, 0 };
+	memcpy(header, buffer, sizeof(header));
+	bool name_found = handshake_size > (pssize)sizeof(header)
+		&& header[0] == WIMP_RECIEVER_HANDSHAKE
+		&& header[1] == sizeof("master")
+		&& strcmp((const char*)&buffer[sizeof(header)], "master") == 0;
+
+	//The extension after the name is left to servers that know it
+	int32_t extension_header = 0;
+	memcpy(&extension_header, &buffer[sizeof(header) + sizeof("master")], sizeof(int32_t));
+	PASS_MATRIX[STEP_NAME_WHERE_IT_WAS].status = name_found
+		&& handshake_size >= (pssize)(sizeof(header) + sizeof("master") + sizeof(WimpHandshakeExtension))
+		&& extension_header == WIMP_HANDSHAKE_EXTENSION;
+
+	//Reply with the header alone, as the first servers did
+	int32_t reply[2] = { WIMP_RECIEVER_HANDSHAKE, 0 };
+	if (con != NULL)
+	{
+		p_socket_send(con, (const pchar*)reply, sizeof(reply), NULL);
+	}
+
+	//Accept the process's reciever, sending the first layout
+	PUThread* thread = p_uthread_create((PUThreadFunc)&baseline_reciever, NULL, true, "wimp-test-baseline");
+	wimp_server_process_accept(&server, 1, OLD_PROCESS);
+
+	WimpProcessData procdat = NULL;
+	PASS_MATRIX[STEP_BASELINE_AGREED].status = wimp_process_table_get(&procdat, server.ptable, OLD_PROCESS) == WIMP_PROCESS_TABLE_SUCCESS
+		&& procdat->process_protocol_version == 0
+		&& procdat->process_transport == WIMP_TRANSPORT_SOCKET
+		&& procdat->process_instr_version == WIMP_INSTR_VERSION_NAMES
+		&& procdat->process_instr_ids == 0
+		&& procdat->process_credits == -1;
+
+	int32_t master_arg = MASTER_ARG;
+	wimp_server_add(&server, OLD_PROCESS, "hello", &master_arg, sizeof(int32_t));
+	wimp_server_send_instructions(&server);
+
+	//The process sends the master an instruction in the first layout
+	int32_t instr_bytes = build_baseline_instr(buffer, "master", OLD_PROCESS, "hello", PROCESS_ARG);
+	if (con != NULL)
+	{
+		p_socket_send(con, (const pchar*)buffer, instr_bytes, NULL);
+	}
+
+	PTimeProfiler* profiler = p_time_profiler_new();
+	bool recieved = false;
+	while (!recieved && p_time_profiler_elapsed_usecs(profiler) < WAIT_TIMEOUT_MS * 1000)
+	{
+		wimp_instr_queue_high_prio_lock(&server.incomingmsg);
+		WimpInstrNode node = wimp_instr_queue_pop(&server.incomingmsg);
+		wimp_instr_queue_high_prio_unlock(&server.incomingmsg);
+		if (node == NULL)
+		{
+			p_uthread_sleep(1);
+			continue;
+		}
+		WimpInstrMeta meta = wimp_instr_get_from_node(node);
+		recieved = strcmp(meta.instr, "hello") == 0
+			&& strcmp(meta.source_process, OLD_PROCESS) == 0
+			&& strcmp(meta.dest_process, "master") == 0
+			&& meta.arg_bytes == sizeof(int32_t)
+			&& *(int32_t*)meta.args == PROCESS_ARG;
+		wimp_instr_node_free(node);
+	}
+	p_time_profiler_free(profiler);
+	PASS_MATRIX[STEP_INSTRUCTION_RECIEVED].status = recieved;
+
+	//Cleanup, which exits the process
+	wimp_server_free(&server);
+	p_uthread_join(thread);
+	p_uthread_unref(thread);
+	if (con != NULL)
+	{
+		p_socket_close(con, NULL);
+		p_socket_free(con);
+	}
+	p_socket_close(old_server, NULL);
+	p_socket_free(old_server);
+	wimp_socket_unix_unlink(PROCESS_DOMAIN);
+
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 6);
+	return 0;
+}
@@ -10,6 +10,8 @@
 #include <wimp_test.h>
 #include <wimp_data.h>
 
+#define EXIT_WAIT_MS 1000
+
 PASSMAT PASS_MATRIX[] =
 {
 	{ "DATA INIT", false },
@@ -320,6 +322,8 @@ int main(void)
 
 	//This is a simple loop. 
 	bool disconnect = false;
+	bool exit_requested = false;
+	int32_t exit_wait = 0;
 	bool tp1_done = false;
 	bool tp2_done = false;
 	bool tp_sent_instr = false;
@@ -339,7 +343,7 @@ int main(void)
 
 			if (strcmp(meta.instr, WIMP_INSTRUCTION_EXIT) == 0)
 			{
-				disconnect = true;
+				exit_requested = true;
 			}
 			else if (strcmp(meta.instr, WIMP_INSTRUCTION_LOG) == 0)
 			{
@@ -386,6 +390,15 @@ int main(void)
 			tp_sent_instr = true;
 		}
 		wimp_server_send_instructions(server);
+
+		//Test process 1 asks to exit straight after writing, but test process 2
+		//is a separate process so give its result a moment to arrive
+		if (exit_requested)
+		{
+			disconnect = PASS_MATRIX[STEP_CHILD2_WRITE_DATA].status || exit_wait >= EXIT_WAIT_MS;
+			exit_wait++;
+			p_uthread_sleep(1);
+		}
 	}
 
 	//Cleanup
@@ -15,6 +15,7 @@ PASSMAT PASS_MATRIX[] =
 	{ "RESPONSE AWAITING", false},
 	{ "PACKED LONG MESSAGE", false},
 	{ "PACKED MULTIPLE LONG MESSAGES", false},
+	{ "BUILT PACK OF MANY STRINGS", false},
 };
 
 enum TEST_ENUMS
@@ -23,10 +24,27 @@ enum TEST_ENUMS
 	AWAITING_RESPONSE,
 	PACKED_LONG_MESSAGE,
 	PACKED_MULTIPLE_LONG_MESSAGES,
+	BUILT_PACK_OF_MANY_STRINGS,
 };
 
+
 const char* long_message = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum. Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum. Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum. Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum.";
 
+#define BUILT_PACK_STRINGS 40
+
+/*
+* Gets the string at an index of the built pack, every other one is the long message
+*/
+static const char* built_pack_string(int32_t index, char* buffer, size_t bytes)
+{
+	if (index % 2 == 1)
+	{
+		return long_message;
+	}
+	snprintf(buffer, bytes, "setting_%d", index);
+	return buffer;
+}
+
 /*
 * This is an example client main. It takes the domains and ports as cmd arguments and creates and starts a server.
 * After sending the commands, the server closes.
@@ -93,6 +111,19 @@ int client_main_entry(int argc, char** argv)
 	wimp_add_local_server("master", "long_messages_packed", pack3, pack3->pack_size);
 	wimp_server_send_instructions(server);
 
+	//5. Send more strings than a pack can hold, built straight into the instruction
+	WimpStrPackBuilder builder;
+	if (wimp_server_pack_begin(server, &builder, "master", "built_pack", 0) == WIMP_SERVER_SUCCESS)
+	{
+		char setting[32];
+		for (int32_t i = 0; i < BUILT_PACK_STRINGS; ++i)
+		{
+			wimp_instr_pack_add(&builder, built_pack_string(i, setting, sizeof(setting)));
+		}
+		wimp_server_add_pack(server, &builder);
+	}
+	wimp_server_send_instructions(server);
+
 	//Exit
 	wimp_add_local_server("master", "exit", NULL, 0);
 	wimp_server_send_instructions(server);
@@ -217,6 +248,18 @@ int main(void)
 				}
 				PASS_MATRIX[PACKED_MULTIPLE_LONG_MESSAGES].status = success;
 			}
+			else if (wimp_instr_check(meta.instr, "built_pack"))
+			{
+				bool success = wimp_instr_pack_count(meta) == BUILT_PACK_STRINGS;
+				int32_t index = 0;
+				char setting[32];
+				for (const char* str = wimp_instr_pack_next(meta, NULL); str != NULL; str = wimp_instr_pack_next(meta, str))
+				{
+					success &= strcmp(str, built_pack_string(index, setting, sizeof(setting))) == 0;
+					index++;
+				}
+				PASS_MATRIX[BUILT_PACK_OF_MANY_STRINGS].status = success && index == BUILT_PACK_STRINGS;
+			}
 			else if (wimp_instr_check(meta.instr, WIMP_INSTRUCTION_EXIT))
 			{
 				wimp_log("\n");
@@ -237,6 +280,6 @@ int main(void)
 	//Cleanup
 	wimp_shutdown();
 
-	wimp_test_validate_passmat(PASS_MATRIX, 4);
+	wimp_test_validate_passmat(PASS_MATRIX, 5);
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "PROCESS VALIDATION", false },
+	{ "SHORT INSTRUCTION", false },
+	{ "LONG INSTRUCTION", false },
+	{ "RESERVED INSTRUCTION", false },
+	{ "EXIT INSTRUCTION", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_PROCESS_VALIDATION,
+	STEP_SHORT_INSTRUCTION,
+	STEP_LONG_INSTRUCTION,
+	STEP_RESERVED_INSTRUCTION,
+	STEP_EXIT_INSTRUCTION,
+};
+
+#define MASTER_DOMAIN "unix:/tmp/wimp-test-07-master.sock"
+#define PROCESS_DOMAIN "unix:/tmp/wimp-test-07-process.sock"
+#define LONG_ARG_COUNT 1000
+#define RESERVED_ARG_COUNT 64
+
+/*
+* This is an example client main. It takes the domains as cmd arguments and creates and starts a server.
+* After sending the commands, the server closes.
+*/
+int client_main_entry(int argc, char** argv)
+{
+	wimp_log("Test process!\n");
+
+	//Default this domain
+	const char* process_domain = PROCESS_DOMAIN;
+
+	//Default the master domain
+	const char* master_domain = MASTER_DOMAIN;
+
+	//Read the args, look for the --master and --proc args
+	for (int i = 0; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--master-domain") == 0 && i + 1 < argc)
+		{
+			master_domain = argv[i+1];
+		}
+		else if (strcmp(argv[i], "--process-domain") == 0 && i + 1 < argc)
+		{
+			process_domain = argv[i+1];
+		}
+	}
+
+	//Create a server local to this thread. The port is ignored for unix domain sockets
+	//Only allow the socket transport, otherwise the local transport would be picked
+	wimp_init_local_server("test_process", process_domain, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the master process that called this thread
+	RecieverArgs args = wimp_get_reciever_args("test_process", master_domain, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("master", process_domain, 0, args);
+
+	//Add the master process to the table for tracking
+	wimp_process_table_add(&server->ptable, "master", master_domain, 0, WIMP_Process_Parent, NULL);
+
+	//Accept the connection to the test_process->master reciever, started by the master thread
+	wimp_server_process_accept(server, 1, "master");
+	p_uthread_sleep(100);
+
+	//Short instruction with a string argument
+	const char* echo_string = "Echo!";
+	wimp_add_local_server("master", "echo", echo_string, (strlen(echo_string) + 1) * sizeof(char));
+
+	//Long instruction, well over the message buffer size
+	int32_t long_args[LONG_ARG_COUNT];
+	for (int32_t i = 0; i < LONG_ARG_COUNT; ++i)
+	{
+		long_args[i] = i;
+	}
+	wimp_add_local_server("master", "sequence", long_args, sizeof(long_args));
+
+	//Reserved instruction, with the arguments written straight into it
+	int32_t* reserved_args = wimp_server_add_begin(server, "master", "reserved", RESERVED_ARG_COUNT * sizeof(int32_t));
+	if (reserved_args != NULL)
+	{
+		for (int32_t i = 0; i < RESERVED_ARG_COUNT; ++i)
+		{
+			reserved_args[i] = i * i;
+		}
+		wimp_server_add_commit(server);
+	}
+
+	wimp_add_local_server("master", "exit", NULL, 0);
+
+	//This tells the server to send off the instructions
+	wimp_server_send_instructions(server);
+	p_uthread_sleep(1000);
+
+	//This should also shut down the reciever
+	wimp_log("Client thread closed\n");
+	wimp_close_local_server();
+
+	return 0;
+}
+
+/*
+* This is the entry for the lib. For this test, as will not be started from a separate executable this will be the only entry point used.
+*/
+int client_main_lib_entry(WimpMainEntry entry)
+{
+	int res = client_main_entry(entry->argc, entry->argv);
+	wimp_free_entry(entry);
+	return res;
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//Start the client process, creating the command line arguments and creating a new thread
+	//No ports need to be assigned as the domains are socket paths
+	WimpMainEntry entry = wimp_get_entry(4, "--master-domain", MASTER_DOMAIN, "--process-domain", PROCESS_DOMAIN);
+	wimp_start_library_process("test_process", (MAIN_FUNC_PTR)&client_main_lib_entry, P_UTHREAD_PRIORITY_LOW, entry);
+
+	//Start a local server for the master process, only allowing the socket transport
+	wimp_init_local_server("master", MASTER_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the client process that the master started
+	RecieverArgs args = wimp_get_reciever_args("master", PROCESS_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("test_process", MASTER_DOMAIN, 0, args);
+
+	//Add the test process to the table for tracking
+	wimp_process_table_add(&server->ptable, "test_process", PROCESS_DOMAIN, 0, WIMP_Process_Child, NULL);
+
+	//Accept the connection to the master->test_process reciever, started by the test_process
+	wimp_server_process_accept(server, 1, "test_process");
+
+	//Validate that the process correctly started. Sends a ping packet to make sure is listening
+	WimpProcessData procdat = NULL;
+	if (wimp_server_check_process_listening(server, "test_process")
+		&& wimp_process_table_get(&procdat, server->ptable, "test_process") == WIMP_PROCESS_TABLE_SUCCESS
+		&& procdat->process_transport == WIMP_TRANSPORT_SOCKET)
+	{
+		wimp_log("Process validated!\n");
+		PASS_MATRIX[STEP_PROCESS_VALIDATION].status = true;
+	}
+
+	//This is a simple loop.
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+
+			if (strcmp(meta.instr, "echo") == 0)
+			{
+				//Get the arguments
+				const char* echo_string = (const char*)meta.args;
+				wimp_log("%s\n", echo_string);
+
+				if (strcmp(echo_string, "Echo!") == 0)
+				{
+					PASS_MATRIX[STEP_SHORT_INSTRUCTION].status = true;
+				}
+			}
+			else if (strcmp(meta.instr, "sequence") == 0)
+			{
+				//Check every value of the sequence arrived in order
+				int32_t* sequence = (int32_t*)meta.args;
+				bool success = meta.arg_bytes == LONG_ARG_COUNT * sizeof(int32_t);
+				for (int32_t i = 0; success && i < LONG_ARG_COUNT; ++i)
+				{
+					success = sequence[i] == i;
+				}
+				PASS_MATRIX[STEP_LONG_INSTRUCTION].status = success;
+			}
+			else if (strcmp(meta.instr, "reserved") == 0)
+			{
+				int32_t* reserved = (int32_t*)meta.args;
+				bool success = meta.arg_bytes == RESERVED_ARG_COUNT * sizeof(int32_t);
+				for (int32_t i = 0; success && i < RESERVED_ARG_COUNT; ++i)
+				{
+					success = reserved[i] == i * i;
+				}
+				PASS_MATRIX[STEP_RESERVED_INSTRUCTION].status = success;
+			}
+			else if (strcmp(meta.instr, WIMP_INSTRUCTION_EXIT) == 0)
+			{
+				wimp_log("\n");
+				PASS_MATRIX[STEP_EXIT_INSTRUCTION].status = true;
+				disconnect = true;
+			}
+
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+	}
+
+	//Cleanup
+	wimp_log("Master thread closed\n");
+	wimp_close_local_server();
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 5);
+	return 0;
+}
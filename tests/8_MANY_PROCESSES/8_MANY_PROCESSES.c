@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "ALL INSTRUCTIONS ARRIVED", false },
+	{ "INSTRUCTIONS IN ORDER", false },
+	{ "ALL EXITS ARRIVED", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_ALL_INSTRUCTIONS,
+	STEP_INSTRUCTIONS_IN_ORDER,
+	STEP_ALL_EXITS,
+};
+
+#define MASTER_DOMAIN "unix:/tmp/wimp-test-08-master.sock"
+#define PROCESS_DOMAIN_FORMAT "unix:/tmp/wimp-test-08-process-%d.sock"
+#define CHILD_COUNT 32
+#define CHILD_INSTRUCTION_COUNT 1000
+
+/*
+* This is an example client main. It takes its name, index and domain as cmd arguments and creates and starts a server.
+* After sending the commands, the server closes.
+*/
+int client_main_entry(int argc, char** argv)
+{
+	const char* process_name = "test_process";
+	int32_t process_index = 0;
+	const char* process_domain = "unix:/tmp/wimp-test-08-process.sock";
+
+	//Read the args, look for the --process-name, --process-index and --process-domain args
+	for (int i = 0; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--process-name") == 0 && i + 1 < argc)
+		{
+			process_name = argv[i+1];
+		}
+		else if (strcmp(argv[i], "--process-index") == 0 && i + 1 < argc)
+		{
+			process_index = strtol(argv[i+1], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--process-domain") == 0 && i + 1 < argc)
+		{
+			process_domain = argv[i+1];
+		}
+	}
+
+	//Create a server local to this thread. Even children stream over the socket
+	//and odd children over shared memory, as otherwise the local transport would be picked.
+	//Unix domain sockets are used so there are no ports to assign for every child
+	wimp_init_local_server(process_name, process_domain, 0);
+	WimpServer* server = wimp_get_local_server();
+	if (process_index % 2 == 0)
+	{
+		wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+	}
+	else
+	{
+		wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET | WIMP_TRANSPORT_SHM);
+	}
+
+	//Add the master process to the table for tracking
+	wimp_process_table_add(&server->ptable, "master", MASTER_DOMAIN, 0, WIMP_Process_Parent, NULL);
+
+	//Accept the connection to the test_process->master reciever, started by the master thread
+	wimp_server_process_accept(server, 1, "master");
+
+	//Each instruction carries the index of this process and its place in the sequence
+	for (int32_t i = 0; i < CHILD_INSTRUCTION_COUNT; ++i)
+	{
+		int32_t sequence_args[2] = { process_index, i };
+		wimp_add_local_server("master", "sequence", sequence_args, sizeof(sequence_args));
+	}
+	wimp_add_local_server("master", "exit", NULL, 0);
+
+	//This tells the server to send off the instructions
+	wimp_server_send_instructions(server);
+	p_uthread_sleep(1000);
+
+	//This should also shut down the reciever
+	wimp_close_local_server();
+	return 0;
+}
+
+/*
+* This is the entry for the lib. For this test, as will not be started from a separate executable this will be the only entry point used.
+*/
+int client_main_lib_entry(WimpMainEntry entry)
+{
+	int res = client_main_entry(entry->argc, entry->argv);
+	wimp_free_entry(entry);
+	return res;
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//Start a local server for the master process
+	wimp_init_local_server("master", MASTER_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+
+	//Start every child, and a reciever for each writing to the master queue
+	for (int32_t i = 0; i < CHILD_COUNT; ++i)
+	{
+		char process_name[32];
+		char process_index[16];
+		char process_domain[64];
+		snprintf(process_name, sizeof(process_name), "test_process_%d", i);
+		snprintf(process_index, sizeof(process_index), "%d", i);
+		snprintf(process_domain, sizeof(process_domain), PROCESS_DOMAIN_FORMAT, i);
+
+		WimpMainEntry entry = wimp_get_entry(6, "--process-name", process_name, "--process-index", process_index, "--process-domain", process_domain);
+		wimp_start_library_process(process_name, (MAIN_FUNC_PTR)&client_main_lib_entry, P_UTHREAD_PRIORITY_LOW, entry);
+
+		RecieverArgs args = wimp_get_reciever_args("master", process_domain, 0, &server->incomingmsg, &server->active);
+		wimp_start_reciever_thread(process_name, MASTER_DOMAIN, 0, args);
+	}
+
+	//Track the next expected place in the sequence of each child
+	int32_t next_sequence[CHILD_COUNT] = { 0 };
+	int32_t instruction_count = 0;
+	int32_t exit_count = 0;
+	bool in_order = true;
+	while (exit_count < CHILD_COUNT)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+
+			if (strcmp(meta.instr, "sequence") == 0)
+			{
+				int32_t* sequence_args = (int32_t*)meta.args;
+				int32_t index = sequence_args[0];
+				if (index < 0 || index >= CHILD_COUNT || sequence_args[1] != next_sequence[index])
+				{
+					in_order = false;
+				}
+				else
+				{
+					next_sequence[index]++;
+				}
+				instruction_count++;
+			}
+			else if (strcmp(meta.instr, WIMP_INSTRUCTION_EXIT) == 0)
+			{
+				exit_count++;
+			}
+
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+	}
+
+	wimp_log("Recieved %d instructions from %d processes\n", instruction_count, exit_count);
+	PASS_MATRIX[STEP_ALL_INSTRUCTIONS].status = instruction_count == CHILD_COUNT * CHILD_INSTRUCTION_COUNT;
+	PASS_MATRIX[STEP_INSTRUCTIONS_IN_ORDER].status = in_order;
+	PASS_MATRIX[STEP_ALL_EXITS].status = exit_count == CHILD_COUNT;
+
+	//Cleanup
+	wimp_log("Master thread closed\n");
+	wimp_close_local_server();
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 3);
+	return 0;
+}
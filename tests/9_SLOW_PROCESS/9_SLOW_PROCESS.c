@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wimp.h>
+#include <wimp_test.h>
+
+PASSMAT PASS_MATRIX[] =
+{
+	{ "PROCESS VALIDATION", false },
+	{ "STALLED PROCESS PENDING", false },
+	{ "CHILD REPLY", false },
+	{ "EXIT INSTRUCTION", false }
+};
+
+enum TEST_ENUMS
+{
+	STEP_PROCESS_VALIDATION,
+	STEP_STALLED_PROCESS_PENDING,
+	STEP_CHILD_REPLY,
+	STEP_EXIT_INSTRUCTION,
+};
+
+#define MASTER_DOMAIN "unix:/tmp/wimp-test-09-master.sock"
+#define PROCESS_DOMAIN "unix:/tmp/wimp-test-09-process.sock"
+#define STALLED_DOMAIN "unix:/tmp/wimp-test-09-stalled.sock"
+#define STALLED_INSTRUCTION_COUNT 64
+#define STALLED_INSTRUCTION_BYTES (1024 * 1024)
+
+/*
+* This is an example client main. It waits for the instruction from the master, then replies and closes.
+*/
+int client_main_entry(int argc, char** argv)
+{
+	wimp_log("Test process!\n");
+
+	//Create a server local to this thread, only allowing the socket transport
+	wimp_init_local_server("test_process", PROCESS_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the master process that called this thread
+	RecieverArgs args = wimp_get_reciever_args("test_process", MASTER_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("master", PROCESS_DOMAIN, 0, args);
+
+	//Add the master process to the table for tracking
+	wimp_process_table_add(&server->ptable, "master", MASTER_DOMAIN, 0, WIMP_Process_Parent, NULL);
+
+	//Accept the connection to the test_process->master reciever, started by the master thread
+	wimp_server_process_accept(server, 1, "master");
+
+	//Wait for the instruction from the master, which was sent after the stalled ones
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+			if (strcmp(meta.instr, "hello") == 0)
+			{
+				wimp_add_local_server("master", "reply", NULL, 0);
+				wimp_add_local_server("master", "exit", NULL, 0);
+				disconnect = true;
+			}
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_send_instructions(server);
+	}
+
+	//This should also shut down the reciever
+	wimp_log("Client thread closed\n");
+	wimp_close_local_server();
+
+	return 0;
+}
+
+/*
+* This is the entry for the lib. For this test, as will not be started from a separate executable this will be the only entry point used.
+*/
+int client_main_lib_entry(WimpMainEntry entry)
+{
+	int res = client_main_entry(entry->argc, entry->argv);
+	wimp_free_entry(entry);
+	return res;
+}
+
+/*
+* This is the main master thread.
+*/
+int main(void)
+{
+	//Initialize the socket library
+	wimp_init();
+
+	//Start the client process
+	WimpMainEntry entry = wimp_get_entry(0);
+	wimp_start_library_process("test_process", (MAIN_FUNC_PTR)&client_main_lib_entry, P_UTHREAD_PRIORITY_LOW, entry);
+
+	//Start a local server for the master process, only allowing the socket transport
+	wimp_init_local_server("master", MASTER_DOMAIN, 0);
+	WimpServer* server = wimp_get_local_server();
+	wimp_server_set_transports(server, WIMP_TRANSPORT_SOCKET);
+
+	//Start a reciever thread for the client process that the master started
+	RecieverArgs args = wimp_get_reciever_args("master", PROCESS_DOMAIN, 0, &server->incomingmsg, &server->active);
+	wimp_start_reciever_thread("test_process", MASTER_DOMAIN, 0, args);
+
+	//Add the test process to the table for tracking
+	wimp_process_table_add(&server->ptable, "test_process", PROCESS_DOMAIN, 0, WIMP_Process_Child, NULL);
+
+	//Accept the connection to the master->test_process reciever, started by the test_process
+	wimp_server_process_accept(server, 1, "test_process");
+
+	if (wimp_server_check_process_listening(server, "test_process"))
+	{
+		wimp_log("Process validated!\n");
+		PASS_MATRIX[STEP_PROCESS_VALIDATION].status = true;
+	}
+
+	//The stalled process is a connection that is never accepted, so nothing reads from it
+	PSocket* stalled_listener = wimp_socket_unix_new();
+	PSocket* stalled = wimp_socket_unix_new();
+	WimpProcessData stalled_data = NULL;
+	if (stalled_listener != NULL && stalled != NULL
+		&& wimp_socket_unix_bind(stalled_listener, STALLED_DOMAIN)
+		&& p_socket_listen(stalled_listener, NULL)
+		&& wimp_socket_unix_connect(stalled, STALLED_DOMAIN)
+		&& wimp_process_table_add(&server->ptable, "stalled", STALLED_DOMAIN, 0, WIMP_Process_Independent, stalled) == WIMP_PROCESS_TABLE_SUCCESS
+		&& wimp_process_table_get(&stalled_data, server->ptable, "stalled") == WIMP_PROCESS_TABLE_SUCCESS)
+	{
+		stalled_data->process_active = WIMP_PROCESS_ACTIVE;
+
+		//Far more than the socket can hold, then the instruction for the child
+		uint8_t* stalled_args = calloc(STALLED_INSTRUCTION_BYTES, 1);
+		for (int32_t i = 0; i < STALLED_INSTRUCTION_COUNT; ++i)
+		{
+			wimp_add_local_server("stalled", "fill", stalled_args, STALLED_INSTRUCTION_BYTES);
+		}
+		free(stalled_args);
+		wimp_add_local_server("test_process", "hello", NULL, 0);
+
+		//Only returns here if sending didn't wait on the stalled process
+		wimp_server_send_instructions(server);
+		PASS_MATRIX[STEP_STALLED_PROCESS_PENDING].status = stalled_data->process_active && wimp_server_flush(server, 0) == WIMP_SERVER_FAIL;
+	}
+
+	//Wait for the child to reply
+	bool disconnect = false;
+	while (!disconnect)
+	{
+		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		while (currentnode != NULL)
+		{
+			WimpInstrMeta meta = wimp_instr_get_from_node(currentnode);
+
+			if (strcmp(meta.instr, "reply") == 0)
+			{
+				PASS_MATRIX[STEP_CHILD_REPLY].status = true;
+			}
+			else if (strcmp(meta.instr, WIMP_INSTRUCTION_EXIT) == 0)
+			{
+				PASS_MATRIX[STEP_EXIT_INSTRUCTION].status = true;
+				disconnect = true;
+			}
+
+			wimp_instr_node_free(currentnode);
+			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		}
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+		wimp_server_send_instructions(server);
+	}
+
+	//Drop the stalled process and whatever is still pending for it
+	wimp_process_table_remove(&server->ptable, "stalled");
+	if (stalled != NULL)
+	{
+		p_socket_free(stalled);
+	}
+	if (stalled_listener != NULL)
+	{
+		p_socket_free(stalled_listener);
+		wimp_socket_unix_unlink(STALLED_DOMAIN);
+	}
+
+	//Cleanup
+	wimp_log("Master thread closed\n");
+	wimp_close_local_server();
+
+	//Cleanup
+	wimp_shutdown();
+
+	wimp_test_validate_passmat(PASS_MATRIX, 4);
+	return 0;
+}
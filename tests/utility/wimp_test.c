@@ -1,4 +1,5 @@
 #include <wimp_test.h>
+#include <string.h>
 
 TTimer timer_init()
 {
@@ -58,4 +59,40 @@ bool wimp_test_validate_passmat(PASSMAT* matrix, size_t entries)
 	}
 
 	return haspassed;
+}
+
+WimpInstrNode wimp_test_create_node(const char* instr, int32_t index)
+{
+	return wimp_instr_node_create("master", 0, "master", 0, instr, 0, &index, sizeof(int32_t));
+}
+
+/*
+* Checks the node is the instruction and index expected, then frees it
+*/
+static bool wimp_test_check_node(WimpInstrNode node, const char* instr, int32_t index)
+{
+	WimpInstrMeta meta = wimp_instr_get_from_node(node);
+	bool expected = strcmp(meta.instr, instr) == 0 && meta.arg_bytes == sizeof(int32_t) && *(int32_t*)meta.args == index;
+	wimp_instr_node_free(node);
+	return expected;
+}
+
+bool wimp_test_pop_expected(WimpInstrQueue* queue, const char* instr, int32_t index)
+{
+	WimpInstrNode node = wimp_instr_queue_pop(queue);
+	return node != NULL && wimp_test_check_node(node, instr, index);
+}
+
+int32_t wimp_test_pop_all(WimpInstrQueue* queue, const char* instr, int32_t first)
+{
+	int32_t popped = 0;
+	bool expected = true;
+	WimpInstrNode node = wimp_instr_queue_pop(queue);
+	while (node != NULL)
+	{
+		expected &= wimp_test_check_node(node, instr, first + popped);
+		popped++;
+		node = wimp_instr_queue_pop(queue);
+	}
+	return expected ? popped : -1;
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/timeb.h>
+#include <wimp_instruction.h>
 
 //Timer struct
 typedef struct _TTimer
@@ -45,4 +46,21 @@ float get_time_elapsed(const TTimer t);
 */
 bool wimp_test_validate_passmat(PASSMAT* matrix, size_t entries);
 
+/*
+* Creates a node of the instruction from master to itself, carrying its index
+*/
+WimpInstrNode wimp_test_create_node(const char* instr, int32_t index);
+
+/*
+* Pops the next node of the queue, checking it's the instruction and index expected
+*/
+bool wimp_test_pop_expected(WimpInstrQueue* queue, const char* instr, int32_t index);
+
+/*
+* Pops every node of the queue, checking they are the instruction with indexes counting up from first
+*
+* @return Returns the amount popped, or -1 if any was unexpected
+*/
+int32_t wimp_test_pop_all(WimpInstrQueue* queue, const char* instr, int32_t first);
+
 #endif
\ No newline at end of file
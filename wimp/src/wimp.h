@@ -5,12 +5,18 @@ extern "C" {
 #include "wimp_core.h"
 #include "wimp_data.h"
 #include "wimp_debug.h"
+#include "wimp_endian.h"
 #include "wimp_instruction.h"
 #include "wimp_log.h"
+#include "wimp_pool.h"
 #include "wimp_process.h"
 #include "wimp_process_table.h"
 #include "wimp_reciever.h"
 #include "wimp_server.h"
+#include "wimp_shm_ring.h"
+#include "wimp_socket.h"
+#include "wimp_transport.h"
+#include "wimp_uring.h"
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,69 @@
+///
+/// @file
+///
+/// This header defines the byte order helpers for the wire format
+///
+/// Everything WIMP sends between processes is little-endian: the handshake,
+/// the instruction headers, credit grants and pings. The helpers convert
+/// between that and the order of the host. On little-endian hosts they are
+/// empty, so the hot path costs nothing, and only big-endian hosts swap.
+///
+/// Processes from before protocol version 1 (see WIMP_PROTOCOL_VERSION) sent
+/// the names version of instructions in host order, WIMP_PEER32() reads and
+/// writes the sizes of those.
+///
+/// The arguments of instructions are left as they are, so processes on hosts
+/// with different byte orders must agree on how their arguments are encoded.
+///
+
+#ifndef WIMP_ENDIAN_H
+#define WIMP_ENDIAN_H
+
+#include <stdint.h>
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define WIMP_BIG_ENDIAN 1
+#else
+#define WIMP_BIG_ENDIAN 0
+#endif
+
+#if WIMP_BIG_ENDIAN
+
+static inline uint16_t wimp_swap16(uint16_t value)
+{
+	return (uint16_t)((value >> 8) | (value << 8));
+}
+
+static inline uint32_t wimp_swap32(uint32_t value)
+{
+	return (value >> 24) | ((value >> 8) & 0x0000ff00u) | ((value << 8) & 0x00ff0000u) | (value << 24);
+}
+
+static inline uint64_t wimp_swap64(uint64_t value)
+{
+	return ((uint64_t)wimp_swap32((uint32_t)value) << 32) | wimp_swap32((uint32_t)(value >> 32));
+}
+
+//Converts between little-endian and host order, which is the same both ways
+#define WIMP_LE16(value) wimp_swap16((uint16_t)(value))
+#define WIMP_LE32(value) wimp_swap32((uint32_t)(value))
+#define WIMP_LE64(value) wimp_swap64((uint64_t)(value))
+
+//Converts between the order a peer sends in and host order. Before protocol
+//version 1 peers sent in their own order, which is taken to be this host's
+#define WIMP_PEER32(protocol_version, value) ((protocol_version) > 0 ? WIMP_LE32(value) : (uint32_t)(value))
+
+#else
+
+//Converts between little-endian and host order, which is the same both ways
+#define WIMP_LE16(value) ((uint16_t)(value))
+#define WIMP_LE32(value) ((uint32_t)(value))
+#define WIMP_LE64(value) ((uint64_t)(value))
+
+//Converts between the order a peer sends in and host order. Before protocol
+//version 1 peers sent in their own order, which is taken to be this host's
+#define WIMP_PEER32(protocol_version, value) ((uint32_t)(value))
+
+#endif
+
+#endif
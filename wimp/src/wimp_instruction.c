@@ -1,176 +1,1711 @@
 #include <wimp_instruction.h>
+#include <wimp_log.h>
+#include <wimp_pool.h>
 #include <stdlib.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#endif
+
+/*
+* A node usually holds its instruction in the same allocation, in data, which
+* comes from the pool. The metadata is decoded the first time it's asked for,
+* and is kept for as long as the node has the same instruction buffer.
+*/
 typedef struct _WimpInstrNode
 {
-	WimpInstr instr;
-	struct _WimpInstrNode* nextnode;
-} *WimpInstrNode;
+	WimpInstr instr;
+	struct _WimpInstrNode* nextnode;
+	WimpInstrMeta meta;		//Decoded from instr when meta.start is the instruction
+	int32_t priority;		//Lane of the node, decoded when first queued unless built with it
+	uint32_t instr_id;		//Registered ID of the instruction, decoded when first counted
+	uint64_t data[];		//The instruction, unless instr points elsewhere. Keeps it 8 byte aligned
+} *WimpInstrNode;
+
+#define WIMP_INSTR_PRIORITY_UNKNOWN -1
+#define WIMP_INSTR_NODE_ID_UNKNOWN UINT32_MAX
+
+/*
+* Producers blocked on the limits of a queue wait on a native condition
+* variable, as plibsys has no timed wait. The consumer only signals once it
+* has seen a waiter, and waiters are counted before they check the limits
+* again, so none is missed.
+*/
+typedef struct _WimpInstrQueueSpace
+{
+#ifdef _WIN32
+	CRITICAL_SECTION mutex;
+	CONDITION_VARIABLE cond;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+	volatile pint waiters;
+} WimpInstrQueueSpace;
+
+/*
+* Counts of the instructions in a queue by registered ID, with ID zero for
+* the ones that aren't registered. Producers count what they push to the
+* inbox, and the nodes move over to the list counts when collected.
+*/
+typedef struct _WimpInstrQueueCounts
+{
+	volatile pint inbox[WIMP_INSTR_REGISTRY_CAPACITY + 1];
+	int32_t list[WIMP_INSTR_REGISTRY_CAPACITY + 1];
+} WimpInstrQueueCounts;
+
+#if defined(__linux__)
+#define WIMP_INSTR_SPACE_CLOCK CLOCK_MONOTONIC
+#elif !defined(_WIN32)
+#define WIMP_INSTR_SPACE_CLOCK CLOCK_REALTIME
+#endif
+
+/*
+* Creates what producers blocked on the limits of a queue wait on
+*/
+static WimpInstrQueueSpace* wimp_instr_queue_space_new(void)
+{
+	WimpInstrQueueSpace* space = malloc(sizeof(WimpInstrQueueSpace));
+	if (space == NULL)
+	{
+		return NULL;
+	}
+
+#ifdef _WIN32
+	InitializeCriticalSection(&space->mutex);
+	InitializeConditionVariable(&space->cond);
+#else
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+#ifdef __linux__
+	pthread_condattr_setclock(&attributes, WIMP_INSTR_SPACE_CLOCK);
+#endif
+	pthread_mutex_init(&space->mutex, NULL);
+	pthread_cond_init(&space->cond, &attributes);
+	pthread_condattr_destroy(&attributes);
+#endif
+	space->waiters = 0;
+	return space;
+}
+
+/*
+* Frees what producers blocked on the limits of a queue wait on, once none are left
+*/
+static void wimp_instr_queue_space_free(WimpInstrQueueSpace* space)
+{
+	if (space == NULL)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	DeleteCriticalSection(&space->mutex);
+#else
+	pthread_cond_destroy(&space->cond);
+	pthread_mutex_destroy(&space->mutex);
+#endif
+	free(space);
+}
+
+WimpInstrQueue wimp_create_instr_queue()
+{
+	WimpInstrQueue q;
+	q.backnode = NULL;
+	q.nextnode = NULL;
+	q.length = 0;
+	q.bytes = 0;
+	q.dropped = 0;
+	q.max_length = 0;
+	q.max_bytes = 0;
+	q.overflow = WIMP_INSTR_OVERFLOW_DROP_NEWEST;
+	q.block_timeout = 0;
+	q._list_length = 0;
+	q._list_bytes = 0;
+	memset(q._lane_backs, 0, sizeof(q._lane_backs));
+	q.high_watermark = 0;
+	q.low_watermark = 0;
+	q.throttled = false;
+	q._drained = NULL;
+	q._drained_context = NULL;
+	q._watermark = NULL;
+	q._watermark_context = NULL;
+	q._room = NULL;
+	q._room_context = NULL;
+	q._room_wanted = 0;
+	q._space = wimp_instr_queue_space_new();
+	q._counts = NULL;
+	q._inbox_stub = calloc(1, sizeof(struct _WimpInstrNode));
+	q._inbox_head = q._inbox_stub;
+	q._inbox_tail = q._inbox_stub;
+	q._datamutex = p_mutex_new();
+	q._nextmutex = p_mutex_new();
+	q._lowpriomutex = p_mutex_new();
+	return q;
+}
+
+void wimp_instr_queue_low_prio_lock(WimpInstrQueue* queue)
+{
+	p_mutex_lock(queue->_lowpriomutex);
+	p_mutex_lock(queue->_nextmutex);
+	p_mutex_lock(queue->_datamutex);
+	p_mutex_unlock(queue->_nextmutex);
+}
+
+void wimp_instr_queue_low_prio_unlock(WimpInstrQueue* queue)
+{
+	p_mutex_unlock(queue->_datamutex);
+	p_mutex_unlock(queue->_lowpriomutex);
+}
+
+void wimp_instr_queue_high_prio_lock(WimpInstrQueue* queue)
+{
+	p_mutex_lock(queue->_nextmutex);
+	p_mutex_lock(queue->_datamutex);
+	p_mutex_unlock(queue->_nextmutex);
+}
+
+void wimp_instr_queue_high_prio_unlock(WimpInstrQueue* queue)
+{
+	p_mutex_unlock(queue->_datamutex);
+}
+
+/*
+* Counts nodes added to the queue, throttling it once it reaches the high
+* watermark. Producers pushing to the inbox count at the same time, so the
+* counts are atomic.
+*/
+static void wimp_instr_queue_count_added(WimpInstrQueue* queue, pint count, pint bytes)
+{
+	p_atomic_int_add(&queue->bytes, bytes);
+	pint length = p_atomic_int_add(&queue->length, count) + count;
+	if (queue->high_watermark > 0 && length >= queue->high_watermark
+		&& p_atomic_int_compare_and_exchange(&queue->throttled, 0, 1) && queue->_watermark != NULL)
+	{
+		queue->_watermark(queue->_watermark_context, true);
+	}
+}
+
+/*
+* Counts a node of the size in the queue if it fits in the limits. Producers
+* reserve at the same time, so each limit is taken with a compare and swap,
+* and the length is given back if the bytes don't fit.
+*
+* @return Returns false if the node doesn't fit, with nothing counted
+*/
+static bool wimp_instr_queue_reserve(WimpInstrQueue* queue, pint bytes)
+{
+	pint length;
+	do
+	{
+		length = p_atomic_int_get(&queue->length);
+		if (queue->max_length > 0 && length >= queue->max_length)
+		{
+			return false;
+		}
+	} while (!p_atomic_int_compare_and_exchange(&queue->length, length, length + 1));
+
+	pint current;
+	do
+	{
+		current = p_atomic_int_get(&queue->bytes);
+		if (queue->max_bytes > 0 && current + bytes > queue->max_bytes)
+		{
+			p_atomic_int_add(&queue->length, -1);
+			return false;
+		}
+	} while (!p_atomic_int_compare_and_exchange(&queue->bytes, current, current + bytes));
+
+	if (queue->high_watermark > 0 && length + 1 >= queue->high_watermark
+		&& p_atomic_int_compare_and_exchange(&queue->throttled, 0, 1) && queue->_watermark != NULL)
+	{
+		queue->_watermark(queue->_watermark_context, true);
+	}
+	return true;
+}
+
+/*
+* Checks if the queue can take more from whoever it held back
+*/
+static bool wimp_instr_queue_can_take(WimpInstrQueue* queue)
+{
+	return !p_atomic_int_get(&queue->throttled)
+		&& (queue->max_length <= 0 || p_atomic_int_get(&queue->length) < queue->max_length)
+		&& (queue->max_bytes <= 0 || p_atomic_int_get(&queue->bytes) < queue->max_bytes);
+}
+
+/*
+* Wakes the producers blocked on the limits of the queue, if there are any
+*/
+static void wimp_instr_queue_wake_space(WimpInstrQueue* queue)
+{
+	WimpInstrQueueSpace* space = queue->_space;
+	if (space == NULL || p_atomic_int_get(&space->waiters) == 0)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	EnterCriticalSection(&space->mutex);
+	WakeAllConditionVariable(&space->cond);
+	LeaveCriticalSection(&space->mutex);
+#else
+	pthread_mutex_lock(&space->mutex);
+	pthread_cond_broadcast(&space->cond);
+	pthread_mutex_unlock(&space->mutex);
+#endif
+}
+
+/*
+* Makes the room callback if it was asked for and the queue can take more
+*/
+static void wimp_instr_queue_notify_room(WimpInstrQueue* queue)
+{
+	if (p_atomic_int_get(&queue->_room_wanted) && wimp_instr_queue_can_take(queue)
+		&& p_atomic_int_compare_and_exchange(&queue->_room_wanted, 1, 0) && queue->_room != NULL)
+	{
+		queue->_room(queue->_room_context);
+	}
+}
+
+/*
+* Lets whoever held back know once a throttled queue has drained enough.
+* A producer can throttle the queue just after it drained, so this is also
+* checked when popping finds nothing.
+*/
+static void wimp_instr_queue_check_drained(WimpInstrQueue* queue)
+{
+	if (p_atomic_int_get(&queue->throttled) && p_atomic_int_get(&queue->length) <= queue->low_watermark
+		&& p_atomic_int_compare_and_exchange(&queue->throttled, 1, 0))
+	{
+		if (queue->_drained != NULL)
+		{
+			queue->_drained(queue->_drained_context);
+		}
+		if (queue->_watermark != NULL)
+		{
+			queue->_watermark(queue->_watermark_context, false);
+		}
+		wimp_instr_queue_notify_room(queue);
+	}
+}
+
+/*
+* Lets the producers blocked on the limits, and whoever asked for the room
+* callback, know nodes were taken from the queue
+*/
+static void wimp_instr_queue_room_freed(WimpInstrQueue* queue)
+{
+	wimp_instr_queue_wake_space(queue);
+	wimp_instr_queue_notify_room(queue);
+}
+
+/*
+* Links a node to the head of the inbox. Swapping the head is the only point
+* producers contend on, and a node is reachable once the previous head links to it.
+*/
+static void wimp_instr_queue_inbox_link(WimpInstrQueue* queue, WimpInstrNode node)
+{
+	p_atomic_pointer_set(&node->nextnode, NULL);
+	WimpInstrNode previous;
+	do
+	{
+		previous = p_atomic_pointer_get(&queue->_inbox_head);
+	} while (!p_atomic_pointer_compare_and_exchange(&queue->_inbox_head, previous, node));
+	p_atomic_pointer_set(&previous->nextnode, node);
+}
+
+/*
+* Takes the oldest node from the inbox, only called by the consumer. Returns
+* NULL if it's empty, or if the next node has been swapped in but not yet
+* linked, in which case it's taken by a later pop.
+*/
+static WimpInstrNode wimp_instr_queue_inbox_take(WimpInstrQueue* queue)
+{
+	WimpInstrNode tail = queue->_inbox_tail;
+	WimpInstrNode next = p_atomic_pointer_get(&tail->nextnode);
+	if (tail == queue->_inbox_stub)
+	{
+		if (next == NULL)
+		{
+			return NULL;
+		}
+		queue->_inbox_tail = next;
+		tail = next;
+		next = p_atomic_pointer_get(&tail->nextnode);
+	}
+
+	if (next != NULL)
+	{
+		queue->_inbox_tail = next;
+		return tail;
+	}
+
+	//The tail is the last node, which can only be taken with the stub behind it
+	if (tail != p_atomic_pointer_get(&queue->_inbox_head))
+	{
+		return NULL;
+	}
+	wimp_instr_queue_inbox_link(queue, queue->_inbox_stub);
+	next = p_atomic_pointer_get(&tail->nextnode);
+	if (next != NULL)
+	{
+		queue->_inbox_tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/*
+* Gets the lane of a node, decoding it from the instruction the first time
+*/
+static int32_t wimp_instr_node_lane(WimpInstrNode node)
+{
+	if (node->priority == WIMP_INSTR_PRIORITY_UNKNOWN)
+	{
+		node->priority = wimp_instr_get_from_node(node).priority;
+	}
+	return node->priority;
+}
+
+/*
+* Gets the registered ID of the instruction of a node, decoding it the first
+* time. Is WIMP_INSTR_ID_NONE if the name wasn't registered by then.
+*/
+static uint32_t wimp_instr_node_id(WimpInstrNode node)
+{
+	if (node->instr_id == WIMP_INSTR_NODE_ID_UNKNOWN)
+	{
+		WimpInstrMeta meta = wimp_instr_get_from_node(node);
+		uint32_t id = meta.instr_id;
+		if (id == WIMP_INSTR_ID_NONE && meta.instr != NULL)
+		{
+			id = wimp_instr_get_id(meta.instr);
+		}
+		node->instr_id = id <= WIMP_INSTR_REGISTRY_CAPACITY ? id : WIMP_INSTR_ID_NONE;
+	}
+	return node->instr_id;
+}
+
+/*
+* Moves the list counts of add over to queue along with its nodes. Only queues
+* that asked to be counted pay for it, a splice between two that didn't stays
+* the same few pointer swaps. The nodes only have to be counted one by one if
+* add doesn't count them.
+*/
+static void wimp_instr_queue_move_counts(WimpInstrQueue* queue, WimpInstrQueue* add)
+{
+	if (add->_counts != NULL)
+	{
+		//Nodes are counted with IDs that were registered by then
+		uint32_t ids = wimp_instr_registry_count();
+		ids = ids < WIMP_INSTR_REGISTRY_CAPACITY ? ids : WIMP_INSTR_REGISTRY_CAPACITY;
+		if (queue->_counts != NULL)
+		{
+			for (uint32_t id = 0; id <= ids; ++id)
+			{
+				queue->_counts->list[id] += add->_counts->list[id];
+			}
+		}
+		memset(add->_counts->list, 0, (ids + 1) * sizeof(int32_t));
+	}
+	else if (queue->_counts != NULL)
+	{
+		for (WimpInstrNode node = add->nextnode; node != NULL; node = node->nextnode)
+		{
+			queue->_counts->list[wimp_instr_node_id(node)]++;
+		}
+	}
+}
+
+/*
+* Gets the end node of the lanes before a lane, which the lane follows in the
+* list. NULL if the lane is at the front.
+*/
+static WimpInstrNode wimp_instr_queue_lane_before(WimpInstrQueue* queue, int32_t lane)
+{
+	for (int32_t before = lane - 1; before >= 0; --before)
+	{
+		if (queue->_lane_backs[before] != NULL)
+		{
+			return queue->_lane_backs[before];
+		}
+	}
+	return NULL;
+}
+
+/*
+* Links the nodes from first to last, which are all in the lane, into the
+* list. They go at the back of the lane, or at the front of it before the
+* nodes already in it. The lanes follow each other in the list, so this only
+* has to find the end of the lane or of the ones before it.
+*/
+static void wimp_instr_queue_link_lane(WimpInstrQueue* queue, int32_t lane, WimpInstrNode first, WimpInstrNode last, bool front)
+{
+	WimpInstrNode previous = !front && queue->_lane_backs[lane] != NULL ? queue->_lane_backs[lane] : wimp_instr_queue_lane_before(queue, lane);
+
+	if (previous == NULL)
+	{
+		last->nextnode = queue->nextnode;
+		queue->nextnode = first;
+	}
+	else
+	{
+		last->nextnode = previous->nextnode;
+		previous->nextnode = first;
+	}
+
+	if (!front || queue->_lane_backs[lane] == NULL)
+	{
+		queue->_lane_backs[lane] = last;
+	}
+	if (last->nextnode == NULL)
+	{
+		queue->backnode = last;
+	}
+}
+
+/*
+* Moves everything in the inbox into the lanes of the list, which was already counted when pushed
+*/
+static void wimp_instr_queue_collect(WimpInstrQueue* queue)
+{
+	if (queue->_inbox_stub == NULL)
+	{
+		return;
+	}
+
+	WimpInstrNode node = wimp_instr_queue_inbox_take(queue);
+	while (node != NULL)
+	{
+		wimp_instr_queue_link_lane(queue, wimp_instr_node_lane(node), node, node, false);
+		queue->_list_length++;
+		queue->_list_bytes += (int32_t)node->instr.instruction_bytes;
+		if (queue->_counts != NULL)
+		{
+			uint32_t id = wimp_instr_node_id(node);
+			p_atomic_int_add(&queue->_counts->inbox[id], -1);
+			queue->_counts->list[id]++;
+		}
+		node = wimp_instr_queue_inbox_take(queue);
+	}
+}
+
+/*
+* Unlinks the first node of a lane from the list, which follows previous, or
+* is at the front if previous is NULL. Once a throttled queue has drained
+* enough, lets whoever held back know, and wakes any producer blocked on the
+* limits.
+*/
+static void wimp_instr_queue_unlink(WimpInstrQueue* queue, WimpInstrNode previous, WimpInstrNode node)
+{
+	if (previous == NULL)
+	{
+		queue->nextnode = node->nextnode;
+	}
+	else
+	{
+		previous->nextnode = node->nextnode;
+	}
+
+	//Being the first of its lane, the lane is empty if it was also the end
+	if (queue->_lane_backs[node->priority] == node)
+	{
+		queue->_lane_backs[node->priority] = NULL;
+	}
+	if (queue->backnode == node)
+	{
+		//Ensure won't add to deallocated memory
+		queue->backnode = previous;
+	}
+
+	pint bytes = (pint)node->instr.instruction_bytes;
+	queue->_list_length--;
+	queue->_list_bytes -= bytes;
+	if (queue->_counts != NULL)
+	{
+		queue->_counts->list[wimp_instr_node_id(node)]--;
+	}
+	p_atomic_int_add(&queue->bytes, -bytes);
+	p_atomic_int_add(&queue->length, -1);
+	wimp_instr_queue_check_drained(queue);
+	wimp_instr_queue_room_freed(queue);
+}
+
+/*
+* Blocks a producer until a node of the size fits in the limits of the queue,
+* or the block timeout, which waits for as long as it takes if it's zero.
+*
+* @return Returns true once room is reserved for the node
+*/
+static bool wimp_instr_queue_wait_space(WimpInstrQueue* queue, pint bytes)
+{
+	WimpInstrQueueSpace* space = queue->_space;
+	if (space == NULL)
+	{
+		return wimp_instr_queue_reserve(queue, bytes);
+	}
+
+	bool reserved = false;
+#ifdef _WIN32
+	ULONGLONG deadline = GetTickCount64() + (ULONGLONG)queue->block_timeout;
+	EnterCriticalSection(&space->mutex);
+	p_atomic_int_inc(&space->waiters);
+	while (!(reserved = wimp_instr_queue_reserve(queue, bytes)))
+	{
+		DWORD wait = INFINITE;
+		if (queue->block_timeout > 0)
+		{
+			ULONGLONG now = GetTickCount64();
+			if (now >= deadline)
+			{
+				break;
+			}
+			wait = (DWORD)(deadline - now);
+		}
+		SleepConditionVariableCS(&space->cond, &space->mutex, wait);
+	}
+	p_atomic_int_dec_and_test(&space->waiters);
+	LeaveCriticalSection(&space->mutex);
+#else
+	struct timespec deadline;
+	clock_gettime(WIMP_INSTR_SPACE_CLOCK, &deadline);
+	deadline.tv_sec += queue->block_timeout / 1000;
+	deadline.tv_nsec += (long)(queue->block_timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&space->mutex);
+	p_atomic_int_inc(&space->waiters);
+	while (!(reserved = wimp_instr_queue_reserve(queue, bytes)))
+	{
+		if (queue->block_timeout <= 0)
+		{
+			pthread_cond_wait(&space->cond, &space->mutex);
+		}
+		else if (pthread_cond_timedwait(&space->cond, &space->mutex, &deadline) == ETIMEDOUT)
+		{
+			//The last nodes taken may have been in time
+			reserved = wimp_instr_queue_reserve(queue, bytes);
+			break;
+		}
+	}
+	p_atomic_int_dec_and_test(&space->waiters);
+	pthread_mutex_unlock(&space->mutex);
+#endif
+	return reserved;
+}
+
+/*
+* Makes room for a node by dropping the oldest nodes in the list, following
+* the overflow policy. A producer drops nodes from the list with the queue
+* locked, so is the only one popping while it does.
+*
+* @return Returns true once room is reserved for the node
+*/
+static bool wimp_instr_queue_make_room(WimpInstrQueue* queue, WimpInstrNode node)
+{
+	pint bytes = (pint)node->instr.instruction_bytes;
+	int32_t lane = wimp_instr_node_lane(node);
+	bool reserved = false;
+	wimp_instr_queue_low_prio_lock(queue);
+	wimp_instr_queue_collect(queue);
+	while (!(reserved = wimp_instr_queue_reserve(queue, bytes)))
+	{
+		//The oldest of the same lane go first, otherwise of the least important one
+		int32_t drop_lane = WIMP_INSTR_PRIORITY_COUNT - 1;
+		while (drop_lane >= 0 && queue->_lane_backs[drop_lane] == NULL)
+		{
+			drop_lane--;
+		}
+		if (queue->overflow == WIMP_INSTR_OVERFLOW_DROP_OLDEST && queue->_lane_backs[lane] != NULL)
+		{
+			drop_lane = lane;
+		}
+
+		//Nodes still being linked to the inbox can't be dropped, and by class
+		//nothing more important than the node is
+		if (drop_lane < 0 || (queue->overflow == WIMP_INSTR_OVERFLOW_DROP_CLASS && drop_lane < lane))
+		{
+			break;
+		}
+
+		WimpInstrNode previous = wimp_instr_queue_lane_before(queue, drop_lane);
+		WimpInstrNode dropped = previous != NULL ? previous->nextnode : queue->nextnode;
+		wimp_instr_queue_unlink(queue, previous, dropped);
+		wimp_instr_node_free(dropped);
+		p_atomic_int_add(&queue->dropped, 1);
+	}
+	wimp_instr_queue_low_prio_unlock(queue);
+	return reserved;
+}
+
+/*
+* Handles a node that didn't fit in the limits of the queue, following its
+* overflow policy. A queue that blocks is waited on if wait is set, otherwise
+* the node goes over the limits if over_limits is set, or is left with the caller.
+*
+* @return Returns WIMP_INSTRUCTION_SUCCESS once the node is counted, WIMP_INSTRUCTION_DROPPED
+* if it was freed or WIMP_INSTRUCTION_FULL if it was left with the caller
+*/
+static int32_t wimp_instr_queue_overflow(WimpInstrQueue* queue, WimpInstrNode node, bool wait, bool over_limits)
+{
+	//Failing to reserve counted the node for a moment, which a blocked
+	//producer may have seen
+	wimp_instr_queue_wake_space(queue);
+
+	//Whoever pops has to be told to exit, so exit is let over the limits
+	pint bytes = (pint)node->instr.instruction_bytes;
+	if (wimp_instr_node_id(node) == WIMP_INSTR_ID_EXIT)
+	{
+		wimp_instr_queue_count_added(queue, 1, bytes);
+		return WIMP_INSTRUCTION_SUCCESS;
+	}
+
+	//A node bigger than the byte limit would never fit, however much is
+	//dropped or waited for
+	bool reserved = false;
+	if (queue->max_bytes <= 0 || bytes <= queue->max_bytes)
+	{
+		if (queue->overflow == WIMP_INSTR_OVERFLOW_BLOCK && !wait)
+		{
+			if (!over_limits)
+			{
+				return WIMP_INSTRUCTION_FULL;
+			}
+			wimp_instr_queue_count_added(queue, 1, bytes);
+			reserved = true;
+		}
+		else if (queue->overflow == WIMP_INSTR_OVERFLOW_BLOCK)
+		{
+			reserved = wimp_instr_queue_wait_space(queue, bytes);
+		}
+		else if (queue->overflow == WIMP_INSTR_OVERFLOW_DROP_OLDEST || queue->overflow == WIMP_INSTR_OVERFLOW_DROP_CLASS)
+		{
+			reserved = wimp_instr_queue_make_room(queue, node);
+		}
+	}
+
+	if (!reserved)
+	{
+		wimp_instr_node_free(node);
+		p_atomic_int_add(&queue->dropped, 1);
+		return WIMP_INSTRUCTION_DROPPED;
+	}
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+/*
+* Pushes a node to the inbox, within the limits of the queue if it has any,
+* see wimp_instr_queue_overflow()
+*/
+static int32_t wimp_instr_queue_push_node(WimpInstrQueue* queue, WimpInstrNode node, bool wait, bool over_limits)
+{
+	if (queue->_inbox_stub == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	pint bytes = (pint)node->instr.instruction_bytes;
+	if (queue->max_length <= 0 && queue->max_bytes <= 0)
+	{
+		wimp_instr_queue_count_added(queue, 1, bytes);
+	}
+	else if (!wimp_instr_queue_reserve(queue, bytes))
+	{
+		int32_t result = wimp_instr_queue_overflow(queue, node, wait, over_limits);
+		if (result != WIMP_INSTRUCTION_SUCCESS)
+		{
+			return result;
+		}
+	}
+
+	//Counted first, so the node is never popped before it's counted
+	if (queue->_counts != NULL)
+	{
+		p_atomic_int_inc(&queue->_counts->inbox[wimp_instr_node_id(node)]);
+	}
+	wimp_instr_queue_inbox_link(queue, node);
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+WimpInstrNode wimp_instr_node_new(size_t bytes)
+{
+	WimpInstrNode node = wimp_pool_alloc(sizeof(struct _WimpInstrNode) + bytes);
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	node->instr.instruction = (uint8_t*)node->data;
+	node->instr.instruction_bytes = bytes;
+	node->nextnode = NULL;
+	node->meta.start = NULL;
+	node->priority = WIMP_INSTR_PRIORITY_UNKNOWN;
+	node->instr_id = WIMP_INSTR_NODE_ID_UNKNOWN;
+	return node;
+}
+
+WimpInstrNode wimp_instr_node_wrap(void* instr, size_t bytes)
+{
+	WimpInstrNode node = wimp_instr_node_new(0);
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	node->instr.instruction = instr;
+	node->instr.instruction_bytes = bytes;
+	return node;
+}
+
+int32_t wimp_instr_queue_add(WimpInstrQueue* queue, void* instr, size_t bytes)
+{
+	WimpInstrNode new_node = wimp_instr_node_wrap(instr, bytes);
+	if (new_node == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+	return wimp_instr_queue_add_existing(queue, new_node);
+}
+
+int32_t wimp_instr_queue_add_existing(WimpInstrQueue* queue, WimpInstrNode node)
+{
+	//Goes to the back of its lane, which is the back of the queue unless a later lane has nodes
+	wimp_instr_queue_link_lane(queue, wimp_instr_node_lane(node), node, node, false);
+	queue->_list_length++;
+	queue->_list_bytes += (int32_t)node->instr.instruction_bytes;
+	if (queue->_counts != NULL)
+	{
+		queue->_counts->list[wimp_instr_node_id(node)]++;
+	}
+	wimp_instr_queue_count_added(queue, 1, (pint)node->instr.instruction_bytes);
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+int32_t wimp_instr_queue_push(WimpInstrQueue* queue, void* instr, size_t bytes)
+{
+	WimpInstrNode new_node = wimp_instr_node_wrap(instr, bytes);
+	if (new_node == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+	return wimp_instr_queue_push_existing(queue, new_node);
+}
+
+int32_t wimp_instr_queue_push_existing(WimpInstrQueue* queue, WimpInstrNode node)
+{
+	return wimp_instr_queue_push_node(queue, node, true, false);
+}
+
+int32_t wimp_instr_queue_push_unblocked(WimpInstrQueue* queue, WimpInstrNode node, bool over_limits)
+{
+	return wimp_instr_queue_push_node(queue, node, false, over_limits);
+}
+
+bool wimp_instr_queue_is_throttled(WimpInstrQueue* queue)
+{
+	return p_atomic_int_get(&queue->throttled) != 0;
+}
+
+/*
+* Moves the list of add to the front or back of the list of queue. Each lane
+* is linked into the same lane by its ends, so nothing in between is walked.
+* Leaves the inbox of add alone, and lets whoever was throttled by add know
+* it drained.
+*/
+static void wimp_instr_queue_splice(WimpInstrQueue* queue, WimpInstrQueue* add, bool front)
+{
+	if (add->nextnode == NULL)
+	{
+		wimp_instr_queue_check_drained(add);
+		return;
+	}
+
+	wimp_instr_queue_move_counts(queue, add);
+	WimpInstrNode first = add->nextnode;
+	for (int32_t lane = 0; lane < WIMP_INSTR_PRIORITY_COUNT; ++lane)
+	{
+		WimpInstrNode last = add->_lane_backs[lane];
+		if (last == NULL)
+		{
+			continue;
+		}
+		WimpInstrNode next = last->nextnode;
+		wimp_instr_queue_link_lane(queue, lane, first, last, front);
+		add->_lane_backs[lane] = NULL;
+		first = next;
+	}
+
+	int32_t moved = add->_list_length;
+	int32_t moved_bytes = add->_list_bytes;
+	queue->_list_length += moved;
+	queue->_list_bytes += moved_bytes;
+	add->_list_length = 0;
+	add->_list_bytes = 0;
+	add->nextnode = NULL;
+	add->backnode = NULL;
+
+	wimp_instr_queue_count_added(queue, moved, moved_bytes);
+	p_atomic_int_add(&add->bytes, -moved_bytes);
+	p_atomic_int_add(&add->length, -moved);
+	wimp_instr_queue_check_drained(add);
+	wimp_instr_queue_room_freed(add);
+}
+
+int32_t wimp_instr_queue_append_queue(WimpInstrQueue* queue, WimpInstrQueue* add)
+{
+	if (queue == NULL || add == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	wimp_instr_queue_collect(add);
+	wimp_instr_queue_splice(queue, add, false);
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+int32_t wimp_instr_queue_prepend_queue(WimpInstrQueue* queue, WimpInstrQueue* add)
+{
+	if (queue == NULL || add == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	//Anything still in the inbox of queue arrived later, so stays behind
+	wimp_instr_queue_collect(add);
+	wimp_instr_queue_splice(queue, add, true);
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+int32_t wimp_instr_queue_take_all(WimpInstrQueue* queue, WimpInstrQueue* out)
+{
+	return wimp_instr_queue_append_queue(out, queue);
+}
+
+void wimp_instr_queue_pin_front(WimpInstrQueue* queue)
+{
+	WimpInstrNode node = queue->nextnode;
+	if (node == NULL || node->priority == WIMP_INSTR_PRIORITY_CONTROL)
+	{
+		return;
+	}
+
+	//The lanes before the one of the node are empty, so it can become the
+	//first lane without moving, and everything added after goes behind it
+	if (queue->_lane_backs[node->priority] == node)
+	{
+		queue->_lane_backs[node->priority] = NULL;
+	}
+	node->priority = WIMP_INSTR_PRIORITY_CONTROL;
+	queue->_lane_backs[WIMP_INSTR_PRIORITY_CONTROL] = node;
+}
+
+int32_t wimp_instr_queue_set_watermarks(WimpInstrQueue* queue, int32_t high, int32_t low)
+{
+	if (high < 0 || low < 0 || (high > 0 && low >= high))
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	queue->high_watermark = high;
+	queue->low_watermark = high > 0 ? low : 0;
+	p_atomic_int_set(&queue->throttled, high > 0 && p_atomic_int_get(&queue->length) >= high);
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+void wimp_instr_queue_set_drained(WimpInstrQueue* queue, WIMP_INSTR_QUEUE_DRAINED drained, void* context)
+{
+	queue->_drained = drained;
+	queue->_drained_context = context;
+}
+
+void wimp_instr_queue_set_watermark_callback(WimpInstrQueue* queue, WIMP_INSTR_QUEUE_WATERMARK watermark, void* context)
+{
+	queue->_watermark = watermark;
+	queue->_watermark_context = context;
+}
+
+void wimp_instr_queue_set_room_callback(WimpInstrQueue* queue, WIMP_INSTR_QUEUE_DRAINED room, void* context)
+{
+	queue->_room = room;
+	queue->_room_context = context;
+}
+
+bool wimp_instr_queue_wait_room(WimpInstrQueue* queue)
+{
+	p_atomic_int_set(&queue->_room_wanted, 1);
+
+	//Check again after asking, as the queue may have drained before seeing it.
+	//If the consumer took the request in between, the callback is made anyway
+	if (wimp_instr_queue_can_take(queue) && p_atomic_int_compare_and_exchange(&queue->_room_wanted, 1, 0))
+	{
+		return false;
+	}
+	return true;
+}
+
+int32_t wimp_instr_queue_set_limits(WimpInstrQueue* queue, int32_t max_length, int32_t max_bytes, int32_t overflow, int32_t block_timeout)
+{
+	if (max_length < 0 || max_bytes < 0 || block_timeout < 0
+		|| overflow < WIMP_INSTR_OVERFLOW_DROP_NEWEST || overflow > WIMP_INSTR_OVERFLOW_BLOCK)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	queue->max_length = max_length;
+	queue->max_bytes = max_bytes;
+	queue->overflow = overflow;
+	queue->block_timeout = block_timeout;
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+int32_t wimp_instr_queue_count_by_name(WimpInstrQueue* queue)
+{
+	if (queue->_counts != NULL)
+	{
+		return WIMP_INSTRUCTION_SUCCESS;
+	}
+
+	//Producers count what they push once the counts are there, so nothing
+	//can have been pushed before
+	if (p_atomic_int_get(&queue->length) != 0)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	queue->_counts = calloc(1, sizeof(WimpInstrQueueCounts));
+	return queue->_counts != NULL ? WIMP_INSTRUCTION_SUCCESS : WIMP_INSTRUCTION_FAIL;
+}
+
+int32_t wimp_instr_queue_get_length(WimpInstrQueue* queue)
+{
+	return p_atomic_int_get(&queue->length);
+}
+
+int32_t wimp_instr_queue_get_bytes(WimpInstrQueue* queue)
+{
+	return p_atomic_int_get(&queue->bytes);
+}
+
+int32_t wimp_instr_queue_get_dropped(WimpInstrQueue* queue)
+{
+	return p_atomic_int_get(&queue->dropped);
+}
+
+WimpInstrNode wimp_instr_queue_pop(WimpInstrQueue* queue)
+{
+	//Take everything pushed so far in one go, even if the list still has
+	//nodes, as a later one may be in an earlier lane. Then return null if the
+	//queue is exhausted
+	wimp_instr_queue_collect(queue);
+	if (queue->nextnode == NULL)
+	{
+		wimp_instr_queue_check_drained(queue);
+		return NULL;
+	}
+
+	//Otherwise, return the node and update the next node
+	WimpInstrNode current = queue->nextnode;
+	wimp_instr_queue_unlink(queue, NULL, current);
+	return current;
+}
+
+WimpInstrNode wimp_instr_node_next(WimpInstrNode node)
+{
+	return node->nextnode;
+}
+
+WimpInstr wimp_instr_node_data(WimpInstrNode node)
+{
+	return node->instr;
+}
+
+void wimp_instr_node_free(WimpInstrNode node)
+{
+	if (node == NULL)
+	{
+		return;
+	}
+
+	//Only an instruction held outside of the node is a separate allocation
+	if (node->instr.instruction != (uint8_t*)node->data)
+	{
+		free(node->instr.instruction);
+	}
+	wimp_pool_free(node);
+}
+
+void wimp_instr_queue_free(WimpInstrQueue queue)
+{
+	//Iterate any remaining nodes and free their data, and the nodes themselves.
+	//Nobody is waiting on the queue to drain any more
+	queue._drained = NULL;
+	queue._watermark = NULL;
+	queue._room = NULL;
+	WimpInstrNode currentnode = wimp_instr_queue_pop(&queue);
+	while (currentnode != NULL)
+	{
+		wimp_instr_node_free(currentnode);
+		currentnode = wimp_instr_queue_pop(&queue);
+	}
+
+	free(queue._inbox_stub);
+	wimp_instr_queue_space_free(queue._space);
+	free(queue._counts);
+	p_mutex_free(queue._datamutex);
+	p_mutex_free(queue._nextmutex);
+	p_mutex_free(queue._lowpriomutex);
+}
+
+/*
+* Registry of instruction names for the address space. IDs are the order the
+* names were registered in, and names are looked up with an open addressed
+* table of twice the capacity. Entries are only added until shutdown and are
+* published atomically, so lookups don't lock.
+*/
+#define WIMP_INSTR_REGISTRY_SLOTS (WIMP_INSTR_REGISTRY_CAPACITY * 2)
+
+static PMutex* s_instr_registry_mutex = NULL;
+static char* s_instr_names[WIMP_INSTR_REGISTRY_CAPACITY];
+static pint s_instr_slots[WIMP_INSTR_REGISTRY_SLOTS];
+static pint s_instr_count = 0;
+static pint s_instr_priorities[WIMP_INSTR_REGISTRY_CAPACITY];
+
+/*
+* FNV-1a of the name, to pick its slot
+*/
+static uint32_t wimp_instr_name_hash(const char* instr)
+{
+	uint32_t hash = 2166136261u;
+	for (const uint8_t* c = (const uint8_t*)instr; *c != '\0'; ++c)
+	{
+		hash = (hash ^ *c) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+* Finds the slot of a name, which is either the one holding it or the empty
+* one it would go in
+*/
+static pint* wimp_instr_find_slot(const char* instr)
+{
+	uint32_t slot = wimp_instr_name_hash(instr) & (WIMP_INSTR_REGISTRY_SLOTS - 1);
+	for (;;)
+	{
+		pint id = p_atomic_int_get(&s_instr_slots[slot]);
+		if (id == WIMP_INSTR_ID_NONE || strcmp(s_instr_names[id - 1], instr) == 0)
+		{
+			return &s_instr_slots[slot];
+		}
+		slot = (slot + 1) & (WIMP_INSTR_REGISTRY_SLOTS - 1);
+	}
+}
+
+int32_t wimp_instr_registry_init(void)
+{
+	if (s_instr_registry_mutex != NULL)
+	{
+		return WIMP_INSTRUCTION_SUCCESS;
+	}
+
+	s_instr_registry_mutex = p_mutex_new();
+	if (s_instr_registry_mutex == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	//In the order of the WIMP_INSTR_ID_ defines. Exit ends what its sender
+	//sent, so it keeps its place behind the instructions before it
+	wimp_instr_register(WIMP_INSTRUCTION_EXIT);
+	wimp_instr_set_priority(WIMP_INSTRUCTION_LOG, WIMP_INSTR_PRIORITY_CONTROL);
+	wimp_instr_set_priority(WIMP_INSTRUCTION_PING, WIMP_INSTR_PRIORITY_CONTROL);
+	wimp_instr_set_priority(WIMP_INSTRUCTION_HANDSHAKE_STATUS, WIMP_INSTR_PRIORITY_CONTROL);
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+void wimp_instr_registry_shutdown(void)
+{
+	if (s_instr_registry_mutex == NULL)
+	{
+		return;
+	}
+
+	pint count = p_atomic_int_get(&s_instr_count);
+	p_atomic_int_set(&s_instr_count, 0);
+	for (pint i = 0; i < WIMP_INSTR_REGISTRY_SLOTS; ++i)
+	{
+		p_atomic_int_set(&s_instr_slots[i], WIMP_INSTR_ID_NONE);
+	}
+	for (pint i = 0; i < count; ++i)
+	{
+		free(s_instr_names[i]);
+		s_instr_names[i] = NULL;
+	}
+
+	p_mutex_free(s_instr_registry_mutex);
+	s_instr_registry_mutex = NULL;
+}
+
+uint32_t wimp_instr_register(const char* instr)
+{
+	if (s_instr_registry_mutex == NULL || instr == NULL || instr[0] == '\0')
+	{
+		return WIMP_INSTR_ID_NONE;
+	}
+
+	p_mutex_lock(s_instr_registry_mutex);
+	pint* slot = wimp_instr_find_slot(instr);
+	pint id = p_atomic_int_get(slot);
+	pint count = p_atomic_int_get(&s_instr_count);
+	if (id == WIMP_INSTR_ID_NONE && count < WIMP_INSTR_REGISTRY_CAPACITY)
+	{
+		//The name has to be in place before the slot and count publish it
+		size_t instr_bytes = strlen(instr) + 1;
+		s_instr_names[count] = malloc(instr_bytes);
+		if (s_instr_names[count] != NULL)
+		{
+			memcpy(s_instr_names[count], instr, instr_bytes);
+			p_atomic_int_set(&s_instr_priorities[count], WIMP_INSTR_PRIORITY_NORMAL);
+			id = count + 1;
+			p_atomic_int_set(slot, id);
+			p_atomic_int_set(&s_instr_count, id);
+		}
+	}
+	p_mutex_unlock(s_instr_registry_mutex);
+
+	if (id == WIMP_INSTR_ID_NONE)
+	{
+		wimp_log_fail("Couldn't register instruction %s\n", instr);
+	}
+	return (uint32_t)id;
+}
+
+uint32_t wimp_instr_get_id(const char* instr)
+{
+	if (s_instr_registry_mutex == NULL || p_atomic_int_get(&s_instr_count) == 0)
+	{
+		return WIMP_INSTR_ID_NONE;
+	}
+	return (uint32_t)p_atomic_int_get(wimp_instr_find_slot(instr));
+}
+
+const char* wimp_instr_get_name(uint32_t id)
+{
+	if (id == WIMP_INSTR_ID_NONE || id > (uint32_t)p_atomic_int_get(&s_instr_count))
+	{
+		return NULL;
+	}
+	return s_instr_names[id - 1];
+}
+
+int32_t wimp_instr_set_priority(const char* instr, int32_t priority)
+{
+	if (priority < 0 || priority >= WIMP_INSTR_PRIORITY_COUNT)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	uint32_t id = wimp_instr_register(instr);
+	if (id == WIMP_INSTR_ID_NONE)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+	p_atomic_int_set(&s_instr_priorities[id - 1], priority);
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+int32_t wimp_instr_get_priority(uint32_t id)
+{
+	if (id == WIMP_INSTR_ID_NONE || id > (uint32_t)p_atomic_int_get(&s_instr_count))
+	{
+		return WIMP_INSTR_PRIORITY_NORMAL;
+	}
+	return p_atomic_int_get(&s_instr_priorities[id - 1]);
+}
+
+uint32_t wimp_instr_registry_count(void)
+{
+	return (uint32_t)p_atomic_int_get(&s_instr_count);
+}
+
+uint8_t* wimp_instr_registry_pack(uint32_t count, size_t* bytes)
+{
+	*bytes = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		*bytes += strlen(s_instr_names[i]) + 1;
+	}
+
+	uint8_t* pack = malloc(*bytes > 0 ? *bytes : 1);
+	if (pack == NULL)
+	{
+		*bytes = 0;
+		return NULL;
+	}
+
+	size_t offset = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		size_t instr_bytes = strlen(s_instr_names[i]) + 1;
+		memcpy(&pack[offset], s_instr_names[i], instr_bytes);
+		offset += instr_bytes;
+	}
+	return pack;
+}
+
+uint32_t* wimp_instr_registry_unpack(const uint8_t* names, size_t bytes, uint32_t* count)
+{
+	//Names are null terminated, so count the terminators
+	*count = 0;
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		*count += names[i] == '\0';
+	}
+
+	uint32_t* ids = malloc((*count > 0 ? *count : 1) * sizeof(uint32_t));
+	if (ids == NULL || (bytes > 0 && names[bytes - 1] != '\0'))
+	{
+		free(ids);
+		*count = 0;
+		return NULL;
+	}
+
+	size_t offset = 0;
+	for (uint32_t i = 0; i < *count; ++i)
+	{
+		const char* instr = (const char*)&names[offset];
+		ids[i] = wimp_instr_register(instr);
+		offset += strlen(instr) + 1;
+	}
+	return ids;
+}
+
+#define WIMP_INSTR_NAME_FIELDS 3 //The destination, source and instruction names
+
+/*
+* A name of an instruction, which is sent by ID if it has one
+*/
+typedef struct _WimpInstrName
+{
+	const char* name;
+	uint32_t id;
+} WimpInstrName;
 
-WimpInstrQueue wimp_create_instr_queue()
+/*
+* Rounds up to the alignment of the fixed header version
+*/
+static size_t wimp_instr_align(size_t bytes)
 {
-	WimpInstrQueue q;
-	q.backnode = NULL;
-	q.nextnode = NULL;
-	q._datamutex = p_mutex_new();
-	q._nextmutex = p_mutex_new();
-	q._lowpriomutex = p_mutex_new();
-	return q;
+	return (bytes + WIMP_INSTR_ALIGN - 1) & ~(size_t)(WIMP_INSTR_ALIGN - 1);
 }
 
-void wimp_instr_queue_low_prio_lock(WimpInstrQueue* queue)
+/*
+* Builds an instruction in the version given
+*
+* @param node If given, the instruction is built in a new node which this is set to, otherwise on its own
+*
+* @return Returns the instruction, which must be freed with the node if there is one, or NULL if failed
+*/
+static uint8_t* wimp_instr_build(int32_t version, const WimpInstrName* names, const void* args, size_t arg_bytes, size_t* bytes, WimpInstrNode* node)
 {
-	p_mutex_lock(queue->_lowpriomutex);
-	p_mutex_lock(queue->_nextmutex);
-	p_mutex_lock(queue->_datamutex);
-	p_mutex_unlock(queue->_nextmutex);
+	//Work out formatted size
+	size_t names_bytes = 0;
+	for (int32_t field = 0; field < WIMP_INSTR_NAME_FIELDS; ++field)
+	{
+		if (names[field].id == WIMP_INSTR_ID_NONE)
+		{
+			names_bytes += (strlen(names[field].name) + 1) * sizeof(char);
+		}
+		else if (version == WIMP_INSTR_VERSION_NAMES)
+		{
+			names_bytes += WIMP_INSTRUCTION_ID_BYTES;
+		}
+	}
+
+	size_t args_offset;
+	size_t total_bytes;
+	if (version == WIMP_INSTR_VERSION_NAMES)
+	{
+		args_offset = WIMP_INSTRUCTION_DEST_OFFSET + names_bytes + sizeof(int32_t);
+		total_bytes = args_offset + arg_bytes;
+	}
+	else
+	{
+		args_offset = wimp_instr_align(sizeof(WimpInstrHeader) + names_bytes);
+		total_bytes = wimp_instr_align(args_offset + arg_bytes);
+	}
+	if (total_bytes > INT32_MAX)
+	{
+		return NULL;
+	}
+
+	uint8_t* buffer;
+	if (node != NULL)
+	{
+		*node = wimp_instr_node_new(total_bytes);
+		buffer = *node != NULL ? (*node)->instr.instruction : NULL;
+	}
+	else
+	{
+		buffer = malloc(total_bytes);
+	}
+	if (buffer == NULL)
+	{
+		return NULL;
+	}
+
+	if (version == WIMP_INSTR_VERSION_NAMES)
+	{
+		//Is only ever built to send, so is little-endian straight away
+		uint32_t header = WIMP_LE32(total_bytes);
+		memcpy(buffer, &header, sizeof(int32_t));
+
+		size_t offset = WIMP_INSTRUCTION_DEST_OFFSET;
+		for (int32_t field = 0; field < WIMP_INSTR_NAME_FIELDS; ++field)
+		{
+			if (names[field].id != WIMP_INSTR_ID_NONE)
+			{
+				uint32_t id = WIMP_LE32(names[field].id);
+				buffer[offset] = '\0';
+				memcpy(&buffer[offset + 1], &id, sizeof(uint32_t));
+				offset += WIMP_INSTRUCTION_ID_BYTES;
+			}
+			else
+			{
+				size_t name_bytes = (strlen(names[field].name) + 1) * sizeof(char);
+				memcpy(&buffer[offset], names[field].name, name_bytes);
+				offset += name_bytes;
+			}
+		}
+
+		uint32_t arg_size = WIMP_LE32(arg_bytes);
+		memcpy(&buffer[offset], &arg_size, sizeof(int32_t));
+	}
+	else
+	{
+		//The priority is sent along, so the process it goes to queues it in the same lane
+		uint32_t instr_id = names[2].id != WIMP_INSTR_ID_NONE ? names[2].id : wimp_instr_get_id(names[2].name);
+		int32_t priority = wimp_instr_get_priority(instr_id);
+		if (node != NULL)
+		{
+			(*node)->priority = priority;
+		}
+
+		WimpInstrHeader header;
+		header.total_bytes = (int32_t)total_bytes;
+		header.version = WIMP_INSTR_VERSION_FIXED;
+		header.flags = priority == WIMP_INSTR_PRIORITY_CONTROL ? WIMP_INSTR_FLAG_CONTROL
+			: priority == WIMP_INSTR_PRIORITY_BULK ? WIMP_INSTR_FLAG_BULK : 0;
+		header.args = (uint32_t)args_offset;
+		header.arg_bytes = (int32_t)arg_bytes;
+
+		//Names without an ID go after the header, in the order of the fields
+		uint32_t fields[WIMP_INSTR_NAME_FIELDS];
+		size_t offset = sizeof(WimpInstrHeader);
+		for (int32_t field = 0; field < WIMP_INSTR_NAME_FIELDS; ++field)
+		{
+			if (names[field].id != WIMP_INSTR_ID_NONE)
+			{
+				header.flags |= (uint16_t)(1 << field);
+				fields[field] = names[field].id;
+				continue;
+			}
+
+			size_t name_bytes = (strlen(names[field].name) + 1) * sizeof(char);
+			memcpy(&buffer[offset], names[field].name, name_bytes);
+			fields[field] = (uint32_t)offset;
+			offset += name_bytes;
+		}
+		header.dest = fields[0];
+		header.source = fields[1];
+		header.instr = fields[2];
+		header.instr_bytes = names[2].id == WIMP_INSTR_ID_NONE ? (uint32_t)(strlen(names[2].name) + 1) : 0;
+		memcpy(buffer, &header, sizeof(WimpInstrHeader));
+		memset(&buffer[offset], 0, args_offset - offset);
+	}
+
+	//Without args the space is only reserved, and filled in by the caller
+	size_t copied_bytes = args != NULL ? arg_bytes : 0;
+	if (copied_bytes > 0)
+	{
+		memcpy(&buffer[args_offset], args, copied_bytes);
+	}
+	memset(&buffer[args_offset + copied_bytes], 0, total_bytes - args_offset - copied_bytes);
+
+	*bytes = total_bytes;
+	return buffer;
 }
 
-void wimp_instr_queue_low_prio_unlock(WimpInstrQueue* queue)
+void wimp_instr_header_swap(uint8_t* buffer)
 {
-	p_mutex_unlock(queue->_datamutex);
-	p_mutex_unlock(queue->_lowpriomutex);
+	WimpInstrHeader* header = (WimpInstrHeader*)buffer;
+	header->total_bytes = (int32_t)WIMP_LE32(header->total_bytes);
+	header->version = WIMP_LE16(header->version);
+	header->flags = WIMP_LE16(header->flags);
+	header->dest = WIMP_LE32(header->dest);
+	header->source = WIMP_LE32(header->source);
+	header->instr = WIMP_LE32(header->instr);
+	header->instr_bytes = WIMP_LE32(header->instr_bytes);
+	header->args = WIMP_LE32(header->args);
+	header->arg_bytes = (int32_t)WIMP_LE32(header->arg_bytes);
 }
 
-void wimp_instr_queue_high_prio_lock(WimpInstrQueue* queue)
+uint8_t* wimp_instr_create(const char* dest, uint32_t dest_id, const char* source, uint32_t source_id, const char* instr, uint32_t instr_id, const void* args, size_t arg_bytes, size_t* bytes)
 {
-	p_mutex_lock(queue->_nextmutex);
-	p_mutex_lock(queue->_datamutex);
-	p_mutex_unlock(queue->_nextmutex);
+	WimpInstrName names[WIMP_INSTR_NAME_FIELDS] = { { dest, dest_id }, { source, source_id }, { instr, instr_id } };
+	return wimp_instr_build(WIMP_INSTR_VERSION, names, args, arg_bytes, bytes, NULL);
 }
 
-void wimp_instr_queue_high_prio_unlock(WimpInstrQueue* queue)
+WimpInstrNode wimp_instr_node_create(const char* dest, uint32_t dest_id, const char* source, uint32_t source_id, const char* instr, uint32_t instr_id, const void* args, size_t arg_bytes)
 {
-	p_mutex_unlock(queue->_datamutex);
+	WimpInstrName names[WIMP_INSTR_NAME_FIELDS] = { { dest, dest_id }, { source, source_id }, { instr, instr_id } };
+	WimpInstrNode node = NULL;
+	size_t bytes = 0;
+	if (wimp_instr_build(WIMP_INSTR_VERSION, names, args, arg_bytes, &bytes, &node) == NULL)
+	{
+		return NULL;
+	}
+	return node;
 }
 
-int32_t wimp_instr_queue_add(WimpInstrQueue* queue, void* instr, size_t bytes)
+/*
+* Reads a name field of the names version at the offset, which is either a
+* null terminated name, or an empty name and the ID. Only one of the name and
+* ID is set.
+*
+* @return Returns the offset after the field, or zero if the buffer ends first
+*/
+static size_t wimp_instr_read_name(const uint8_t* buffer, size_t buffsize, size_t offset, const char** name, uint32_t* id)
 {
-	WimpInstrNode new_node = malloc(sizeof(struct _WimpInstrNode));
-	if (new_node == NULL)
+	*name = NULL;
+	*id = WIMP_INSTR_ID_NONE;
+	if (offset >= buffsize)
 	{
-		return WIMP_INSTRUCTION_FAIL;
+		return 0;
 	}
 
-	new_node->instr.instruction = instr;
-	new_node->instr.instruction_bytes = bytes;
-	new_node->nextnode = NULL;
+	if (buffer[offset] == '\0')
+	{
+		if (offset + WIMP_INSTRUCTION_ID_BYTES > buffsize)
+		{
+			return 0;
+		}
+		memcpy(id, &buffer[offset + 1], sizeof(uint32_t));
+		*id = WIMP_LE32(*id);
+		return offset + WIMP_INSTRUCTION_ID_BYTES;
+	}
 
-	if (queue->backnode == NULL)
+	const uint8_t* end = memchr(&buffer[offset], '\0', buffsize - offset);
+	if (end == NULL)
 	{
-		//There are no nodes in the queue, set both to first node
-		queue->nextnode = new_node;
-		queue->backnode = new_node;
+		return 0;
 	}
-	else
+	*name = (const char*)&buffer[offset];
+	return (size_t)(end - buffer) + 1;
+}
+
+/*
+* Maps an ID from another address space to the local one
+*
+* @return Returns false if the ID isn't one the other address space sent
+*/
+static bool wimp_instr_map_one(uint32_t* id, const uint32_t* ids, uint32_t count)
+{
+	if (*id == WIMP_INSTR_ID_NONE || *id > count || ids[*id - 1] == WIMP_INSTR_ID_NONE)
 	{
-		//There is a node in the queue, add to its next node and set to back
-		queue->backnode->nextnode = new_node;
-		queue->backnode = new_node;
+		return false;
 	}
-	return WIMP_INSTRUCTION_SUCCESS;
+	*id = ids[*id - 1];
+	return true;
 }
 
-int32_t wimp_instr_queue_add_existing(WimpInstrQueue* queue, WimpInstrNode node)
+bool wimp_instr_map_id(uint8_t* buffer, size_t buffsize, const uint32_t* ids, uint32_t count)
 {
-	node->nextnode = NULL;
-	if (queue->backnode == NULL)
+	if (buffsize < sizeof(WimpInstrHeader))
 	{
-		//There are no nodes in the queue, set both to first node
-		queue->nextnode = node;
-		queue->backnode = node;
+		return false;
 	}
-	else
+
+	WimpInstrHeader* header = (WimpInstrHeader*)buffer;
+	if (header->version != WIMP_INSTR_VERSION_FIXED || (size_t)header->total_bytes != buffsize
+		|| header->args < sizeof(WimpInstrHeader) || header->args > buffsize
+		|| header->arg_bytes < 0 || (size_t)header->arg_bytes > buffsize - header->args)
 	{
-		//There is a node in the queue, add to its next node and set to back
-		queue->backnode->nextnode = node;
-		queue->backnode = node;
+		return false;
 	}
-	return WIMP_INSTRUCTION_SUCCESS;
+
+	uint32_t* fields[WIMP_INSTR_NAME_FIELDS] = { &header->dest, &header->source, &header->instr };
+	for (int32_t field = 0; field < WIMP_INSTR_NAME_FIELDS; ++field)
+	{
+		if (header->flags & (1 << field))
+		{
+			if (!wimp_instr_map_one(fields[field], ids, count))
+			{
+				return false;
+			}
+		}
+		else if (*fields[field] < sizeof(WimpInstrHeader) || *fields[field] >= header->args
+			|| memchr(&buffer[*fields[field]], '\0', header->args - *fields[field]) == NULL)
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
-int32_t wimp_instr_queue_append_queue(WimpInstrQueue* queue, WimpInstrQueue* add)
+uint8_t* wimp_instr_upgrade(const uint8_t* buffer, size_t buffsize, const uint32_t* ids, uint32_t count, int32_t protocol_version, size_t* bytes)
 {
-	if (queue == NULL || add == NULL)
+	//Names sent by ID are mapped, and the rest get the local ID if registered
+	WimpInstrName names[WIMP_INSTR_NAME_FIELDS];
+	size_t offset = WIMP_INSTRUCTION_DEST_OFFSET;
+	for (int32_t field = 0; field < WIMP_INSTR_NAME_FIELDS; ++field)
 	{
-		return WIMP_INSTRUCTION_FAIL;
+		offset = wimp_instr_read_name(buffer, buffsize, offset, &names[field].name, &names[field].id);
+		if (offset == 0)
+		{
+			return NULL;
+		}
+
+		if (names[field].name == NULL)
+		{
+			if (!wimp_instr_map_one(&names[field].id, ids, count))
+			{
+				return NULL;
+			}
+		}
+		else
+		{
+			names[field].id = wimp_instr_get_id(names[field].name);
+		}
 	}
 
-	//Iterate queue, adding to back
-	WimpInstrNode currentnode = wimp_instr_queue_pop(add);
-	while (currentnode != NULL)
+	int32_t arg_bytes;
+	if (offset + sizeof(int32_t) > buffsize)
 	{
-		wimp_instr_queue_add_existing(queue, currentnode);
-		currentnode = wimp_instr_queue_pop(add);
+		return NULL;
 	}
-	return WIMP_INSTRUCTION_SUCCESS;
+	memcpy(&arg_bytes, &buffer[offset], sizeof(int32_t));
+	arg_bytes = (int32_t)WIMP_PEER32(protocol_version, arg_bytes);
+	offset += sizeof(int32_t);
+	if (arg_bytes < 0 || (size_t)arg_bytes > buffsize - offset)
+	{
+		return NULL;
+	}
+	return wimp_instr_build(WIMP_INSTR_VERSION_FIXED, names, &buffer[offset], (size_t)arg_bytes, bytes, NULL);
 }
 
-int32_t wimp_instr_queue_prepend_queue(WimpInstrQueue* queue, WimpInstrQueue* add)
+/*
+* Rebuilds the instruction of a node in a version, keeping only the IDs the
+* process it is going to knows
+*/
+static int32_t wimp_instr_node_rebuild(WimpInstrNode node, int32_t version, uint32_t known_ids)
 {
-	//Iterate normal queue, adding to back of add. Then swap the queues.
-	int32_t success = wimp_instr_queue_append_queue(add, queue);
-	if (success == WIMP_INSTRUCTION_SUCCESS)
+	WimpInstrMeta meta = wimp_instr_get_from_node(node);
+	if (meta.instr == NULL)
 	{
-		WimpInstrQueue queue_orig = *queue;
-		WimpInstrQueue add_orig = *add;
-		*queue = add_orig;
-		*add = queue_orig;
+		return WIMP_INSTRUCTION_FAIL;
 	}
-	return success;
-}
 
-WimpInstrNode wimp_instr_queue_pop(WimpInstrQueue* queue)
-{
-	//Return null if the queue is exhausted
-	if (queue->nextnode == NULL)
+	WimpInstrName names[WIMP_INSTR_NAME_FIELDS] = { { meta.dest_process, meta.dest_id }, { meta.source_process, meta.source_id }, { meta.instr, meta.instr_id } };
+	for (int32_t field = 0; field < WIMP_INSTR_NAME_FIELDS; ++field)
 	{
-		return NULL;
+		if (names[field].id > known_ids)
+		{
+			if (wimp_instr_get_name(names[field].id) == NULL)
+			{
+				return WIMP_INSTRUCTION_FAIL;
+			}
+			names[field].id = WIMP_INSTR_ID_NONE;
+		}
 	}
 
-	//Otherwise, return the node and update the next node
-	WimpInstrNode current = queue->nextnode;
-	queue->nextnode = current->nextnode;
+	size_t bytes;
+	uint8_t* rebuilt = wimp_instr_build(version, names, meta.args, meta.arg_bytes, &bytes, NULL);
+	if (rebuilt == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
 
-	if (queue->nextnode == NULL)
+	//The rebuilt instruction is held outside of the node, and the old metadata no longer applies
+	if (node->instr.instruction != (uint8_t*)node->data)
 	{
-		//Ensure won't add to deallocated memory
-		queue->backnode = NULL;
+		free(node->instr.instruction);
 	}
-	return current;
+	node->instr.instruction = rebuilt;
+	node->instr.instruction_bytes = bytes;
+	node->meta.start = NULL;
+	return WIMP_INSTRUCTION_SUCCESS;
 }
 
-void wimp_instr_node_free(WimpInstrNode node)
+int32_t wimp_instr_node_expand_id(WimpInstrNode node, uint32_t known_ids)
 {
-	free(node->instr.instruction);
-	free(node);
+	//Only IDs past those the process knows need replacing, which is rare
+	WimpInstrMeta meta = wimp_instr_get_from_node(node);
+	if (meta.dest_id <= known_ids && meta.source_id <= known_ids && meta.instr_id <= known_ids)
+	{
+		return WIMP_INSTRUCTION_SUCCESS;
+	}
+	return wimp_instr_node_rebuild(node, WIMP_INSTR_VERSION_FIXED, known_ids);
 }
 
-void wimp_instr_queue_free(WimpInstrQueue queue)
+int32_t wimp_instr_node_downgrade(WimpInstrNode node, uint32_t known_ids, int32_t protocol_version)
 {
-	//Iterate any remaining nodes and free their data, and the nodes themselves
-	WimpInstrNode currentnode = wimp_instr_queue_pop(&queue);
-	while (currentnode != NULL)
+	int32_t arg_bytes = wimp_instr_get_from_node(node).arg_bytes;
+	if (wimp_instr_node_rebuild(node, WIMP_INSTR_VERSION_NAMES, known_ids) != WIMP_INSTRUCTION_SUCCESS)
 	{
-		wimp_instr_node_free(currentnode);
-		currentnode = wimp_instr_queue_pop(&queue);
+		return WIMP_INSTRUCTION_FAIL;
 	}
 
-	p_mutex_free(queue._datamutex);
-	p_mutex_free(queue._nextmutex);
-	p_mutex_free(queue._lowpriomutex);
+	//The sizes are built little-endian, which a process from before protocol
+	//version 1 takes in its own order instead
+	uint8_t* buffer = node->instr.instruction;
+	size_t bytes = node->instr.instruction_bytes;
+	uint32_t sizes[2] = { WIMP_PEER32(protocol_version, bytes), WIMP_PEER32(protocol_version, arg_bytes) };
+	memcpy(buffer, &sizes[0], sizeof(uint32_t));
+	memcpy(&buffer[bytes - (size_t)arg_bytes - sizeof(int32_t)], &sizes[1], sizeof(uint32_t));
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+/*
+* Gets a name of the fixed header, from the registry if sent by ID. An ID
+* that isn't registered gives an empty name.
+*/
+static const char* wimp_instr_header_name(const uint8_t* buffer, uint16_t flags, int32_t field, uint32_t value, uint32_t* id)
+{
+	if (flags & (1 << field))
+	{
+		*id = value;
+		const char* name = wimp_instr_get_name(value);
+		return name != NULL ? name : "";
+	}
+
+	*id = WIMP_INSTR_ID_NONE;
+	return (const char*)&buffer[value];
 }
 
 WimpInstrMeta wimp_instr_get_from_buffer(uint8_t* buffer, size_t buffsize)
 {
 	WimpInstrMeta instr;
+	instr.start = buffer;
 	instr.arg_bytes = 0;
 	instr.dest_process = NULL;
 	instr.source_process = NULL;
 	instr.instr = NULL;
+	instr.dest_id = WIMP_INSTR_ID_NONE;
+	instr.source_id = WIMP_INSTR_ID_NONE;
+	instr.instr_id = WIMP_INSTR_ID_NONE;
 	instr.args = NULL;
 	instr.instr_bytes = 0;
 	instr.total_bytes = 0;
+	instr.priority = WIMP_INSTR_PRIORITY_NORMAL;
 
 	//if buffer is nullptr, was unable to allocate!
 	if (buffer == NULL)
@@ -179,68 +1714,45 @@ WimpInstrMeta wimp_instr_get_from_buffer(uint8_t* buffer, size_t buffsize)
 		return instr;
 	}
 
-	//Size of the full instruction is the start of the buffer - if is \0 is a
-	//ping packet so return as is
-	if (buffer[0] == '\0')
+	const WimpInstrHeader* header = (const WimpInstrHeader*)buffer;
+	if (buffsize < sizeof(WimpInstrHeader) || header->version != WIMP_INSTR_VERSION_FIXED)
 	{
+		wimp_log_fail("Attempting to get instr from a buffer without the fixed header!\n");
 		return instr;
 	}
 
-	instr.dest_process = &buffer[WIMP_INSTRUCTION_DEST_OFFSET];
-
-	//Find start of source process
-	char current_char = ' ';
-	size_t offset = WIMP_INSTRUCTION_DEST_OFFSET + 1;
-	while (current_char != '\0' && offset < buffsize)
-	{
-		current_char = (char)buffer[offset];
-		offset++;
-	}
-
-	instr.source_process = &buffer[offset];
-	offset++;
-	current_char = ' ';
-
-	//Find start of instruction
-	while (current_char != '\0' && offset < buffsize)
+	//Everything is at a known place, so nothing is scanned for
+	instr.dest_process = wimp_instr_header_name(buffer, header->flags, 0, header->dest, &instr.dest_id);
+	instr.source_process = wimp_instr_header_name(buffer, header->flags, 1, header->source, &instr.source_id);
+	instr.instr = wimp_instr_header_name(buffer, header->flags, 2, header->instr, &instr.instr_id);
+	instr.instr_bytes = (int32_t)header->instr_bytes;
+	instr.arg_bytes = header->arg_bytes;
+	if (instr.arg_bytes != 0)
 	{
-		current_char = (char)buffer[offset];
-		offset++;
+		instr.args = &buffer[header->args];
 	}
-
-	//Record start to get start of instr length
-	size_t instr_start = offset;
-
-	instr.instr = &buffer[offset];
-	offset++;
-	current_char = ' ';
-
-	//Find start of arg bytes
-	while (current_char != '\0' && offset < buffsize)
+	instr.total_bytes = header->total_bytes;
+	if (header->flags & WIMP_INSTR_FLAG_CONTROL)
 	{
-		current_char = (char)buffer[offset];
-		offset++;
+		instr.priority = WIMP_INSTR_PRIORITY_CONTROL;
 	}
-
-	//Use diff to get length of instr
-	instr.instr_bytes = offset - instr_start;
-
-	instr.arg_bytes = *(int32_t*)&buffer[offset];
-	offset += sizeof(int32_t);
-
-	if (instr.arg_bytes != 0)
+	else if (header->flags & WIMP_INSTR_FLAG_BULK)
 	{
-		instr.args = &buffer[offset];
+		instr.priority = WIMP_INSTR_PRIORITY_BULK;
 	}
 
-	instr.total_bytes = *(int32_t*)&buffer[0];
-
 	return instr;
 }
 
 WimpInstrMeta wimp_instr_get_from_node(WimpInstrNode node)
 {
-	return wimp_instr_get_from_buffer(node->instr.instruction, node->instr.instruction_bytes);
+	//Only decoded once for each instruction buffer the node has
+	if (node->meta.start != node->instr.instruction)
+	{
+		node->meta = wimp_instr_get_from_buffer(node->instr.instruction, node->instr.instruction_bytes);
+		node->meta.start = node->instr.instruction;
+	}
+	return node->meta;
 }
 
 bool wimp_instr_check(const char* instr1, const char* instr2)
@@ -252,21 +1764,34 @@ bool wimp_instr_check(const char* instr1, const char* instr2)
 size_t wimp_instr_get_instruction_count(WimpInstrQueue* queue, const char* instruction)
 {
 	size_t instr_count = 0;
+	wimp_instr_queue_collect(queue);
 
-	//Return 0 if the queue is exhausted
-	if (queue->nextnode == NULL)
+	//Registered instructions are counted as they come and go, so only the
+	//nodes whose name wasn't registered when they were queued are looked through
+	WimpInstrQueueCounts* counts = queue->_counts;
+	if (counts != NULL)
 	{
-		return instr_count;
+		uint32_t id = wimp_instr_get_id(instruction);
+		if (id != WIMP_INSTR_ID_NONE && id <= WIMP_INSTR_REGISTRY_CAPACITY)
+		{
+			instr_count = (size_t)(counts->list[id] + p_atomic_int_get(&counts->inbox[id]));
+		}
+		if (counts->list[WIMP_INSTR_ID_NONE] == 0)
+		{
+			return instr_count;
+		}
 	}
 
-	//Otherwise, iterate nodes and check
 	WimpInstrNode current = queue->nextnode;
 	while (current != NULL)
 	{
-		WimpInstrMeta meta = wimp_instr_get_from_node(current);
-		if (strcmp(meta.instr, instruction) == 0)
+		if (counts == NULL || wimp_instr_node_id(current) == WIMP_INSTR_ID_NONE)
 		{
-			instr_count++;
+			WimpInstrMeta meta = wimp_instr_get_from_node(current);
+			if (strcmp(meta.instr, instruction) == 0)
+			{
+				instr_count++;
+			}
 		}
 		current = current->nextnode;
 	}
@@ -333,4 +1858,153 @@ void wimp_instr_pack_free(WimpStrPack* pack)
 	free(*pack);
 	*pack = NULL;
 	return;
+}
+
+#define WIMP_STR_PACK_HEADER_BYTES (2 * sizeof(uint32_t)) //The count and size of the strings
+
+int32_t wimp_instr_pack_begin(WimpStrPackBuilder* builder, const char* dest, uint32_t dest_id, const char* source, uint32_t source_id, const char* instr, uint32_t instr_id, size_t reserve_bytes)
+{
+	memset(builder, 0, sizeof(WimpStrPackBuilder));
+	if (reserve_bytes > INT32_MAX)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	//The space for the strings is reserved but left to be written
+	WimpInstrName names[WIMP_INSTR_NAME_FIELDS] = { { dest, dest_id }, { source, source_id }, { instr, instr_id } };
+	size_t bytes = 0;
+	uint8_t* instruction = wimp_instr_build(WIMP_INSTR_VERSION_FIXED, names, NULL, WIMP_STR_PACK_HEADER_BYTES + reserve_bytes, &bytes, NULL);
+	if (instruction == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	WimpInstrHeader* header = (WimpInstrHeader*)instruction;
+	builder->instruction = instruction;
+	builder->capacity = bytes;
+	builder->args_offset = header->args;
+	builder->bytes = header->args + WIMP_STR_PACK_HEADER_BYTES;
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+int32_t wimp_instr_pack_add(WimpStrPackBuilder* builder, const char* string)
+{
+	if (builder->instruction == NULL)
+	{
+		return WIMP_INSTRUCTION_FAIL;
+	}
+
+	size_t string_bytes = (strlen(string) + 1) * sizeof(char);
+	size_t needed = builder->bytes + string_bytes;
+	if (needed > builder->capacity)
+	{
+		//Doubles, so the strings are only moved a few times however many there are
+		if (needed > INT32_MAX - WIMP_INSTR_ALIGN)
+		{
+			wimp_instr_pack_discard(builder);
+			return WIMP_INSTRUCTION_FAIL;
+		}
+		size_t capacity = builder->capacity;
+		while (capacity < needed)
+		{
+			capacity *= 2;
+		}
+		if (capacity > INT32_MAX)
+		{
+			capacity = INT32_MAX;
+		}
+
+		uint8_t* grown = realloc(builder->instruction, capacity);
+		if (grown == NULL)
+		{
+			wimp_instr_pack_discard(builder);
+			return WIMP_INSTRUCTION_FAIL;
+		}
+		builder->instruction = grown;
+		builder->capacity = capacity;
+	}
+
+	memcpy(&builder->instruction[builder->bytes], string, string_bytes);
+	builder->bytes = needed;
+	builder->str_count++;
+	return WIMP_INSTRUCTION_SUCCESS;
+}
+
+uint8_t* wimp_instr_pack_finish(WimpStrPackBuilder* builder, size_t* bytes)
+{
+	if (builder->instruction == NULL)
+	{
+		return NULL;
+	}
+
+	//Pad the end to the alignment, which the capacity might not have room for
+	size_t total_bytes = wimp_instr_align(builder->bytes);
+	if (total_bytes > builder->capacity)
+	{
+		uint8_t* grown = realloc(builder->instruction, total_bytes);
+		if (grown == NULL)
+		{
+			wimp_instr_pack_discard(builder);
+			return NULL;
+		}
+		builder->instruction = grown;
+	}
+	memset(&builder->instruction[builder->bytes], 0, total_bytes - builder->bytes);
+
+	size_t arg_bytes = builder->bytes - builder->args_offset;
+	uint32_t pack_header[2] = { WIMP_LE32(builder->str_count), WIMP_LE32(arg_bytes - WIMP_STR_PACK_HEADER_BYTES) };
+	memcpy(&builder->instruction[builder->args_offset], pack_header, WIMP_STR_PACK_HEADER_BYTES);
+
+	WimpInstrHeader* header = (WimpInstrHeader*)builder->instruction;
+	header->total_bytes = (int32_t)total_bytes;
+	header->arg_bytes = (int32_t)arg_bytes;
+
+	uint8_t* instruction = builder->instruction;
+	memset(builder, 0, sizeof(WimpStrPackBuilder));
+	*bytes = total_bytes;
+	return instruction;
+}
+
+void wimp_instr_pack_discard(WimpStrPackBuilder* builder)
+{
+	free(builder->instruction);
+	memset(builder, 0, sizeof(WimpStrPackBuilder));
+}
+
+uint32_t wimp_instr_pack_count(WimpInstrMeta meta)
+{
+	if (meta.args == NULL || meta.arg_bytes < (int32_t)WIMP_STR_PACK_HEADER_BYTES)
+	{
+		return 0;
+	}
+
+	uint32_t count;
+	memcpy(&count, meta.args, sizeof(uint32_t));
+	return WIMP_LE32(count);
+}
+
+const char* wimp_instr_pack_next(WimpInstrMeta meta, const char* previous)
+{
+	if (meta.args == NULL || meta.arg_bytes < (int32_t)WIMP_STR_PACK_HEADER_BYTES)
+	{
+		return NULL;
+	}
+
+	uint32_t strings_bytes;
+	memcpy(&strings_bytes, &((const uint8_t*)meta.args)[sizeof(uint32_t)], sizeof(uint32_t));
+	strings_bytes = WIMP_LE32(strings_bytes);
+	if (strings_bytes > (uint32_t)meta.arg_bytes - WIMP_STR_PACK_HEADER_BYTES)
+	{
+		return NULL;
+	}
+
+	//Each string is checked to end inside the pack before it is given out
+	const char* start = (const char*)meta.args + WIMP_STR_PACK_HEADER_BYTES;
+	const char* end = start + strings_bytes;
+	const char* next = previous == NULL ? start : previous + strlen(previous) + 1;
+	if (next < start || next >= end || memchr(next, '\0', (size_t)(end - next)) == NULL)
+	{
+		return NULL;
+	}
+	return next;
 }
\ No newline at end of file
@@ -3,16 +3,27 @@
 ///
 /// This header defines the interfaces to wimp instructions
 ///
-/// An instruction is formatted as such:
+/// An instruction starts with a fixed header (see WimpInstrHeader), followed
+/// by the names not sent by ID and then the arguments:
+/// 
+/// HEADER-[DESTPROCESS\0]-[SOURCEPROCESS\0]-[INSTRUCTION\0]-PADDING-ARGS-PADDING
+/// 
+/// The header holds the offsets of the fields, so the metadata is read without
+/// scanning. Processes built before the header existed send the names one after
+/// another instead, which recievers convert as the instructions arrive:
 /// 
 /// TOTAL_BYTES-DESTPROCESS\0-SOURCEPROCESS\0-INSTRUCTION\0-ARG_BYTES-...
 /// 
-/// An individual instruction can only be up to WIMP_MESSAGE_BUFFER_BYTES long.
+/// The sizes in an instruction are int32_t, so it can be up to INT32_MAX bytes
+/// long. Recievers read large bodies straight into the allocation of the
+/// instruction, so it isn't limited by the size of their buffer.
 /// 
 /// Each server has two linked lists for instructions (queue), one is incoming
-/// and one is outgoing. Formatted as FIFO. The reciever(s) for the process
-/// add to the incoming queue (as multiple threads could write need to use
-/// mutexes) which the process reads and executes. In the process of executing,
+/// and one is outgoing. Formatted as FIFO within each priority lane, and the
+/// lanes are drained in order (see wimp_instr_set_priority()), so control
+/// instructions such as pings never wait behind data. The reciever(s) for the process
+/// push to the incoming queue without locking (see wimp_instr_queue_push()),
+/// which the process reads and executes. In the process of executing,
 /// outgoing instructions may be added from the same thread. Each thread usually
 /// has one server, which is a thread local pointer. This means as long as a
 /// server exists on the thread, including the server header calling the function to
@@ -24,13 +35,23 @@
 /// applications:
 // 
 /// - Formatting the instructions as strings with constantly reused identifiers
-///   is not ideal. Can improve by converting the plain text process names and
-///   instructions with a hashed value which would reduce memory footprint.
-///   Hashed values would also be faster for instruction lookup at the other end.
-///   Therefore, this will be changed in the future once the base system works.
+///   is not ideal. Instruction names can be registered for an ID (see
+///   wimp_instr_register()), then they are sent as the ID and matched with an
+///   integer compare. Process names share the registry, as they are registered
+///   when added to a process table or when a server is created.
+///
+/// Each of the names (destination, source and instruction) can be sent by ID,
+/// flagged in the header (in the names version, as an empty name followed by
+/// the uint32_t ID). IDs are given out in the order names are registered in the
+/// address space, so they differ between processes. The server sends its
+/// registered names in the handshake, and the reciever maps the IDs of the
+/// server to its own as instructions arrive. A name registered after the
+/// handshake is sent to that process as a string.
 ///
-/// - Nodes could share some memory space for faster reading of instructions,
-///   potentially working like buckets of instructions up to a limit size.
+/// - Nodes hold their instruction in the same allocation where they can (see
+///   wimp_instr_node_new()), and decode its metadata once. Nodes could also
+///   share some memory space, working like buckets of instructions up to a
+///   limit size.
 ///
 
 #ifndef WIMP_INSTRUCTION_H
@@ -43,18 +64,57 @@
 #include <assert.h>
 #include <wimp_core.h>
 #include <wimp_debug.h>
+#include <wimp_endian.h>
 
 #define WIMP_INSTRUCTION_EXIT "exit"
 #define WIMP_INSTRUCTION_LOG "log"
 #define WIMP_INSTRUCTION_PING "ping"
 #define WIMP_INSTRUCTION_HANDSHAKE_STATUS "handshake_status"
-#define WIMP_INSTRUCTION_DEST_OFFSET sizeof(int32_t)
+#define WIMP_INSTRUCTION_DEST_OFFSET sizeof(int32_t) //Only in the names version
+#define WIMP_INSTRUCTION_ID_BYTES (1 + sizeof(uint32_t)) //An empty name then the ID, only in the names version
+
+#define WIMP_INSTR_VERSION_NAMES 1	//Names one after another, found by scanning
+#define WIMP_INSTR_VERSION_FIXED 2	//Fixed header with the offsets of the fields
+#define WIMP_INSTR_VERSION WIMP_INSTR_VERSION_FIXED //Version built, and kept in the queues
+#define WIMP_INSTR_ALIGN 8
+
+//Flags for the names of the fixed header sent by ID, in the order of the fields
+#define WIMP_INSTR_FLAG_DEST_ID 0x01
+#define WIMP_INSTR_FLAG_SOURCE_ID 0x02
+#define WIMP_INSTR_FLAG_INSTR_ID 0x04
+
+//Flags for the priority of the fixed header, an instruction with neither is normal
+#define WIMP_INSTR_FLAG_CONTROL 0x08
+#define WIMP_INSTR_FLAG_BULK 0x10
+
+//Priority lanes of the queues, drained strictly in this order
+#define WIMP_INSTR_PRIORITY_CONTROL 0	//Instructions that need to get through however busy the process is
+#define WIMP_INSTR_PRIORITY_NORMAL 1	//Any instruction not given a priority
+#define WIMP_INSTR_PRIORITY_BULK 2		//Data that can wait for everything else
+#define WIMP_INSTR_PRIORITY_COUNT 3
+
+//What a queue does with an instruction pushed past its limits, see wimp_instr_queue_set_limits()
+#define WIMP_INSTR_OVERFLOW_DROP_NEWEST 0	//Drops the instruction being pushed
+#define WIMP_INSTR_OVERFLOW_DROP_OLDEST 1	//Drops the oldest instructions in the lane of the one being pushed, or the least important lane if it has none
+#define WIMP_INSTR_OVERFLOW_DROP_CLASS 2	//Drops the oldest instructions in the least important lane, which may be the one being pushed
+#define WIMP_INSTR_OVERFLOW_BLOCK 3			//Blocks the thread pushing until there is room, or drops the instruction after the timeout if one is set
+
+#define WIMP_INSTR_REGISTRY_CAPACITY 1024 //Most instruction and process names an address space can register
+
+//The built in instructions are registered first by wimp_init, so always have these IDs
+#define WIMP_INSTR_ID_NONE 0
+#define WIMP_INSTR_ID_EXIT 1
+#define WIMP_INSTR_ID_LOG 2
+#define WIMP_INSTR_ID_PING 3
+#define WIMP_INSTR_ID_HANDSHAKE_STATUS 4
 
 /// @brief The result of a WIMP instruction operation
 enum WimpInstructionResult
 {
 	WIMP_INSTRUCTION_SUCCESS = 0, ///< Result if instruction operation is successful
-    WIMP_INSTRUCTION_FAIL    = -1 ///< Result if instruction operation fails for an unspecified reason
+    WIMP_INSTRUCTION_FAIL    = -1, ///< Result if instruction operation fails for an unspecified reason
+	WIMP_INSTRUCTION_DROPPED = -2, ///< Result if the instruction was dropped, as the queue was at its limits
+	WIMP_INSTRUCTION_FULL    = -3 ///< Result if the instruction was left with the caller, as the queue was at its limits and blocks
 };
 
 /// @brief Contains the data of an instruction
@@ -64,14 +124,97 @@ typedef struct _WimpInstr
 	size_t instruction_bytes;
 } WimpInstr;
 
+///
+/// @brief The fixed header at the start of an instruction
+///
+/// The header is 8 byte aligned, as are the arguments, and the total size is
+/// padded to a multiple of 8 so instructions following each other stay aligned.
+/// Each name is the ID it is registered for if its flag is set, otherwise the
+/// offset of the null terminated name. It is in host order in the queues and
+/// little-endian on the wire (see WIMP_INSTR_HEADER_TO_WIRE()).
+///
+typedef struct _WimpInstrHeader
+{
+	int32_t total_bytes;	///< Size of the instruction, including the header and padding
+	uint16_t version;		///< Is WIMP_INSTR_VERSION_FIXED
+	uint16_t flags;			///< The WIMP_INSTR_FLAG_ bits of the names sent by ID, and of the priority
+	uint32_t dest;			///< ID or offset of the destination process name
+	uint32_t source;		///< ID or offset of the source process name
+	uint32_t instr;			///< ID or offset of the instruction name
+	uint32_t instr_bytes;	///< Size of the instruction name, zero if sent by ID
+	uint32_t args;			///< Offset of the arguments
+	int32_t arg_bytes;		///< Size of the arguments
+} WimpInstrHeader;
+
+#if WIMP_BIG_ENDIAN
+#define WIMP_INSTR_HEADER_TO_WIRE(buffer) wimp_instr_header_swap(buffer)
+#define WIMP_INSTR_HEADER_FROM_WIRE(buffer) wimp_instr_header_swap(buffer)
+#else
+#define WIMP_INSTR_HEADER_TO_WIRE(buffer)	//Already little-endian
+#define WIMP_INSTR_HEADER_FROM_WIRE(buffer)
+#endif
+
 /// @brief A node used in the instruction queues
 typedef struct _WimpInstrNode *WimpInstrNode;
 
+///
+/// @brief Called when a throttled queue has been popped down to its low watermark
+///
+typedef void (*WIMP_INSTR_QUEUE_DRAINED)(void* context);
+
+///
+/// @brief Called when a queue reaches its high watermark, and when it drains to its low watermark after
+///
+typedef void (*WIMP_INSTR_QUEUE_WATERMARK)(void* context, bool high);
+
+///
 /// @brief Defines a linked list instruction queue
+///
+/// Nodes are added to the list with the queue locked, or pushed from any
+/// number of threads without locking to the inbox, an intrusive
+/// multi-producer single-consumer queue. The inbox is moved onto the back of
+/// the list in one go when popping finds the list empty, so only whoever
+/// holds the high priority lock pops.
+///
+/// A queue can be given high/low watermarks. Once it holds high_watermark
+/// instructions it is throttled, and stays so until it's popped down to
+/// low_watermark. Recievers and local senders hold back while it's throttled.
+///
+/// A queue can also be given limits on its length and size in bytes, which
+/// bound its memory even when whoever is sending to it doesn't hold back.
+/// What happens to an instruction pushed past them is set by the overflow
+/// policy. The counts are kept as instructions come and go, so reading them
+/// doesn't lock or walk the queue.
+///
 typedef struct _WimpInstrQueue
 {
 	WimpInstrNode nextnode; ///< The next node, if one exists
 	WimpInstrNode backnode; ///< The end node, if one exists
+	volatile pint length;	///< The amount of instructions in the queue, including the inbox
+	volatile pint bytes;	///< The size of the instructions in the queue in bytes, including the inbox
+	volatile pint dropped;	///< The amount of instructions dropped as the queue was at its limits
+	int32_t max_length;		///< Most instructions the queue is let hold, zero for no limit
+	int32_t max_bytes;		///< Most bytes of instructions the queue is let hold, zero for no limit
+	int32_t overflow;		///< The WIMP_INSTR_OVERFLOW_ policy for instructions pushed past the limits
+	int32_t block_timeout;	///< Longest a push is blocked for in ms with WIMP_INSTR_OVERFLOW_BLOCK, zero to wait until there is room
+	int32_t _list_length;	//Nodes linked from nextnode, only touched by the consumer
+	int32_t _list_bytes;	//Bytes of the nodes linked from nextnode, only touched by the consumer
+	WimpInstrNode _lane_backs[WIMP_INSTR_PRIORITY_COUNT]; //End node of each lane, the lanes follow each other in the list
+	int32_t high_watermark;	///< Length the queue is throttled at, zero if it never is
+	int32_t low_watermark;	///< Length a throttled queue has to drain to
+	volatile pint throttled; ///< Set from reaching the high watermark until drained to the low, see wimp_instr_queue_is_throttled()
+	WIMP_INSTR_QUEUE_DRAINED _drained;
+	void* _drained_context;
+	WIMP_INSTR_QUEUE_WATERMARK _watermark;
+	void* _watermark_context;
+	WIMP_INSTR_QUEUE_DRAINED _room;
+	void* _room_context;
+	volatile pint _room_wanted; //Set from wimp_instr_queue_wait_room() until the room callback is made
+	struct _WimpInstrQueueSpace* _space; //Producers blocked on the limits wait on this, NULL if it has no inbox
+	struct _WimpInstrQueueCounts* _counts; //Instructions in the queue by ID, NULL if they aren't counted
+	WimpInstrNode _inbox_head; //Newest pushed node, swapped in by the producers
+	WimpInstrNode _inbox_tail; //Oldest pushed node, only touched by the consumer
+	WimpInstrNode _inbox_stub; //Keeps the inbox from ever being empty, NULL if it has no inbox
 	PMutex* _datamutex;
 	PMutex* _nextmutex;
 	PMutex* _lowpriomutex; //Uses the triple mutex pattern
@@ -93,29 +236,53 @@ typedef struct _WimpStrPack
 	size_t strings[WIMP_STR_PACK_MAX_STRINGS];	///< The offsets of each string, up to WIMP_STR_PACK_MAX_STRINGS length
 } *WimpStrPack;
 
+///
+/// @brief Builds a pack of any number of strings straight into an instruction
+///
+/// Unlike WimpStrPack there is no limit on the strings and no separate
+/// allocation, each string is copied once into the argument area of the
+/// instruction, which grows as needed. The arguments are a uint32_t count and
+/// a uint32_t size of the strings, both little-endian, then the strings back
+/// to back with their null chars. Read them with wimp_instr_pack_count() and
+/// wimp_instr_pack_next().
+///
+typedef struct _WimpStrPackBuilder
+{
+	uint8_t* instruction;		///< The instruction being built, NULL if building failed
+	size_t capacity;			///< The bytes allocated for the instruction
+	size_t bytes;				///< The bytes of the instruction written so far
+	size_t args_offset;			///< The offset of the arguments in the instruction
+	uint32_t str_count;			///< The number of strings added
+} WimpStrPackBuilder;
+
 ///
 /// @brief Instruction metadata that can be pulled from a buffer
 ///
 typedef struct _WimpInstrMeta
 {
+	uint8_t* start;				///< Start of the raw instruction in the buffer
 	const char* source_process;	///< Name of the source process
 	const char* dest_process;	///< Name of the destination process
 	const char* instr;			///< Instruction string
+	uint32_t source_id;			///< ID of the source process, WIMP_INSTR_ID_NONE if the name isn't registered
+	uint32_t dest_id;			///< ID of the destination process, WIMP_INSTR_ID_NONE if the name isn't registered
+	uint32_t instr_id;			///< ID of the instruction, WIMP_INSTR_ID_NONE if the name isn't registered
 	void* args;					///< Pointer to the arguments
 	size_t total_bytes;			///< Total size in bytes of the instruction
 	int32_t arg_bytes;			///< Total size in bytes of the arguments only
-	int32_t instr_bytes;		///< Total size in bytes of the instruction only
+	int32_t instr_bytes;		///< Total size in bytes of the instruction name in the buffer, zero if sent by ID
+	int32_t priority;			///< The WIMP_INSTR_PRIORITY_ lane of the instruction
 } WimpInstrMeta;
 
 ///
 /// Get the start of the raw instruction data 
 ///
-#define WIMP_INSTR_START(meta) (uint8_t*)(meta.dest_process - WIMP_INSTRUCTION_DEST_OFFSET)
+#define WIMP_INSTR_START(meta) (meta.start)
 
 ///
 /// Get the offset into the raw instruction data
 ///
-#define WIMP_INSTR_OFFSET(meta, offset) (uint8_t*)(meta.dest_process - WIMP_INSTRUCTION_DEST_OFFSET + offset)
+#define WIMP_INSTR_OFFSET(meta, offset) (meta.start + offset)
 
 ///
 /// @brief Creates a new instruction queue
@@ -156,8 +323,33 @@ WIMP_API void wimp_instr_queue_high_prio_lock(WimpInstrQueue* queue);
 ///
 WIMP_API void wimp_instr_queue_high_prio_unlock(WimpInstrQueue* queue);
 
+///
+/// @brief Creates a node with room for an instruction in the same allocation
+///
+/// The instruction is written to wimp_instr_node_data(), and freed with the node.
+///
+/// @param bytes The size of the instruction in bytes
+///
+/// @return Returns the node, or NULL if it couldn't be allocated
+///
+WIMP_API WimpInstrNode wimp_instr_node_new(size_t bytes);
+
+///
+/// @brief Creates a node for an instruction allocated on its own
+///
+/// @param instr A heap pointer to the instruction buffer, which will later be freed with the node
+/// @param bytes The size of the instruction buffer in bytes
+///
+/// @return Returns the node, or NULL if it couldn't be allocated, in which case the buffer isn't freed
+///
+WIMP_API WimpInstrNode wimp_instr_node_wrap(void* instr, size_t bytes);
+
 ///
 /// @brief Adds an instruction to the queue
+///
+/// Allocates a node for the instruction, so wimp_instr_node_create() and
+/// wimp_instr_queue_add_existing() should be used where the instruction is
+/// built for the queue.
 /// 
 /// @param queue The pointer to the queue to add to
 /// @param instr A heap pointer to the instruction buffer, which will later be freed automatically
@@ -179,8 +371,71 @@ WIMP_API int32_t wimp_instr_queue_add(WimpInstrQueue* queue, void* instr, size_t
 ///
 WIMP_API int32_t wimp_instr_queue_add_existing(WimpInstrQueue* queue, WimpInstrNode node);
 
+///
+/// @brief Pushes an instruction to the inbox of the queue without locking
+///
+/// Any number of threads can push at once, while the queue is locked by the
+/// one popping. Instructions pushed by a thread are popped in the order it
+/// pushed them. A queue should either be pushed to or added to, as added
+/// nodes go ahead of any still in the inbox.
+///
+/// The limits of the queue are checked when pushing (see
+/// wimp_instr_queue_set_limits()), and an instruction dropped by them is freed.
+/// 
+/// @param queue The pointer to the queue to push to, from wimp_create_instr_queue()
+/// @param instr A heap pointer to the instruction buffer, which will later be freed automatically
+/// @param bytes The size of the instruction buffer in bytes
+/// 
+/// @return Returns WIMP_INSTRUCTION_SUCCESS, WIMP_INSTRUCTION_DROPPED or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_queue_push(WimpInstrQueue* queue, void* instr, size_t bytes);
+
+///
+/// @brief Pushes an existing instruction node to the inbox of the queue without locking
+///
+/// Implicitly passes ownership to the specified queue, see wimp_instr_queue_push()
+/// 
+/// @param queue The pointer to the queue to push to, from wimp_create_instr_queue()
+/// @param node The node to give to the queue
+/// 
+/// @return Returns WIMP_INSTRUCTION_SUCCESS, WIMP_INSTRUCTION_DROPPED or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_queue_push_existing(WimpInstrQueue* queue, WimpInstrNode node);
+
+///
+/// @brief Pushes an existing instruction node to the inbox of the queue, never blocking
+///
+/// Is the same as wimp_instr_queue_push_existing(), apart from a queue at its
+/// limits that blocks (WIMP_INSTR_OVERFLOW_BLOCK). The node then either goes
+/// over the limits, for a thread that holds its senders back some other way
+/// (e.g. a reciever with credits), or is left with the caller to push later.
+///
+/// @param queue The pointer to the queue to push to, from wimp_create_instr_queue()
+/// @param node The node to give to the queue
+/// @param over_limits True to let the node go over the limits rather than leave it with the caller
+///
+/// @return Returns WIMP_INSTRUCTION_SUCCESS, WIMP_INSTRUCTION_DROPPED, WIMP_INSTRUCTION_FULL
+/// (the caller keeps the node) or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_queue_push_unblocked(WimpInstrQueue* queue, WimpInstrNode node, bool over_limits);
+
+///
+/// @brief Checks if the queue is throttled, without locking
+///
+/// Throttles the queue if it has reached its high watermark, so should be
+/// checked before adding more.
+///
+/// @param queue The queue to check
+///
+/// @return Returns true if whoever is adding to the queue should hold back
+///
+WIMP_API bool wimp_instr_queue_is_throttled(WimpInstrQueue* queue);
+
 ///
 /// @brief Prepends an existing queue to the front of a queue
+///
+/// The nodes are linked across without walking them, so this takes the same
+/// time however long either queue is. add is left empty.
 /// 
 /// @param queue The queue being added to
 /// @param add The queue to add
@@ -192,6 +447,9 @@ WIMP_API int32_t wimp_instr_queue_prepend_queue(WimpInstrQueue* queue, WimpInstr
 ///
 /// @brief Appends an existing queue to the back of a queue
 ///
+/// The nodes are linked across without walking them, so this takes the same
+/// time however long either queue is. add is left empty.
+///
 /// @param queue The queue being added to
 /// @param add The queue to add
 ///
@@ -199,12 +457,164 @@ WIMP_API int32_t wimp_instr_queue_prepend_queue(WimpInstrQueue* queue, WimpInstr
 ///
 WIMP_API int32_t wimp_instr_queue_append_queue(WimpInstrQueue* queue, WimpInstrQueue* add);
 
+///
+/// @brief Takes every instruction from a queue at once, to the back of another
+///
+/// Only the consumer of queue needs to hold its lock for this, which takes
+/// the same time however many instructions there are. The instructions can
+/// then be handled from out without holding the lock, so nothing waiting on
+/// it is held up by the handlers. Counts as draining queue, so lets whoever
+/// was throttled by it know.
+///
+/// @param queue The queue to take the instructions from
+/// @param out The queue to add them to, usually a local one made with wimp_create_instr_queue() or zeroed
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_queue_take_all(WimpInstrQueue* queue, WimpInstrQueue* out);
+
+///
+/// @brief Keeps the front node of a queue at the front, whatever lane nodes added after are in
+///
+/// For a node that has been partly sent, which nothing can go in front of.
+/// The node stays pinned until it is popped.
+///
+/// @param queue The queue to pin the front of
+///
+WIMP_API void wimp_instr_queue_pin_front(WimpInstrQueue* queue);
+
+///
+/// @brief Sets the watermarks the queue is throttled between
+///
+/// Must be set before any reciever for the queue is started, as they offer
+/// senders a credit window of the gap between the watermarks.
+///
+/// @param queue The queue to set the watermarks of
+/// @param high The length the queue is throttled at, zero to never throttle
+/// @param low The length a throttled queue has to drain to, must be below high
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_queue_set_watermarks(WimpInstrQueue* queue, int32_t high, int32_t low);
+
+///
+/// @brief Sets the callback for when the queue stops being throttled
+///
+/// The callback is made from wimp_instr_queue_pop(), with the queue locked by
+/// whoever is popping, so must be quick and not touch the queue.
+///
+/// @param queue The queue to watch
+/// @param drained The callback, NULL to remove it
+/// @param context Passed to the callback
+///
+WIMP_API void wimp_instr_queue_set_drained(WimpInstrQueue* queue, WIMP_INSTR_QUEUE_DRAINED drained, void* context);
+
+///
+/// @brief Sets the callback for when the queue reaches its high watermark, and drains to its low one after
+///
+/// Is separate to the drained callback the recievers use for flow control,
+/// so can be used however the queue is fed. Reaching the high watermark is
+/// called from whichever thread added to the queue, and draining from the
+/// one popping, so the callback must be quick and not touch the queue.
+///
+/// @param queue The queue to watch
+/// @param watermark The callback, NULL to remove it
+/// @param context Passed to the callback
+///
+WIMP_API void wimp_instr_queue_set_watermark_callback(WimpInstrQueue* queue, WIMP_INSTR_QUEUE_WATERMARK watermark, void* context);
+
+///
+/// @brief Sets the callback for when a queue that couldn't take more can again
+///
+/// Is for whoever adds to the queue for other threads, such as a local
+/// endpoint, which asks for it with wimp_instr_queue_wait_room(). Must be set
+/// by the consumer. The callback is made from popping, with the queue locked
+/// by whoever is popping, so must be quick and not touch the queue.
+///
+/// @param queue The queue to watch
+/// @param room The callback, NULL to remove it
+/// @param context Passed to the callback
+///
+WIMP_API void wimp_instr_queue_set_room_callback(WimpInstrQueue* queue, WIMP_INSTR_QUEUE_DRAINED room, void* context);
+
+///
+/// @brief Asks for the room callback once the queue can take more, without locking
+///
+/// The callback is made once for each time it's asked for. A throttled queue
+/// can take more once it has drained to its low watermark.
+///
+/// @param queue The queue to wait on
+///
+/// @return Returns true if the callback will be made, false if the queue can already take more
+///
+WIMP_API bool wimp_instr_queue_wait_room(WimpInstrQueue* queue);
+
+///
+/// @brief Sets the limits of a queue, and what happens to instructions pushed past them
+///
+/// The limits are checked by wimp_instr_queue_push(), which is how recievers
+/// and other threads feed a queue. Room is reserved atomically, so producers
+/// pushing at the same moment never take the queue past its limits. Nodes
+/// added by the consumer itself are never dropped, and neither is exit.
+///
+/// To drop instructions already in the queue, the producer locks it with
+/// wimp_instr_queue_low_prio_lock(), so the consumer must pop with the queue
+/// locked and must not push to it while holding the lock. Blocking waits on a
+/// condition the consumer signals as it takes instructions, so the thread
+/// popping must never push to a queue that blocks, or it waits out the
+/// timeout (or forever without one).
+///
+/// Recievers, local senders and a server sending to itself never block. They
+/// push with wimp_instr_queue_push_unblocked(): recievers go over the limits
+/// and rely on the credit window to hold the sender back, and local senders
+/// keep the instruction pending until the queue has room. Flow controlled
+/// senders don't go past the high watermark by more than the window they are
+/// given, so limits above that only apply to the rest.
+///
+/// @param queue The queue to limit
+/// @param max_length Most instructions the queue holds, zero for no limit
+/// @param max_bytes Most bytes of instructions the queue holds, zero for no limit
+/// @param overflow The WIMP_INSTR_OVERFLOW_ policy
+/// @param block_timeout Longest a push blocks for in ms with WIMP_INSTR_OVERFLOW_BLOCK, zero to wait until there is room
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_queue_set_limits(WimpInstrQueue* queue, int32_t max_length, int32_t max_bytes, int32_t overflow, int32_t block_timeout);
+
+///
+/// @brief Gets the amount of instructions in the queue, without locking
+///
+/// @param queue The queue to check
+///
+/// @return Returns the amount of instructions, including those not yet popped from the inbox
+///
+WIMP_API int32_t wimp_instr_queue_get_length(WimpInstrQueue* queue);
+
+///
+/// @brief Gets the size of the instructions in the queue, without locking
+///
+/// @param queue The queue to check
+///
+/// @return Returns the size in bytes, including those not yet popped from the inbox
+///
+WIMP_API int32_t wimp_instr_queue_get_bytes(WimpInstrQueue* queue);
+
+///
+/// @brief Gets the amount of instructions the queue has dropped, without locking
+///
+/// @param queue The queue to check
+///
+/// @return Returns the amount of instructions dropped as the queue was at its limits
+///
+WIMP_API int32_t wimp_instr_queue_get_dropped(WimpInstrQueue* queue);
+
 ///
 /// @brief Pops the top node off the queue
 /// 
 /// When a node is returned, the user is responsible for its memory and it cannot
 /// be accessed from the queue anymore. Use wimp_instr_node_free when done as
-/// ownership is implicitly passed to the user
+/// ownership is implicitly passed to the user. Once the list is empty,
+/// everything pushed to the inbox so far is moved onto it.
 /// 
 /// @param queue The queue to pop the top instruction off
 /// 
@@ -212,6 +622,27 @@ WIMP_API int32_t wimp_instr_queue_append_queue(WimpInstrQueue* queue, WimpInstrQ
 ///
 WIMP_API WimpInstrNode wimp_instr_queue_pop(WimpInstrQueue* queue);
 
+///
+/// @brief Gets the node after a node still in a queue
+///
+/// Allows looking through a queue without popping. The queue must be locked
+/// if it's shared.
+///
+/// @param node The node to get the next of
+///
+/// @return Returns the next node, NULL if it's the last
+///
+WIMP_API WimpInstrNode wimp_instr_node_next(WimpInstrNode node);
+
+///
+/// @brief Gets the raw data of a node
+///
+/// @param node The node to get the data of
+///
+/// @return Returns the instruction data and its size
+///
+WIMP_API WimpInstr wimp_instr_node_data(WimpInstrNode node);
+
 ///
 /// @brief Frees the memory used for the queue node
 /// 
@@ -226,10 +657,59 @@ WIMP_API void wimp_instr_node_free(WimpInstrNode node);
 ///
 WIMP_API void wimp_instr_queue_free(WimpInstrQueue queue);
 
+///
+/// @brief Swaps the byte order of the fixed header of an instruction
+///
+/// Is only needed on big-endian hosts, use WIMP_INSTR_HEADER_TO_WIRE() and
+/// WIMP_INSTR_HEADER_FROM_WIRE() which are empty elsewhere.
+///
+/// @param buffer The instruction buffer
+///
+WIMP_API void wimp_instr_header_swap(uint8_t* buffer);
+
+///
+/// @brief Creates an instruction
+///
+/// Each name is sent by its ID, unless the ID is WIMP_INSTR_ID_NONE.
+///
+/// @param dest The name of the destination process
+/// @param dest_id The ID of the destination process
+/// @param source The name of the source process
+/// @param source_id The ID of the source process
+/// @param instr The name of the instruction
+/// @param instr_id The ID of the instruction
+/// @param args The arguments to copy in, can be NULL to leave the space for them to be written in place
+/// @param arg_bytes The size of the arguments
+/// @param bytes Pointer to store the size of the instruction in
+///
+/// @return Returns the instruction, which must be freed, or NULL if failed
+///
+WIMP_API uint8_t* wimp_instr_create(const char* dest, uint32_t dest_id, const char* source, uint32_t source_id, const char* instr, uint32_t instr_id, const void* args, size_t arg_bytes, size_t* bytes);
+
+///
+/// @brief Creates an instruction in a new node, in one allocation
+///
+/// Is the same as wimp_instr_create(), but the node is ready to be added to a queue.
+///
+/// @param dest The name of the destination process
+/// @param dest_id The ID of the destination process
+/// @param source The name of the source process
+/// @param source_id The ID of the source process
+/// @param instr The name of the instruction
+/// @param instr_id The ID of the instruction
+/// @param args The arguments to copy in, can be NULL to leave the space for them to be written in place
+/// @param arg_bytes The size of the arguments
+///
+/// @return Returns the node, or NULL if failed
+///
+WIMP_API WimpInstrNode wimp_instr_node_create(const char* dest, uint32_t dest_id, const char* source, uint32_t source_id, const char* instr, uint32_t instr_id, const void* args, size_t arg_bytes);
+
 ///
 /// @brief Gets an instruction metadata from a buffer
 ///
-/// Assumes buffer starts at start of an instruction
+/// Assumes buffer starts at start of an instruction with the fixed header.
+/// The fields are read from the offsets in the header, and names sent by ID
+/// from the registry.
 ///
 /// @param buffer The buffer to extract from
 /// @param buffsize The buffer size to extract in bytes
@@ -241,12 +721,166 @@ WIMP_API WimpInstrMeta wimp_instr_get_from_buffer(uint8_t* buffer, size_t buffsi
 ///
 /// @brief Extracts the wimp instruction metadata from a node.
 ///
+/// Is only decoded the first time, then kept in the node. If the instruction
+/// is changed in place after that, the metadata may be out of date.
+///
 /// @param node The node to extract from
 ///
 /// @return Returns the metadata of the instruction
 ///
 WIMP_API WimpInstrMeta wimp_instr_get_from_node(WimpInstrNode node);
 
+///
+/// @brief Initializes the registry of instruction IDs, registering the built in instructions
+///
+/// Is called by wimp_init, so doesn't need to be called directly.
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_registry_init(void);
+
+///
+/// @brief Shuts down the registry of instruction IDs
+///
+/// Is called by wimp_shutdown, so doesn't need to be called directly.
+///
+WIMP_API void wimp_instr_registry_shutdown(void);
+
+///
+/// @brief Registers an instruction name for an ID
+///
+/// Names should be registered before the servers sending them accept their
+/// connections, as only names registered by then are sent by ID. Registering
+/// a name again gives the same ID. Process names are registered the same way.
+///
+/// @param instr The instruction name
+///
+/// @return Returns the ID of the instruction, or WIMP_INSTR_ID_NONE if the registry is full or not initialized
+///
+WIMP_API uint32_t wimp_instr_register(const char* instr);
+
+///
+/// @brief Gets the ID of a registered instruction name
+///
+/// @param instr The instruction name
+///
+/// @return Returns the ID, or WIMP_INSTR_ID_NONE if the name isn't registered
+///
+WIMP_API uint32_t wimp_instr_get_id(const char* instr);
+
+///
+/// @brief Gets the name of a registered instruction ID
+///
+/// @param id The instruction ID
+///
+/// @return Returns the name, or NULL if the ID isn't registered
+///
+WIMP_API const char* wimp_instr_get_name(uint32_t id);
+
+///
+/// @brief Sets the priority lane an instruction is queued and sent in
+///
+/// Applies to instructions built from then on in this address space, and is
+/// sent in their header, so the process they go to queues them in the same
+/// lane. Instructions are WIMP_INSTR_PRIORITY_NORMAL unless set, apart from
+/// the built in log, ping and handshake_status, which are
+/// WIMP_INSTR_PRIORITY_CONTROL. Exit stays normal, as it ends the
+/// instructions sent before it, unless it should cut in front of them.
+///
+/// @param instr The instruction name, which is registered if it isn't already
+/// @param priority One of the WIMP_INSTR_PRIORITY_ lanes
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_set_priority(const char* instr, int32_t priority);
+
+///
+/// @brief Gets the priority lane of a registered instruction
+///
+/// @param id The instruction ID
+///
+/// @return Returns the WIMP_INSTR_PRIORITY_ lane, WIMP_INSTR_PRIORITY_NORMAL if the ID isn't registered
+///
+WIMP_API int32_t wimp_instr_get_priority(uint32_t id);
+
+///
+/// @brief Gets the amount of names registered, which is also the highest ID
+///
+/// @return Returns the amount of names registered
+///
+WIMP_API uint32_t wimp_instr_registry_count(void);
+
+///
+/// @brief Packs the first registered names, in ID order, to send in a handshake
+///
+/// @param count The amount of names to pack
+/// @param bytes Pointer to store the size of the pack in
+///
+/// @return Returns the pack of null terminated names, which must be freed, or NULL if failed
+///
+WIMP_API uint8_t* wimp_instr_registry_pack(uint32_t count, size_t* bytes);
+
+///
+/// @brief Registers the names from a pack made by another address space
+///
+/// @param names The pack of names
+/// @param bytes The size of the pack
+/// @param count Pointer to store the amount of names in
+///
+/// @return Returns the local ID of each name, indexed by the ID in the other address space less one. Must be freed. NULL if failed.
+///
+WIMP_API uint32_t* wimp_instr_registry_unpack(const uint8_t* names, size_t bytes, uint32_t* count);
+
+///
+/// @brief Maps the IDs of an instruction from another address space to the local ones
+///
+/// Names sent as strings are left as they are. Also checks the offsets of the
+/// header are within the instruction, as it has come from another process.
+///
+/// @param buffer The instruction buffer
+/// @param buffsize The size of the instruction buffer
+/// @param ids The local IDs, from wimp_instr_registry_unpack()
+/// @param count The amount of IDs
+///
+/// @return Returns false if an ID isn't one the other address space sent, or the instruction is malformed
+///
+WIMP_API bool wimp_instr_map_id(uint8_t* buffer, size_t buffsize, const uint32_t* ids, uint32_t count);
+
+///
+/// @brief Converts an instruction in the names version from another address space to the fixed header
+///
+/// @param buffer The instruction buffer
+/// @param buffsize The size of the instruction buffer
+/// @param ids The local IDs, from wimp_instr_registry_unpack()
+/// @param count The amount of IDs
+/// @param protocol_version The protocol version of the sender, which sent the sizes in host order before version 1
+/// @param bytes Pointer to store the size of the converted instruction in
+///
+/// @return Returns the converted instruction, which must be freed, or NULL if it is malformed
+///
+WIMP_API uint8_t* wimp_instr_upgrade(const uint8_t* buffer, size_t buffsize, const uint32_t* ids, uint32_t count, int32_t protocol_version, size_t* bytes);
+
+///
+/// @brief Converts an instruction to the names version, for a process that doesn't take the fixed header
+///
+/// @param node The node holding the instruction
+/// @param known_ids The highest ID the process knows, names past it are sent as strings
+/// @param protocol_version The protocol version of the process, which takes the sizes in host order before version 1
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_node_downgrade(WimpInstrNode node, uint32_t known_ids, int32_t protocol_version);
+
+///
+/// @brief Replaces the IDs of an instruction with their names, if the IDs are past those a process knows
+///
+/// @param node The node holding the instruction
+/// @param known_ids The highest ID the process knows
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_node_expand_id(WimpInstrNode node, uint32_t known_ids);
+
 ///
 /// @brief Compares two instructions to check if they're the same
 /// 
@@ -257,8 +891,30 @@ WIMP_API WimpInstrMeta wimp_instr_get_from_node(WimpInstrNode node);
 ///
 WIMP_API bool wimp_instr_check(const char* instr1, const char* instr2);
 
+///
+/// @brief Keeps count of the instructions in the queue by registered name
+///
+/// Makes wimp_instr_get_instruction_count() a lookup instead of a walk of the
+/// queue, at the cost of a count per registered ID for the queue and of
+/// moving the counts whenever whole queues are taken or put back. Queues
+/// aren't counted unless this is called, which must be before anything is
+/// added to the queue.
+///
+/// @param queue The queue to count
+///
+/// @return Returns WIMP_INSTRUCTION_FAIL if the queue isn't empty or the counts couldn't be allocated
+///
+WIMP_API int32_t wimp_instr_queue_count_by_name(WimpInstrQueue* queue);
+
 ///
 /// @brief Counts the amount of instructions with a given name in the queue
+///
+/// The queue must be locked. In a queue counted with
+/// wimp_instr_queue_count_by_name(), registered instructions are counted as
+/// they come and go, so this doesn't walk the queue unless it holds
+/// instructions whose names weren't registered. Otherwise the queue is walked.
+/// The length of the whole queue is always kept, see
+/// wimp_instr_queue_get_length().
 /// 
 /// @param queue The queue to count the instructions in
 /// 
@@ -295,4 +951,71 @@ WIMP_API char* wimp_instr_pack_get_string(WimpStrPack pack, int32_t index);
 ///
 WIMP_API void wimp_instr_pack_free(WimpStrPack* pack);
 
+///
+/// @brief Starts building a string pack into a new instruction
+///
+/// @param builder The builder to start
+/// @param dest The name of the destination process
+/// @param dest_id The ID of the destination process
+/// @param source The name of the source process
+/// @param source_id The ID of the source process
+/// @param instr The name of the instruction
+/// @param instr_id The ID of the instruction
+/// @param reserve_bytes The bytes of strings to make space for up front, can be zero
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_pack_begin(WimpStrPackBuilder* builder, const char* dest, uint32_t dest_id, const char* source, uint32_t source_id, const char* instr, uint32_t instr_id, size_t reserve_bytes);
+
+///
+/// @brief Adds a string to the end of a pack being built
+///
+/// If the instruction can't grow the builder is failed, and the instruction
+/// is freed.
+///
+/// @param builder The builder to add to
+/// @param string The string to add
+///
+/// @return Returns either WIMP_INSTRUCTION_SUCCESS or WIMP_INSTRUCTION_FAIL
+///
+WIMP_API int32_t wimp_instr_pack_add(WimpStrPackBuilder* builder, const char* string);
+
+///
+/// @brief Finishes building a string pack
+///
+/// The builder is reset, so the instruction is owned by the caller.
+///
+/// @param builder The builder to finish
+/// @param bytes Pointer to store the size of the instruction in
+///
+/// @return Returns the instruction, which must be freed, or NULL if building failed
+///
+WIMP_API uint8_t* wimp_instr_pack_finish(WimpStrPackBuilder* builder, size_t* bytes);
+
+///
+/// @brief Frees the instruction of a string pack that won't be finished
+///
+/// @param builder The builder to discard
+///
+WIMP_API void wimp_instr_pack_discard(WimpStrPackBuilder* builder);
+
+///
+/// @brief Gets the number of strings in a pack made with WimpStrPackBuilder
+///
+/// @param meta The metadata of the instruction
+///
+/// @return Returns the number of strings, or zero if the arguments aren't a pack
+///
+WIMP_API uint32_t wimp_instr_pack_count(WimpInstrMeta meta);
+
+///
+/// @brief Gets the next string in a pack made with WimpStrPackBuilder
+///
+/// @param meta The metadata of the instruction
+/// @param previous The string returned last, or NULL to get the first
+///
+/// @return Returns the string, or NULL if there are no more or the pack is malformed
+///
+WIMP_API const char* wimp_instr_pack_next(WimpInstrMeta meta, const char* previous);
+
 #endif
\ No newline at end of file
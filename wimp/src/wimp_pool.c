@@ -0,0 +1,250 @@
+#include <wimp_pool.h>
+#include <utility/thread_local.h>
+#include <plibsys.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Every block starts with its size class, which stays while it's handed out.
+* The links are only used while the block is in the pool, so overlap what the
+* user of the block sees. The smallest class has room for all of them.
+*/
+typedef struct _WimpPoolBlock
+{
+	uint64_t size_class;				//WIMP_POOL_CLASS_COUNT for blocks too big for a class
+	struct _WimpPoolBlock* next;		//Next block in the cache or batch
+	struct _WimpPoolBlock* next_batch;	//Next batch in the depot, only set on the first block of a batch
+	int32_t batch_blocks;				//Blocks in the batch, only set on the first block of a batch
+} WimpPoolBlock;
+
+#define WIMP_POOL_HEADER_BYTES sizeof(uint64_t)
+
+/*
+* Blocks cached by a thread, taken from without locking
+*/
+typedef struct _WimpPoolCache
+{
+	WimpPoolBlock* blocks[WIMP_POOL_CLASS_COUNT];
+	int32_t counts[WIMP_POOL_CLASS_COUNT];
+	WimpPoolStats stats;	//Not yet added to the shared counts
+} WimpPoolCache;
+
+static thread_local WimpPoolCache s_pool_cache;
+
+/*
+* The depot holds batches of blocks given up by threads. It's only locked for
+* as long as it takes to move a batch, so is a spin lock on an atomic, which
+* also means it needs no setting up and works at any point.
+*/
+static volatile pint s_pool_lock = 0;
+static WimpPoolBlock* s_pool_depot[WIMP_POOL_CLASS_COUNT];
+static WimpPoolStats s_pool_stats;
+
+static void wimp_pool_lock(void)
+{
+	while (!p_atomic_int_compare_and_exchange(&s_pool_lock, 0, 1))
+	{
+		p_uthread_yield();
+	}
+}
+
+static void wimp_pool_unlock(void)
+{
+	p_atomic_int_set(&s_pool_lock, 0);
+}
+
+/*
+* Adds the counts of this thread to the shared counts, must be called with the depot locked
+*/
+static void wimp_pool_flush_stats(WimpPoolCache* cache)
+{
+	s_pool_stats.allocs += cache->stats.allocs;
+	s_pool_stats.cache_hits += cache->stats.cache_hits;
+	s_pool_stats.depot_hits += cache->stats.depot_hits;
+	s_pool_stats.system_allocs += cache->stats.system_allocs;
+	s_pool_stats.frees += cache->stats.frees;
+	s_pool_stats.system_frees += cache->stats.system_frees;
+	memset(&cache->stats, 0, sizeof(WimpPoolStats));
+}
+
+/*
+* Gets the smallest class a block of the size fits in, WIMP_POOL_CLASS_COUNT if none
+*/
+static uint64_t wimp_pool_size_class(size_t block_bytes)
+{
+	uint64_t size_class = 0;
+	size_t class_bytes = WIMP_POOL_MIN_BYTES;
+	while (class_bytes < block_bytes && size_class < WIMP_POOL_CLASS_COUNT)
+	{
+		class_bytes <<= 1;
+		size_class++;
+	}
+	return size_class;
+}
+
+/*
+* Gives a batch to the depot
+*/
+static void wimp_pool_give_batch(WimpPoolCache* cache, uint64_t size_class, WimpPoolBlock* batch, int32_t batch_blocks)
+{
+	batch->batch_blocks = batch_blocks;
+	wimp_pool_lock();
+	batch->next_batch = s_pool_depot[size_class];
+	s_pool_depot[size_class] = batch;
+	wimp_pool_flush_stats(cache);
+	wimp_pool_unlock();
+}
+
+void* wimp_pool_alloc(size_t bytes)
+{
+	WimpPoolCache* cache = &s_pool_cache;
+	size_t block_bytes = WIMP_POOL_HEADER_BYTES + bytes;
+	uint64_t size_class = wimp_pool_size_class(block_bytes);
+	cache->stats.allocs++;
+
+	WimpPoolBlock* block = NULL;
+	if (size_class < WIMP_POOL_CLASS_COUNT)
+	{
+		block = cache->blocks[size_class];
+		if (block != NULL)
+		{
+			cache->stats.cache_hits++;
+		}
+		else
+		{
+			//Take a whole batch, so the depot isn't locked again for a while
+			wimp_pool_lock();
+			block = s_pool_depot[size_class];
+			if (block != NULL)
+			{
+				s_pool_depot[size_class] = block->next_batch;
+				cache->counts[size_class] = block->batch_blocks;
+			}
+			wimp_pool_flush_stats(cache);
+			wimp_pool_unlock();
+
+			if (block != NULL)
+			{
+				cache->stats.depot_hits++;
+			}
+		}
+	}
+
+	if (block == NULL)
+	{
+		//Blocks are only ever the size of their class, so can be reused for anything in it
+		size_t class_bytes = size_class < WIMP_POOL_CLASS_COUNT ? (size_t)WIMP_POOL_MIN_BYTES << size_class : block_bytes;
+		block = malloc(class_bytes);
+		if (block == NULL)
+		{
+			cache->stats.allocs--;
+			return NULL;
+		}
+		cache->stats.system_allocs++;
+		block->size_class = size_class;
+		return (uint8_t*)block + WIMP_POOL_HEADER_BYTES;
+	}
+
+	cache->blocks[size_class] = block->next;
+	cache->counts[size_class]--;
+	return (uint8_t*)block + WIMP_POOL_HEADER_BYTES;
+}
+
+void wimp_pool_free(void* block)
+{
+	if (block == NULL)
+	{
+		return;
+	}
+
+	WimpPoolCache* cache = &s_pool_cache;
+	WimpPoolBlock* pool_block = (WimpPoolBlock*)((uint8_t*)block - WIMP_POOL_HEADER_BYTES);
+	uint64_t size_class = pool_block->size_class;
+	cache->stats.frees++;
+	if (size_class >= WIMP_POOL_CLASS_COUNT)
+	{
+		cache->stats.system_frees++;
+		free(pool_block);
+		return;
+	}
+
+	pool_block->next = cache->blocks[size_class];
+	cache->blocks[size_class] = pool_block;
+	cache->counts[size_class]++;
+	if (cache->counts[size_class] <= WIMP_POOL_CACHE_BLOCKS)
+	{
+		return;
+	}
+
+	//The cache is full, so the most recently freed blocks go to the depot for other threads
+	WimpPoolBlock* batch = pool_block;
+	WimpPoolBlock* last = batch;
+	for (int32_t i = 1; i < WIMP_POOL_BATCH_BLOCKS; ++i)
+	{
+		last = last->next;
+	}
+	cache->blocks[size_class] = last->next;
+	cache->counts[size_class] -= WIMP_POOL_BATCH_BLOCKS;
+	last->next = NULL;
+	wimp_pool_give_batch(cache, size_class, batch, WIMP_POOL_BATCH_BLOCKS);
+}
+
+void wimp_pool_thread_release(void)
+{
+	WimpPoolCache* cache = &s_pool_cache;
+	for (uint64_t size_class = 0; size_class < WIMP_POOL_CLASS_COUNT; ++size_class)
+	{
+		if (cache->blocks[size_class] != NULL)
+		{
+			wimp_pool_give_batch(cache, size_class, cache->blocks[size_class], cache->counts[size_class]);
+			cache->blocks[size_class] = NULL;
+			cache->counts[size_class] = 0;
+		}
+	}
+
+	wimp_pool_lock();
+	wimp_pool_flush_stats(cache);
+	wimp_pool_unlock();
+}
+
+WimpPoolStats wimp_pool_get_stats(void)
+{
+	WimpPoolCache* cache = &s_pool_cache;
+	wimp_pool_lock();
+	WimpPoolStats stats = s_pool_stats;
+	wimp_pool_unlock();
+
+	stats.allocs += cache->stats.allocs;
+	stats.cache_hits += cache->stats.cache_hits;
+	stats.depot_hits += cache->stats.depot_hits;
+	stats.system_allocs += cache->stats.system_allocs;
+	stats.frees += cache->stats.frees;
+	stats.system_frees += cache->stats.system_frees;
+	return stats;
+}
+
+void wimp_pool_shutdown(void)
+{
+	wimp_pool_thread_release();
+
+	wimp_pool_lock();
+	for (uint64_t size_class = 0; size_class < WIMP_POOL_CLASS_COUNT; ++size_class)
+	{
+		WimpPoolBlock* batch = s_pool_depot[size_class];
+		while (batch != NULL)
+		{
+			WimpPoolBlock* next_batch = batch->next_batch;
+			WimpPoolBlock* block = batch;
+			while (block != NULL)
+			{
+				WimpPoolBlock* next = block->next;
+				free(block);
+				s_pool_stats.system_frees++;
+				block = next;
+			}
+			batch = next_batch;
+		}
+		s_pool_depot[size_class] = NULL;
+	}
+	wimp_pool_unlock();
+}
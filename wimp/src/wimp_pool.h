@@ -0,0 +1,92 @@
+///
+/// @file
+///
+/// This header defines the interfaces to the wimp_pool
+///
+/// The pool hands out the memory for instruction nodes, which hold their
+/// instruction in the same allocation (see wimp_instr_node_new()), so it is
+/// asked for many small blocks of varying size by the recievers and handed
+/// them back by the process. Blocks are rounded up to a power of two size
+/// class, and freed blocks are kept in a cache local to the freeing thread to
+/// be handed out again without locking.
+///
+/// The threads allocating are usually not the ones freeing, so once a cache
+/// holds WIMP_POOL_CACHE_BLOCKS of a class it moves WIMP_POOL_BATCH_BLOCKS of
+/// them to the depot shared by all threads, and a thread with an empty cache
+/// takes a batch from there. The depot is only locked once for each batch, and
+/// once the pool is warmed up messaging doesn't touch the system allocator.
+///
+/// Each block is its own system allocation, so a block can always be freed
+/// with the system allocator, and blocks bigger than the largest class are.
+/// Memory held by the pool is only given back by wimp_pool_thread_release()
+/// and wimp_pool_shutdown().
+///
+
+#ifndef WIMP_POOL_H
+#define WIMP_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <wimp_core.h>
+
+#define WIMP_POOL_MIN_BYTES 64			//Size of the smallest class, including the block header
+#define WIMP_POOL_CLASS_COUNT 11		//Classes double from WIMP_POOL_MIN_BYTES, so go up to 64KB
+#define WIMP_POOL_CACHE_BLOCKS 64		//Most blocks of a class a thread keeps before giving a batch to the depot
+#define WIMP_POOL_BATCH_BLOCKS 32		//Blocks moved between a thread and the depot at once
+
+///
+/// @brief Counts of how the pool served allocations
+///
+/// Threads add their counts to the shared ones when they exchange a batch with
+/// the depot or are released, so the counts of other threads may be behind.
+///
+typedef struct _WimpPoolStats
+{
+	uint64_t allocs;			///< Blocks allocated
+	uint64_t cache_hits;		///< Blocks from the cache of the thread, without locking
+	uint64_t depot_hits;		///< Blocks that took a batch from the depot to the cache of the thread
+	uint64_t system_allocs;		///< Blocks the system allocator had to be asked for
+	uint64_t frees;				///< Blocks freed
+	uint64_t system_frees;		///< Blocks given back to the system allocator
+} WimpPoolStats;
+
+///
+/// @brief Allocates a block from the pool
+///
+/// @param bytes The size of the block in bytes
+///
+/// @return Returns the block, which is 8 byte aligned, or NULL if it couldn't be allocated
+///
+WIMP_API void* wimp_pool_alloc(size_t bytes);
+
+///
+/// @brief Gives a block back to the pool, from any thread
+///
+/// @param block The block from wimp_pool_alloc(), can be NULL
+///
+WIMP_API void wimp_pool_free(void* block);
+
+///
+/// @brief Moves the blocks cached by this thread to the depot
+///
+/// Should be called by threads that free blocks before they end, otherwise
+/// the blocks they cached are lost.
+///
+WIMP_API void wimp_pool_thread_release(void);
+
+///
+/// @brief Gets the counts of how the pool served allocations
+///
+/// @return Returns the shared counts, plus the ones of this thread
+///
+WIMP_API WimpPoolStats wimp_pool_get_stats(void);
+
+///
+/// @brief Frees the blocks in the depot
+///
+/// The pool keeps working after, and can still be given back blocks. Is called by wimp_shutdown().
+///
+WIMP_API void wimp_pool_shutdown(void);
+
+#endif
@@ -4,6 +4,7 @@
 
 #include <wimp_process.h>
 #include <wimp_log.h>
+#include <wimp_pool.h>
 #include <time.h>
 #include <stdlib.h>
 #include <utility/sds.h>
@@ -11,6 +12,15 @@
 
 static pint s_init_ref_counter = 0;
 
+/*
+* What a library process thread is started with, freed by the thread once it has started
+*/
+typedef struct _WimpLibraryProcess
+{
+	MAIN_FUNC_PTR main_func;
+	WimpMainEntry entry;
+}* WimpLibraryProcess;
+
 #ifdef _WIN32
 
 #include <windows.h>
@@ -217,13 +227,42 @@ int32_t wimp_get_running_executable_directory(char* path)
 
 #endif
 
+/*
+* Runs the main function of a library process, then drops the init reference it was started with.
+* The registry and loop the thread uses can't be shut down by other processes until it returns.
+*/
+static ppointer wimp_library_process_entry(ppointer data)
+{
+	WimpLibraryProcess process = data;
+	MAIN_FUNC_PTR main_func = process->main_func;
+	WimpMainEntry entry = process->entry;
+	free(process);
+
+	((PUThreadFunc)main_func)(entry);
+	wimp_shutdown();
+	return NULL;
+}
+
 int32_t wimp_start_library_process(const char* process_name, MAIN_FUNC_PTR main_func, enum PUThreadPriority_ priority, WimpMainEntry entry)
 {
 	wimp_log_important("Starting %s!\n", process_name);
-	PUThread* process_thread = p_uthread_create_full((PUThreadFunc)main_func, entry, false, priority, 0, process_name);
+	WimpLibraryProcess process = malloc(sizeof(struct _WimpLibraryProcess));
+	if (process == NULL)
+	{
+		wimp_log_fail("Failed to create thread: %s", process_name);
+		return WIMP_PROCESS_FAIL;
+	}
+	process->main_func = main_func;
+	process->entry = entry;
+
+	//The thread holds an init reference until its main function returns
+	wimp_init();
+	PUThread* process_thread = p_uthread_create_full(&wimp_library_process_entry, process, false, priority, 0, process_name);
 	if (process_thread == NULL)
 	{
 		wimp_log_fail("Failed to create thread: %s", process_name);
+		free(process);
+		wimp_shutdown();
 		return WIMP_PROCESS_FAIL;
 	}
 	return WIMP_PROCESS_SUCCESS;
@@ -235,6 +274,9 @@ int32_t wimp_init(void)
 	{
 		wimp_log_important("WIMP Init\n");
 		p_libsys_init();
+		wimp_instr_registry_init();
+		wimp_transport_init();
+		wimp_reciever_loop_init();
 	}
 	p_atomic_int_inc(&s_init_ref_counter);
 	return WIMP_PROCESS_SUCCESS;
@@ -242,10 +284,14 @@ int32_t wimp_init(void)
 
 void wimp_shutdown(void)
 {
-	p_atomic_int_dec_and_test(&s_init_ref_counter);
-	if (p_atomic_int_get(&s_init_ref_counter) == 0)
+	//Only the call that drops the last reference shuts down
+	if (p_atomic_int_dec_and_test(&s_init_ref_counter))
 	{
 		wimp_log_important("WIMP Shutdown\n");
+		wimp_reciever_loop_shutdown();
+		wimp_transport_shutdown();
+		wimp_instr_registry_shutdown();
+		wimp_pool_shutdown();
 		p_libsys_shutdown();
 	}
 	assert(p_atomic_int_get(&s_init_ref_counter) >= 0 && "More processes called shutdown than init!\n");
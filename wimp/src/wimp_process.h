@@ -63,6 +63,9 @@ WIMP_API void wimp_shutdown(void);
 ///
 /// A library process is one called from a statically or dynamically linked library
 /// 
+/// The thread holds a wimp_init reference until main_func returns, so wimp_shutdown
+/// called by other processes doesn't free the registries while it is still running
+/// 
 /// @param process_name The name of the process to create
 /// @param main_func The pointer to the main function, which should be set up for being a library process not an executable one
 /// @param priority The puthread thread priority
@@ -5,6 +5,16 @@ void wimp_process_data_free(void* data)
 {
 	WimpProcessData proc_data = (WimpProcessData)data;
 	sdsfree(proc_data->process_domain);
+	wimp_local_endpoint_release(proc_data->process_endpoint);
+	wimp_shm_ring_free(proc_data->process_ring);
+
+	//Anything never sent is dropped with the process
+	WimpInstrNode node = wimp_instr_queue_pop(&proc_data->process_pending);
+	while (node != NULL)
+	{
+		wimp_instr_node_free(node);
+		node = wimp_instr_queue_pop(&proc_data->process_pending);
+	}
 	free(proc_data);
 	return;
 }
@@ -14,6 +24,7 @@ WimpProcessTable wimp_create_process_table()
 	WimpProcessTable t;
 	t._hash_table = HashString_create(WIMP_PROCESS_TABLE_MAX_LENGTH);
 	t._table_length = 0;
+	t._processes = calloc(WIMP_INSTR_REGISTRY_CAPACITY + 1, sizeof(WimpProcessData));
 	return t;
 }
 
@@ -40,8 +51,19 @@ int32_t wimp_process_table_add(WimpProcessTable* table, const char* process_name
 	process_data->process_domain = sdsnew(process_domain);
 	process_data->process_port = process_port;
 	process_data->process_connection = connection;
+	process_data->process_endpoint = NULL;
+	process_data->process_ring = NULL;
+	process_data->process_transport = WIMP_TRANSPORT_SOCKET;
 	process_data->process_active = WIMP_PROCESS_INACTIVE;
 	process_data->process_relation = relation;
+	memset(&process_data->process_pending, 0, sizeof(WimpInstrQueue));
+	process_data->process_pending_sent = 0;
+	process_data->process_credits = -1;
+	process_data->process_grant_bytes = 0;
+	process_data->process_instr_ids = 0;
+	process_data->process_instr_version = WIMP_INSTR_VERSION;
+	process_data->process_protocol_version = WIMP_PROTOCOL_VERSION;
+	process_data->process_id = wimp_instr_register(process_name);
 
 	if (HashString_add(table->_hash_table, process_name, process_data) != 0)
 	{
@@ -49,6 +71,12 @@ int32_t wimp_process_table_add(WimpProcessTable* table, const char* process_name
 	}
 	table->_table_length++;
 
+	//Without an ID the process can still be found by name
+	if (table->_processes != NULL && process_data->process_id != WIMP_INSTR_ID_NONE)
+	{
+		table->_processes[process_data->process_id] = process_data;
+	}
+
 	return WIMP_PROCESS_TABLE_SUCCESS;
 }
 
@@ -65,7 +93,12 @@ int32_t wimp_process_table_remove(WimpProcessTable* table, const char* process_n
 		return WIMP_PROCESS_TABLE_FAIL;
 	}
 
-	wimp_process_data_free(entry->value);
+	WimpProcessData process_data = (WimpProcessData)entry->value;
+	if (table->_processes != NULL && process_data->process_id != WIMP_INSTR_ID_NONE)
+	{
+		table->_processes[process_data->process_id] = NULL;
+	}
+	wimp_process_data_free(process_data);
 	
 	if (HashString_remove(table->_hash_table, process_name) != 0)
 	{
@@ -94,6 +127,18 @@ int32_t wimp_process_table_get(WimpProcessData* data, WimpProcessTable table, co
 	return WIMP_PROCESS_TABLE_SUCCESS;
 }
 
+int32_t wimp_process_table_get_by_id(WimpProcessData* data, WimpProcessTable table, uint32_t process_id)
+{
+	if (table._processes == NULL || process_id == WIMP_INSTR_ID_NONE || process_id > WIMP_INSTR_REGISTRY_CAPACITY
+		|| table._processes[process_id] == NULL)
+	{
+		return WIMP_PROCESS_TABLE_FAIL;
+	}
+
+	*data = table._processes[process_id];
+	return WIMP_PROCESS_TABLE_SUCCESS;
+}
+
 size_t wimp_process_table_length(WimpProcessTable table)
 {
 	return table._table_length;
@@ -117,4 +162,5 @@ void wimp_process_table_free(WimpProcessTable table)
 	}
 
 	HashString_destroy(table._hash_table);
+	free(table._processes);
 }
\ No newline at end of file
@@ -13,8 +13,10 @@
 #include <utility/sds.h>
 #include <wimp_core.h>
 #include <wimp_process.h>
+#include <wimp_transport.h>
+#include <wimp_shm_ring.h>
 
-#define WIMP_PROCESS_TABLE_MAX_LENGTH 128 //If need to track more processes, rethink
+#define WIMP_PROCESS_TABLE_MAX_LENGTH 1024 //If need to track more processes, rethink
 #define WIMP_PROCESS_ACTIVE 1
 #define WIMP_PROCESS_INACTIVE 0
 
@@ -45,18 +47,34 @@ typedef struct _WimpProcessData
 {
 	sds process_domain;			///< String representation of the process domain
 	PSocket* process_connection;///< Connection socket to the process
+	WimpLocalEndpoint process_endpoint; ///< Endpoint of the process if it uses the local transport
+	WimpShmRing process_ring;	///< Ring to the process if it uses the shared memory transport
 	int32_t process_port;		///< Port the process runs on
 	int16_t process_active;		///< Whether the process is active or not
 	int16_t process_relation;	///< Relationship of the process to this process
+	int32_t process_transport;	///< Transport used to send instructions to the process
+	WimpInstrQueue process_pending;	///< Instructions waiting until the process can take them, is only touched by the server
+	size_t process_pending_sent;	///< Bytes of the first pending instruction already sent
+	int32_t process_credits;		///< Instructions the process can still be sent, -1 if it isn't flow controlled
+	uint8_t process_grant[sizeof(int32_t)];	///< Start of a credit grant split between recieves
+	size_t process_grant_bytes;		///< Bytes of the split credit grant recieved
+	uint32_t process_instr_ids;		///< Names up to this ID are sent to the process by ID, the rest as strings
+	uint32_t process_id;			///< ID the process name is registered for, WIMP_INSTR_ID_NONE if it couldn't be
+	int32_t process_instr_version;	///< Version of the instructions sent to the process
+	int32_t process_protocol_version;	///< Protocol version agreed with the process, zero if it is from before versions
 } *WimpProcessData;
 
 ///
 /// Defines the process table
 ///
+/// Processes are found by name through the hash table, or by the ID of their
+/// name (see wimp_instr_register()) by indexing the array.
+///
 typedef struct _WimpProcessTable
 {
 	HashString* _hash_table;
 	size_t _table_length;
+	WimpProcessData* _processes; //Indexed by process ID, up to WIMP_INSTR_REGISTRY_CAPACITY
 } WimpProcessTable;
 
 ///
@@ -69,6 +87,8 @@ WIMP_API WimpProcessTable wimp_create_process_table(void);
 ///
 /// @brief Adds a new process to the table.
 /// 
+/// Registers the process name for an ID, so instructions to it can be sent by ID.
+/// 
 /// @param table The pointer to the process table to add to
 /// @param process_name The name of the process to add
 /// @param process_domain The domain that the process runs on
@@ -101,6 +121,17 @@ WIMP_API int32_t wimp_process_table_remove(WimpProcessTable* table, const char*
 ///
 WIMP_API int32_t wimp_process_table_get(WimpProcessData* data, WimpProcessTable table, const char* process_name);
 
+///
+/// @brief Gets the data for a process in the table by the ID of its name
+/// 
+/// @param data The pointer to the location to store the returned data in.
+/// @param table The process table to get from
+/// @param process_id The ID of the process to get
+/// 
+/// @return Returns either WIMP_PROCESS_TABLE_SUCCESS or WIMP_PROCESS_TABLE_FAIL
+///
+WIMP_API int32_t wimp_process_table_get_by_id(WimpProcessData* data, WimpProcessTable table, uint32_t process_id);
+
 ///
 /// @brief Removes the data for a process from the table
 /// 
@@ -1,7 +1,35 @@
 #include <wimp_reciever.h>
+#include <wimp_socket.h>
+#include <wimp_uring.h>
 #include <wimp_log.h>
+#include <wimp_pool.h>
 #include <stdlib.h>
 
+//On linux every connection writing to a queue is recieved from by one event
+//loop (io_uring or epoll), elsewhere each connection keeps a blocking thread
+#ifdef __linux__
+#define WIMP_RECIEVER_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+//Size of the buffer connections are recieved into, can be set at build time.
+//Instruction bodies with at least this much left skip it and are recieved
+//straight into their allocation
+#ifndef WIMP_RECIEVER_BUFFER_BYTES
+#define WIMP_RECIEVER_BUFFER_BYTES 65536
+#endif
+
+#if WIMP_RECIEVER_BUFFER_BYTES < WIMP_MESSAGE_BUFFER_BYTES
+#error "WIMP_RECIEVER_BUFFER_BYTES must be at least WIMP_MESSAGE_BUFFER_BYTES"
+#endif
+
+#define WIMP_REC_MAX_EVENTS 64
+#define WIMP_REC_MAX_READS 16
+
 /*
 * Represents the state the reciever is in
 */
@@ -14,16 +42,30 @@ enum RecieverState
 };
 
 /*
-* Reciever loop
+* Reciever thread entry, performs the handshake then hands the connection over
 * 
 * @param args The arguments to pass to the reciever
 */
 void wimp_reciever_recieve(RecieverArgs args);
 
 /*
-* Allocates the instruction for the incoming queue
+* Allocates the node for the incoming queue, with room for the instruction in the same allocation
 */
-WimpInstr wimp_reciever_allocateinstr(pssize size);
+WimpInstrNode wimp_reciever_allocateinstr(pssize size);
+
+/*
+* What the server agreed to in the handshake
+*/
+typedef struct _WimpRecieverAgreed
+{
+	int32_t transport;			//The transport picked by the server
+	WimpShmRing ring;			//The shared memory ring, if that transport is picked
+	int32_t window;				//The credit window accepted by the server, zero if none
+	uint32_t* instr_ids;		//Local IDs of the instructions the server sends by ID
+	uint32_t instr_id_count;
+	int32_t instr_version;		//The version of the instructions the server sends
+	int32_t protocol_version;	//The protocol version picked by the server, zero for one from before versions
+} WimpRecieverAgreed;
 
 /*
 * Initializes the sockets for the reciever and checks the handshake
@@ -31,10 +73,11 @@ WimpInstr wimp_reciever_allocateinstr(pssize size);
 * @param recsock Pointer to the reciever socket
 * @param rec_address Pointer to the reciever address
 * @param args Reciever args
+* @param agreed Pointer to store what the server agreed to in
 * 
 * @return Returns either WIMP_RECIEVER_SUCCESS or WIMP_RECIEVER_FAIL
 */
-int32_t wimp_reciever_init(PSocket** recsock, PSocketAddress** rec_address, RecieverArgs args);
+int32_t wimp_reciever_init(PSocket** recsock, PSocketAddress** rec_address, RecieverArgs args, WimpRecieverAgreed* agreed);
 
 /*
 * Sets the reciever process priority
@@ -63,11 +106,90 @@ WimpHandshakeHeader wimp_create_handshake(const char* process_name, uint8_t* mes
 		header.handshake_header = WIMP_RECIEVER_HANDSHAKE;
 		header.process_name_bytes = process_name_bytes;
 
-		memcpy(message_buffer, &header, sizeof(WimpHandshakeHeader));
+		WimpHandshakeHeader wire = { (int32_t)WIMP_LE32(header.handshake_header), (int32_t)WIMP_LE32(header.process_name_bytes) };
+		memcpy(message_buffer, &wire, sizeof(WimpHandshakeHeader));
 	}
 	return header;
 }
 
+bool wimp_handshake_read_header(const uint8_t* buffer, WimpHandshakeHeader* header)
+{
+	WimpHandshakeHeader wire;
+	memcpy(&wire, buffer, sizeof(WimpHandshakeHeader));
+	header->handshake_header = (int32_t)WIMP_LE32(wire.handshake_header);
+	header->process_name_bytes = (int32_t)WIMP_LE32(wire.process_name_bytes);
+
+	//Before protocol version 1 the header was sent in host order, which only
+	//differs on big-endian hosts
+	if (header->handshake_header != WIMP_RECIEVER_HANDSHAKE && wire.handshake_header == WIMP_RECIEVER_HANDSHAKE)
+	{
+		*header = wire;
+	}
+	return header->handshake_header == WIMP_RECIEVER_HANDSHAKE;
+}
+
+/*
+* Swaps an extension between little-endian and host order, which is empty on little-endian hosts
+*/
+static void wimp_handshake_extension_to_wire(WimpHandshakeExtension* extension)
+{
+#if WIMP_BIG_ENDIAN
+	extension->extension_header = (int32_t)WIMP_LE32(extension->extension_header);
+	extension->extension_bytes = (int32_t)WIMP_LE32(extension->extension_bytes);
+	extension->protocol_version = (int32_t)WIMP_LE32(extension->protocol_version);
+	extension->transport = (int32_t)WIMP_LE32(extension->transport);
+	extension->local_endpoint = (int32_t)WIMP_LE32(extension->local_endpoint);
+	extension->shm_name_bytes = (int32_t)WIMP_LE32(extension->shm_name_bytes);
+	extension->credits = (int32_t)WIMP_LE32(extension->credits);
+	extension->instr_ids = (int32_t)WIMP_LE32(extension->instr_ids);
+	extension->instr_names_bytes = (int32_t)WIMP_LE32(extension->instr_names_bytes);
+	extension->instr_version = (int32_t)WIMP_LE32(extension->instr_version);
+	extension->process_token = WIMP_LE64(extension->process_token);
+#else
+	(void)extension; //Already little-endian
+#endif
+}
+
+int32_t wimp_handshake_write_extension(uint8_t* buffer, WimpHandshakeExtension extension)
+{
+	extension.extension_header = WIMP_HANDSHAKE_EXTENSION;
+	extension.extension_bytes = (int32_t)sizeof(WimpHandshakeExtension);
+	wimp_handshake_extension_to_wire(&extension);
+	memcpy(buffer, &extension, sizeof(WimpHandshakeExtension));
+	return (int32_t)sizeof(WimpHandshakeExtension);
+}
+
+int32_t wimp_handshake_read_extension(const uint8_t* buffer, size_t bytes, WimpHandshakeExtension* extension)
+{
+	//What a peer from before the extension agrees to
+	memset(extension, 0, sizeof(WimpHandshakeExtension));
+	extension->transport = WIMP_TRANSPORT_SOCKET;
+
+	int32_t start[2];
+	if (bytes < sizeof(start))
+	{
+		return 0;
+	}
+	memcpy(start, buffer, sizeof(start));
+	int32_t extension_bytes = (int32_t)WIMP_LE32(start[1]);
+	if ((int32_t)WIMP_LE32(start[0]) != WIMP_HANDSHAKE_EXTENSION || extension_bytes < (int32_t)sizeof(start))
+	{
+		return 0;
+	}
+	if ((size_t)extension_bytes > bytes)
+	{
+		return extension_bytes;
+	}
+
+	//Fields added after the version that sent it are left zero, and fields it
+	//has that this version doesn't know are skipped
+	size_t known_bytes = (size_t)extension_bytes < sizeof(WimpHandshakeExtension) ? (size_t)extension_bytes : sizeof(WimpHandshakeExtension);
+	memset(extension, 0, sizeof(WimpHandshakeExtension));
+	memcpy(extension, buffer, known_bytes);
+	wimp_handshake_extension_to_wire(extension);
+	return extension_bytes;
+}
+
 RecieverArgs wimp_get_reciever_args(const char* process_name, const char* recfrom_domain, int32_t recfrom_port, WimpInstrQueue* incomingq, int32_t* active)
 {
 	RecieverArgs recargs = malloc(sizeof(struct _RecieverArgs));
@@ -91,7 +213,142 @@ void wimp_free_reciever_args(RecieverArgs args)
 	free(args);
 }
 
-int32_t wimp_reciever_init(PSocket** recsock, PSocketAddress** rec_address, RecieverArgs args)
+/*
+* Recieves until the buffer is full
+*
+* @return Returns false if the socket closed first
+*/
+static bool wimp_reciever_receive_all(PSocket* socket, uint8_t* buffer, size_t bytes)
+{
+	size_t recieved = 0;
+	while (recieved < bytes)
+	{
+		pssize size = p_socket_receive(socket, (pchar*)&buffer[recieved], bytes - recieved, NULL);
+		if (size <= 0)
+		{
+			return false;
+		}
+		recieved += (size_t)size;
+	}
+	return true;
+}
+
+/*
+* Registry of the reciever threads and event loops recieving into each queue,
+* so stopping a queue can wait until nothing recieves into it any more. A
+* thread is tracked from when it's started until it has handed its connection
+* to the event loop, or has stopped recieving from it.
+*/
+typedef struct _WimpRecieverThread
+{
+	RecieverArgs args;
+	PSocket* socket;	//Set once connected, shut down to wake the thread when its queue stops
+	struct _WimpRecieverThread* next;
+} *WimpRecieverThread;
+
+static PMutex* s_loop_mutex = NULL;
+static PCondVariable* s_loop_exited = NULL;
+static WimpRecieverThread s_threads = NULL;
+static int32_t s_loops_running = 0;
+
+/*
+* Starts tracking a reciever thread before it's started
+*
+* @return Returns false if the registry isn't initialized
+*/
+static bool wimp_reciever_thread_track(RecieverArgs args)
+{
+	if (s_loop_mutex == NULL)
+	{
+		return false;
+	}
+
+	WimpRecieverThread thread = malloc(sizeof(struct _WimpRecieverThread));
+	if (thread == NULL)
+	{
+		return false;
+	}
+	thread->args = args;
+	thread->socket = NULL;
+
+	p_mutex_lock(s_loop_mutex);
+	thread->next = s_threads;
+	s_threads = thread;
+	p_mutex_unlock(s_loop_mutex);
+	return true;
+}
+
+/*
+* Finds the link to the thread. Must be called with the registry lock held.
+*
+* @return Returns the link, which points to NULL if the thread isn't tracked
+*/
+static WimpRecieverThread* wimp_reciever_thread_find(RecieverArgs args)
+{
+	WimpRecieverThread* link = &s_threads;
+	while (*link != NULL && (*link)->args != args)
+	{
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+/*
+* Sets the socket the thread recieves on, so stopping its queue can wake it.
+* Is set back to NULL before the socket is freed.
+*
+* @return Returns false if the server has stopped, then the socket isn't set
+*/
+static bool wimp_reciever_thread_set_socket(RecieverArgs args, PSocket* socket)
+{
+	if (s_loop_mutex == NULL)
+	{
+		return p_atomic_int_get(args->active);
+	}
+
+	p_mutex_lock(s_loop_mutex);
+	bool active = p_atomic_int_get(args->active);
+	WimpRecieverThread thread = *wimp_reciever_thread_find(args);
+	if (thread != NULL)
+	{
+		thread->socket = active ? socket : NULL;
+	}
+	p_mutex_unlock(s_loop_mutex);
+	return active;
+}
+
+/*
+* Stops tracking the thread, once it's done with its queue. Must be called
+* with the registry lock held.
+*/
+static void wimp_reciever_thread_untrack(RecieverArgs args)
+{
+	WimpRecieverThread* link = wimp_reciever_thread_find(args);
+	WimpRecieverThread thread = *link;
+	if (thread != NULL)
+	{
+		*link = thread->next;
+		free(thread);
+		p_cond_variable_broadcast(s_loop_exited);
+	}
+}
+
+/*
+* Stops tracking the thread, after which it mustn't touch its queue or active flag
+*/
+static void wimp_reciever_thread_end(RecieverArgs args)
+{
+	if (s_loop_mutex == NULL)
+	{
+		return;
+	}
+
+	p_mutex_lock(s_loop_mutex);
+	wimp_reciever_thread_untrack(args);
+	p_mutex_unlock(s_loop_mutex);
+}
+
+int32_t wimp_reciever_init(PSocket** recsock, PSocketAddress** rec_address, RecieverArgs args, WimpRecieverAgreed* agreed)
 {
 	WimpMsgBuffer recbuffer;
 	WimpMsgBuffer sendbuffer;
@@ -102,23 +359,70 @@ int32_t wimp_reciever_init(PSocket** recsock, PSocketAddress** rec_address, Reci
 	//Then send handshake and process name
 	WimpHandshakeHeader header = wimp_create_handshake(args->process_name, sendbuffer);
 
+	//Everything else is offered in the extension after the name, which a
+	//server from before it skips
+	memset(agreed, 0, sizeof(WimpRecieverAgreed));
+	WimpShmRing* ring = &agreed->ring;
+	WimpHandshakeExtension offer;
+	memset(&offer, 0, sizeof(WimpHandshakeExtension));
+	offer.protocol_version = WIMP_PROTOCOL_VERSION;
+	offer.transport = WIMP_TRANSPORT_SOCKET;
+	offer.instr_ids = 1;
+	offer.instr_version = WIMP_INSTR_VERSION;
+	offer.process_token = wimp_transport_process_token();
+
+	//If the queue being written to has a local endpoint, offer it so a server
+	//in the same address space can skip the socket
+	int32_t allowed_transports = WIMP_TRANSPORT_NONE;
+	int32_t endpoint_id = wimp_local_endpoint_find(args->incoming_queue, &allowed_transports);
+	if (endpoint_id != 0)
+	{
+		offer.transport |= WIMP_TRANSPORT_LOCAL;
+		offer.local_endpoint = endpoint_id;
+	}
+
+	//If the queue is throttled at a high watermark, each sender may run ahead
+	//by the gap down to the low watermark
+	wimp_instr_queue_low_prio_lock(args->incoming_queue);
+	if (args->incoming_queue->high_watermark > 0)
+	{
+		offer.credits = args->incoming_queue->high_watermark - args->incoming_queue->low_watermark;
+	}
+	wimp_instr_queue_low_prio_unlock(args->incoming_queue);
+
 	//Construct address for client, which should be listening
-    *rec_address = p_socket_address_new(args->recfrom_domain, args->recfrom_port);
-    if (*rec_address == NULL)
-    {
-		WIMP_ZERO_BUFFER(sendbuffer);
-        return WIMP_RECIEVER_FAIL;
-    }
+	//Unix domain sockets connect to the path so have no address
+	bool is_unix_domain = wimp_socket_is_unix_domain(args->recfrom_domain);
+	*rec_address = NULL;
+	if (is_unix_domain)
+	{
+		*recsock = wimp_socket_unix_new();
+		if (*recsock == NULL)
+		{
+			WIMP_ZERO_BUFFER(sendbuffer);
+			return WIMP_RECIEVER_FAIL;
+		}
+	}
+	else
+	{
+		*rec_address = p_socket_address_new(args->recfrom_domain, args->recfrom_port);
+		if (*rec_address == NULL)
+		{
+			WIMP_ZERO_BUFFER(sendbuffer);
+			return WIMP_RECIEVER_FAIL;
+		}
 
-    //Create the main listen/recieve socket - currently hard coded
-    *recsock = p_socket_new(P_SOCKET_FAMILY_INET, P_SOCKET_TYPE_STREAM, P_SOCKET_PROTOCOL_TCP, &err);
-    if (*recsock == NULL)
-    {
-		wimp_log_fail("Failed to create reciever socket! (%d): %s\n", p_error_get_code(err), p_error_get_message(err));
-		p_error_free(err);
-		WIMP_ZERO_BUFFER(sendbuffer);
-        return WIMP_RECIEVER_FAIL;
-    }
+		//Create the main listen/recieve socket
+		*recsock = p_socket_new(P_SOCKET_FAMILY_INET, P_SOCKET_TYPE_STREAM, P_SOCKET_PROTOCOL_TCP, &err);
+		if (*recsock == NULL)
+		{
+			wimp_log_fail("Failed to create reciever socket! (%d): %s\n", p_error_get_code(err), p_error_get_message(err));
+			p_error_free(err);
+			p_socket_address_free(*rec_address);
+			WIMP_ZERO_BUFFER(sendbuffer);
+			return WIMP_RECIEVER_FAIL;
+		}
+	}
 
     //Connect to end process, which should be waiting to accept
 
@@ -126,9 +430,22 @@ int32_t wimp_reciever_init(PSocket** recsock, PSocketAddress** rec_address, Reci
 	//This is because there is no timeout on the connect call
 	int32_t num_tries = 0;
 	bool con_success = false;
-	while (num_tries < WIMP_REC_TRY_COUNT)
+	err = NULL;
+	while (num_tries < WIMP_REC_TRY_COUNT && p_atomic_int_get(args->active))
 	{
-		con_success = p_socket_connect(*recsock, *rec_address, &err);
+		if (is_unix_domain)
+		{
+			con_success = wimp_socket_unix_connect(*recsock, args->recfrom_domain);
+		}
+		else
+		{
+			if (err != NULL)
+			{
+				p_error_free(err);
+				err = NULL;
+			}
+			con_success = p_socket_connect(*recsock, *rec_address, &err);
+		}
 		if (con_success)
 		{
 			break;
@@ -150,245 +467,1281 @@ int32_t wimp_reciever_init(PSocket** recsock, PSocketAddress** rec_address, Reci
         return WIMP_RECIEVER_FAIL;
     }
 
+	//Once the socket is tracked, stopping the server wakes the handshake
+	if (!wimp_reciever_thread_set_socket(args, *recsock))
+	{
+		wimp_log_important("%s reciever connected after the server stopped\n", args->process_name);
+		p_socket_address_free(*rec_address);
+		p_socket_free(*recsock);
+		WIMP_ZERO_BUFFER(sendbuffer);
+		return WIMP_RECIEVER_FAIL;
+	}
+
 	wimp_log_success("%s reciever connection at %s:%d\n", args->process_name, args->recfrom_domain, args->recfrom_port);
 
+	//Offer a shared memory ring after the extension, for a server on the same host
+	size_t extension_offset = sizeof(WimpHandshakeHeader) + header.process_name_bytes;
+	size_t ring_offset = extension_offset + sizeof(WimpHandshakeExtension);
+	if (allowed_transports & WIMP_TRANSPORT_SHM)
+	{
+		char ring_name[WIMP_SHM_RING_MAX_NAME_BYTES];
+		*ring = wimp_shm_ring_create(offer.process_token, ring_name);
+		if (*ring != NULL && header.handshake_header == WIMP_RECIEVER_HANDSHAKE && ring_offset + WIMP_SHM_RING_MAX_NAME_BYTES < WIMP_MESSAGE_BUFFER_BYTES)
+		{
+			offer.transport |= WIMP_TRANSPORT_SHM;
+			offer.shm_name_bytes = (int32_t)(strlen(ring_name) + 1) * sizeof(char);
+			memcpy(&sendbuffer[ring_offset], ring_name, offer.shm_name_bytes);
+		}
+		else
+		{
+			wimp_shm_ring_free(*ring);
+			*ring = NULL;
+		}
+	}
+
+	size_t handshake_bytes = extension_offset;
+	if (header.handshake_header == WIMP_RECIEVER_HANDSHAKE && ring_offset <= WIMP_MESSAGE_BUFFER_BYTES)
+	{
+		wimp_handshake_write_extension(&sendbuffer[extension_offset], offer);
+		handshake_bytes = ring_offset + offer.shm_name_bytes;
+	}
+
 	//Send the handshake
-	p_socket_send(*recsock, sendbuffer, sizeof(WimpHandshakeHeader) + header.process_name_bytes, NULL);
+	p_socket_send(*recsock, sendbuffer, handshake_bytes, NULL);
 	WIMP_ZERO_BUFFER(sendbuffer);
 
-	//Read next handshake
-	pssize handshake_size = p_socket_receive(*recsock, recbuffer, WIMP_MESSAGE_BUFFER_BYTES, NULL);
-
-	if (handshake_size <= 0)
+	//Read the reply header then its extension, if the server has one. Only
+	//that much is read so nothing sent after it is taken
+	WimpHandshakeHeader recheader = { 0, 0 };
+	WimpHandshakeExtension reply;
+	bool recieved = wimp_reciever_receive_all(*recsock, recbuffer, sizeof(WimpHandshakeHeader))
+		&& wimp_handshake_read_header(recbuffer, &recheader);
+	int32_t reply_bytes = recieved ? recheader.process_name_bytes : 0;
+	if (reply_bytes > 0)
 	{
-		wimp_log_fail("Reciever handshake failed! (%d): %s\n", p_error_get_code(err), p_error_get_message(err));
-		p_error_free(err);
-        p_socket_address_free(*rec_address);
-        p_socket_free(*recsock);
-		WIMP_ZERO_BUFFER(recbuffer);
-        return WIMP_RECIEVER_FAIL;
+		recieved = (size_t)reply_bytes <= WIMP_MESSAGE_BUFFER_BYTES
+			&& wimp_reciever_receive_all(*recsock, recbuffer, (size_t)reply_bytes)
+			&& wimp_handshake_read_extension(recbuffer, (size_t)reply_bytes, &reply) == reply_bytes;
+	}
+	else
+	{
+		//A server from before the extension
+		wimp_handshake_read_extension(recbuffer, 0, &reply);
 	}
 
 	//Check start of handshake
-	WimpHandshakeHeader* recheader = (WimpHandshakeHeader*)recbuffer;
-	if (recheader->handshake_header != WIMP_RECIEVER_HANDSHAKE)
+	if (!recieved || reply.protocol_version > WIMP_PROTOCOL_VERSION)
 	{
-		wimp_log_fail("Reciever recieved invalid handshake!: %d\n", recheader->handshake_header);
+		wimp_log_fail("Reciever recieved invalid handshake!: %d, protocol %d\n", recheader.handshake_header, reply.protocol_version);
+		wimp_reciever_thread_set_socket(args, NULL);
         p_socket_address_free(*rec_address);
         p_socket_free(*recsock);
+		wimp_shm_ring_free(*ring);
 		WIMP_ZERO_BUFFER(recbuffer);
 		return WIMP_RECIEVER_FAIL;
 	}
+	agreed->transport = reply.transport;
+	agreed->window = offer.credits > 0 && reply.credits > 0 ? reply.credits : 0;
+	agreed->instr_version = reply.instr_version >= WIMP_INSTR_VERSION_FIXED ? WIMP_INSTR_VERSION_FIXED : WIMP_INSTR_VERSION_NAMES;
+	agreed->protocol_version = reply.protocol_version;
+	if (agreed->transport != WIMP_TRANSPORT_SHM)
+	{
+		wimp_shm_ring_free(*ring);
+		*ring = NULL;
+	}
+
+	//The names the server registered follow, in the order of their IDs there
+	int32_t names_bytes = reply.instr_names_bytes;
+	if (reply.instr_ids > 0 && names_bytes > 0)
+	{
+		uint8_t* names = malloc(names_bytes);
+		bool names_recieved = names != NULL && wimp_reciever_receive_all(*recsock, names, names_bytes);
+		if (names_recieved)
+		{
+			agreed->instr_ids = wimp_instr_registry_unpack(names, names_bytes, &agreed->instr_id_count);
+		}
+		free(names);
+
+		if (agreed->instr_ids == NULL)
+		{
+			wimp_log_fail("Reciever failed to read instruction names!\n");
+			wimp_reciever_thread_set_socket(args, NULL);
+			p_socket_address_free(*rec_address);
+			p_socket_free(*recsock);
+			wimp_shm_ring_free(*ring);
+			*ring = NULL;
+			WIMP_ZERO_BUFFER(recbuffer);
+			return WIMP_RECIEVER_FAIL;
+		}
+	}
 	WIMP_ZERO_BUFFER(recbuffer);
 	return WIMP_RECIEVER_SUCCESS;
 }
 
 typedef struct _WimpRecieverState
 {
-	//Size of the last packet to be received
-	pssize incoming_size;
-
-	//Current offset within the recievebuffer
-	size_t rec_offset;
+	//Bytes of the size header read so far, as a header can be split between packets
+	uint8_t header[sizeof(int32_t)];
+	size_t header_bytes_read;
 
 	//Current state of the reciever
 	int32_t state;
 
-	//Current instruction of the reciever
+	//Current instruction of the reciever, which is the data of its node
+	WimpInstrNode node;
 	WimpInstr instruction;
 
 	size_t instruction_bytes_read;
+
+	//Instructions added to the queue that haven't been granted back to the sender yet
+	int32_t ungranted;
+
+	//Local IDs of the instructions the sender sends by ID, indexed by its IDs
+	uint32_t* instr_ids;
+	uint32_t instr_id_count;
+
+	//Version of the instructions the sender sends, the names version is converted as it arrives
+	int32_t instr_version;
+
+	//Protocol version of the sender, which sends sizes in host order before version 1
+	int32_t protocol_version;
 } WimpRecieverState;
 
 /*
-* Gets the next packet and resets location in recbuffer
+* A connection being recieved from after the handshake
 */
-void wimp_reciever_next_packet(WimpRecieverState* state, PSocket* recsock, uint8_t* recbuffer)
+typedef struct _WimpRecieverConn
 {
-	WIMP_ZERO_BUFFER(recbuffer);
-	state->incoming_size = p_socket_receive(recsock, recbuffer, WIMP_MESSAGE_BUFFER_BYTES, NULL);
-	state->rec_offset = 0;
-}
+	RecieverArgs args;
+	PSocket* socket;
+	PSocketAddress* address;
+	WimpShmRing ring;
+	WimpRecieverState state;
+	int32_t window;	//The credit window agreed in the handshake, zero if not flow controlled
+	bool ready;		//Set if the ring still had bytes when the connection gave up its turn
+	bool posted;	//Set while a recieve for the connection is posted to io_uring
+	bool closing;	//Set once closed while a recieve is still posted
+	struct _WimpRecieverConn* prev;
+	struct _WimpRecieverConn* next;
+} *WimpRecieverConn;
 
-void wimp_reciever_recieve(RecieverArgs args)
-{	
-	WimpMsgBuffer recbuffer;
-	WimpMsgBuffer sendbuffer;
-	WIMP_ZERO_BUFFER(recbuffer); WIMP_ZERO_BUFFER(sendbuffer);
+static void wimp_reciever_conn_free(WimpRecieverConn conn)
+{
+	//If an instruction was being built, clear it
+	wimp_instr_node_free(conn->state.node);
+	free(conn->state.instr_ids);
+	wimp_shm_ring_free(conn->ring);
+	p_socket_address_free(conn->address);
+	p_socket_free(conn->socket);
+	wimp_free_reciever_args(conn->args);
+	free(conn);
+}
 
-	//Initialize the sockets for the reciever and send handshake
-	PSocket* recsock;
-    PSocketAddress* rec_address;
-	if (wimp_reciever_init(&recsock, &rec_address, args) == WIMP_RECIEVER_FAIL)
+/*
+* Adds the fully read instruction to the incoming queue and goes back to idle
+*
+* @return Returns true if it was the exit instruction for this process
+*/
+static bool wimp_reciever_complete(WimpRecieverState* state, RecieverArgs args)
+{
+	//Names sent by ID have the IDs of the sender, swap them for the local ones
+	if (state->instr_version == WIMP_INSTR_VERSION_NAMES)
 	{
-		wimp_free_reciever_args(args);
-		p_uthread_exit(WIMP_RECIEVER_FAIL);
-		return;
+		size_t bytes = 0;
+		uint8_t* upgraded = wimp_instr_upgrade(state->instruction.instruction, state->instruction.instruction_bytes, state->instr_ids, state->instr_id_count, state->protocol_version, &bytes);
+		wimp_instr_node_free(state->node);
+		state->node = upgraded != NULL ? wimp_instr_node_wrap(upgraded, bytes) : NULL;
+		if (state->node == NULL)
+		{
+			free(upgraded);
+			state->instruction.instruction = NULL;
+			wimp_log_fail("%s reciever read a malformed instruction\n", args->process_name);
+			return true;
+		}
+		state->instruction = wimp_instr_node_data(state->node);
+	}
+	else
+	{
+		WIMP_INSTR_HEADER_FROM_WIRE(state->instruction.instruction);
+		if (!wimp_instr_map_id(state->instruction.instruction, state->instruction.instruction_bytes, state->instr_ids, state->instr_id_count))
+		{
+			wimp_log_fail("%s reciever read a malformed instruction or unknown ID\n", args->process_name);
+			return true;
+		}
 	}
 
-	//State of the reciever
-	WimpRecieverState state = 
-	{ 
-		0, 
-		0, 
-		REC_IDLE,
-		{ NULL, 0 },
-		0
-	};
+	//Check for the exit signal
+	//Will be the "exit" instruction and this process will be the destination.
+	//The metadata is kept in the node, so isn't decoded again by the process
+	WimpInstrMeta meta = wimp_instr_get_from_node(state->node);
+	bool disconnect = meta.instr_id == WIMP_INSTR_ID_EXIT && strcmp(meta.dest_process, args->process_name) == 0;
 
-	bool disconnect = false;
-	while (!disconnect)
+	//Push to the inbox, which doesn't lock the queue. The loop never blocks on
+	//a full queue, the credit window holds the sender back instead
+	wimp_instr_queue_push_unblocked(args->incoming_queue, state->node, true);
+	state->ungranted++;
+
+	//Go back to idle and reset instr
+	state->node = NULL;
+	state->instruction.instruction = NULL;
+	state->instruction.instruction_bytes = 0;
+	state->instruction_bytes_read = 0;
+	state->state = REC_IDLE;
+	return disconnect;
+}
+
+/*
+* Feeds bytes of the instruction stream through the reciever state machine,
+* adding each completed instruction to the incoming queue. The bytes are
+* copied straight into the allocation of the instruction they belong to.
+*
+* @return Returns true if the connection should close, which is after the
+* exit instruction for this process or on a corrupt stream
+*/
+static bool wimp_reciever_feed(WimpRecieverState* state, RecieverArgs args, const uint8_t* data, size_t bytes)
+{
+	size_t offset = 0;
+	while (offset < bytes)
 	{
 		/*
-		* CHECK PROCESS: checks if the process is still active
+		* IDLE/READING HEADERS STATE: (TODO: typedef for the header as may include extra info)
+		* Read the int32_t size header, which may be split between packets. If it is a
+		* valid sized instruction, enter reading data mode (up to size specified)
 		*/
-		if (!p_atomic_int_get(args->active))
+		if (state->state != REC_READING_DATA)
 		{
-			//If an instruction being built, clear it
-			if (state.instruction.instruction)
+			size_t to_copy = sizeof(int32_t) - state->header_bytes_read;
+			if (to_copy > bytes - offset)
 			{
-				free(state.instruction.instruction);
+				to_copy = bytes - offset;
 			}
-			break;
-		}
+			memcpy(&state->header[state->header_bytes_read], &data[offset], to_copy);
+			state->header_bytes_read += to_copy;
+			offset += to_copy;
 
-		/*
-		* IDLE STATE: continuously poll for a new packet until one is recieved
-		* If a packet is recieved, enter reading headers mode
-		*/
-		if (state.state == REC_IDLE)
-		{
-			wimp_reciever_next_packet(&state, recsock, recbuffer);
-			if (state.incoming_size > 0)
+			if (state->header_bytes_read < sizeof(int32_t))
 			{
-				state.state = REC_READING_HEADERS;
+				state->state = REC_READING_HEADERS;
+				break;
 			}
-		}
 
-		/*
-		* READING HEADERS STATE: (TODO: typedef for the header as may include extra info)
-		* In units of int32_t (i.e. 4 bytes) check the header value - if is a valid sized
-		* instruction, enter reading data mode (up to size specified)
-		*
-		* If a header hasn't been fully read, call for another packet and complete
-		*/
-		if (state.state == REC_READING_HEADERS)
-		{
-			int32_t header = -1;
-			uint8_t* header_ptr = (uint8_t*)&header;
+			//Sizes are little-endian on the wire
+			int32_t header;
+			memcpy(&header, state->header, sizeof(int32_t));
+			header = (int32_t)WIMP_PEER32(state->protocol_version, header);
+			state->header_bytes_read = 0;
+			state->state = REC_IDLE;
 
-			//Read in each byte and if havent finished, recieve again and finish
-			//Assume the endianness of the system sending the header is the same (as probably is localhost)
-			//TODO: Account for endianness in future
-			for (size_t h_bytes_read = 0; h_bytes_read < sizeof(int32_t); ++h_bytes_read)
+			//Pings only check the connection is alive
+			if (header == 0 || header == WIMP_RECIEVER_PING)
 			{
-				if (state.rec_offset >= state.incoming_size)
-				{
-					wimp_reciever_next_packet(&state, recsock, recbuffer);
-				}
-				header_ptr[h_bytes_read] = recbuffer[state.rec_offset];
-				state.rec_offset++;
+				continue;
 			}
 
-			//Check values of the header
-			assert(header != -1 && "Header value wasn't changed!");
-
-			//If header is zero, are at end of data
-			if (header == 0)
+			if (header < (int32_t)sizeof(int32_t))
 			{
-				state.state = REC_IDLE;
+				wimp_log_fail("%s reciever read invalid instruction size: %d\n", args->process_name, header);
+				return true;
 			}
-			else if (header != WIMP_RECIEVER_PING)
-			{
-				//If isn't a ping, create the instruction here and reading
-				state.instruction = wimp_reciever_allocateinstr(header);
-				state.state = REC_READING_DATA;
 
-				//Add header
-				memcpy(&state.instruction.instruction[0], &header, sizeof(header));
-				state.instruction_bytes_read = sizeof(header);
+			state->node = wimp_reciever_allocateinstr(header);
+			if (state->node == NULL)
+			{
+				return true;
 			}
+			state->instruction = wimp_instr_node_data(state->node);
+
+			//Add header, as it was sent so the whole instruction is converted together
+			memcpy(&state->instruction.instruction[0], state->header, sizeof(int32_t));
+			state->instruction_bytes_read = sizeof(int32_t);
+			state->state = REC_READING_DATA;
 		}
 
 		/*
 		* READING DATA STATE: Read until the bytes read = the instructions read
-		* Once the instruction is read, add to queue and return to header reading
-		*
-		* If didn't get all of instruction, get another packet
+		* Once the instruction is read, add to queue and return to idle
 		*/
-		if (state.state == REC_READING_DATA)
+		size_t to_copy = state->instruction.instruction_bytes - state->instruction_bytes_read;
+		if (to_copy > bytes - offset)
 		{
-			while (state.instruction_bytes_read != state.instruction.instruction_bytes)
-			{
-				//Copy up to end of recieved data
-				size_t bytes_to_copy = state.instruction.instruction_bytes - state.instruction_bytes_read;
-
-				if (state.rec_offset + bytes_to_copy > state.incoming_size)
-				{
-					bytes_to_copy =  state.incoming_size - state.rec_offset;
-				}
-
-				memcpy(&state.instruction.instruction[state.instruction_bytes_read], &recbuffer[state.rec_offset], bytes_to_copy);
-				state.rec_offset += bytes_to_copy;
-				state.instruction_bytes_read += bytes_to_copy;
-
-				if (state.instruction_bytes_read != state.instruction.instruction_bytes)
-				{
-					wimp_reciever_next_packet(&state, recsock, recbuffer);
-				}
-			}
-
-			//Check for the exit signal
-			//Will be the "exit" instruction and this process will be the destination
-			WimpInstrMeta meta = wimp_instr_get_from_buffer(state.instruction.instruction, state.instruction.instruction_bytes);
-			if (strcmp(meta.instr, "exit") == 0 && strcmp(meta.dest_process, args->process_name) == 0)
-			{
-				disconnect = true;
-			}
+			to_copy = bytes - offset;
+		}
+		memcpy(&state->instruction.instruction[state->instruction_bytes_read], &data[offset], to_copy);
+		state->instruction_bytes_read += to_copy;
+		offset += to_copy;
 
-			//Lock queue and add instructions
-			wimp_instr_queue_low_prio_lock(args->incoming_queue);
-			wimp_instr_queue_add(args->incoming_queue, state.instruction.instruction, state.instruction.instruction_bytes);
-			wimp_instr_queue_low_prio_unlock(args->incoming_queue);
+		if (state->instruction_bytes_read < state->instruction.instruction_bytes)
+		{
+			break;
+		}
 
-			//Go back to reading headers and reset instr
-			state.instruction.instruction = NULL;
-			state.instruction.instruction_bytes = 0;
-			state.instruction_bytes_read = 0;
-			state.state = REC_READING_HEADERS;
+		if (wimp_reciever_complete(state, args))
+		{
+			return true;
 		}
 	}
-
-	WIMP_ZERO_BUFFER(recbuffer);
-    p_socket_address_free(rec_address);
-    p_socket_free(recsock);
-	wimp_free_reciever_args(args);
-	return;
+	return false;
 }
 
-int32_t wimp_start_reciever_thread(const char* recfrom_name, const char* process_domain, int32_t process_port, RecieverArgs args)
+/*
+* Gets where the rest of a large instruction body can be recieved to, so it
+* skips the recieve buffer and the copy out of it
+*
+* @param target Set to the next unread byte of the instruction
+*
+* @return Returns the bytes of the body left, or zero if the next bytes should
+* go through the recieve buffer
+*/
+static size_t wimp_reciever_direct_target(WimpRecieverState* state, uint8_t** target)
 {
-	wimp_log("Starting Reciever for %s recieving from %s\n", args->process_name, recfrom_name);
+	if (state->state != REC_READING_DATA)
+	{
+		return 0;
+	}
 
-	PUThread* process_thread = p_uthread_create((PUThreadFunc)&wimp_reciever_recieve, args, false, args->process_name);
-	if (process_thread == NULL)
+	size_t remaining = state->instruction.instruction_bytes - state->instruction_bytes_read;
+	if (remaining < WIMP_RECIEVER_BUFFER_BYTES)
 	{
-		wimp_log_fail("Failed to create thread for %s reciever!\n", args->process_name);
-		return WIMP_RECIEVER_FAIL;
+		return 0;
 	}
-	return WIMP_RECIEVER_SUCCESS;
+	*target = &state->instruction.instruction[state->instruction_bytes_read];
+	return remaining;
 }
 
-WimpInstr wimp_reciever_allocateinstr(pssize size)
+/*
+* Accounts for bytes recieved straight into the instruction allocation
+*
+* @return Returns true if the connection should close
+*/
+static bool wimp_reciever_direct_commit(WimpRecieverState* state, RecieverArgs args, size_t bytes)
 {
-	WimpInstr instr = { NULL, 0 };
-	void* i = malloc(size);
-	if (i == NULL)
+	state->instruction_bytes_read += bytes;
+	if (state->instruction_bytes_read < state->instruction.instruction_bytes)
 	{
-		return instr;
+		return false;
 	}
-	
-	instr.instruction = i;
-	instr.instruction_bytes = size;
-	return instr;
-}
\ No newline at end of file
+	return wimp_reciever_complete(state, args);
+}
+
+/*
+* Gives the sender a credit back for every instruction added to the queue
+* since the last grant
+*/
+static void wimp_reciever_grant(WimpRecieverConn conn)
+{
+	if (conn->window == 0 || conn->state.ungranted == 0)
+	{
+		return;
+	}
+
+	int32_t credits = (int32_t)WIMP_LE32(conn->state.ungranted);
+	conn->state.ungranted = 0;
+	p_socket_send(conn->socket, (const pchar*)&credits, sizeof(int32_t), NULL);
+}
+
+/*
+* Recieves from the connection in the calling thread until it closes. Is used
+* where the event loop isn't available. Nothing wakes the thread when the
+* queue drains, so credits are granted straight away and the window only
+* limits how far the sender runs ahead of this thread. Stopping the queue
+* shuts the socket down to wake it.
+*/
+static void wimp_reciever_run_blocking(WimpRecieverConn conn)
+{
+	RecieverArgs args = conn->args;
+	uint8_t* recbuffer = malloc(WIMP_RECIEVER_BUFFER_BYTES);
+	bool disconnect = recbuffer == NULL;
+	while (!disconnect && p_atomic_int_get(args->active))
+	{
+		wimp_reciever_grant(conn);
+		if (conn->ring != NULL)
+		{
+			//Parse whatever is in the ring in place, then sleep on the doorbell
+			const uint8_t* data;
+			size_t available = wimp_shm_ring_peek(conn->ring, &data);
+			if (available > 0)
+			{
+				disconnect = wimp_reciever_feed(&conn->state, args, data, available);
+				wimp_shm_ring_consume(conn->ring, conn->socket, available);
+			}
+			else if (wimp_shm_ring_sleep(conn->ring))
+			{
+				disconnect = p_socket_receive(conn->socket, (pchar*)recbuffer, WIMP_RECIEVER_BUFFER_BYTES, NULL) <= 0;
+			}
+			continue;
+		}
+
+		uint8_t* target = NULL;
+		size_t direct_bytes = wimp_reciever_direct_target(&conn->state, &target);
+		if (direct_bytes > 0)
+		{
+			pssize incoming_size = p_socket_receive(conn->socket, (pchar*)target, direct_bytes, NULL);
+			if (incoming_size <= 0)
+			{
+				break;
+			}
+			disconnect = wimp_reciever_direct_commit(&conn->state, args, (size_t)incoming_size);
+			continue;
+		}
+
+		pssize incoming_size = p_socket_receive(conn->socket, (pchar*)recbuffer, WIMP_RECIEVER_BUFFER_BYTES, NULL);
+		if (incoming_size <= 0)
+		{
+			break;
+		}
+		disconnect = wimp_reciever_feed(&conn->state, args, recbuffer, (size_t)incoming_size);
+	}
+
+	free(recbuffer);
+	wimp_reciever_thread_end(args);
+	wimp_reciever_conn_free(conn);
+
+	//Nodes are taken from the pool in batches, give back what this thread has left
+	wimp_pool_thread_release();
+}
+
+#ifdef WIMP_RECIEVER_EPOLL
+
+/*
+* Event loop recieving every connection that writes to one incoming queue.
+* Uses io_uring if it's available, otherwise epoll.
+*/
+typedef struct _WimpRecieverLoop
+{
+	WimpInstrQueue* queue;
+	int32_t* active;
+	int epoll_fd;
+	int wake_fd;					//Eventfd written when connections are handed over
+	WimpUring uring;
+	uint64_t wake_value;			//Read into by io_uring from the eventfd
+	uint8_t* recbuffer;				//Shared by the connections with epoll, io_uring recieves into its own buffers
+	WimpRecieverConn pending;		//Handed over but not watched yet, guarded by the registry mutex
+	WimpRecieverConn connections;	//Watched connections, only touched by the loop thread
+	WimpRecieverConn closing;		//Closed connections with a recieve still posted to io_uring
+	bool stopping;					//Set while the loop is waited on to stop, whoever is waiting frees it
+	bool exited;					//Set once the loop thread is done with the loop
+	struct _WimpRecieverLoop* next;
+} *WimpRecieverLoop;
+
+/*
+* The running loops, guarded by the registry lock. Is only walked when a
+* connection is handed over or a loop is stopped, so a list is enough. Loops
+* leave the list once they have no connections, but are still counted as
+* running until their thread is done.
+*/
+static WimpRecieverLoop s_loops = NULL;
+
+/*
+* Finds the loop recieving into the queue. Must be called with the registry lock held.
+*/
+static WimpRecieverLoop wimp_reciever_loop_find(WimpInstrQueue* queue, int32_t* active)
+{
+	WimpRecieverLoop loop = s_loops;
+	while (loop != NULL && (loop->queue != queue || loop->active != active))
+	{
+		loop = loop->next;
+	}
+	return loop;
+}
+
+/*
+* Wakes the loop from waiting on its connections
+*/
+static void wimp_reciever_loop_wake(WimpRecieverLoop loop)
+{
+	uint64_t wake = 1;
+	if (write(loop->wake_fd, &wake, sizeof(uint64_t)) < 0)
+	{
+		wimp_log_fail("Failed to wake reciever event loop (%d)\n", errno);
+	}
+}
+
+static void wimp_reciever_list_push(WimpRecieverConn* list, WimpRecieverConn conn)
+{
+	conn->prev = NULL;
+	conn->next = *list;
+	if (*list != NULL)
+	{
+		(*list)->prev = conn;
+	}
+	*list = conn;
+}
+
+static void wimp_reciever_list_remove(WimpRecieverConn* list, WimpRecieverConn conn)
+{
+	if (conn->prev != NULL)
+	{
+		conn->prev->next = conn->next;
+	}
+	else
+	{
+		*list = conn->next;
+	}
+	if (conn->next != NULL)
+	{
+		conn->next->prev = conn->prev;
+	}
+}
+
+/*
+* Stops watching the connection and frees it. With io_uring a posted recieve
+* still refers to the connection, so it's cancelled and freed on completion.
+*/
+static void wimp_reciever_loop_unwatch(WimpRecieverLoop loop, WimpRecieverConn conn)
+{
+	wimp_reciever_list_remove(&loop->connections, conn);
+	if (loop->uring != NULL && conn->posted)
+	{
+		wimp_uring_cancel(loop->uring, (uint64_t)(uintptr_t)conn);
+		conn->closing = true;
+		wimp_reciever_list_push(&loop->closing, conn);
+		return;
+	}
+
+	if (loop->uring == NULL)
+	{
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, p_socket_get_fd(conn->socket), NULL);
+	}
+	wimp_reciever_conn_free(conn);
+}
+
+/*
+* Parses the ring in place until it's empty, then flags the consumer as sleeping
+* so the producer rings the doorbell for more. After a full ring's worth the turn
+* is given up, and the loop comes back without waiting on the doorbell.
+*
+* @return Returns true if the connection should close
+*/
+static bool wimp_reciever_loop_drain_ring(WimpRecieverConn conn, bool closed)
+{
+	bool disconnect = false;
+	size_t consumed = 0;
+	conn->ready = false;
+	while (!disconnect)
+	{
+		const uint8_t* data;
+		size_t available = wimp_shm_ring_peek(conn->ring, &data);
+		if (available > 0)
+		{
+			disconnect = wimp_reciever_feed(&conn->state, conn->args, data, available);
+			wimp_shm_ring_consume(conn->ring, conn->socket, available);
+			consumed += available;
+		}
+		else if (closed || wimp_shm_ring_sleep(conn->ring))
+		{
+			break;
+		}
+
+		if (consumed >= WIMP_SHM_RING_BYTES)
+		{
+			conn->ready = !closed;
+			break;
+		}
+	}
+	return closed || disconnect;
+}
+
+/*
+* Reads everything available on the connection without blocking
+*
+* @return Returns true if the connection should close
+*/
+static bool wimp_reciever_loop_service(WimpRecieverConn conn, uint8_t* recbuffer)
+{
+	WimpRecieverState* state = &conn->state;
+	int fd = p_socket_get_fd(conn->socket);
+	bool closed = false;
+	bool disconnect = false;
+
+	//Bounded so a busy connection can't starve the others, anything left
+	//is reported again by epoll. For shared memory these are only doorbell pings
+	for (int32_t reads = 0; !disconnect && reads < WIMP_REC_MAX_READS; ++reads)
+	{
+		//The rest of a large body is recieved straight into the instruction
+		uint8_t* target = recbuffer;
+		size_t target_bytes = WIMP_RECIEVER_BUFFER_BYTES;
+		size_t direct_bytes = conn->ring == NULL ? wimp_reciever_direct_target(state, &target) : 0;
+		if (direct_bytes > 0)
+		{
+			target_bytes = direct_bytes;
+		}
+
+		ssize_t incoming_size = recv(fd, target, target_bytes, MSG_DONTWAIT);
+		if (incoming_size < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (incoming_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			break;
+		}
+		if (incoming_size <= 0)
+		{
+			closed = true;
+			break;
+		}
+		if (direct_bytes > 0)
+		{
+			disconnect = wimp_reciever_direct_commit(state, conn->args, (size_t)incoming_size);
+		}
+		else if (conn->ring == NULL)
+		{
+			disconnect = wimp_reciever_feed(state, conn->args, recbuffer, (size_t)incoming_size);
+		}
+	}
+
+	if (conn->ring != NULL && !disconnect)
+	{
+		return wimp_reciever_loop_drain_ring(conn, closed);
+	}
+	return closed || disconnect;
+}
+
+/*
+* Starts watching the connections that have been handed over
+*/
+static void wimp_reciever_loop_adopt(WimpRecieverLoop loop)
+{
+	p_mutex_lock(s_loop_mutex);
+	WimpRecieverConn pending = loop->pending;
+	loop->pending = NULL;
+	p_mutex_unlock(s_loop_mutex);
+
+	while (pending != NULL)
+	{
+		WimpRecieverConn conn = pending;
+		pending = pending->next;
+
+		bool watched;
+		if (loop->uring != NULL)
+		{
+			watched = wimp_uring_recv_post(loop->uring, p_socket_get_fd(conn->socket), (uint64_t)(uintptr_t)conn) == WIMP_URING_SUCCESS;
+			conn->posted = watched;
+		}
+		else
+		{
+			struct epoll_event event;
+			event.events = EPOLLIN | EPOLLRDHUP;
+			event.data.ptr = conn;
+			watched = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, p_socket_get_fd(conn->socket), &event) == 0;
+		}
+
+		if (!watched)
+		{
+			wimp_log_fail("%s reciever failed to watch connection (%d)\n", conn->args->process_name, errno);
+			wimp_reciever_conn_free(conn);
+			continue;
+		}
+		wimp_reciever_list_push(&loop->connections, conn);
+
+		//The producer only rings the doorbell once the consumer is sleeping,
+		//so a new ring has to be drained once to flag that
+		if (conn->ring != NULL && wimp_reciever_loop_drain_ring(conn, false))
+		{
+			wimp_reciever_loop_unwatch(loop, conn);
+		}
+	}
+}
+
+/*
+* Called from popping the queue once it has drained from throttled
+*/
+static void wimp_reciever_loop_drained(void* context)
+{
+	wimp_reciever_loop_wake((WimpRecieverLoop)context);
+}
+
+/*
+* Grants the senders credits for what was added to the queue, unless it's
+* throttled. Then the credits are held back until the queue drains, which
+* wakes the loop to grant them.
+*/
+static void wimp_reciever_loop_grant(WimpRecieverLoop loop)
+{
+	bool ungranted = false;
+	for (WimpRecieverConn conn = loop->connections; conn != NULL && !ungranted; conn = conn->next)
+	{
+		ungranted = conn->window > 0 && conn->state.ungranted > 0;
+	}
+	if (!ungranted)
+	{
+		return;
+	}
+
+	if (wimp_instr_queue_is_throttled(loop->queue))
+	{
+		return;
+	}
+
+	for (WimpRecieverConn conn = loop->connections; conn != NULL; conn = conn->next)
+	{
+		wimp_reciever_grant(conn);
+	}
+}
+
+/*
+* Takes the loop out of the registry, after which the queue may be freed at
+* any point. Must be called with the registry lock held.
+*/
+static void wimp_reciever_loop_leave(WimpRecieverLoop loop)
+{
+	wimp_instr_queue_low_prio_lock(loop->queue);
+	wimp_instr_queue_set_drained(loop->queue, NULL, NULL);
+	wimp_instr_queue_low_prio_unlock(loop->queue);
+
+	WimpRecieverLoop* link = &s_loops;
+	while (*link != NULL && *link != loop)
+	{
+		link = &(*link)->next;
+	}
+	if (*link != NULL)
+	{
+		*link = loop->next;
+	}
+}
+
+/*
+* Services the connections that gave up their turn with bytes left in the ring,
+* grants credits, closes everything if the server is inactive, then checks if the loop is done
+*
+* @param any_ready Set if a connection still has bytes left
+*
+* @return Returns true once every connection has closed
+*/
+static bool wimp_reciever_loop_finish_iteration(WimpRecieverLoop loop, bool* any_ready)
+{
+	*any_ready = false;
+	WimpRecieverConn conn = loop->connections;
+	while (conn != NULL)
+	{
+		WimpRecieverConn next = conn->next;
+		if (conn->ready)
+		{
+			if (wimp_reciever_loop_drain_ring(conn, false))
+			{
+				wimp_reciever_loop_unwatch(loop, conn);
+			}
+			else
+			{
+				*any_ready |= conn->ready;
+			}
+		}
+		conn = next;
+	}
+	wimp_reciever_loop_grant(loop);
+
+	//CHECK PROCESS: checks if the process is still active
+	if (!p_atomic_int_get(loop->active))
+	{
+		while (loop->connections != NULL)
+		{
+			wimp_reciever_loop_unwatch(loop, loop->connections);
+		}
+	}
+
+	//Stop once every connection has closed. Is checked under the registry
+	//lock so a connection can't be handed over to a loop that is stopping
+	p_mutex_lock(s_loop_mutex);
+	bool finished = loop->connections == NULL && loop->pending == NULL;
+	if (finished)
+	{
+		wimp_reciever_loop_leave(loop);
+	}
+	p_mutex_unlock(s_loop_mutex);
+	return finished;
+}
+
+static void wimp_reciever_loop_run_epoll(WimpRecieverLoop loop)
+{
+	struct epoll_event events[WIMP_REC_MAX_EVENTS];
+	bool any_ready = false;
+	for (;;)
+	{
+		//Only the connections and the eventfd wake the loop, which is written
+		//when connections are handed over or the server stops
+		int count = epoll_wait(loop->epoll_fd, events, WIMP_REC_MAX_EVENTS, any_ready ? 0 : -1);
+		for (int i = 0; i < count; ++i)
+		{
+			WimpRecieverConn conn = (WimpRecieverConn)events[i].data.ptr;
+			if (conn == NULL)
+			{
+				uint64_t wakes;
+				while (read(loop->wake_fd, &wakes, sizeof(uint64_t)) > 0);
+				wimp_reciever_loop_adopt(loop);
+			}
+			else if (wimp_reciever_loop_service(conn, loop->recbuffer))
+			{
+				wimp_reciever_loop_unwatch(loop, conn);
+			}
+		}
+
+		if (wimp_reciever_loop_finish_iteration(loop, &any_ready))
+		{
+			break;
+		}
+	}
+}
+
+static void wimp_reciever_loop_run_uring(WimpRecieverLoop loop)
+{
+	WimpUringCompletion completions[WIMP_REC_MAX_EVENTS];
+	bool any_ready = false;
+	wimp_uring_read_post(loop->uring, loop->wake_fd, &loop->wake_value, sizeof(uint64_t), 0);
+	for (;;)
+	{
+		//Only the connections and the eventfd wake the loop, which is written
+		//when connections are handed over or the server stops
+		int32_t count = wimp_uring_wait(loop->uring, completions, WIMP_REC_MAX_EVENTS, any_ready ? 0 : -1);
+		for (int32_t i = 0; i < count; ++i)
+		{
+			WimpUringCompletion* completion = &completions[i];
+			if (completion->user_data == 0)
+			{
+				wimp_uring_read_post(loop->uring, loop->wake_fd, &loop->wake_value, sizeof(uint64_t), 0);
+				wimp_reciever_loop_adopt(loop);
+				continue;
+			}
+
+			WimpRecieverConn conn = (WimpRecieverConn)(uintptr_t)completion->user_data;
+			conn->posted = completion->more;
+
+			//Closed connections only wait for the recieve to finish
+			if (conn->closing)
+			{
+				if (completion->buffer >= 0)
+				{
+					wimp_uring_buffer_release(loop->uring, completion->buffer);
+				}
+				if (!conn->posted)
+				{
+					wimp_reciever_list_remove(&loop->closing, conn);
+					wimp_reciever_conn_free(conn);
+				}
+				continue;
+			}
+
+			//The data is parsed straight out of the provided buffer. For shared
+			//memory these are only doorbell pings
+			bool disconnect = false;
+			if (completion->buffer >= 0)
+			{
+				if (conn->ring == NULL && completion->result > 0)
+				{
+					const uint8_t* data = wimp_uring_buffer_get(loop->uring, completion->buffer);
+					disconnect = wimp_reciever_feed(&conn->state, conn->args, data, (size_t)completion->result);
+				}
+				wimp_uring_buffer_release(loop->uring, completion->buffer);
+			}
+
+			//Running out of buffers only stops the multishot recieve, the data waits in the socket
+			bool closed = completion->result <= 0 && completion->result != -ENOBUFS;
+			if (conn->ring != NULL && !disconnect)
+			{
+				disconnect = wimp_reciever_loop_drain_ring(conn, closed);
+			}
+
+			if (disconnect || closed)
+			{
+				wimp_reciever_loop_unwatch(loop, conn);
+			}
+			else if (!conn->posted)
+			{
+				conn->posted = wimp_uring_recv_post(loop->uring, p_socket_get_fd(conn->socket), completion->user_data) == WIMP_URING_SUCCESS;
+				if (!conn->posted)
+				{
+					wimp_reciever_loop_unwatch(loop, conn);
+				}
+			}
+		}
+
+		if (count < 0)
+		{
+			p_mutex_lock(s_loop_mutex);
+			wimp_reciever_loop_leave(loop);
+			p_mutex_unlock(s_loop_mutex);
+			break;
+		}
+		if (wimp_reciever_loop_finish_iteration(loop, &any_ready))
+		{
+			break;
+		}
+	}
+
+	//Freeing the ring cancels any recieves still posted, so the closing
+	//connections can be freed after
+	wimp_uring_free(loop->uring);
+	loop->uring = NULL;
+	while (loop->closing != NULL)
+	{
+		WimpRecieverConn conn = loop->closing;
+		loop->closing = conn->next;
+		wimp_reciever_conn_free(conn);
+	}
+	while (loop->connections != NULL)
+	{
+		WimpRecieverConn conn = loop->connections;
+		loop->connections = conn->next;
+		wimp_reciever_conn_free(conn);
+	}
+}
+
+static void wimp_reciever_loop_run(WimpRecieverLoop loop)
+{
+	//Held back credits are granted once the queue drains
+	wimp_instr_queue_low_prio_lock(loop->queue);
+	wimp_instr_queue_set_drained(loop->queue, &wimp_reciever_loop_drained, loop);
+	wimp_instr_queue_low_prio_unlock(loop->queue);
+
+	if (loop->uring != NULL)
+	{
+		wimp_reciever_loop_run_uring(loop);
+	}
+	else
+	{
+		wimp_reciever_loop_run_epoll(loop);
+	}
+
+	if (loop->epoll_fd >= 0)
+	{
+		close(loop->epoll_fd);
+	}
+	close(loop->wake_fd);
+	free(loop->recbuffer);
+	wimp_pool_thread_release();
+
+	//If the loop is being stopped, whoever is waiting frees it
+	p_mutex_lock(s_loop_mutex);
+	bool stopping = loop->stopping;
+	loop->exited = true;
+	s_loops_running--;
+	p_cond_variable_broadcast(s_loop_exited);
+	p_mutex_unlock(s_loop_mutex);
+
+	if (!stopping)
+	{
+		free(loop);
+	}
+}
+
+static void wimp_reciever_loop_free_fds(WimpRecieverLoop loop)
+{
+	wimp_uring_free(loop->uring);
+	if (loop->epoll_fd >= 0)
+	{
+		close(loop->epoll_fd);
+	}
+	if (loop->wake_fd >= 0)
+	{
+		close(loop->wake_fd);
+	}
+	free(loop->recbuffer);
+}
+
+/*
+* Creates a loop for the queue and starts its thread. Must be called with the
+* registry lock held.
+*/
+static WimpRecieverLoop wimp_reciever_loop_create(WimpInstrQueue* queue, int32_t* active)
+{
+	WimpRecieverLoop loop = calloc(1, sizeof(struct _WimpRecieverLoop));
+	if (loop == NULL)
+	{
+		return NULL;
+	}
+
+	loop->queue = queue;
+	loop->active = active;
+	loop->epoll_fd = -1;
+	loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	//Prefer io_uring if it was built and the kernel supports it
+	loop->uring = wimp_uring_create(WIMP_URING_BUFFER_COUNT);
+	bool created = loop->wake_fd >= 0 && loop->uring != NULL;
+	if (!created && loop->wake_fd >= 0)
+	{
+		loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		created = loop->epoll_fd >= 0 && epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) == 0;
+
+		loop->recbuffer = malloc(WIMP_RECIEVER_BUFFER_BYTES);
+		created = created && loop->recbuffer != NULL;
+	}
+
+	if (!created)
+	{
+		wimp_log_fail("Failed to create reciever event loop (%d)\n", errno);
+		wimp_reciever_loop_free_fds(loop);
+		free(loop);
+		return NULL;
+	}
+
+	if (p_uthread_create((PUThreadFunc)&wimp_reciever_loop_run, loop, false, "wimp-reciever-loop") == NULL)
+	{
+		wimp_log_fail("Failed to create thread for reciever event loop!\n");
+		wimp_reciever_loop_free_fds(loop);
+		free(loop);
+		return NULL;
+	}
+
+	wimp_log("Started reciever event loop using %s\n", loop->uring != NULL ? "io_uring" : "epoll");
+	loop->next = s_loops;
+	s_loops = loop;
+	s_loops_running++;
+	return loop;
+}
+
+/*
+* Hands the connection over to the loop for its incoming queue, starting
+* one if needed. The thread that made the connection is no longer tracked after.
+*
+* @return Returns true if the loop took ownership of the connection
+*/
+static bool wimp_reciever_loop_add(WimpRecieverConn conn)
+{
+	if (s_loop_mutex == NULL)
+	{
+		return false;
+	}
+
+	//Once the server has stopped its queue may be freed, so nothing is handed over.
+	//Is checked under the registry lock, which stopping the server takes after
+	p_mutex_lock(s_loop_mutex);
+	if (!p_atomic_int_get(conn->args->active))
+	{
+		p_mutex_unlock(s_loop_mutex);
+		return false;
+	}
+
+	WimpRecieverLoop loop = wimp_reciever_loop_find(conn->args->incoming_queue, conn->args->active);
+	if (loop == NULL)
+	{
+		loop = wimp_reciever_loop_create(conn->args->incoming_queue, conn->args->active);
+		if (loop == NULL)
+		{
+			p_mutex_unlock(s_loop_mutex);
+			return false;
+		}
+	}
+
+	wimp_reciever_thread_untrack(conn->args);
+	wimp_reciever_list_push(&loop->pending, conn);
+	wimp_reciever_loop_wake(loop);
+	p_mutex_unlock(s_loop_mutex);
+	return true;
+}
+
+/*
+* Wakes the loop for the queue and waits for it to end, then frees it.
+* Must be called with the registry lock held.
+*/
+static void wimp_reciever_loop_end(WimpInstrQueue* incoming_queue, int32_t* active)
+{
+	//The loop sees the server is inactive as soon as it's woken, then closes
+	//its connections and ends
+	WimpRecieverLoop loop = wimp_reciever_loop_find(incoming_queue, active);
+	if (loop == NULL)
+	{
+		return;
+	}
+
+	loop->stopping = true;
+	wimp_reciever_loop_wake(loop);
+	while (!loop->exited)
+	{
+		p_cond_variable_wait(s_loop_exited, s_loop_mutex);
+	}
+	free(loop);
+}
+
+#else
+
+static bool wimp_reciever_loop_add(WimpRecieverConn conn)
+{
+	return false;
+}
+
+static void wimp_reciever_loop_end(WimpInstrQueue* incoming_queue, int32_t* active)
+{
+	return;
+}
+
+#endif
+
+int32_t wimp_reciever_loop_init(void)
+{
+	if (s_loop_mutex != NULL)
+	{
+		return WIMP_RECIEVER_SUCCESS;
+	}
+
+	s_loop_mutex = p_mutex_new();
+	s_loop_exited = p_cond_variable_new();
+	if (s_loop_mutex == NULL || s_loop_exited == NULL)
+	{
+		if (s_loop_mutex != NULL)
+		{
+			p_mutex_free(s_loop_mutex);
+			s_loop_mutex = NULL;
+		}
+		if (s_loop_exited != NULL)
+		{
+			p_cond_variable_free(s_loop_exited);
+			s_loop_exited = NULL;
+		}
+		return WIMP_RECIEVER_FAIL;
+	}
+	return WIMP_RECIEVER_SUCCESS;
+}
+
+void wimp_reciever_loop_stop(WimpInstrQueue* incoming_queue, int32_t* active)
+{
+	if (s_loop_mutex == NULL)
+	{
+		return;
+	}
+
+	//Threads still connecting or recieving on their own see the server is
+	//inactive once their socket is shut down, so wait for them to finish first.
+	//After that nothing can be handed over to the loop any more
+	p_mutex_lock(s_loop_mutex);
+	bool waiting = true;
+	while (waiting)
+	{
+		waiting = false;
+		for (WimpRecieverThread thread = s_threads; thread != NULL; thread = thread->next)
+		{
+			if (thread->args->incoming_queue != incoming_queue || thread->args->active != active)
+			{
+				continue;
+			}
+			waiting = true;
+			if (thread->socket != NULL)
+			{
+				p_socket_shutdown(thread->socket, TRUE, TRUE, NULL);
+				thread->socket = NULL;
+			}
+		}
+		if (waiting)
+		{
+			p_cond_variable_wait(s_loop_exited, s_loop_mutex);
+		}
+	}
+	wimp_reciever_loop_end(incoming_queue, active);
+	p_mutex_unlock(s_loop_mutex);
+}
+
+void wimp_reciever_loop_shutdown(void)
+{
+	if (s_loop_mutex == NULL)
+	{
+		return;
+	}
+
+	//A loop or thread still running belongs to a server on another thread that
+	//hasn't been freed yet, so the registry has to stay valid for it
+	p_mutex_lock(s_loop_mutex);
+	bool in_use = s_loops_running > 0 || s_threads != NULL;
+	p_mutex_unlock(s_loop_mutex);
+	if (in_use)
+	{
+		wimp_log("Reciever shutdown with recievers still running\n");
+		return;
+	}
+
+	p_cond_variable_free(s_loop_exited);
+	s_loop_exited = NULL;
+	p_mutex_free(s_loop_mutex);
+	s_loop_mutex = NULL;
+}
+
+void wimp_reciever_recieve(RecieverArgs args)
+{	
+	//Initialize the sockets for the reciever and send handshake
+	PSocket* recsock;
+    PSocketAddress* rec_address;
+	WimpRecieverAgreed agreed;
+	if (wimp_reciever_init(&recsock, &rec_address, args, &agreed) == WIMP_RECIEVER_FAIL)
+	{
+		wimp_reciever_thread_end(args);
+		wimp_free_reciever_args(args);
+		p_uthread_exit(WIMP_RECIEVER_FAIL);
+		return;
+	}
+
+	//If the server picked the local transport, it delivers straight to the
+	//incoming queue so the reciever is no longer needed
+	if (agreed.transport == WIMP_TRANSPORT_LOCAL)
+	{
+		wimp_log_success("%s reciever using local transport\n", args->process_name);
+		wimp_reciever_thread_end(args);
+		free(agreed.instr_ids);
+		p_socket_address_free(rec_address);
+		p_socket_free(recsock);
+		wimp_free_reciever_args(args);
+		return;
+	}
+
+	if (agreed.transport == WIMP_TRANSPORT_SHM)
+	{
+		wimp_log_success("%s reciever using shared memory transport\n", args->process_name);
+	}
+
+	WimpRecieverConn conn = malloc(sizeof(struct _WimpRecieverConn));
+	if (conn == NULL)
+	{
+		wimp_reciever_thread_end(args);
+		wimp_shm_ring_free(agreed.ring);
+		free(agreed.instr_ids);
+		p_socket_address_free(rec_address);
+		p_socket_free(recsock);
+		wimp_free_reciever_args(args);
+		p_uthread_exit(WIMP_RECIEVER_FAIL);
+		return;
+	}
+
+	memset(conn, 0, sizeof(struct _WimpRecieverConn));
+	conn->args = args;
+	conn->socket = recsock;
+	conn->address = rec_address;
+	conn->ring = agreed.ring;
+	conn->window = agreed.window;
+	conn->state.state = REC_IDLE;
+	conn->state.instr_ids = agreed.instr_ids;
+	conn->state.instr_id_count = agreed.instr_id_count;
+	conn->state.instr_version = agreed.instr_version;
+	conn->state.protocol_version = agreed.protocol_version;
+
+	//Hand the connection to the event loop for the queue, so this thread can end.
+	//If there isn't one, keep recieving on this thread instead, which ends
+	//straight away if the server has stopped
+	if (!wimp_reciever_loop_add(conn))
+	{
+		wimp_reciever_run_blocking(conn);
+	}
+}
+
+int32_t wimp_start_reciever_thread(const char* recfrom_name, const char* process_domain, int32_t process_port, RecieverArgs args)
+{
+	wimp_log("Starting Reciever for %s recieving from %s\n", args->process_name, recfrom_name);
+
+	//The thread only lives for the handshake, after which the connection is
+	//recieved from by the event loop for the incoming queue. Until then it's
+	//tracked, so freeing the server waits for it
+	wimp_reciever_thread_track(args);
+	PUThread* process_thread = p_uthread_create((PUThreadFunc)&wimp_reciever_recieve, args, false, args->process_name);
+	if (process_thread == NULL)
+	{
+		wimp_log_fail("Failed to create thread for %s reciever!\n", args->process_name);
+		wimp_reciever_thread_end(args);
+		return WIMP_RECIEVER_FAIL;
+	}
+	return WIMP_RECIEVER_SUCCESS;
+}
+
+WimpInstrNode wimp_reciever_allocateinstr(pssize size)
+{
+	return wimp_instr_node_new((size_t)size);
+}
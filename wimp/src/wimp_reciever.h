@@ -21,10 +21,15 @@
 #include <perrortypes.h>
 
 #include <wimp_core.h>
+#include <wimp_endian.h>
 #include <wimp_instruction.h>
+#include <wimp_transport.h>
+#include <wimp_shm_ring.h>
 #include <wimp_log.h>
 
 #define WIMP_RECIEVER_HANDSHAKE 0x706d6977
+#define WIMP_HANDSHAKE_EXTENSION 0x74786577
+#define WIMP_PROTOCOL_VERSION 1 //Version of the wire format, which is little-endian from version 1
 #define WIMP_MESSAGE_BUFFER_BYTES 512
 #define WIMP_RECIEVER_PING 0x676e6970
 #define WIMP_ZERO_BUFFER(buffer) memset(buffer, 0, WIMP_MESSAGE_BUFFER_BYTES)
@@ -55,7 +60,11 @@ typedef uint8_t WimpMsgBuffer[WIMP_MESSAGE_BUFFER_BYTES];
 /// @brief Containins the handshake header information
 /// 
 /// @param handshake_header Header that should be equal to WIMP_RECIEVER_HANDSHAKE
-/// @param process_name_bytes Length in bytes of the process name, in the buffer after the header struct. This is zero if the name overran the buffer.
+/// @param process_name_bytes Length in bytes of the process name, in the buffer after the header struct. This is zero if the name overran the buffer. In the reply, the length of the extension after the header instead, which is zero from a server without one.
+///
+/// This is the layout every WIMP process has sent, and is kept as it is so
+/// processes from before the extension can still handshake. They only read the
+/// process name up to its terminator, so skip the extension sent after it.
 ///
 typedef struct _WimpHandshakeHeader
 {
@@ -63,6 +72,50 @@ typedef struct _WimpHandshakeHeader
 	int32_t process_name_bytes;
 } WimpHandshakeHeader;
 
+///
+/// @brief Contains what the handshake has been extended with
+///
+/// @param extension_header Header that should be equal to WIMP_HANDSHAKE_EXTENSION
+/// @param extension_bytes Length in bytes of the extension, so a later version can add fields that are skipped
+/// @param protocol_version The WIMP_PROTOCOL_VERSION of the reciever, or the version picked by the server in the reply
+/// @param transport The transports offered by the reciever, or the transport picked by the server in the reply
+/// @param local_endpoint The id of the reciever's local endpoint, zero if it has none
+/// @param shm_name_bytes Length in bytes of the shared memory ring name, in the buffer after the extension. Zero if no ring is offered.
+/// @param credits The credit window offered by the reciever, or the window accepted by the server in the reply. Zero if not flow controlled.
+/// @param instr_ids Set by the reciever if it takes instructions by ID. In the reply, the amount of names registered by the server.
+/// @param instr_names_bytes Length in bytes of the names registered by the server, in the buffer after the reply extension
+/// @param instr_version The highest instruction version the reciever reads, or the version picked by the server in the reply. Zero is taken as WIMP_INSTR_VERSION_NAMES.
+/// @param process_token The token of the address space the handshake was sent from
+///
+/// The reciever sends it after the process name, and the server replies with
+/// one straight after the header, but only to a reciever that sent one. A peer
+/// without it is protocol version zero, and only takes the socket transport
+/// and the names version of instructions, sent without IDs.
+///
+/// With a credit window the server only sends that many instructions ahead of
+/// the reciever. The reciever grants credits back over the connection as an
+/// int32_t count, once they're added to its queue and the queue isn't
+/// throttled (see wimp_instr_queue_set_watermarks()).
+///
+/// The header and extension are little-endian on the wire, like everything
+/// else sent from protocol version 1. Version zero sent everything in host
+/// order, so is taken to be the order of this host.
+///
+typedef struct _WimpHandshakeExtension
+{
+	int32_t extension_header;
+	int32_t extension_bytes;
+	int32_t protocol_version;
+	int32_t transport;
+	int32_t local_endpoint;
+	int32_t shm_name_bytes;
+	int32_t credits;
+	int32_t instr_ids;
+	int32_t instr_names_bytes;
+	int32_t instr_version;
+	uint64_t process_token;
+} WimpHandshakeExtension;
+
 ///
 /// @brief Reciver arguments structure
 ///
@@ -110,10 +163,55 @@ WIMP_API int32_t wimp_get_instr_size(uint8_t* buffer);
 /// @param process_name The name of the process this reciever writes instructions to
 /// @param message_buffer A pointer to the buffer to write the handshake into
 /// 
+/// Only the header and process name are written, the reciever writes its
+/// extension after them with wimp_handshake_write_extension().
+/// 
 /// @return Returns a copy of the header. This will be intialized to { 0, 0 } if function fails for any reason.
 ///
 WIMP_API WimpHandshakeHeader wimp_create_handshake(const char* process_name, uint8_t* message_buffer);
 
+///
+/// @brief Reads a handshake header from the wire
+///
+/// A header in host order is taken too, as processes before protocol
+/// version 1 sent it that way.
+///
+/// @param buffer The buffer holding the header
+/// @param header Pointer to store the header in, in host order
+///
+/// @return Returns false if the buffer doesn't start with a handshake
+///
+WIMP_API bool wimp_handshake_read_header(const uint8_t* buffer, WimpHandshakeHeader* header);
+
+///
+/// @brief Writes a handshake extension to the wire
+///
+/// The header and length of the extension are filled in.
+///
+/// @param buffer The buffer to write to, with room for a WimpHandshakeExtension
+/// @param extension The extension to write
+///
+/// @return Returns the length of the extension written in bytes
+///
+WIMP_API int32_t wimp_handshake_write_extension(uint8_t* buffer, WimpHandshakeExtension extension);
+
+///
+/// @brief Reads a handshake extension from the wire
+///
+/// If there is no extension, or it hasn't all been given, the extension is
+/// set to what a peer without one agrees to: protocol version zero, the
+/// socket transport and nothing else. Fields of a shorter extension from an
+/// earlier version are zero, and any a later version added are skipped.
+///
+/// @param buffer The buffer the extension would start at
+/// @param bytes The bytes in the buffer
+/// @param extension Pointer to store the extension in, in host order
+///
+/// @return Returns the length of the extension in bytes, which may be more than
+/// was given if the rest hasn't been recieved yet, or zero if there is none
+///
+WIMP_API int32_t wimp_handshake_read_extension(const uint8_t* buffer, size_t bytes, WimpHandshakeExtension* extension);
+
 ///
 /// @brief Creates the reciever arguments
 ///
@@ -131,8 +229,45 @@ WIMP_API WimpHandshakeHeader wimp_create_handshake(const char* process_name, uin
 ///
 WIMP_API RecieverArgs wimp_get_reciever_args(const char* process_name, const char* recfrom_domain, int32_t recfrom_port, WimpInstrQueue* incomingq, int32_t* active);
 
+///
+/// @brief Initializes the registry of reciever threads and event loops
+///
+/// Is called by wimp_init, so doesn't need to be called directly.
+///
+/// @return Returns either WIMP_RECIEVER_SUCCESS or WIMP_RECIEVER_FAIL
+///
+WIMP_API int32_t wimp_reciever_loop_init(void);
+
+///
+/// @brief Stops the recievers for a queue, waiting until they have ended
+///
+/// The server must already be inactive. Reciever threads still connecting or
+/// recieving on their own have their sockets shut down and are waited for,
+/// then the event loop is woken straight away to close its connections. Once
+/// this returns nothing recieves into the queue any more. Is called by
+/// wimp_server_free, which has to be before the matching wimp_shutdown.
+///
+/// @param incoming_queue The queue the loop recieves into
+/// @param active The active flag the loop was started with
+///
+WIMP_API void wimp_reciever_loop_stop(WimpInstrQueue* incoming_queue, int32_t* active);
+
+///
+/// @brief Shuts down the registry of reciever threads and event loops
+///
+/// Is called by wimp_shutdown, so doesn't need to be called directly.
+///
+WIMP_API void wimp_reciever_loop_shutdown(void);
+
 ///
 /// @brief Starts a reciever thread
+///
+/// The thread connects and performs the handshake. On linux the connection is
+/// then handed to an event loop (io_uring if built with WIMP_USE_IO_URING and
+/// supported, otherwise epoll) shared by every reciever writing to the
+/// same incoming queue and the thread ends, so a server recieving from many
+/// processes only needs one reciever thread. Elsewhere the thread keeps
+/// recieving from the connection.
 /// 
 /// @param recfrom_name The name of the process to recieve from. Used to create the unique thread name for the reciever thread.
 /// @param process_domain The domain that this reciver writes to
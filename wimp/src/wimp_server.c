@@ -1,8 +1,15 @@
 #include <wimp_server.h>
 #include <utility/thread_local.h>
 #include <wimp_log.h>
+#include <wimp_pool.h>
 #include <stdlib.h>
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
 /*
 * A thread can have a local server instance to make sending instructions
 * easier.
@@ -35,6 +42,9 @@ void wimp_close_local_server()
 	}
 	wimp_server_free(_local_server);
 	_local_server = NULL;
+
+	//The thread may be about to end, so the nodes it cached go back to the pool
+	wimp_pool_thread_release();
 }
 
 void wimp_add_local_server(const char* dest, const char* instr, const void* args, size_t arg_size_bytes)
@@ -53,44 +63,146 @@ int32_t wimp_create_server(WimpServer* server, const char* process_name, const c
 	WimpProcessTable ptable = wimp_create_process_table();
 	WIMP_ZERO_BUFFER(server->recbuffer); WIMP_ZERO_BUFFER(server->sendbuffer);
 
-	PSocketAddress* addr;
+	PSocketAddress* addr = NULL;
 	PSocket* s;
 	PError* err;
 
-	if ((addr = p_socket_address_new(domain, port)) == NULL)
+	if (wimp_socket_is_unix_domain(domain))
 	{
-		return WIMP_SERVER_ADDRESS_FAIL;
-	}
+		//Unix domain sockets are bound to the path, with no address or port
+		if ((s = wimp_socket_unix_new()) == NULL)
+		{
+			return WIMP_SERVER_SOCKET_FAIL;
+		}
 
-	if ((s = p_socket_new(P_SOCKET_FAMILY_INET, P_SOCKET_TYPE_STREAM, P_SOCKET_PROTOCOL_TCP, &err)) == NULL)
-	{
-		wimp_log_fail("Failed to create server socket! (%d): %s\n", p_error_get_code(err), p_error_get_message(err));
-		p_error_free(err);
-		p_socket_address_free(addr);
-		return WIMP_SERVER_SOCKET_FAIL;
+		if (!wimp_socket_unix_bind(s, domain))
+		{
+			p_socket_free(s);
+			return WIMP_SERVER_BIND_FAIL;
+		}
 	}
-
-	if (!p_socket_bind(s, addr, TRUE, &err))
+	else
 	{
-		wimp_log_fail("Failed to bind server socket! (%d): %s\n", p_error_get_code(err), p_error_get_message(err));
-		p_error_free(err);
-		p_socket_address_free(addr);
-		p_socket_free(s);
-		return WIMP_SERVER_BIND_FAIL;
+		if ((addr = p_socket_address_new(domain, port)) == NULL)
+		{
+			return WIMP_SERVER_ADDRESS_FAIL;
+		}
+
+		if ((s = p_socket_new(P_SOCKET_FAMILY_INET, P_SOCKET_TYPE_STREAM, P_SOCKET_PROTOCOL_TCP, &err)) == NULL)
+		{
+			wimp_log_fail("Failed to create server socket! (%d): %s\n", p_error_get_code(err), p_error_get_message(err));
+			p_error_free(err);
+			p_socket_address_free(addr);
+			return WIMP_SERVER_SOCKET_FAIL;
+		}
+
+		if (!p_socket_bind(s, addr, TRUE, &err))
+		{
+			wimp_log_fail("Failed to bind server socket! (%d): %s\n", p_error_get_code(err), p_error_get_message(err));
+			p_error_free(err);
+			p_socket_address_free(addr);
+			p_socket_free(s);
+			return WIMP_SERVER_BIND_FAIL;
+		}
 	}
 	
 	server->process_name = process_name;
+	server->domain = sdsnew(domain);
 	server->addr = addr;
 	server->ptable = ptable;
 	server->server = s;
 	server->parent = NULL;
+	server->process_id = wimp_instr_register(process_name);
+	server->parent_id = WIMP_INSTR_ID_NONE;
 	server->incomingmsg = wimp_create_instr_queue();
 	server->outgoingmsg = wimp_create_instr_queue();
+	server->endpoint = wimp_local_endpoint_create(&server->incomingmsg);
+	server->transports = WIMP_TRANSPORT_ALL;
+	server->uring = wimp_uring_create(0);
+	server->reserved = NULL;
+	server->handlers = NULL;
+#ifdef __linux__
+	server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+	server->wake_fd = -1;
+#endif
 	p_atomic_int_set(&server->active, 1);
 	wimp_log_success("Server created! %s %s:%d\n", process_name, domain, port);
 	return WIMP_SERVER_SUCCESS;
 }
 
+void wimp_server_set_transports(WimpServer* server, int32_t transports)
+{
+	server->transports = transports | WIMP_TRANSPORT_SOCKET;
+	if (server->endpoint != NULL)
+	{
+		wimp_local_endpoint_set_transports(server->endpoint, server->transports);
+	}
+}
+
+/*
+* Wakes a flush waiting on a local endpoint
+*/
+static void wimp_server_wake(void* context)
+{
+#ifdef __linux__
+	WimpServer* server = context;
+	uint64_t value = 1;
+	ssize_t written = write(server->wake_fd, &value, sizeof(uint64_t));
+	(void)written;
+#else
+	(void)context;
+#endif
+}
+
+/*
+* Drops the waits the server made on the endpoint of a process, before it's released
+*/
+static void wimp_server_cancel_wait(WimpServer* server, WimpProcessData data)
+{
+	if (data->process_endpoint != NULL)
+	{
+		wimp_local_endpoint_cancel_wait(data->process_endpoint, server);
+	}
+}
+
+/*
+* Recieves until there are the bytes wanted in the buffer, blocking until they arrive
+*
+* @return Returns false if the socket closed first
+*/
+static bool wimp_server_receive_to(PSocket* socket, uint8_t* buffer, size_t* recieved, size_t wanted)
+{
+	while (*recieved < wanted)
+	{
+		pssize size = p_socket_receive(socket, (pchar*)&buffer[*recieved], wanted - *recieved, NULL);
+		if (size <= 0)
+		{
+			return false;
+		}
+		*recieved += (size_t)size;
+	}
+	return true;
+}
+
+/*
+* Sends the whole buffer, blocking until it's gone
+*/
+static bool wimp_server_send_all(PSocket* socket, const uint8_t* data, size_t bytes)
+{
+	size_t sent = 0;
+	while (sent < bytes)
+	{
+		pssize size = p_socket_send(socket, (const pchar*)&data[sent], bytes - sent, NULL);
+		if (size <= 0)
+		{
+			return false;
+		}
+		sent += (size_t)size;
+	}
+	return true;
+}
+
 int32_t wimp_server_process_accept(WimpServer* server, int pcount, ...)
 {
 	//Get an array of the process names
@@ -140,15 +252,39 @@ int32_t wimp_server_process_accept(WimpServer* server, int pcount, ...)
 			}
 
 			//Check start of handshake
-			WimpHandshakeHeader potential_handshake = *((WimpHandshakeHeader*)((void*)server->recbuffer));
+			WimpHandshakeHeader potential_handshake;
 			size_t offset = sizeof(WimpHandshakeHeader);
-			if (potential_handshake.handshake_header != WIMP_RECIEVER_HANDSHAKE)
+			if ((size_t)handshake_size < offset || !wimp_handshake_read_header(server->recbuffer, &potential_handshake)
+				|| potential_handshake.process_name_bytes <= 0 || offset + (size_t)potential_handshake.process_name_bytes > (size_t)handshake_size)
+			{
+				continue;
+			}
+
+			//The extension follows the name, unless the reciever is from before it.
+			//The lengths come off the wire, so are checked before being added as sizes
+			WimpHandshakeExtension extension;
+			size_t recieved = (size_t)handshake_size;
+			size_t extension_offset = offset + (size_t)potential_handshake.process_name_bytes;
+			int32_t extension_bytes = wimp_handshake_read_extension(&server->recbuffer[extension_offset], recieved - extension_offset, &extension);
+			if (extension_bytes > 0 && extension_offset + (size_t)extension_bytes > recieved)
+			{
+				if (extension_offset + (size_t)extension_bytes > WIMP_MESSAGE_BUFFER_BYTES
+					|| !wimp_server_receive_to(con, server->recbuffer, &recieved, extension_offset + (size_t)extension_bytes))
+				{
+					continue;
+				}
+				wimp_handshake_read_extension(&server->recbuffer[extension_offset], recieved - extension_offset, &extension);
+			}
+			size_t ring_offset = extension_offset + (size_t)extension_bytes;
+			if (extension.shm_name_bytes > 0 && ring_offset + (size_t)extension.shm_name_bytes <= WIMP_MESSAGE_BUFFER_BYTES
+				&& !wimp_server_receive_to(con, server->recbuffer, &recieved, ring_offset + (size_t)extension.shm_name_bytes))
 			{
 				continue;
 			}
 
 			//Get process name
 			char* proc_name = &server->recbuffer[offset];
+			proc_name[potential_handshake.process_name_bytes - 1] = '\0';
 
 			//Check if it is an expected process
 			bool isvalid = false;
@@ -181,13 +317,58 @@ int32_t wimp_server_process_accept(WimpServer* server, int pcount, ...)
 			wimp_log("Process added!\n");
 
 			procdat->process_connection = con;
+			procdat->process_transport = WIMP_TRANSPORT_SOCKET;
 			procdat->process_active = WIMP_PROCESS_ACTIVE;
 
+			//If the reciever is in this address space, use its endpoint instead of the socket
+			if ((extension.transport & WIMP_TRANSPORT_LOCAL)
+				&& (server->transports & WIMP_TRANSPORT_LOCAL)
+				&& extension.process_token == wimp_transport_process_token())
+			{
+				wimp_server_cancel_wait(server, procdat);
+				wimp_local_endpoint_release(procdat->process_endpoint);
+				procdat->process_endpoint = wimp_local_endpoint_acquire(extension.local_endpoint);
+				if (procdat->process_endpoint != NULL)
+				{
+					procdat->process_transport = WIMP_TRANSPORT_LOCAL;
+					wimp_log("Using local transport for %s\n", proc_name);
+				}
+			}
+
+			//Past the local transport, which checks the queue itself, the
+			//reciever's credit window limits how far ahead this runs
+			procdat->process_credits = -1;
+			procdat->process_grant_bytes = 0;
+			if (procdat->process_transport != WIMP_TRANSPORT_LOCAL && extension.credits > 0)
+			{
+				procdat->process_credits = extension.credits;
+			}
+
+			//Otherwise if the reciever offered a ring that can be opened, it is on this host
+			if (procdat->process_transport == WIMP_TRANSPORT_SOCKET
+				&& (extension.transport & WIMP_TRANSPORT_SHM)
+				&& (server->transports & WIMP_TRANSPORT_SHM)
+				&& extension.shm_name_bytes > 0
+				&& ring_offset + (size_t)extension.shm_name_bytes <= recieved)
+			{
+				char* ring_name = (char*)&server->recbuffer[ring_offset];
+				ring_name[(size_t)extension.shm_name_bytes - 1] = '\0';
+
+				wimp_shm_ring_free(procdat->process_ring);
+				procdat->process_ring = wimp_shm_ring_open(ring_name, extension.process_token);
+				if (procdat->process_ring != NULL)
+				{
+					procdat->process_transport = WIMP_TRANSPORT_SHM;
+					wimp_log("Using shared memory transport for %s\n", proc_name);
+				}
+			}
+
 			if (procdat->process_relation == WIMP_Process_Parent)
 			{
 				if (server->parent == NULL)
 				{
 					server->parent = sdsnew(proc_name);
+					server->parent_id = procdat->process_id;
 				}
 				else
 				{
@@ -198,14 +379,64 @@ int32_t wimp_server_process_accept(WimpServer* server, int pcount, ...)
 			//Clear rec buffer
 			WIMP_ZERO_BUFFER(server->recbuffer);
 
-			//Send handshake back with no process name this time
-			WimpHandshakeHeader* sendheader = ((WimpHandshakeHeader*)server->sendbuffer);
-			sendheader->handshake_header = WIMP_RECIEVER_HANDSHAKE;
-			sendheader->process_name_bytes = 0;
+			//If the reciever takes instructions by ID, send the names registered so
+			//far so it knows them. The local transport shares the registry already
+			uint8_t* instr_names = NULL;
+			size_t instr_names_bytes = 0;
+			procdat->process_instr_ids = 0;
+			if (extension.instr_ids > 0 && procdat->process_transport != WIMP_TRANSPORT_LOCAL)
+			{
+				uint32_t instr_ids = wimp_instr_registry_count();
+				instr_names = wimp_instr_registry_pack(instr_ids, &instr_names_bytes);
+				procdat->process_instr_ids = instr_names != NULL ? instr_ids : 0;
+			}
+
+			//A reciever that doesn't know the fixed header is sent the names version,
+			//in host order if it is from before protocol version 1
+			procdat->process_instr_version = WIMP_INSTR_VERSION;
+			if (procdat->process_transport != WIMP_TRANSPORT_LOCAL && extension.instr_version < WIMP_INSTR_VERSION_FIXED)
+			{
+				procdat->process_instr_version = WIMP_INSTR_VERSION_NAMES;
+			}
+			procdat->process_protocol_version = extension.protocol_version < WIMP_PROTOCOL_VERSION ? extension.protocol_version : WIMP_PROTOCOL_VERSION;
+
+			//Send handshake back with no process name this time, and the extension
+			//straight after if the reciever sent one
+			WimpHandshakeExtension reply;
+			memset(&reply, 0, sizeof(WimpHandshakeExtension));
+			reply.protocol_version = procdat->process_protocol_version;
+			reply.transport = procdat->process_transport;
+			reply.credits = procdat->process_credits > 0 ? procdat->process_credits : 0;
+			reply.instr_ids = (int32_t)procdat->process_instr_ids;
+			reply.instr_names_bytes = procdat->process_instr_ids > 0 ? (int32_t)instr_names_bytes : 0;
+			reply.instr_version = procdat->process_instr_version;
+			reply.process_token = wimp_transport_process_token();
+			int32_t reply_bytes = extension_bytes > 0 ? wimp_handshake_write_extension(&server->sendbuffer[sizeof(WimpHandshakeHeader)], reply) : 0;
+			bool send_names = reply_bytes > 0 && reply.instr_names_bytes > 0;
 
-			p_socket_send(con, server->sendbuffer, sizeof(WimpHandshakeHeader), NULL);
+			WimpHandshakeHeader sendheader =
+			{
+				(int32_t)WIMP_PEER32(procdat->process_protocol_version, WIMP_RECIEVER_HANDSHAKE),
+				(int32_t)WIMP_PEER32(procdat->process_protocol_version, reply_bytes)
+			};
+			memcpy(server->sendbuffer, &sendheader, sizeof(WimpHandshakeHeader));
+
+			wimp_server_send_all(con, server->sendbuffer, sizeof(WimpHandshakeHeader) + (size_t)reply_bytes);
+			if (send_names && !wimp_server_send_all(con, instr_names, instr_names_bytes))
+			{
+				wimp_log_fail("Failed to send instruction names to %s\n", proc_name);
+			}
+			free(instr_names);
 			WIMP_ZERO_BUFFER(server->sendbuffer);
 
+			//The socket isn't needed past the handshake for the local transport
+			if (procdat->process_transport == WIMP_TRANSPORT_LOCAL)
+			{
+				p_socket_close(con, NULL);
+				p_socket_free(con);
+				procdat->process_connection = NULL;
+			}
+
 			accepted_count++;
 		}
 		else
@@ -243,94 +474,129 @@ bool wimp_server_check_process_listening(WimpServer* server, const char* process
 		return false;
 	}
 
-	PError* err = NULL;
-	int32_t ping = WIMP_RECIEVER_PING;
-	if (p_socket_send(procdat->process_connection, (const pchar*)&ping, sizeof(int32_t), NULL) != -1)
+	if (procdat->process_transport == WIMP_TRANSPORT_LOCAL)
+	{
+		if (wimp_local_endpoint_is_open(procdat->process_endpoint))
+		{
+			return true;
+		}
+	}
+	else if (procdat->process_transport == WIMP_TRANSPORT_SOCKET && procdat->process_pending.nextnode != NULL)
 	{
+		//A ping can't go in the middle of a partly sent instruction, and the
+		//connection was taking instructions anyway
 		return true;
 	}
+	else
+	{
+		int32_t ping = (int32_t)WIMP_PEER32(procdat->process_protocol_version, WIMP_RECIEVER_PING);
+		if (p_socket_send(procdat->process_connection, (const pchar*)&ping, sizeof(int32_t), NULL) != -1)
+		{
+			return true;
+		}
+	}
 
 	procdat->process_active = false;
+	wimp_server_cancel_wait(server, procdat);
 	wimp_process_table_remove(&server->ptable, process_name);
 	return false;
 }
 
-typedef struct _InstrBundle
+/*
+* Creates an instruction from this server in a node, with registered names sent by ID
+*/
+static WimpInstrNode wimp_server_create_node(const char* process, uint32_t process_id, const char* dest, const char* instr, const void* args, size_t arg_size_bytes)
 {
-	uint8_t* instr;
-	size_t size;
-} InstrBundle;
+	return wimp_instr_node_create(dest, wimp_instr_get_id(dest), process, process_id, instr, wimp_instr_get_id(instr), args, arg_size_bytes);
+}
 
-static void wimp_server_free_bundle(InstrBundle* bundle)
+void wimp_server_add(WimpServer* server, const char* dest, const char* instr, const void* args, size_t arg_size_bytes)
 {
-	free(bundle->instr);
-	bundle->instr = NULL;
-	bundle->size = 0;
+	WimpInstrNode node = wimp_server_create_node(server->process_name, server->process_id, dest, instr, args, arg_size_bytes);
+	if (node != NULL)
+	{
+		wimp_instr_queue_add_existing(&server->outgoingmsg, node);
+	}
 }
 
-static InstrBundle wimp_server_bundle_instr(const char* process, const char* dest, const char* instr, const void* args, size_t arg_size_bytes)
+int32_t wimp_server_pack_begin(WimpServer* server, WimpStrPackBuilder* builder, const char* dest, const char* instr, size_t reserve_bytes)
 {
-	InstrBundle bundle = { NULL, 0 };
-
-	//Work out formatted size
-	size_t header_bytes = sizeof(int32_t);
-	size_t destp_bytes = (strlen(dest) + 1) * sizeof(char);
-	size_t sourcep_bytes = (strlen(process) + 1) * sizeof(char);
-	size_t instr_bytes = (strlen(instr) + 1) * sizeof(char);
-	size_t arglen_bytes = sizeof(int32_t);
-	size_t total_bytes = header_bytes + sourcep_bytes + destp_bytes + instr_bytes + arglen_bytes + arg_size_bytes;
+	int32_t res = wimp_instr_pack_begin(builder, dest, wimp_instr_get_id(dest), server->process_name, server->process_id, instr, wimp_instr_get_id(instr), reserve_bytes);
+	return res == WIMP_INSTRUCTION_SUCCESS ? WIMP_SERVER_SUCCESS : WIMP_SERVER_FAIL;
+}
 
-	//Create a buffer and add the instructions
-	uint8_t* instrbuff = malloc(total_bytes);
-	if (instrbuff == NULL)
+int32_t wimp_server_add_pack(WimpServer* server, WimpStrPackBuilder* builder)
+{
+	size_t bytes = 0;
+	uint8_t* instr = wimp_instr_pack_finish(builder, &bytes);
+	if (instr == NULL)
 	{
-		return bundle;
+		return WIMP_SERVER_FAIL;
 	}
+	if (wimp_instr_queue_add(&server->outgoingmsg, instr, bytes) != WIMP_INSTRUCTION_SUCCESS)
+	{
+		free(instr);
+		return WIMP_SERVER_FAIL;
+	}
+	return WIMP_SERVER_SUCCESS;
+}
 
-	size_t offset = 0;
-
-	memcpy(&instrbuff[offset], &total_bytes, header_bytes);
-	offset += header_bytes;
-
-	memcpy(&instrbuff[offset], dest, destp_bytes);
-	offset += destp_bytes;
-
-	memcpy(&instrbuff[offset], process, sourcep_bytes);
-	offset += sourcep_bytes;
+void* wimp_server_add_begin(WimpServer* server, const char* dest, const char* instr, size_t arg_bytes)
+{
+	if (server->reserved != NULL)
+	{
+		wimp_log_fail("%s reserved an instruction before committing the last one\n", server->process_name);
+		wimp_server_add_cancel(server);
+	}
 
-	memcpy(&instrbuff[offset], instr, instr_bytes);
-	offset += instr_bytes;
+	//Without the args the space for them is left to be written in place
+	server->reserved = wimp_server_create_node(server->process_name, server->process_id, dest, instr, NULL, arg_bytes);
+	if (server->reserved == NULL)
+	{
+		return NULL;
+	}
 
-	memcpy(&instrbuff[offset], &arg_size_bytes, arglen_bytes);
-	offset += arglen_bytes;
+	uint8_t* instruction = wimp_instr_node_data(server->reserved).instruction;
+	WimpInstrHeader* header = (WimpInstrHeader*)instruction;
+	return &instruction[header->args];
+}
 
-	if (arg_size_bytes > 0)
+int32_t wimp_server_add_commit(WimpServer* server)
+{
+	if (server->reserved == NULL)
 	{
-		memcpy(&instrbuff[offset], args, arg_size_bytes);
+		return WIMP_SERVER_FAIL;
 	}
 
-	bundle.instr = instrbuff;
-	bundle.size = total_bytes;
-	return bundle;
+	int32_t res = wimp_instr_queue_add_existing(&server->outgoingmsg, server->reserved);
+	server->reserved = NULL;
+	return res == WIMP_INSTRUCTION_SUCCESS ? WIMP_SERVER_SUCCESS : WIMP_SERVER_FAIL;
 }
 
-void wimp_server_add(WimpServer* server, const char* dest, const char* instr, const void* args, size_t arg_size_bytes)
+void wimp_server_add_cancel(WimpServer* server)
 {
-	InstrBundle instr_bundle = wimp_server_bundle_instr(server->process_name, dest, instr, args, arg_size_bytes);
-	wimp_instr_queue_add(&server->outgoingmsg, instr_bundle.instr, instr_bundle.size);
+	wimp_instr_node_free(server->reserved);
+	server->reserved = NULL;
 }
 
 WimpInstrNode wimp_server_wait_response(WimpServer* server, const char* instr, int32_t timeout)
 {
-	//Create a temporary instruction queue to pass instructions over to
+	//Create a temporary instruction queue to pass instructions over to. The
+	//incoming queue is only locked to take what has arrived, so the batch and
+	//the temporary queue are only used by this thread
 	WimpInstrQueue tmpqueue = wimp_create_instr_queue();
+	WimpInstrQueue batch;
+	memset(&batch, 0, sizeof(WimpInstrQueue));
 	WimpInstrNode node = NULL;
 	bool disconnect = false;
 	while (!disconnect)
 	{
 		//Reading stage
 		wimp_instr_queue_high_prio_lock(&server->incomingmsg);
-		WimpInstrNode currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+		wimp_instr_queue_take_all(&server->incomingmsg, &batch);
+		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+
+		WimpInstrNode currentnode = wimp_instr_queue_pop(&batch);
 		while (currentnode != NULL)
 		{
 			//Extract the instruction and process
@@ -352,12 +618,12 @@ WimpInstrNode wimp_server_wait_response(WimpServer* server, const char* instr, i
 				//Add node to tmp queue
 				wimp_instr_queue_add_existing(&tmpqueue, currentnode);
 			}
-			currentnode = wimp_instr_queue_pop(&server->incomingmsg);
+			currentnode = wimp_instr_queue_pop(&batch);
 		}
-		wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
 	}
 
-	//Add tmp queue to front of incoming queue
+	//Add tmp queue, then whatever came after the response, to front of incoming queue
+	wimp_instr_queue_append_queue(&tmpqueue, &batch);
 	wimp_instr_queue_high_prio_lock(&server->incomingmsg);
 	int32_t success = wimp_instr_queue_prepend_queue(&server->incomingmsg, &tmpqueue);
 	assert(success == WIMP_INSTRUCTION_SUCCESS && "Error recombining queues!");
@@ -368,7 +634,8 @@ WimpInstrNode wimp_server_wait_response(WimpServer* server, const char* instr, i
 
 bool wimp_server_instr_routed(WimpServer* server, const char* dest_process, WimpInstrNode instrnode)
 {
-	if (strcmp(dest_process, server->process_name) != 0)
+	//A destination sent by ID points at the registered name, so usually matches without comparing
+	if (dest_process != wimp_instr_get_name(server->process_id) && strcmp(dest_process, server->process_name) != 0)
 	{
 		//Add to the outgoing and continue to prevent freeing
 		wimp_instr_queue_add_existing(&server->outgoingmsg, instrnode);
@@ -377,10 +644,371 @@ bool wimp_server_instr_routed(WimpServer* server, const char* dest_process, Wimp
 	return false;
 }
 
+typedef struct _WimpServerHandler
+{
+	WIMP_SERVER_HANDLER handler;
+	void* context;
+} WimpServerHandler;
+
+struct _WimpServerHandlers
+{
+	WimpServerHandler by_id[WIMP_INSTR_REGISTRY_CAPACITY + 1];
+	WimpServerHandler fallback;
+};
+
+int32_t wimp_server_set_handler(WimpServer* server, const char* instr, WIMP_SERVER_HANDLER handler, void* context)
+{
+	if (server->handlers == NULL)
+	{
+		server->handlers = calloc(1, sizeof(struct _WimpServerHandlers));
+		if (server->handlers == NULL)
+		{
+			return WIMP_SERVER_FAIL;
+		}
+	}
+
+	WimpServerHandler* entry = &server->handlers->fallback;
+	if (instr != NULL)
+	{
+		uint32_t id = wimp_instr_register(instr);
+		if (id == WIMP_INSTR_ID_NONE || id > WIMP_INSTR_REGISTRY_CAPACITY)
+		{
+			wimp_log_fail("Couldn't register %s for a handler\n", instr);
+			return WIMP_SERVER_FAIL;
+		}
+		entry = &server->handlers->by_id[id];
+	}
+	entry->handler = handler;
+	entry->context = context;
+	return WIMP_SERVER_SUCCESS;
+}
+
+/*
+* Gets the handler for an instruction. Names sent without their ID are looked
+* up, which is still a hash rather than a comparison with each handler
+*/
+static const WimpServerHandler* wimp_server_find_handler(WimpServer* server, WimpInstrMeta meta)
+{
+	if (server->handlers == NULL)
+	{
+		return NULL;
+	}
+
+	uint32_t id = meta.instr_id != WIMP_INSTR_ID_NONE ? meta.instr_id : wimp_instr_get_id(meta.instr);
+	if (id != WIMP_INSTR_ID_NONE && id <= WIMP_INSTR_REGISTRY_CAPACITY && server->handlers->by_id[id].handler != NULL)
+	{
+		return &server->handlers->by_id[id];
+	}
+	return server->handlers->fallback.handler != NULL ? &server->handlers->fallback : NULL;
+}
+
+int32_t wimp_server_dispatch(WimpServer* server, int32_t budget)
+{
+	//Take the instructions first, so the recievers aren't held up by the handlers.
+	//The batch is only used by this thread, so doesn't need its own mutexes
+	WimpInstrQueue batch;
+	memset(&batch, 0, sizeof(WimpInstrQueue));
+	int32_t taken = 0;
+	wimp_instr_queue_high_prio_lock(&server->incomingmsg);
+	if (budget <= 0)
+	{
+		wimp_instr_queue_take_all(&server->incomingmsg, &batch);
+		taken = (int32_t)batch.length;
+	}
+	while (taken < budget)
+	{
+		WimpInstrNode node = wimp_instr_queue_pop(&server->incomingmsg);
+		if (node == NULL)
+		{
+			break;
+		}
+		wimp_instr_queue_add_existing(&batch, node);
+		taken++;
+	}
+	wimp_instr_queue_high_prio_unlock(&server->incomingmsg);
+
+	WimpInstrNode node = wimp_instr_queue_pop(&batch);
+	while (node != NULL)
+	{
+		WimpInstrMeta meta = wimp_instr_get_from_node(node);
+		if (meta.instr != NULL && wimp_server_instr_routed(server, meta.dest_process, node))
+		{
+			node = wimp_instr_queue_pop(&batch);
+			continue;
+		}
+
+		const WimpServerHandler* handler = meta.instr != NULL ? wimp_server_find_handler(server, meta) : NULL;
+		if (handler != NULL)
+		{
+			handler->handler(server, meta, handler->context);
+		}
+		wimp_instr_node_free(node);
+		node = wimp_instr_queue_pop(&batch);
+	}
+	return taken;
+}
+
+/*
+* Moves the pending instructions of a process on past the bytes sent, freeing
+* the ones that are fully sent
+*/
+static void wimp_server_pending_advance(WimpProcessData data, size_t sent)
+{
+	sent += data->process_pending_sent;
+	WimpInstrNode node = data->process_pending.nextnode;
+	while (node != NULL)
+	{
+		size_t bytes = wimp_instr_node_data(node).instruction_bytes;
+		if (sent < bytes)
+		{
+			break;
+		}
+		sent -= bytes;
+		wimp_instr_node_free(wimp_instr_queue_pop(&data->process_pending));
+		node = data->process_pending.nextnode;
+		if (data->process_credits > 0)
+		{
+			data->process_credits--;
+		}
+	}
+	data->process_pending_sent = node != NULL ? sent : 0;
+
+	//Nothing can be queued in front of the rest of a partly sent instruction, whatever its lane
+	if (data->process_pending_sent > 0)
+	{
+		wimp_instr_queue_pin_front(&data->process_pending);
+	}
+}
+
+/*
+* Marks the process inactive and drops everything pending for it
+*/
+static void wimp_server_pending_fail(WimpProcessData data)
+{
+	data->process_active = WIMP_PROCESS_INACTIVE;
+	WimpInstrNode node = wimp_instr_queue_pop(&data->process_pending);
+	while (node != NULL)
+	{
+		wimp_instr_node_free(node);
+		node = wimp_instr_queue_pop(&data->process_pending);
+	}
+	data->process_pending_sent = 0;
+}
+
+/*
+* Points the buffers at the pending instructions of a process, straight from
+* their nodes, starting after what is already sent. Stops at the credits the
+* process has, which already cover a partly sent instruction.
+*
+* @return Returns the amount of buffers filled
+*/
+static size_t wimp_server_pending_gather(WimpProcessData data, WimpSocketBuffer* buffers, size_t* bytes)
+{
+	size_t count = 0;
+	size_t offset = data->process_pending_sent;
+	*bytes = 0;
+	WimpInstrNode node = data->process_pending.nextnode;
+	while (node != NULL && count < WIMP_SOCKET_MAX_BUFFERS && (data->process_credits < 0 || count < (size_t)data->process_credits))
+	{
+		//Is the raw data as it may be in the names version for the process
+		WimpInstr instr = wimp_instr_node_data(node);
+		buffers[count].data = &instr.instruction[offset];
+		buffers[count].bytes = instr.instruction_bytes - offset;
+		*bytes += buffers[count].bytes;
+		count++;
+		offset = 0;
+		node = wimp_instr_node_next(node);
+	}
+	return count;
+}
+
+/*
+* Copies as much of the pending instructions into the ring as it has space for
+*/
+static void wimp_server_pending_write_ring(WimpProcessData data)
+{
+	WimpInstrNode node = data->process_pending.nextnode;
+	while (node != NULL && data->process_credits != 0)
+	{
+		WimpInstr instr = wimp_instr_node_data(node);
+		size_t bytes = instr.instruction_bytes - data->process_pending_sent;
+		size_t written = wimp_shm_ring_try_write(data->process_ring, data->process_connection, &instr.instruction[data->process_pending_sent], bytes);
+		wimp_server_pending_advance(data, written);
+		if (written < bytes)
+		{
+			break;
+		}
+		node = data->process_pending.nextnode;
+	}
+}
+
+/*
+* Adds the credits the process has granted back since last time, which are
+* each an int32_t. Doorbell pings of a shared memory ring share the socket
+* so are skipped.
+*
+* @return Returns false if the connection has closed
+*/
+static bool wimp_server_take_grants(WimpProcessData data)
+{
+	uint8_t grants[WIMP_MESSAGE_BUFFER_BYTES];
+	memcpy(grants, data->process_grant, data->process_grant_bytes);
+	pssize recieved = wimp_socket_receive_available(data->process_connection, &grants[data->process_grant_bytes], sizeof(grants) - data->process_grant_bytes);
+	if (recieved < 0)
+	{
+		return false;
+	}
+
+	size_t bytes = data->process_grant_bytes + (size_t)recieved;
+	size_t offset = 0;
+	for (; offset + sizeof(int32_t) <= bytes; offset += sizeof(int32_t))
+	{
+		int32_t grant;
+		memcpy(&grant, &grants[offset], sizeof(int32_t));
+		grant = (int32_t)WIMP_LE32(grant);
+		if (grant > 0 && grant != WIMP_RECIEVER_PING)
+		{
+			data->process_credits += grant;
+		}
+	}
+
+	//Keep the start of a grant split between recieves
+	data->process_grant_bytes = bytes - offset;
+	memcpy(data->process_grant, &grants[offset], data->process_grant_bytes);
+	return true;
+}
+
+/*
+* Takes what each socket took from an io_uring batch
+*/
+static void wimp_server_batch_sent(void* context, void* tag, int32_t result)
+{
+	WimpProcessData data = (WimpProcessData)tag;
+	if (result < 0)
+	{
+		wimp_server_pending_fail(data);
+		return;
+	}
+
+	//Another round is worth it only while the socket takes everything given
+	wimp_server_pending_advance(data, (size_t)result);
+	if (result > 0 && data->process_pending.nextnode != NULL && data->process_credits != 0)
+	{
+		*(bool*)context = true;
+	}
+}
+
+/*
+* Sends what every process has pending, until it's all sent, the connections
+* are full or the processes are out of credits. Nothing blocks, what a process
+* can't take yet stays pending.
+*
+* @return Returns true if anything is still pending
+*/
+static bool wimp_server_flush_pending(WimpServer* server)
+{
+	WimpSocketBuffer buffers[WIMP_SOCKET_MAX_BUFFERS];
+	bool pending = false;
+	bool progress = true;
+	while (progress)
+	{
+		progress = false;
+		pending = false;
+
+		HashStringEntry* entry = NULL;
+		int i = 0;
+		HASH_STRING_ITER(server->ptable._hash_table, entry, i)
+		{
+			WimpProcessData data = (WimpProcessData)entry->value;
+			if (data->process_pending.nextnode == NULL)
+			{
+				continue;
+			}
+			if (!data->process_active)
+			{
+				wimp_server_pending_fail(data);
+				continue;
+			}
+
+			//Delivered straight to the queue of the process while it isn't throttled
+			if (data->process_transport == WIMP_TRANSPORT_LOCAL)
+			{
+				pending |= wimp_local_endpoint_deliver_queue(data->process_endpoint, &data->process_pending) == WIMP_TRANSPORT_FULL;
+				continue;
+			}
+
+			//Grants are taken whenever instructions are waiting, so the window is
+			//refilled as the process drains rather than once it has run out.
+			//Out of credits, the instructions are held back until it grants more.
+			//A ring also has its doorbell pings drained, so they don't wake a flush
+			if ((data->process_credits >= 0 || data->process_transport == WIMP_TRANSPORT_SHM) && !wimp_server_take_grants(data))
+			{
+				wimp_server_pending_fail(data);
+				continue;
+			}
+			if (data->process_credits == 0)
+			{
+				pending = true;
+				continue;
+			}
+
+			if (data->process_transport == WIMP_TRANSPORT_SHM)
+			{
+				wimp_server_pending_write_ring(data);
+				pending |= data->process_pending.nextnode != NULL;
+				continue;
+			}
+
+			size_t bytes;
+			size_t count = wimp_server_pending_gather(data, buffers, &bytes);
+			if (server->uring != NULL)
+			{
+				//Sent together with the other processes once all are gathered
+				for (size_t j = 0; j < count; ++j)
+				{
+					if (wimp_uring_send_add(server->uring, data->process_connection, buffers[j].data, buffers[j].bytes, data) != WIMP_URING_SUCCESS)
+					{
+						break;
+					}
+				}
+				continue;
+			}
+
+			pssize sent = wimp_socket_send_vectored(data->process_connection, buffers, count);
+			if (sent < 0)
+			{
+				wimp_server_pending_fail(data);
+				continue;
+			}
+			wimp_server_pending_advance(data, (size_t)sent);
+			progress |= (size_t)sent == bytes && data->process_pending.nextnode != NULL && data->process_credits != 0;
+			pending |= data->process_pending.nextnode != NULL;
+		}
+
+		if (server->uring != NULL)
+		{
+			wimp_uring_send_flush(server->uring, &wimp_server_batch_sent, &progress);
+
+			HASH_STRING_ITER(server->ptable._hash_table, entry, i)
+			{
+				pending |= ((WimpProcessData)entry->value)->process_pending.nextnode != NULL;
+			}
+		}
+	}
+	return pending;
+}
+
 int32_t wimp_server_send_instructions(WimpServer* server)
 {
+	//The lock is only held to take the instructions, the routing and sending
+	//is done from the batch. The pending queues are only used by the thread sending
+	WimpInstrQueue batch;
+	memset(&batch, 0, sizeof(WimpInstrQueue));
 	wimp_instr_queue_high_prio_lock(&server->outgoingmsg);
-	WimpInstrNode currentn = wimp_instr_queue_pop(&server->outgoingmsg);
+	wimp_instr_queue_take_all(&server->outgoingmsg, &batch);
+	wimp_instr_queue_high_prio_unlock(&server->outgoingmsg);
+
+	WimpInstrNode currentn = wimp_instr_queue_pop(&batch);
 	while (currentn != NULL)
 	{
 		//Get process con
@@ -388,49 +1016,187 @@ int32_t wimp_server_send_instructions(WimpServer* server)
 		WimpProcessData data = NULL;
 		WimpInstrMeta currentn_meta = wimp_instr_get_from_node(currentn);
 
-		//If the destination is this server, add to incoming instead (loopback)
-		if (strcmp(currentn_meta.dest_process, server->process_name) == 0)
+		//If the destination is this server, move the node to incoming instead (loopback).
+		//A registered destination only has to compare IDs
+		bool loopback = currentn_meta.dest_id != WIMP_INSTR_ID_NONE
+			? currentn_meta.dest_id == server->process_id
+			: strcmp(currentn_meta.dest_process, server->process_name) == 0;
+		if (loopback)
 		{
-			wimp_instr_queue_add(&server->incomingmsg, WIMP_INSTR_START(currentn_meta), currentn_meta.total_bytes);
+			//Waiting on its own queue would never end, so goes over the limits
+			wimp_instr_queue_push_unblocked(&server->incomingmsg, currentn, true);
+			currentn = wimp_instr_queue_pop(&batch);
+			continue;
 		}
 		else if 
 			(
-			//First look for a destination in the server ptable
+			//First look for a destination in the server ptable, indexed by ID if registered
 			//Otherwise send to the default destination (the parent) which may route it
 			//Short circuit is guaranteed by C standard
-			wimp_process_table_get(&data, server->ptable, currentn_meta.dest_process) == WIMP_PROCESS_TABLE_SUCCESS
+			(currentn_meta.dest_id != WIMP_INSTR_ID_NONE
+				? wimp_process_table_get_by_id(&data, server->ptable, currentn_meta.dest_id)
+				: wimp_process_table_get(&data, server->ptable, currentn_meta.dest_process)) == WIMP_PROCESS_TABLE_SUCCESS
+			||
+			wimp_process_table_get_by_id(&data, server->ptable, server->parent_id) == WIMP_PROCESS_TABLE_SUCCESS
 			||
 			wimp_process_table_get(&data, server->ptable, server->parent) == WIMP_PROCESS_TABLE_SUCCESS
 			)
 		{
-			//Check the process is still active, otherwise scrap the instruction
-			if (data->process_active)
+			//Check the process is still active, otherwise scrap the instruction.
+			//An ID registered after the handshake is sent by name instead, and
+			//a process without the fixed header gets the names version
+			if (data->process_active
+				&& (data->process_transport == WIMP_TRANSPORT_LOCAL
+					|| (data->process_instr_version == WIMP_INSTR_VERSION_NAMES
+						? wimp_instr_node_downgrade(currentn, data->process_instr_ids, data->process_protocol_version)
+						: wimp_instr_node_expand_id(currentn, data->process_instr_ids)) == WIMP_INSTRUCTION_SUCCESS))
 			{
-				//If a valid place to send to is found send the instruction
-				size_t sent_bytes = 0;
-				while (sent_bytes < currentn_meta.total_bytes)
+				//Only the fixed header is still in host order, the names version is built little-endian
+				if (data->process_transport != WIMP_TRANSPORT_LOCAL && data->process_instr_version != WIMP_INSTR_VERSION_NAMES)
 				{
-					size_t bytes_to_send = currentn_meta.total_bytes - sent_bytes;
-					if (bytes_to_send > WIMP_MESSAGE_BUFFER_BYTES)
-					{
-						bytes_to_send = WIMP_MESSAGE_BUFFER_BYTES;
-					}
-					memcpy(server->sendbuffer, WIMP_INSTR_OFFSET(currentn_meta, sent_bytes), bytes_to_send);
-
-					pssize sendres = p_socket_send(data->process_connection, server->sendbuffer, bytes_to_send, NULL);
-
-					WIMP_ZERO_BUFFER(server->sendbuffer);
-					sent_bytes += sendres;
+					WIMP_INSTR_HEADER_TO_WIRE(wimp_instr_node_data(currentn).instruction);
 				}
+
+				//Queued behind whatever the process hasn't taken yet, and sent
+				//or delivered once everything is routed
+				wimp_instr_queue_add_existing(&data->process_pending, currentn);
+				currentn = wimp_instr_queue_pop(&batch);
+				continue;
 			}
 		}
 		wimp_instr_node_free(currentn);
-		currentn = wimp_instr_queue_pop(&server->outgoingmsg);
+		currentn = wimp_instr_queue_pop(&batch);
 	}
-	wimp_instr_queue_high_prio_unlock(&server->outgoingmsg);
+
+	//A slow process only keeps its own instructions waiting
+	wimp_server_flush_pending(server);
 	return WIMP_SERVER_SUCCESS;
 }
 
+#ifdef __linux__
+/*
+* Waits until a process with instructions pending can take more, or the timeout.
+* Connections are polled for space and grants, rings flag the producer as waiting
+* so the doorbell is rung once there is space, and local endpoints write to the
+* wake eventfd once their queue drains.
+*/
+static void wimp_server_flush_wait(WimpServer* server, int32_t timeout)
+{
+	size_t capacity = 1;
+	HashStringEntry* entry = NULL;
+	int i = 0;
+	HASH_STRING_ITER(server->ptable._hash_table, entry, i)
+	{
+		capacity++;
+	}
+
+	struct pollfd* fds = malloc(sizeof(struct pollfd) * capacity);
+	if (fds == NULL)
+	{
+		p_uthread_sleep(1);
+		return;
+	}
+
+	nfds_t count = 0;
+	if (server->wake_fd >= 0)
+	{
+		fds[count].fd = server->wake_fd;
+		fds[count].events = POLLIN;
+		fds[count].revents = 0;
+		count++;
+	}
+
+	HASH_STRING_ITER(server->ptable._hash_table, entry, i)
+	{
+		WimpProcessData data = (WimpProcessData)entry->value;
+		if (data->process_pending.nextnode == NULL || !data->process_active)
+		{
+			continue;
+		}
+
+		//Without the eventfd there is nothing to wake on, so the endpoint is checked again shortly
+		if (data->process_transport == WIMP_TRANSPORT_LOCAL)
+		{
+			if (server->wake_fd < 0)
+			{
+				timeout = timeout < 1 ? timeout : 1;
+			}
+			else if (!wimp_local_endpoint_wait(data->process_endpoint, &wimp_server_wake, server))
+			{
+				timeout = 0;
+			}
+			continue;
+		}
+
+		//Grants (and doorbell pings) are read, space only matters with credits to use it
+		bool ring = data->process_transport == WIMP_TRANSPORT_SHM;
+		short events = 0;
+		if (data->process_credits >= 0 || ring)
+		{
+			events |= POLLIN;
+		}
+		if (data->process_credits != 0 && !ring)
+		{
+			events |= POLLOUT;
+		}
+		if (data->process_credits != 0 && ring && !wimp_shm_ring_wait_space(data->process_ring))
+		{
+			timeout = 0;
+		}
+		fds[count].fd = p_socket_get_fd(data->process_connection);
+		fds[count].events = events;
+		fds[count].revents = 0;
+		count++;
+	}
+
+	//Is interrupted early at worst, the caller checks again either way
+	poll(fds, count, timeout);
+	if (server->wake_fd >= 0)
+	{
+		uint64_t value;
+		ssize_t drained = read(server->wake_fd, &value, sizeof(uint64_t));
+		(void)drained;
+	}
+	free(fds);
+}
+#else
+/*
+* Waits a moment before the pending instructions are tried again
+*/
+static void wimp_server_flush_wait(WimpServer* server, int32_t timeout)
+{
+	(void)server;
+	(void)timeout;
+	p_uthread_sleep(1);
+}
+#endif
+
+int32_t wimp_server_flush(WimpServer* server, int32_t timeout)
+{
+	PTimeProfiler* profiler = p_time_profiler_new();
+	int32_t result = WIMP_SERVER_FAIL;
+	for (;;)
+	{
+		if (!wimp_server_flush_pending(server))
+		{
+			result = WIMP_SERVER_SUCCESS;
+			break;
+		}
+
+		int64_t remaining = (int64_t)timeout - (profiler != NULL ? (int64_t)(p_time_profiler_elapsed_usecs(profiler) / 1000) : timeout);
+		if (remaining <= 0)
+		{
+			break;
+		}
+		wimp_server_flush_wait(server, (int32_t)remaining);
+	}
+	if (profiler != NULL)
+	{
+		p_time_profiler_free(profiler);
+	}
+	return result;
+}
+
 bool wimp_server_is_parent_alive(WimpServer* server)
 {
 	if (server->parent == NULL)
@@ -442,11 +1208,9 @@ bool wimp_server_is_parent_alive(WimpServer* server)
 
 void wimp_server_free(WimpServer* server)
 {
-	//Sets the server to inactive
+	//Sets the server to inactive, then wakes the reciever and waits for it to stop
 	p_atomic_int_set(&server->active, 0);
-
-	//Need to sleep to allow the reciever time to pick up the signal
-	p_uthread_sleep(100);
+	wimp_reciever_loop_stop(&server->incomingmsg, &server->active);
 
 	//Before freeing, send exit signal to any child process
 	HashStringEntry* entry = NULL;
@@ -460,10 +1224,36 @@ void wimp_server_free(WimpServer* server)
 		}
 	}
 	wimp_server_send_instructions(server);
-	p_uthread_sleep(100);
+	if (wimp_server_flush(server, WIMP_SERVER_CLOSE_TIMEOUT) != WIMP_SERVER_SUCCESS)
+	{
+		wimp_log_fail("%s closed with instructions still unsent\n", server->process_name);
+	}
 
-	p_socket_address_free(server->addr);
+	//An instruction never committed isn't sent
+	wimp_server_add_cancel(server);
+	free(server->handlers);
+	server->handlers = NULL;
+
+	//Stop any more instructions being delivered locally before freeing the queue
+	wimp_local_endpoint_close(server->endpoint);
+	server->endpoint = NULL;
+	wimp_uring_free(server->uring);
+	server->uring = NULL;
+
+	if (server->addr != NULL)
+	{
+		p_socket_address_free(server->addr);
+	}
 	p_socket_close(server->server, NULL);
+	if (wimp_socket_is_unix_domain(server->domain))
+	{
+		wimp_socket_unix_unlink(server->domain);
+	}
+	sdsfree(server->domain);
+	HASH_STRING_ITER(server->ptable._hash_table, entry, i)
+	{
+		wimp_server_cancel_wait(server, (WimpProcessData)entry->value);
+	}
 	wimp_process_table_free(server->ptable);
 	wimp_instr_queue_free(server->incomingmsg);
 	wimp_instr_queue_free(server->outgoingmsg);
@@ -471,5 +1261,12 @@ void wimp_server_free(WimpServer* server)
 	{
 		sdsfree(server->parent);
 	}
+#ifdef __linux__
+	if (server->wake_fd >= 0)
+	{
+		close(server->wake_fd);
+	}
+#endif
+	server->wake_fd = -1;
 	WIMP_ZERO_BUFFER(server->recbuffer); WIMP_ZERO_BUFFER(server->sendbuffer);
 }
\ No newline at end of file
@@ -11,6 +11,9 @@
 #include <wimp_core.h>
 #include <wimp_process_table.h>
 #include <wimp_instruction.h>
+#include <wimp_transport.h>
+#include <wimp_socket.h>
+#include <wimp_uring.h>
 #include <wimp_log.h>
 
 /// @brief The result of wimp server operations
@@ -27,6 +30,7 @@ enum WimpServerResult
 };
 
 #define WIMP_SERVER_ACCEPT_TIMEOUT 5000 //Waits 5000 ms before timing out on the blocking calls
+#define WIMP_SERVER_CLOSE_TIMEOUT 1000 //Waits up to 1000 ms for pending instructions to go when freeing
 
 typedef int32_t WimpServerType;
 
@@ -40,10 +44,13 @@ typedef int32_t WimpServerType;
 typedef struct _WimpServer
 {
 	sds process_name;		///< Name of the server
-	PSocketAddress* addr;   ///< Server address structure
+	sds domain;				///< Domain the server runs on
+	PSocketAddress* addr;   ///< Server address structure - is null for unix domain sockets
 	PSocket* server;		///< Server socket pointer
 	WimpProcessTable ptable;///< Process table tracking connected processes
 	const char* parent;		///< Name of the parent process - is null when no parent exists
+	uint32_t process_id;	///< ID the server name is registered for, WIMP_INSTR_ID_NONE if it couldn't be
+	uint32_t parent_id;		///< ID of the parent process - is WIMP_INSTR_ID_NONE when no parent exists
 
 	//Ingoing and outgoing msg queues
 	WimpInstrQueue incomingmsg;	///< Incoming message queue
@@ -55,8 +62,27 @@ typedef struct _WimpServer
 
 	int32_t active; ///< The active status of the server
 
+	WimpLocalEndpoint endpoint; ///< Endpoint servers in the same address space deliver to
+	int32_t transports;			///< Mask of the transports the server will accept connections over
+	WimpUring uring;			///< Batches the socket sends, is null if io_uring isn't available
+	WimpInstrNode reserved;		///< Instruction being filled in from wimp_server_add_begin(), is null when there is none
+	struct _WimpServerHandlers* handlers; ///< Handlers for dispatching instructions by ID, is null until one is set
+	int32_t wake_fd;			///< Wakes a flush once a local endpoint can take more, is -1 if unavailable
+
 } WimpServer;
 
+///
+/// @brief Handles an instruction dispatched by wimp_server_dispatch()
+///
+/// The instruction node is freed once the handler returns, so the metadata
+/// and arguments mustn't be kept.
+///
+/// @param server The server the instruction was dispatched on
+/// @param meta The metadata of the instruction
+/// @param context The context given when the handler was set
+///
+typedef void (*WIMP_SERVER_HANDLER)(WimpServer* server, WimpInstrMeta meta, void* context);
+
 ///
 /// @brief Gets the local thread server
 /// 
@@ -102,13 +128,25 @@ WIMP_API void wimp_add_local_server(const char* dest, const char* instr, const v
 /// 
 /// @param server The pointer to the server to create
 /// @param process_name The name of the process running on the server
-/// @param domain The domain for the server to run on
-/// @param port The port for the server to run on
+/// @param domain The domain for the server to run on. Can be a unix domain socket path prefixed with WIMP_UNIX_DOMAIN_PREFIX.
+/// @param port The port for the server to run on. Is ignored for unix domain sockets.
 /// 
 /// @return Returns a WimpServerResult enum
 ///
 WIMP_API int32_t wimp_create_server(WimpServer* server, const char* process_name, const char* domain, int32_t port);
 
+///
+/// @brief Sets which transports the server accepts connections over
+///
+/// Must be set before wimp_server_process_accept() and any recievers writing to the server
+/// are started. Defaults to WIMP_TRANSPORT_ALL. The socket transport is always allowed
+/// as it is the fallback for every connection.
+/// 
+/// @param server The server to set the transports of
+/// @param transports A mask of WimpTransport values
+///
+WIMP_API void wimp_server_set_transports(WimpServer* server, int32_t transports);
+
 ///
 /// @brief Accepts valid processes connecting to the server
 ///
@@ -144,6 +182,66 @@ WIMP_API bool wimp_server_check_process_listening(WimpServer* server, const char
 ///
 WIMP_API void wimp_server_add(WimpServer* server, const char* dest, const char* instr, const void* args, size_t arg_size_bytes);
 
+///
+/// @brief Starts building a string pack instruction from the server
+///
+/// Add the strings with wimp_instr_pack_add(), which writes them straight
+/// into the instruction, then queue it with wimp_server_add_pack().
+///
+/// @param server The server sending the instruction
+/// @param builder The builder to start
+/// @param dest The name of the destination process
+/// @param instr The name of the instruction
+/// @param reserve_bytes The bytes of strings to make space for up front, can be zero
+///
+/// @return Returns either WIMP_SERVER_SUCCESS or WIMP_SERVER_FAIL
+///
+WIMP_API int32_t wimp_server_pack_begin(WimpServer* server, WimpStrPackBuilder* builder, const char* dest, const char* instr, size_t reserve_bytes);
+
+///
+/// @brief Finishes a string pack instruction and adds it to the server outgoing queue
+///
+/// @param server The server to add to
+/// @param builder The builder started with wimp_server_pack_begin()
+///
+/// @return Returns either WIMP_SERVER_SUCCESS or WIMP_SERVER_FAIL
+///
+WIMP_API int32_t wimp_server_add_pack(WimpServer* server, WimpStrPackBuilder* builder);
+
+///
+/// @brief Reserves an instruction, for its arguments to be written in place
+///
+/// The instruction is allocated with space for the arguments, which are
+/// filled in through the pointer returned, then it is queued with
+/// wimp_server_add_commit(). This avoids building the arguments separately
+/// and copying them in. Only one instruction can be reserved on a server at a
+/// time, and starting another drops the first.
+///
+/// @param server The server to add to
+/// @param dest The name of the destination process
+/// @param instr The name of the instruction
+/// @param arg_bytes The size of the arguments
+///
+/// @return Returns the arguments of the instruction, aligned to WIMP_INSTR_ALIGN, or NULL if failed
+///
+WIMP_API void* wimp_server_add_begin(WimpServer* server, const char* dest, const char* instr, size_t arg_bytes);
+
+///
+/// @brief Adds the instruction reserved with wimp_server_add_begin() to the server outgoing queue
+///
+/// @param server The server to add to
+///
+/// @return Returns WIMP_SERVER_SUCCESS, or WIMP_SERVER_FAIL if nothing was reserved or it couldn't be queued
+///
+WIMP_API int32_t wimp_server_add_commit(WimpServer* server);
+
+///
+/// @brief Drops the instruction reserved with wimp_server_add_begin() without sending it
+///
+/// @param server The server the instruction was reserved on
+///
+WIMP_API void wimp_server_add_cancel(WimpServer* server);
+
 ///
 /// @brief Waits until the specified instruction is recieved
 ///
@@ -174,13 +272,70 @@ WIMP_API WimpInstrNode wimp_server_wait_response(WimpServer* server, const char*
 ///
 WIMP_API bool wimp_server_instr_routed(WimpServer* server, const char* dest_process, WimpInstrNode instrnode);
 
+///
+/// @brief Sets the handler wimp_server_dispatch() calls for an instruction
+///
+/// The instruction name is registered, so the handler is found by its ID in
+/// a table rather than by comparing names. Setting a handler again replaces
+/// it, and a NULL handler removes it.
+///
+/// @param server The server to set the handler on
+/// @param instr The name of the instruction, or NULL for instructions with no handler of their own
+/// @param handler The handler to call
+/// @param context Passed to the handler
+///
+/// @return Returns WIMP_SERVER_SUCCESS, or WIMP_SERVER_FAIL if the name couldn't be registered
+///
+WIMP_API int32_t wimp_server_set_handler(WimpServer* server, const char* instr, WIMP_SERVER_HANDLER handler, void* context);
+
+///
+/// @brief Dispatches incoming instructions to their handlers
+///
+/// The instructions are taken off the incoming queue first, so the recievers
+/// aren't held up by the handlers. Instructions for other processes are
+/// routed (see wimp_server_instr_routed()), and the rest are passed to their
+/// handler then freed. Instructions without a handler are freed.
+///
+/// @param server The server to dispatch on
+/// @param budget The most instructions to dispatch, or zero for everything queued
+///
+/// @return Returns the number of instructions taken off the incoming queue
+///
+WIMP_API int32_t wimp_server_dispatch(WimpServer* server, int32_t budget);
+
 ///
 /// @brief Sends the instructions in the outgoing queue
+///
+/// Never blocks on a process. Instructions a process can't take yet, along
+/// with any partly sent one, stay pending for it and are retried first on
+/// the next call, so a slow process only holds up its own instructions.
+///
+/// A process whose incoming queue has watermarks can't take more than the
+/// credits it has granted. Once they run out its instructions are held back
+/// until it grants more, which it does as its queue drains.
+///
+/// The outgoing queue is only locked while its instructions are taken, and
+/// the pending instructions belong to the thread sending, so should only be
+/// sent and flushed from one thread.
 /// 
 /// @param server The server to send instructions from
 ///
 WIMP_API int32_t wimp_server_send_instructions(WimpServer* server);
 
+///
+/// @brief Waits for the instructions still pending from earlier sends to go
+///
+/// Sleeps until a process with instructions pending can take more (its
+/// connection has space, it grants credits or its queue drains) rather than
+/// polling, so is woken as soon as there is something to send.
+///
+/// @param server The server to flush
+/// @param timeout Time to wait in ms
+///
+/// @return Returns WIMP_SERVER_SUCCESS if everything was sent, or WIMP_SERVER_FAIL if some is still pending
+///
+WIMP_API int32_t wimp_server_flush(WimpServer* server, int32_t timeout);
+
 ///
 /// @brief Checks if the parent process is alive
 ///
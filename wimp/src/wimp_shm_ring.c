@@ -0,0 +1,231 @@
+#include <wimp_shm_ring.h>
+#include <wimp_reciever.h>
+#include <wimp_log.h>
+#include <wimp_endian.h>
+#include <patomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define WIMP_SHM_RING_CACHE_LINE 64
+
+/*
+* Control block at the start of the segment. The producer and consumer
+* positions are kept on separate cache lines so the two sides don't share
+* lines they write to. Positions only ever increase and wrap, so the used
+* bytes are always tail - head.
+*/
+typedef struct _WimpShmRingHeader
+{
+	uint64_t owner_token;
+	int32_t magic;
+	int32_t capacity;
+	uint8_t _pad0[WIMP_SHM_RING_CACHE_LINE - sizeof(uint64_t) - 2 * sizeof(int32_t)];
+
+	pint tail;				//Written by the producer
+	pint producer_waiting;	//Set by the producer when blocked on a full ring
+	uint8_t _pad1[WIMP_SHM_RING_CACHE_LINE - 2 * sizeof(pint)];
+
+	pint head;				//Written by the consumer
+	pint consumer_sleeping;	//Set by the consumer when blocked on an empty ring
+	uint8_t _pad2[WIMP_SHM_RING_CACHE_LINE - 2 * sizeof(pint)];
+} WimpShmRingHeader;
+
+typedef struct _WimpShmRing
+{
+	PShm* shm;
+	WimpShmRingHeader* header;
+	uint8_t* data;
+	uint32_t mask;
+	bool owner;
+} *WimpShmRing;
+
+static int32_t s_ring_counter = 0;
+
+static WimpShmRing wimp_shm_ring_map(PShm* shm, bool owner)
+{
+	WimpShmRing ring = malloc(sizeof(struct _WimpShmRing));
+	if (ring == NULL)
+	{
+		return NULL;
+	}
+
+	ring->shm = shm;
+	ring->header = (WimpShmRingHeader*)p_shm_get_address(shm);
+	ring->data = (uint8_t*)p_shm_get_address(shm) + sizeof(WimpShmRingHeader);
+	ring->mask = WIMP_SHM_RING_BYTES - 1;
+	ring->owner = owner;
+	return ring;
+}
+
+WimpShmRing wimp_shm_ring_create(uint64_t owner_token, char* name_out)
+{
+	int32_t counter = p_atomic_int_add(&s_ring_counter, 1);
+	snprintf(name_out, WIMP_SHM_RING_MAX_NAME_BYTES, "wimp-ring-%016llx-%d", (unsigned long long)owner_token, counter);
+
+	size_t length = sizeof(WimpShmRingHeader) + WIMP_SHM_RING_BYTES;
+	PShm* shm = p_shm_new(name_out, length, P_SHM_ACCESS_READWRITE, NULL);
+	if (shm == NULL)
+	{
+		wimp_log_fail("Failed to create shared memory ring %s\n", name_out);
+		return NULL;
+	}
+	p_shm_take_ownership(shm);
+
+	if (p_shm_get_size(shm) < length)
+	{
+		p_shm_free(shm);
+		return NULL;
+	}
+
+	WimpShmRing ring = wimp_shm_ring_map(shm, true);
+	if (ring == NULL)
+	{
+		p_shm_free(shm);
+		return NULL;
+	}
+
+	memset(ring->header, 0, sizeof(WimpShmRingHeader));
+	ring->header->owner_token = owner_token;
+	ring->header->capacity = WIMP_SHM_RING_BYTES;
+	p_atomic_int_set(&ring->header->magic, WIMP_SHM_RING_MAGIC);
+	return ring;
+}
+
+WimpShmRing wimp_shm_ring_open(const char* name, uint64_t owner_token)
+{
+	size_t length = sizeof(WimpShmRingHeader) + WIMP_SHM_RING_BYTES;
+	PShm* shm = p_shm_new(name, length, P_SHM_ACCESS_READWRITE, NULL);
+	if (shm == NULL)
+	{
+		return NULL;
+	}
+
+	//If the ring wasn't created on this host the segment is a fresh empty one,
+	//so remove it again and fall back
+	WimpShmRingHeader* header = (WimpShmRingHeader*)p_shm_get_address(shm);
+	if (p_shm_get_size(shm) < length
+		|| p_atomic_int_get(&header->magic) != WIMP_SHM_RING_MAGIC
+		|| header->owner_token != owner_token
+		|| header->capacity != WIMP_SHM_RING_BYTES)
+	{
+		p_shm_take_ownership(shm);
+		p_shm_free(shm);
+		return NULL;
+	}
+
+	WimpShmRing ring = wimp_shm_ring_map(shm, false);
+	if (ring == NULL)
+	{
+		p_shm_free(shm);
+		return NULL;
+	}
+	return ring;
+}
+
+/*
+* Rings the doorbell if the other side flagged that it's waiting on it
+*/
+static void wimp_shm_ring_notify(pint* waiting_flag, PSocket* doorbell)
+{
+	if (p_atomic_int_get(waiting_flag) && p_atomic_int_compare_and_exchange(waiting_flag, 1, 0))
+	{
+		int32_t ping = (int32_t)WIMP_LE32(WIMP_RECIEVER_PING);
+		p_socket_send(doorbell, (const pchar*)&ping, sizeof(int32_t), NULL);
+	}
+}
+
+/*
+* Flags that this side is waiting and blocks on the doorbell, unless the
+* ring changed in between. Any stale pings are drained with the wake up.
+*/
+static int32_t wimp_shm_ring_wait(WimpShmRing ring, pint* waiting_flag, bool producer)
+{
+	p_atomic_int_set(waiting_flag, 1);
+
+	//Check again after setting the flag, as the other side may have moved
+	//before seeing it
+	uint32_t used = (uint32_t)p_atomic_int_get(&ring->header->tail) - (uint32_t)p_atomic_int_get(&ring->header->head);
+	bool ready = producer ? used < (uint32_t)WIMP_SHM_RING_BYTES : used > 0;
+	if (ready)
+	{
+		p_atomic_int_set(waiting_flag, 0);
+		return WIMP_SHM_RING_SUCCESS;
+	}
+	return WIMP_SHM_RING_FAIL;
+}
+
+size_t wimp_shm_ring_try_write(WimpShmRing ring, PSocket* doorbell, const uint8_t* data, size_t bytes)
+{
+	WimpShmRingHeader* header = ring->header;
+	uint32_t tail = (uint32_t)p_atomic_int_get(&header->tail);
+	uint32_t used = tail - (uint32_t)p_atomic_int_get(&header->head);
+	size_t space = WIMP_SHM_RING_BYTES - used;
+
+	//Copy up to the end of the data, then wrap to the start
+	size_t to_copy = bytes;
+	if (to_copy > space)
+	{
+		to_copy = space;
+	}
+	if (to_copy == 0)
+	{
+		return 0;
+	}
+
+	uint32_t offset = tail & ring->mask;
+	size_t first = WIMP_SHM_RING_BYTES - offset;
+	if (first > to_copy)
+	{
+		first = to_copy;
+	}
+	memcpy(&ring->data[offset], data, first);
+	memcpy(&ring->data[0], &data[first], to_copy - first);
+
+	p_atomic_int_set(&header->tail, (pint)(tail + (uint32_t)to_copy));
+	wimp_shm_ring_notify(&header->consumer_sleeping, doorbell);
+	return to_copy;
+}
+
+size_t wimp_shm_ring_peek(WimpShmRing ring, const uint8_t** data)
+{
+	WimpShmRingHeader* header = ring->header;
+	uint32_t head = (uint32_t)p_atomic_int_get(&header->head);
+	uint32_t used = (uint32_t)p_atomic_int_get(&header->tail) - head;
+
+	//Only the bytes up to the end of the data are contiguous, the rest is
+	//returned by the next peek
+	uint32_t offset = head & ring->mask;
+	size_t contiguous = WIMP_SHM_RING_BYTES - offset;
+	*data = &ring->data[offset];
+	return used < contiguous ? used : contiguous;
+}
+
+void wimp_shm_ring_consume(WimpShmRing ring, PSocket* doorbell, size_t bytes)
+{
+	WimpShmRingHeader* header = ring->header;
+	uint32_t head = (uint32_t)p_atomic_int_get(&header->head);
+	p_atomic_int_set(&header->head, (pint)(head + (uint32_t)bytes));
+
+	wimp_shm_ring_notify(&header->producer_waiting, doorbell);
+}
+
+bool wimp_shm_ring_sleep(WimpShmRing ring)
+{
+	return wimp_shm_ring_wait(ring, &ring->header->consumer_sleeping, false) != WIMP_SHM_RING_SUCCESS;
+}
+
+bool wimp_shm_ring_wait_space(WimpShmRing ring)
+{
+	return wimp_shm_ring_wait(ring, &ring->header->producer_waiting, true) != WIMP_SHM_RING_SUCCESS;
+}
+
+void wimp_shm_ring_free(WimpShmRing ring)
+{
+	if (ring == NULL)
+	{
+		return;
+	}
+
+	p_shm_free(ring->shm);
+	free(ring);
+}
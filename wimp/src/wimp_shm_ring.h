@@ -0,0 +1,130 @@
+///
+/// @file
+///
+/// This header defines the interfaces to the wimp_shm_ring
+///
+/// A shared memory ring carries the instruction stream of one connection
+/// between two processes on the same host. It is created by the reciever (the
+/// consumer) and its name is sent in the handshake, the server (the producer)
+/// then opens it and checks the owner token matches the handshake. If it doesn't
+/// the processes aren't sharing memory and the socket transport is used.
+///
+/// The ring is a single producer, single consumer byte stream, so the usual
+/// instruction format is copied in and out unchanged. The connection socket stays
+/// open as the doorbell: a side only sends a ping to wake the other when it has
+/// flagged that it is blocked waiting on the ring, so busy connections don't make
+/// any socket calls at all. The consumer never blocks inside the ring, it peeks and
+/// consumes what is there then waits on the doorbell (usually in the reciever event
+/// loop along with every other connection).
+///
+
+#ifndef WIMP_SHM_RING_H
+#define WIMP_SHM_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <plibsys.h>
+#include <wimp_core.h>
+
+#define WIMP_SHM_RING_BYTES (1 << 20) //Must be a power of two
+#define WIMP_SHM_RING_MAGIC 0x676e6972
+#define WIMP_SHM_RING_MAX_NAME_BYTES 64
+
+/// @brief The result of WIMP shared memory ring operations
+enum WimpShmRingResult
+{
+	WIMP_SHM_RING_SUCCESS      = 0,	///< Result if ring operation is successful
+	WIMP_SHM_RING_FAIL         = -1,///< Result if ring operation fails for an unspecified reason
+};
+
+/// @brief A handle to a mapped shared memory ring
+typedef struct _WimpShmRing *WimpShmRing;
+
+///
+/// @brief Creates a new ring as the consumer
+///
+/// The segment is removed when the ring is freed.
+///
+/// @param owner_token The token of the creating address space, which the producer checks
+/// @param name_out Buffer of WIMP_SHM_RING_MAX_NAME_BYTES to write the ring name to
+///
+/// @return Returns the ring, or NULL if failed
+///
+WIMP_API WimpShmRing wimp_shm_ring_create(uint64_t owner_token, char* name_out);
+
+///
+/// @brief Opens an existing ring as the producer
+///
+/// Fails if the ring wasn't created by the owner token given, which is the case
+/// when the creator is on another host.
+///
+/// @param name The name of the ring sent in the handshake
+/// @param owner_token The token sent in the handshake
+///
+/// @return Returns the ring, or NULL if failed
+///
+WIMP_API WimpShmRing wimp_shm_ring_open(const char* name, uint64_t owner_token);
+
+///
+/// @brief Writes as many bytes to the ring as there is space for, without blocking
+///
+/// @param ring The ring to write to
+/// @param doorbell The connection socket of the ring
+/// @param data The bytes to write
+/// @param bytes The amount of bytes to write
+///
+/// @return Returns the bytes written, zero if the ring is full
+///
+WIMP_API size_t wimp_shm_ring_try_write(WimpShmRing ring, PSocket* doorbell, const uint8_t* data, size_t bytes);
+
+///
+/// @brief Gets the bytes that can be read from the ring without blocking
+///
+/// The bytes stay in the ring until passed to wimp_shm_ring_consume(), so can be
+/// parsed in place. Only the contiguous bytes up to the end of the ring are
+/// returned, so peek again after consuming to get any that wrapped.
+///
+/// @param ring The ring to read from
+/// @param data Pointer to store the start of the readable bytes in
+///
+/// @return Returns the amount of readable bytes, which is zero if the ring is empty
+///
+WIMP_API size_t wimp_shm_ring_peek(WimpShmRing ring, const uint8_t** data);
+
+///
+/// @brief Releases bytes returned by wimp_shm_ring_peek() back to the producer
+///
+/// @param ring The ring to consume from
+/// @param doorbell The connection socket of the ring
+/// @param bytes The amount of bytes to consume
+///
+WIMP_API void wimp_shm_ring_consume(WimpShmRing ring, PSocket* doorbell, size_t bytes);
+
+///
+/// @brief Flags the consumer as sleeping, so the next write rings the doorbell
+///
+/// @param ring The ring to flag
+///
+/// @return Returns true if the ring is still empty and the caller should wait on the
+/// doorbell, false if bytes arrived in between and the flag was cleared again
+///
+WIMP_API bool wimp_shm_ring_sleep(WimpShmRing ring);
+
+///
+/// @brief Flags the producer as waiting, so the next consume rings the doorbell
+///
+/// @param ring The ring to flag
+///
+/// @return Returns true if the ring is still full and the caller should wait on the
+/// doorbell, false if space was freed in between and the flag was cleared again
+///
+WIMP_API bool wimp_shm_ring_wait_space(WimpShmRing ring);
+
+///
+/// @brief Unmaps the ring, removing the segment if this is the creator
+///
+/// @param ring The ring to free
+///
+WIMP_API void wimp_shm_ring_free(WimpShmRing ring);
+
+#endif
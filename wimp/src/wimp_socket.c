@@ -0,0 +1,203 @@
+#include <wimp_socket.h>
+#include <wimp_log.h>
+#include <string.h>
+
+bool wimp_socket_is_unix_domain(const char* domain)
+{
+	return domain != NULL && strncmp(domain, WIMP_UNIX_DOMAIN_PREFIX, strlen(WIMP_UNIX_DOMAIN_PREFIX)) == 0;
+}
+
+#ifdef __unix__
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+
+pssize wimp_socket_send_vectored(PSocket* socket, const WimpSocketBuffer* buffers, size_t count)
+{
+	struct iovec iovs[WIMP_SOCKET_MAX_BUFFERS];
+	if (count > WIMP_SOCKET_MAX_BUFFERS)
+	{
+		count = WIMP_SOCKET_MAX_BUFFERS;
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		iovs[i].iov_base = (void*)buffers[i].data;
+		iovs[i].iov_len = buffers[i].bytes;
+	}
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = iovs;
+	msg.msg_iovlen = count;
+
+	ssize_t sent;
+	do
+	{
+		sent = sendmsg(p_socket_get_fd(socket), &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (sent < 0 && errno == EINTR);
+
+	if (sent < 0)
+	{
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+	}
+	return (pssize)sent;
+}
+
+pssize wimp_socket_receive_available(PSocket* socket, uint8_t* buffer, size_t bytes)
+{
+	ssize_t recieved;
+	do
+	{
+		recieved = recv(p_socket_get_fd(socket), buffer, bytes, MSG_DONTWAIT);
+	} while (recieved < 0 && errno == EINTR);
+
+	if (recieved < 0)
+	{
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+	}
+	return recieved > 0 ? (pssize)recieved : -1;
+}
+
+/*
+* Fills the native address from the path after the domain prefix
+*/
+static bool wimp_socket_unix_address(const char* domain, struct sockaddr_un* address)
+{
+	const char* path = &domain[strlen(WIMP_UNIX_DOMAIN_PREFIX)];
+	size_t path_bytes = (strlen(path) + 1) * sizeof(char);
+
+	memset(address, 0, sizeof(struct sockaddr_un));
+	if (path_bytes <= 1 || path_bytes > sizeof(address->sun_path))
+	{
+		wimp_log_fail("Invalid unix domain socket path: %s\n", path);
+		return false;
+	}
+
+	address->sun_family = AF_UNIX;
+	memcpy(address->sun_path, path, path_bytes);
+	return true;
+}
+
+PSocket* wimp_socket_unix_new(void)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		wimp_log_fail("Failed to create unix domain socket! (%d)\n", errno);
+		return NULL;
+	}
+
+	PError* err = NULL;
+	PSocket* s = p_socket_new_from_fd(fd, &err);
+	if (s == NULL)
+	{
+		wimp_log_fail("Failed to wrap unix domain socket! (%d): %s\n", p_error_get_code(err), p_error_get_message(err));
+		p_error_free(err);
+		close(fd);
+		return NULL;
+	}
+	return s;
+}
+
+bool wimp_socket_unix_bind(PSocket* socket, const char* domain)
+{
+	struct sockaddr_un address;
+	if (!wimp_socket_unix_address(domain, &address))
+	{
+		return false;
+	}
+
+	//A socket file left by a process that didn't clean up would fail the bind
+	unlink(address.sun_path);
+
+	if (bind(p_socket_get_fd(socket), (struct sockaddr*)&address, sizeof(struct sockaddr_un)) != 0)
+	{
+		wimp_log_fail("Failed to bind unix domain socket %s! (%d)\n", address.sun_path, errno);
+		return false;
+	}
+	return true;
+}
+
+bool wimp_socket_unix_connect(PSocket* socket, const char* domain)
+{
+	struct sockaddr_un address;
+	if (!wimp_socket_unix_address(domain, &address))
+	{
+		return false;
+	}
+
+	int res;
+	do
+	{
+		res = connect(p_socket_get_fd(socket), (struct sockaddr*)&address, sizeof(struct sockaddr_un));
+	} while (res != 0 && errno == EINTR);
+	return res == 0;
+}
+
+void wimp_socket_unix_unlink(const char* domain)
+{
+	struct sockaddr_un address;
+	if (wimp_socket_unix_address(domain, &address))
+	{
+		unlink(address.sun_path);
+	}
+}
+
+#else
+
+pssize wimp_socket_send_vectored(PSocket* socket, const WimpSocketBuffer* buffers, size_t count)
+{
+	pssize total = 0;
+	for (size_t i = 0; i < count && i < WIMP_SOCKET_MAX_BUFFERS; ++i)
+	{
+		size_t sent_bytes = 0;
+		while (sent_bytes < buffers[i].bytes)
+		{
+			pssize sent = p_socket_send(socket, (const pchar*)&buffers[i].data[sent_bytes], buffers[i].bytes - sent_bytes, NULL);
+			if (sent <= 0)
+			{
+				return total > 0 ? total : -1;
+			}
+			sent_bytes += (size_t)sent;
+			total += sent;
+		}
+	}
+	return total;
+}
+
+pssize wimp_socket_receive_available(PSocket* socket, uint8_t* buffer, size_t bytes)
+{
+	//Can't tell a closed socket from an empty one here, so a close is
+	//only noticed when sending
+	bool blocking = p_socket_get_blocking(socket);
+	p_socket_set_blocking(socket, false);
+	pssize recieved = p_socket_receive(socket, (pchar*)buffer, bytes, NULL);
+	p_socket_set_blocking(socket, blocking);
+	return recieved > 0 ? recieved : 0;
+}
+
+PSocket* wimp_socket_unix_new(void)
+{
+	wimp_log_fail("Unix domain sockets aren't supported on this platform!\n");
+	return NULL;
+}
+
+bool wimp_socket_unix_bind(PSocket* socket, const char* domain)
+{
+	return false;
+}
+
+bool wimp_socket_unix_connect(PSocket* socket, const char* domain)
+{
+	return false;
+}
+
+void wimp_socket_unix_unlink(const char* domain)
+{
+	return;
+}
+
+#endif
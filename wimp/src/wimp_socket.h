@@ -0,0 +1,110 @@
+///
+/// @file
+///
+/// This header defines the interfaces to the wimp_socket
+///
+/// Servers and recievers normally use TCP sockets, with a domain such as
+/// "127.0.0.1" and a port. A domain starting with WIMP_UNIX_DOMAIN_PREFIX
+/// (e.g. "unix:/run/wimp/master.sock") uses a unix domain stream socket at
+/// that path instead, and the port is ignored.
+///
+/// plibsys only creates inet sockets, so unix domain sockets are created and
+/// bound/connected natively then wrapped in a PSocket. Everything after that
+/// (accept, send, recieve, timeouts) goes through plibsys as usual.
+///
+
+#ifndef WIMP_SOCKET_H
+#define WIMP_SOCKET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <plibsys.h>
+#include <wimp_core.h>
+
+#define WIMP_UNIX_DOMAIN_PREFIX "unix:"
+#define WIMP_SOCKET_MAX_BUFFERS 1024 //Most buffers written by one vectored send call
+
+///
+/// @brief A span of bytes for a vectored send
+///
+/// @param data The start of the bytes
+/// @param bytes The amount of bytes
+///
+typedef struct _WimpSocketBuffer
+{
+	const uint8_t* data;
+	size_t bytes;
+} WimpSocketBuffer;
+
+///
+/// @brief Checks if a domain refers to a unix domain socket
+///
+/// @param domain The domain to check
+///
+/// @return Returns true if the domain starts with WIMP_UNIX_DOMAIN_PREFIX
+///
+WIMP_API bool wimp_socket_is_unix_domain(const char* domain);
+
+///
+/// @brief Sends as much of several buffers, in order, as the socket takes without blocking
+///
+/// Uses a single sendmsg where available, covering up to WIMP_SOCKET_MAX_BUFFERS
+/// buffers straight from where they are. Elsewhere each buffer is sent in turn
+/// with p_socket_send, which blocks.
+///
+/// @param socket The socket to send to
+/// @param buffers The buffers to send
+/// @param count The amount of buffers, any past WIMP_SOCKET_MAX_BUFFERS are left
+///
+/// @return Returns the bytes sent, zero if the socket is full, or -1 if the socket failed
+///
+WIMP_API pssize wimp_socket_send_vectored(PSocket* socket, const WimpSocketBuffer* buffers, size_t count);
+
+///
+/// @brief Recieves whatever is already waiting on the socket without blocking
+///
+/// @param socket The socket to recieve from
+/// @param buffer The buffer to recieve into
+/// @param bytes The size of the buffer
+///
+/// @return Returns the bytes recieved, zero if nothing was waiting, or -1 if the socket closed or failed
+///
+WIMP_API pssize wimp_socket_receive_available(PSocket* socket, uint8_t* buffer, size_t bytes);
+
+///
+/// @brief Creates a new unix domain stream socket
+///
+/// @return Returns the socket, or NULL if failed or unsupported on the platform
+///
+WIMP_API PSocket* wimp_socket_unix_new(void);
+
+///
+/// @brief Binds a unix domain socket to the path in the domain
+///
+/// Any stale socket file left at the path is removed first.
+///
+/// @param socket The socket to bind
+/// @param domain The domain containing the path
+///
+/// @return Returns true if successful, false otherwise
+///
+WIMP_API bool wimp_socket_unix_bind(PSocket* socket, const char* domain);
+
+///
+/// @brief Connects a unix domain socket to the path in the domain
+///
+/// @param socket The socket to connect
+/// @param domain The domain containing the path
+///
+/// @return Returns true if successful, false otherwise
+///
+WIMP_API bool wimp_socket_unix_connect(PSocket* socket, const char* domain);
+
+///
+/// @brief Removes the socket file of a unix domain
+///
+/// @param domain The domain containing the path
+///
+WIMP_API void wimp_socket_unix_unlink(const char* domain);
+
+#endif
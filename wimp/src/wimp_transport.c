@@ -0,0 +1,385 @@
+#include <wimp_transport.h>
+#include <wimp_log.h>
+#include <pprocess.h>
+#include <patomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct _WimpLocalEndpointWaiter
+{
+	WIMP_INSTR_QUEUE_DRAINED wake;
+	void* context;
+} WimpLocalEndpointWaiter;
+
+typedef struct _WimpLocalEndpoint
+{
+	WimpInstrQueue* queue;	//Queue owned by the server the endpoint belongs to
+	PMutex* mutex;			//Held while delivering, so closing waits for in flight nodes
+	PMutex* wait_mutex;		//Guards the waiters. Is never held while taking another lock
+	WimpLocalEndpointWaiter* waiters;
+	int32_t waiter_count;
+	int32_t waiter_capacity;
+	int32_t id;
+	int32_t open;
+	int32_t transports;
+	pint refcount;
+	struct _WimpLocalEndpoint* next;
+} *WimpLocalEndpoint;
+
+/*
+* Registry of the endpoints open in this address space. Is only walked during
+* handshakes, so a list is enough.
+*/
+static PMutex* s_registry_mutex = NULL;
+static WimpLocalEndpoint s_registry = NULL;
+static int32_t s_next_endpoint_id = 1;
+static uint64_t s_process_token = 0;
+
+int32_t wimp_transport_init(void)
+{
+	if (s_registry_mutex != NULL)
+	{
+		return WIMP_TRANSPORT_SUCCESS;
+	}
+
+	s_registry_mutex = p_mutex_new();
+	if (s_registry_mutex == NULL)
+	{
+		return WIMP_TRANSPORT_FAIL;
+	}
+
+	//Mix the pid, time and the address of a static so separate processes
+	//(even reusing a pid) don't end up with the same token
+	uint64_t token = (uint64_t)p_process_get_current_pid() << 32;
+	token ^= (uint64_t)time(NULL);
+	token ^= (uint64_t)(uintptr_t)&s_registry;
+	s_process_token = token;
+	return WIMP_TRANSPORT_SUCCESS;
+}
+
+void wimp_transport_shutdown(void)
+{
+	if (s_registry_mutex == NULL)
+	{
+		return;
+	}
+
+	//Any endpoint still registered belongs to a server on another thread that
+	//hasn't been freed yet, so the registry has to stay valid for it
+	p_mutex_lock(s_registry_mutex);
+	bool in_use = s_registry != NULL;
+	p_mutex_unlock(s_registry_mutex);
+	if (in_use)
+	{
+		wimp_log("Transport shutdown with local endpoints still open\n");
+		return;
+	}
+
+	p_mutex_free(s_registry_mutex);
+	s_registry_mutex = NULL;
+	s_registry = NULL;
+}
+
+uint64_t wimp_transport_process_token(void)
+{
+	return s_process_token;
+}
+
+/*
+* Wakes everyone waiting on the endpoint queue to take more. Is made by the
+* queue, or by closing the endpoint.
+*/
+static void wimp_local_endpoint_wake_all(void* context)
+{
+	WimpLocalEndpoint endpoint = context;
+	p_mutex_lock(endpoint->wait_mutex);
+	for (int32_t i = 0; i < endpoint->waiter_count; ++i)
+	{
+		endpoint->waiters[i].wake(endpoint->waiters[i].context);
+	}
+	endpoint->waiter_count = 0;
+	p_mutex_unlock(endpoint->wait_mutex);
+}
+
+WimpLocalEndpoint wimp_local_endpoint_create(WimpInstrQueue* queue)
+{
+	if (s_registry_mutex == NULL)
+	{
+		wimp_log_fail("Transport registry isn't initialized! Call wimp_init first\n");
+		return NULL;
+	}
+
+	WimpLocalEndpoint endpoint = malloc(sizeof(struct _WimpLocalEndpoint));
+	if (endpoint == NULL)
+	{
+		return NULL;
+	}
+
+	endpoint->mutex = p_mutex_new();
+	endpoint->wait_mutex = p_mutex_new();
+	if (endpoint->mutex == NULL || endpoint->wait_mutex == NULL)
+	{
+		if (endpoint->mutex != NULL)
+		{
+			p_mutex_free(endpoint->mutex);
+		}
+		if (endpoint->wait_mutex != NULL)
+		{
+			p_mutex_free(endpoint->wait_mutex);
+		}
+		free(endpoint);
+		return NULL;
+	}
+
+	endpoint->queue = queue;
+	endpoint->waiters = NULL;
+	endpoint->waiter_count = 0;
+	endpoint->waiter_capacity = 0;
+	endpoint->open = 1;
+	endpoint->transports = WIMP_TRANSPORT_ALL;
+	p_atomic_int_set(&endpoint->refcount, 1);
+	wimp_instr_queue_set_room_callback(queue, &wimp_local_endpoint_wake_all, endpoint);
+
+	p_mutex_lock(s_registry_mutex);
+	endpoint->id = s_next_endpoint_id++;
+	endpoint->next = s_registry;
+	s_registry = endpoint;
+	p_mutex_unlock(s_registry_mutex);
+	return endpoint;
+}
+
+void wimp_local_endpoint_set_transports(WimpLocalEndpoint endpoint, int32_t transports)
+{
+	p_mutex_lock(endpoint->mutex);
+	endpoint->transports = transports;
+	p_mutex_unlock(endpoint->mutex);
+}
+
+int32_t wimp_local_endpoint_find(WimpInstrQueue* queue, int32_t* transports)
+{
+	*transports = WIMP_TRANSPORT_ALL & ~WIMP_TRANSPORT_LOCAL;
+	if (s_registry_mutex == NULL)
+	{
+		return 0;
+	}
+
+	int32_t id = 0;
+	p_mutex_lock(s_registry_mutex);
+	for (WimpLocalEndpoint current = s_registry; current != NULL; current = current->next)
+	{
+		if (current->queue == queue)
+		{
+			p_mutex_lock(current->mutex);
+			*transports = current->transports;
+			if (current->transports & WIMP_TRANSPORT_LOCAL)
+			{
+				id = current->id;
+			}
+			p_mutex_unlock(current->mutex);
+			break;
+		}
+	}
+	p_mutex_unlock(s_registry_mutex);
+	return id;
+}
+
+WimpLocalEndpoint wimp_local_endpoint_acquire(int32_t id)
+{
+	if (s_registry_mutex == NULL || id == 0)
+	{
+		return NULL;
+	}
+
+	WimpLocalEndpoint endpoint = NULL;
+	p_mutex_lock(s_registry_mutex);
+	for (WimpLocalEndpoint current = s_registry; current != NULL; current = current->next)
+	{
+		if (current->id == id)
+		{
+			//Endpoints are unregistered before being closed, so is still open
+			p_atomic_int_inc(&current->refcount);
+			endpoint = current;
+			break;
+		}
+	}
+	p_mutex_unlock(s_registry_mutex);
+	return endpoint;
+}
+
+void wimp_local_endpoint_release(WimpLocalEndpoint endpoint)
+{
+	if (endpoint == NULL)
+	{
+		return;
+	}
+
+	if (p_atomic_int_dec_and_test(&endpoint->refcount))
+	{
+		p_mutex_free(endpoint->mutex);
+		p_mutex_free(endpoint->wait_mutex);
+		free(endpoint->waiters);
+		free(endpoint);
+	}
+}
+
+bool wimp_local_endpoint_is_open(WimpLocalEndpoint endpoint)
+{
+	p_mutex_lock(endpoint->mutex);
+	bool open = endpoint->open;
+	p_mutex_unlock(endpoint->mutex);
+	return open;
+}
+
+int32_t wimp_local_endpoint_deliver(WimpLocalEndpoint endpoint, WimpInstrNode node)
+{
+	p_mutex_lock(endpoint->mutex);
+	if (!endpoint->open)
+	{
+		p_mutex_unlock(endpoint->mutex);
+		wimp_instr_node_free(node);
+		return WIMP_TRANSPORT_CLOSED;
+	}
+
+	//Same as a reciever adding to the queue, so pushes to the inbox. A
+	//throttled queue takes nothing until it has drained, and one at its limits
+	//that blocks is never waited on while holding the lock
+	bool full = wimp_instr_queue_is_throttled(endpoint->queue)
+		|| wimp_instr_queue_push_unblocked(endpoint->queue, node, false) == WIMP_INSTRUCTION_FULL;
+	p_mutex_unlock(endpoint->mutex);
+	return full ? WIMP_TRANSPORT_FULL : WIMP_TRANSPORT_SUCCESS;
+}
+
+int32_t wimp_local_endpoint_deliver_queue(WimpLocalEndpoint endpoint, WimpInstrQueue* queue)
+{
+	p_mutex_lock(endpoint->mutex);
+	if (!endpoint->open)
+	{
+		p_mutex_unlock(endpoint->mutex);
+		WimpInstrNode node = wimp_instr_queue_pop(queue);
+		while (node != NULL)
+		{
+			wimp_instr_node_free(node);
+			node = wimp_instr_queue_pop(queue);
+		}
+		return WIMP_TRANSPORT_CLOSED;
+	}
+
+	bool full = false;
+	while (queue->nextnode != NULL && !full)
+	{
+		full = wimp_instr_queue_is_throttled(endpoint->queue);
+		if (!full)
+		{
+			WimpInstrNode node = wimp_instr_queue_pop(queue);
+			full = wimp_instr_queue_push_unblocked(endpoint->queue, node, false) == WIMP_INSTRUCTION_FULL;
+			if (full)
+			{
+				//Goes back in front of the rest, to be delivered first once there is room
+				WimpInstrQueue front;
+				memset(&front, 0, sizeof(WimpInstrQueue));
+				wimp_instr_queue_add_existing(&front, node);
+				wimp_instr_queue_prepend_queue(queue, &front);
+			}
+		}
+	}
+	p_mutex_unlock(endpoint->mutex);
+	return full ? WIMP_TRANSPORT_FULL : WIMP_TRANSPORT_SUCCESS;
+}
+
+bool wimp_local_endpoint_wait(WimpLocalEndpoint endpoint, WIMP_INSTR_QUEUE_DRAINED wake, void* context)
+{
+	p_mutex_lock(endpoint->mutex);
+	if (!endpoint->open)
+	{
+		p_mutex_unlock(endpoint->mutex);
+		return false;
+	}
+
+	p_mutex_lock(endpoint->wait_mutex);
+	bool waiting = false;
+	for (int32_t i = 0; i < endpoint->waiter_count; ++i)
+	{
+		if (endpoint->waiters[i].context == context)
+		{
+			waiting = true;
+			break;
+		}
+	}
+	if (!waiting)
+	{
+		if (endpoint->waiter_count == endpoint->waiter_capacity)
+		{
+			int32_t capacity = endpoint->waiter_capacity == 0 ? 4 : endpoint->waiter_capacity * 2;
+			WimpLocalEndpointWaiter* waiters = realloc(endpoint->waiters, sizeof(WimpLocalEndpointWaiter) * capacity);
+			if (waiters == NULL)
+			{
+				p_mutex_unlock(endpoint->wait_mutex);
+				p_mutex_unlock(endpoint->mutex);
+				return false;
+			}
+			endpoint->waiters = waiters;
+			endpoint->waiter_capacity = capacity;
+		}
+		endpoint->waiters[endpoint->waiter_count].wake = wake;
+		endpoint->waiters[endpoint->waiter_count].context = context;
+		endpoint->waiter_count += 1;
+	}
+	p_mutex_unlock(endpoint->wait_mutex);
+
+	//Asked for after adding the waiter, so a callback made straight away finds it
+	bool wait = wimp_instr_queue_wait_room(endpoint->queue);
+	p_mutex_unlock(endpoint->mutex);
+	return wait;
+}
+
+void wimp_local_endpoint_cancel_wait(WimpLocalEndpoint endpoint, void* context)
+{
+	p_mutex_lock(endpoint->wait_mutex);
+	int32_t kept = 0;
+	for (int32_t i = 0; i < endpoint->waiter_count; ++i)
+	{
+		if (endpoint->waiters[i].context != context)
+		{
+			endpoint->waiters[kept++] = endpoint->waiters[i];
+		}
+	}
+	endpoint->waiter_count = kept;
+	p_mutex_unlock(endpoint->wait_mutex);
+}
+
+void wimp_local_endpoint_close(WimpLocalEndpoint endpoint)
+{
+	if (endpoint == NULL)
+	{
+		return;
+	}
+
+	//Unregister so no new connections can be made to the endpoint
+	if (s_registry_mutex != NULL)
+	{
+		p_mutex_lock(s_registry_mutex);
+		WimpLocalEndpoint* current = &s_registry;
+		while (*current != NULL)
+		{
+			if (*current == endpoint)
+			{
+				*current = endpoint->next;
+				break;
+			}
+			current = &(*current)->next;
+		}
+		p_mutex_unlock(s_registry_mutex);
+	}
+
+	//Wait on any delivery in progress, then stop accepting. Anyone waiting to
+	//deliver is woken to find the endpoint closed
+	p_mutex_lock(endpoint->mutex);
+	endpoint->open = 0;
+	wimp_instr_queue_set_room_callback(endpoint->queue, NULL, NULL);
+	endpoint->queue = NULL;
+	p_mutex_unlock(endpoint->mutex);
+	wimp_local_endpoint_wake_all(endpoint);
+
+	wimp_local_endpoint_release(endpoint);
+}
@@ -0,0 +1,200 @@
+///
+/// @file
+///
+/// This header defines the interfaces to the wimp_transport
+///
+/// A connection between two processes is always set up over a socket, with the
+/// reciever sending a handshake to the server it recieves from. The handshake
+/// offers the transports the reciever can use and the server picks one in its
+/// reply.
+///
+/// When both ends of a connection live in the same address space (e.g. a process
+/// started with wimp_start_library_process) the local transport is used. Every
+/// server registers a local endpoint wrapping its incoming queue, and the sending
+/// server hands the instruction node straight to that queue. No bytes are copied
+/// and no reciever thread is needed for the connection.
+///
+/// When both ends are on the same host (e.g. a process started with
+/// wimp_start_executable_process) the shared memory transport is used, see
+/// wimp_shm_ring.h.
+///
+
+#ifndef WIMP_TRANSPORT_H
+#define WIMP_TRANSPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <plibsys.h>
+#include <wimp_core.h>
+#include <wimp_instruction.h>
+
+/// @brief The result of WIMP transport operations
+enum WimpTransportResult
+{
+	WIMP_TRANSPORT_SUCCESS = 0,	///< Result if transport operation is successful
+	WIMP_TRANSPORT_FAIL    = -1,///< Result if transport operation fails for an unspecified reason
+	WIMP_TRANSPORT_CLOSED  = -2,///< Result if the endpoint has been closed by its owner
+	WIMP_TRANSPORT_FULL    = -3,///< Result if the endpoint queue is throttled or at its limits and can't take more yet
+};
+
+/// @brief The transports a connection can use. Can be combined as a mask.
+enum WimpTransport
+{
+	WIMP_TRANSPORT_NONE   = 0x00, ///< No transport, which is usually an error
+	WIMP_TRANSPORT_SOCKET = 0x01, ///< Instructions are streamed over the connection socket
+	WIMP_TRANSPORT_LOCAL  = 0x02, ///< Instruction nodes are passed directly to a server in the same address space
+	WIMP_TRANSPORT_SHM    = 0x04, ///< Instructions are streamed through a shared memory ring on the same host
+};
+
+#define WIMP_TRANSPORT_ALL (WIMP_TRANSPORT_SOCKET | WIMP_TRANSPORT_LOCAL | WIMP_TRANSPORT_SHM)
+
+/// @brief A registered endpoint that other servers in the address space can deliver to
+typedef struct _WimpLocalEndpoint *WimpLocalEndpoint;
+
+///
+/// @brief Initializes the transport registry
+///
+/// Is called by wimp_init, so doesn't need to be called directly.
+///
+/// @return Returns either WIMP_TRANSPORT_SUCCESS or WIMP_TRANSPORT_FAIL
+///
+WIMP_API int32_t wimp_transport_init(void);
+
+///
+/// @brief Shuts down the transport registry
+///
+/// Is called by wimp_shutdown, so doesn't need to be called directly.
+///
+WIMP_API void wimp_transport_shutdown(void);
+
+///
+/// @brief Gets the token identifying this address space
+///
+/// Is sent in the handshake so a server can tell if a reciever is local to it.
+///
+/// @return Returns the token of this address space
+///
+WIMP_API uint64_t wimp_transport_process_token(void);
+
+///
+/// @brief Creates and registers a local endpoint for a queue
+///
+/// The queue must outlive the endpoint being open. Should be closed with
+/// wimp_local_endpoint_close() before the queue is freed.
+///
+/// @param queue The queue that instructions delivered to the endpoint are added to
+///
+/// @return Returns the endpoint, or NULL if failed
+///
+WIMP_API WimpLocalEndpoint wimp_local_endpoint_create(WimpInstrQueue* queue);
+
+///
+/// @brief Sets the transports recievers writing to the endpoint queue offer during the handshake
+///
+/// @param endpoint The endpoint to set
+/// @param transports A mask of WimpTransport values
+///
+WIMP_API void wimp_local_endpoint_set_transports(WimpLocalEndpoint endpoint, int32_t transports);
+
+///
+/// @brief Finds the endpoint registered for a queue
+///
+/// @param queue The queue to find the endpoint of
+/// @param transports Pointer to store the transports the endpoint allows in. If there is no
+/// endpoint, every transport but the local one is allowed.
+///
+/// @return Returns the endpoint id, or 0 if the local transport can't be used for the queue
+///
+WIMP_API int32_t wimp_local_endpoint_find(WimpInstrQueue* queue, int32_t* transports);
+
+///
+/// @brief Acquires a reference to an open endpoint
+///
+/// Must be released with wimp_local_endpoint_release().
+///
+/// @param id The id of the endpoint
+///
+/// @return Returns the endpoint, or NULL if no open endpoint has that id
+///
+WIMP_API WimpLocalEndpoint wimp_local_endpoint_acquire(int32_t id);
+
+///
+/// @brief Releases a reference to an endpoint
+///
+/// @param endpoint The endpoint to release
+///
+WIMP_API void wimp_local_endpoint_release(WimpLocalEndpoint endpoint);
+
+///
+/// @brief Checks if the owner of the endpoint is still accepting instructions
+///
+/// @param endpoint The endpoint to check
+///
+/// @return Returns true if the endpoint is open, false otherwise
+///
+WIMP_API bool wimp_local_endpoint_is_open(WimpLocalEndpoint endpoint);
+
+///
+/// @brief Delivers an instruction node to the endpoint queue
+///
+/// Ownership of the node is passed on unless the queue is throttled, or at
+/// its limits and blocks, in which case the caller keeps it to deliver later.
+/// Never waits on the queue. If the endpoint has been closed the node is freed.
+///
+/// @param endpoint The endpoint to deliver to
+/// @param node The node to deliver
+///
+/// @return Returns either WIMP_TRANSPORT_SUCCESS, WIMP_TRANSPORT_CLOSED or WIMP_TRANSPORT_FULL
+///
+WIMP_API int32_t wimp_local_endpoint_deliver(WimpLocalEndpoint endpoint, WimpInstrNode node);
+
+///
+/// @brief Delivers the nodes from the front of a queue to the endpoint queue
+///
+/// Nodes are moved over until the queue is empty or the endpoint queue is
+/// throttled, or at its limits and blocks, under one lock. If the endpoint has
+/// been closed the nodes are freed.
+///
+/// @param endpoint The endpoint to deliver to
+/// @param queue The queue to take the nodes from, which the caller must own
+///
+/// @return Returns either WIMP_TRANSPORT_SUCCESS, WIMP_TRANSPORT_CLOSED or WIMP_TRANSPORT_FULL if nodes are left
+///
+WIMP_API int32_t wimp_local_endpoint_deliver_queue(WimpLocalEndpoint endpoint, WimpInstrQueue* queue);
+
+///
+/// @brief Asks to be woken once the endpoint queue can take more
+///
+/// The wake callback is made once, from the thread that drains the queue or
+/// closes the endpoint, so should only signal the waiting thread. The wait
+/// must be cancelled with wimp_local_endpoint_cancel_wait() before the context
+/// is freed.
+///
+/// @param endpoint The endpoint to wait on
+/// @param wake The callback to make
+/// @param context The context passed to the callback, which identifies the waiter
+///
+/// @return Returns true if the callback will be made, false if the endpoint can
+/// take more or is closed already
+///
+WIMP_API bool wimp_local_endpoint_wait(WimpLocalEndpoint endpoint, WIMP_INSTR_QUEUE_DRAINED wake, void* context);
+
+///
+/// @brief Cancels the waits made on the endpoint with a context
+///
+/// @param endpoint The endpoint the waits were made on
+/// @param context The context the waits were made with
+///
+WIMP_API void wimp_local_endpoint_cancel_wait(WimpLocalEndpoint endpoint, void* context);
+
+///
+/// @brief Closes and unregisters the endpoint
+///
+/// After returning no more instructions will be delivered to the queue.
+/// Releases the reference held by the creator.
+///
+/// @param endpoint The endpoint to close
+///
+WIMP_API void wimp_local_endpoint_close(WimpLocalEndpoint endpoint);
+
+#endif
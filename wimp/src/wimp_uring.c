@@ -0,0 +1,624 @@
+#include <wimp_uring.h>
+#include <wimp_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIMP_USE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+
+#define WIMP_URING_CANCEL_DATA UINT64_MAX //User data of cancellations, whose completions are skipped
+#define WIMP_URING_REAP_BATCH 64
+
+/*
+* The instructions being sent to one socket in the current batch
+*/
+typedef struct _WimpUringSend
+{
+	int fd;
+	void* tag;
+	int32_t result;		//Bytes sent or the negative errno
+	struct iovec* iovs;
+	size_t iov_count;
+	size_t iov_capacity;
+	struct msghdr msg;	//Must stay valid while the sendmsg is posted
+} WimpUringSend;
+
+typedef struct _WimpUring
+{
+	int fd;
+
+	//Submission ring
+	void* sq_map;
+	size_t sq_map_bytes;
+	uint32_t* sq_head;
+	uint32_t* sq_tail;
+	uint32_t* sq_mask;
+	uint32_t* sq_array;
+	uint32_t sq_entries;
+	uint32_t sqe_tail;	//Tail of the prepared entries, published on submit
+	struct io_uring_sqe* sqes;
+	size_t sqes_bytes;
+
+	//Completion ring
+	void* cq_map;
+	size_t cq_map_bytes;
+	uint32_t* cq_head;
+	uint32_t* cq_tail;
+	uint32_t* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	//Provided buffers for recieving
+	struct io_uring_buf_ring* buf_ring;
+	size_t buf_ring_bytes;
+	uint8_t* buffers;
+	int32_t buffer_count;
+	uint16_t buf_tail;
+
+	//Current send batch
+	WimpUringSend* sends;
+	size_t send_count;
+	size_t send_capacity;
+	size_t send_last;
+} *WimpUring;
+
+static bool wimp_uring_kernel_at_least(int major, int minor)
+{
+	struct utsname name;
+	int kernel_major = 0;
+	int kernel_minor = 0;
+	if (uname(&name) != 0 || sscanf(name.release, "%d.%d", &kernel_major, &kernel_minor) != 2)
+	{
+		return false;
+	}
+	return kernel_major > major || (kernel_major == major && kernel_minor >= minor);
+}
+
+static void wimp_uring_buffer_add(WimpUring uring, int32_t buffer)
+{
+	struct io_uring_buf* buf = &uring->buf_ring->bufs[uring->buf_tail & (uring->buffer_count - 1)];
+	buf->addr = (uint64_t)(uintptr_t)&uring->buffers[(size_t)buffer * WIMP_URING_BUFFER_BYTES];
+	buf->len = WIMP_URING_BUFFER_BYTES;
+	buf->bid = (uint16_t)buffer;
+	uring->buf_tail++;
+	__atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static bool wimp_uring_buffers_init(WimpUring uring, int32_t buffer_count)
+{
+	uring->buf_ring_bytes = (size_t)buffer_count * sizeof(struct io_uring_buf);
+	uring->buf_ring = mmap(NULL, uring->buf_ring_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (uring->buf_ring == MAP_FAILED)
+	{
+		uring->buf_ring = NULL;
+		return false;
+	}
+
+	uring->buffers = malloc((size_t)buffer_count * WIMP_URING_BUFFER_BYTES);
+	if (uring->buffers == NULL)
+	{
+		return false;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+	reg.ring_entries = (uint32_t)buffer_count;
+	reg.bgid = 0;
+	if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+	{
+		return false;
+	}
+
+	uring->buffer_count = buffer_count;
+	for (int32_t i = 0; i < buffer_count; ++i)
+	{
+		wimp_uring_buffer_add(uring, i);
+	}
+	return true;
+}
+
+bool wimp_uring_is_built(void)
+{
+	return true;
+}
+
+WimpUring wimp_uring_create(int32_t buffer_count)
+{
+	//Multishot recieves into provided buffers need linux 6.0
+	if (buffer_count > 0 && !wimp_uring_kernel_at_least(6, 0))
+	{
+		wimp_log("io_uring recieving needs linux 6.0, falling back\n");
+		return NULL;
+	}
+
+	WimpUring uring = calloc(1, sizeof(struct _WimpUring));
+	if (uring == NULL)
+	{
+		return NULL;
+	}
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(struct io_uring_params));
+	uring->fd = (int)syscall(__NR_io_uring_setup, WIMP_URING_ENTRIES, &params);
+	if (uring->fd < 0)
+	{
+		wimp_log("io_uring isn't available (%d), falling back\n", errno);
+		free(uring);
+		return NULL;
+	}
+
+	//The wait timeout needs the extended arguments, and completions mustn't be dropped
+	if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+	{
+		wimp_log("io_uring is missing needed features, falling back\n");
+		wimp_uring_free(uring);
+		return NULL;
+	}
+
+	uring->sq_map_bytes = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	uring->cq_map_bytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (uring->cq_map_bytes > uring->sq_map_bytes)
+		{
+			uring->sq_map_bytes = uring->cq_map_bytes;
+		}
+		uring->cq_map_bytes = uring->sq_map_bytes;
+	}
+
+	uring->sq_map = mmap(NULL, uring->sq_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (uring->sq_map == MAP_FAILED)
+	{
+		uring->sq_map = NULL;
+		wimp_uring_free(uring);
+		return NULL;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		uring->cq_map = uring->sq_map;
+	}
+	else
+	{
+		uring->cq_map = mmap(NULL, uring->cq_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+		if (uring->cq_map == MAP_FAILED)
+		{
+			uring->cq_map = NULL;
+			wimp_uring_free(uring);
+			return NULL;
+		}
+	}
+
+	uring->sqes_bytes = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED)
+	{
+		uring->sqes = NULL;
+		wimp_uring_free(uring);
+		return NULL;
+	}
+
+	uint8_t* sq = (uint8_t*)uring->sq_map;
+	uring->sq_head = (uint32_t*)&sq[params.sq_off.head];
+	uring->sq_tail = (uint32_t*)&sq[params.sq_off.tail];
+	uring->sq_mask = (uint32_t*)&sq[params.sq_off.ring_mask];
+	uring->sq_array = (uint32_t*)&sq[params.sq_off.array];
+	uring->sq_entries = params.sq_entries;
+	uring->sqe_tail = *uring->sq_tail;
+
+	uint8_t* cq = (uint8_t*)uring->cq_map;
+	uring->cq_head = (uint32_t*)&cq[params.cq_off.head];
+	uring->cq_tail = (uint32_t*)&cq[params.cq_off.tail];
+	uring->cq_mask = (uint32_t*)&cq[params.cq_off.ring_mask];
+	uring->cqes = (struct io_uring_cqe*)&cq[params.cq_off.cqes];
+
+	if (buffer_count > 0 && !wimp_uring_buffers_init(uring, buffer_count))
+	{
+		wimp_log("io_uring provided buffers aren't available, falling back\n");
+		wimp_uring_free(uring);
+		return NULL;
+	}
+	return uring;
+}
+
+void wimp_uring_free(WimpUring uring)
+{
+	if (uring == NULL)
+	{
+		return;
+	}
+
+	//Closing the ring cancels anything still posted
+	if (uring->sqes != NULL)
+	{
+		munmap(uring->sqes, uring->sqes_bytes);
+	}
+	if (uring->cq_map != NULL && uring->cq_map != uring->sq_map)
+	{
+		munmap(uring->cq_map, uring->cq_map_bytes);
+	}
+	if (uring->sq_map != NULL)
+	{
+		munmap(uring->sq_map, uring->sq_map_bytes);
+	}
+	close(uring->fd);
+
+	if (uring->buf_ring != NULL)
+	{
+		munmap(uring->buf_ring, uring->buf_ring_bytes);
+	}
+	free(uring->buffers);
+
+	for (size_t i = 0; i < uring->send_capacity; ++i)
+	{
+		free(uring->sends[i].iovs);
+	}
+	free(uring->sends);
+	free(uring);
+}
+
+/*
+* Publishes the prepared entries and enters the kernel, waiting for completions
+* if asked to
+*
+* @return Returns the result of the syscall, or a negative errno
+*/
+static int wimp_uring_submit(WimpUring uring, uint32_t min_complete, int32_t timeout)
+{
+	__atomic_store_n(uring->sq_tail, uring->sqe_tail, __ATOMIC_RELEASE);
+	uint32_t to_submit = uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	if (to_submit == 0 && min_complete == 0)
+	{
+		return 0;
+	}
+
+	uint32_t flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	void* argp = NULL;
+	size_t arg_bytes = 0;
+	if (min_complete > 0 && timeout >= 0)
+	{
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+		memset(&arg, 0, sizeof(struct io_uring_getevents_arg));
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		argp = &arg;
+		arg_bytes = sizeof(struct io_uring_getevents_arg);
+	}
+
+	int res;
+	do
+	{
+		res = (int)syscall(__NR_io_uring_enter, uring->fd, to_submit, min_complete, flags, argp, arg_bytes);
+	} while (res < 0 && errno == EINTR);
+
+	//Timing out isn't an error, and a busy completion ring just needs reaping
+	if (res < 0 && (errno == ETIME || errno == EBUSY))
+	{
+		return 0;
+	}
+	return res < 0 ? -errno : res;
+}
+
+static struct io_uring_sqe* wimp_uring_get_sqe(WimpUring uring)
+{
+	if (uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries)
+	{
+		//The ring is full, so submit what is there to make room
+		wimp_uring_submit(uring, 0, 0);
+		if (uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries)
+		{
+			return NULL;
+		}
+	}
+
+	uint32_t index = uring->sqe_tail & *uring->sq_mask;
+	struct io_uring_sqe* sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	uring->sq_array[index] = index;
+	uring->sqe_tail++;
+	return sqe;
+}
+
+static int32_t wimp_uring_reap(WimpUring uring, WimpUringCompletion* completions, int32_t max)
+{
+	uint32_t head = *uring->cq_head;
+	uint32_t tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	int32_t count = 0;
+	while (head != tail && count < max)
+	{
+		struct io_uring_cqe* cqe = &uring->cqes[head & *uring->cq_mask];
+		head++;
+		if (cqe->user_data == WIMP_URING_CANCEL_DATA)
+		{
+			continue;
+		}
+
+		WimpUringCompletion* completion = &completions[count++];
+		completion->user_data = cqe->user_data;
+		completion->result = cqe->res;
+		completion->more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+		completion->buffer = (cqe->flags & IORING_CQE_F_BUFFER) ? (int32_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+	}
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+int32_t wimp_uring_send_add(WimpUring uring, PSocket* socket, const uint8_t* data, size_t bytes, void* tag)
+{
+	//Instructions usually come in runs to the same destination
+	int fd = p_socket_get_fd(socket);
+	WimpUringSend* send = NULL;
+	if (uring->send_last < uring->send_count && uring->sends[uring->send_last].fd == fd)
+	{
+		send = &uring->sends[uring->send_last];
+	}
+	for (size_t i = 0; send == NULL && i < uring->send_count; ++i)
+	{
+		if (uring->sends[i].fd == fd)
+		{
+			send = &uring->sends[i];
+			uring->send_last = i;
+		}
+	}
+
+	if (send == NULL)
+	{
+		if (uring->send_count == uring->send_capacity)
+		{
+			size_t capacity = uring->send_capacity == 0 ? 8 : uring->send_capacity * 2;
+			WimpUringSend* sends = realloc(uring->sends, capacity * sizeof(WimpUringSend));
+			if (sends == NULL)
+			{
+				return WIMP_URING_FAIL;
+			}
+			memset(&sends[uring->send_capacity], 0, (capacity - uring->send_capacity) * sizeof(WimpUringSend));
+			uring->sends = sends;
+			uring->send_capacity = capacity;
+		}
+
+		//The iovec array is kept between batches
+		uring->send_last = uring->send_count++;
+		send = &uring->sends[uring->send_last];
+		send->fd = fd;
+		send->tag = tag;
+		send->result = 0;
+		send->iov_count = 0;
+	}
+
+	if (send->iov_count == WIMP_URING_MAX_SEND_BUFFERS)
+	{
+		return WIMP_URING_FAIL;
+	}
+	if (send->iov_count == send->iov_capacity)
+	{
+		size_t capacity = send->iov_capacity == 0 ? 16 : send->iov_capacity * 2;
+		struct iovec* iovs = realloc(send->iovs, capacity * sizeof(struct iovec));
+		if (iovs == NULL)
+		{
+			return WIMP_URING_FAIL;
+		}
+		send->iovs = iovs;
+		send->iov_capacity = capacity;
+	}
+
+	send->iovs[send->iov_count].iov_base = (void*)data;
+	send->iovs[send->iov_count].iov_len = bytes;
+	send->iov_count++;
+	return WIMP_URING_SUCCESS;
+}
+
+int32_t wimp_uring_send_flush(WimpUring uring, WIMP_URING_SEND_DONE done, void* context)
+{
+	//One sendmsg per destination, which the kernel completes straight away as
+	//they don't wait for space. Destinations past the submission ring size
+	//report nothing sent
+	uint32_t posted = 0;
+	for (size_t i = 0; i < uring->send_count; ++i)
+	{
+		WimpUringSend* send = &uring->sends[i];
+		send->result = 0;
+
+		struct io_uring_sqe* sqe = wimp_uring_get_sqe(uring);
+		if (sqe == NULL)
+		{
+			continue;
+		}
+
+		memset(&send->msg, 0, sizeof(struct msghdr));
+		send->msg.msg_iov = send->iovs;
+		send->msg.msg_iovlen = send->iov_count;
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = send->fd;
+		sqe->addr = (uint64_t)(uintptr_t)&send->msg;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+		sqe->user_data = i;
+		posted++;
+	}
+
+	uint32_t completed = 0;
+	while (completed < posted)
+	{
+		int res = wimp_uring_submit(uring, posted - completed, -1);
+		if (res < 0)
+		{
+			wimp_log_fail("io_uring send failed to submit (%d)\n", -res);
+			for (size_t i = 0; i < uring->send_count; ++i)
+			{
+				uring->sends[i].result = res;
+			}
+			break;
+		}
+
+		WimpUringCompletion completions[WIMP_URING_REAP_BATCH];
+		int32_t count = wimp_uring_reap(uring, completions, WIMP_URING_REAP_BATCH);
+		for (int32_t i = 0; i < count; ++i)
+		{
+			//A full socket just has nothing sent
+			int32_t result = completions[i].result;
+			uring->sends[completions[i].user_data].result = result == -EAGAIN ? 0 : result;
+			completed++;
+		}
+	}
+
+	int32_t result = WIMP_URING_SUCCESS;
+	for (size_t i = 0; i < uring->send_count; ++i)
+	{
+		if (uring->sends[i].result < 0)
+		{
+			result = WIMP_URING_FAIL;
+		}
+		done(context, uring->sends[i].tag, uring->sends[i].result);
+	}
+	uring->send_count = 0;
+	uring->send_last = 0;
+	return result;
+}
+
+int32_t wimp_uring_recv_post(WimpUring uring, int fd, uint64_t user_data)
+{
+	struct io_uring_sqe* sqe = wimp_uring_get_sqe(uring);
+	if (sqe == NULL)
+	{
+		return WIMP_URING_FAIL;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = user_data;
+	return WIMP_URING_SUCCESS;
+}
+
+int32_t wimp_uring_read_post(WimpUring uring, int fd, void* data, size_t bytes, uint64_t user_data)
+{
+	struct io_uring_sqe* sqe = wimp_uring_get_sqe(uring);
+	if (sqe == NULL)
+	{
+		return WIMP_URING_FAIL;
+	}
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)data;
+	sqe->len = (uint32_t)bytes;
+	sqe->user_data = user_data;
+	return WIMP_URING_SUCCESS;
+}
+
+int32_t wimp_uring_cancel(WimpUring uring, uint64_t user_data)
+{
+	struct io_uring_sqe* sqe = wimp_uring_get_sqe(uring);
+	if (sqe == NULL)
+	{
+		return WIMP_URING_FAIL;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = WIMP_URING_CANCEL_DATA;
+	return WIMP_URING_SUCCESS;
+}
+
+int32_t wimp_uring_wait(WimpUring uring, WimpUringCompletion* completions, int32_t max, int32_t timeout)
+{
+	//Only wait in the kernel if nothing has completed already
+	int32_t count = wimp_uring_reap(uring, completions, max);
+	int res = wimp_uring_submit(uring, count > 0 ? 0 : 1, timeout);
+	if (res < 0)
+	{
+		wimp_log_fail("io_uring wait failed (%d)\n", -res);
+		return WIMP_URING_FAIL;
+	}
+
+	if (count == 0)
+	{
+		count = wimp_uring_reap(uring, completions, max);
+	}
+	return count;
+}
+
+const uint8_t* wimp_uring_buffer_get(WimpUring uring, int32_t buffer)
+{
+	return &uring->buffers[(size_t)buffer * WIMP_URING_BUFFER_BYTES];
+}
+
+void wimp_uring_buffer_release(WimpUring uring, int32_t buffer)
+{
+	wimp_uring_buffer_add(uring, buffer);
+}
+
+#else
+
+bool wimp_uring_is_built(void)
+{
+	return false;
+}
+
+WimpUring wimp_uring_create(int32_t buffer_count)
+{
+	return NULL;
+}
+
+void wimp_uring_free(WimpUring uring)
+{
+	return;
+}
+
+int32_t wimp_uring_send_add(WimpUring uring, PSocket* socket, const uint8_t* data, size_t bytes, void* tag)
+{
+	return WIMP_URING_FAIL;
+}
+
+int32_t wimp_uring_send_flush(WimpUring uring, WIMP_URING_SEND_DONE done, void* context)
+{
+	return WIMP_URING_FAIL;
+}
+
+int32_t wimp_uring_recv_post(WimpUring uring, int fd, uint64_t user_data)
+{
+	return WIMP_URING_FAIL;
+}
+
+int32_t wimp_uring_read_post(WimpUring uring, int fd, void* data, size_t bytes, uint64_t user_data)
+{
+	return WIMP_URING_FAIL;
+}
+
+int32_t wimp_uring_cancel(WimpUring uring, uint64_t user_data)
+{
+	return WIMP_URING_FAIL;
+}
+
+int32_t wimp_uring_wait(WimpUring uring, WimpUringCompletion* completions, int32_t max, int32_t timeout)
+{
+	return WIMP_URING_FAIL;
+}
+
+const uint8_t* wimp_uring_buffer_get(WimpUring uring, int32_t buffer)
+{
+	return NULL;
+}
+
+void wimp_uring_buffer_release(WimpUring uring, int32_t buffer)
+{
+	return;
+}
+
+#endif
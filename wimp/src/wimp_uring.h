@@ -0,0 +1,191 @@
+///
+/// @file
+///
+/// This header defines the interfaces to the wimp_uring
+///
+/// An optional io_uring backend for the socket transport on linux, enabled
+/// by building with the WIMP_USE_IO_URING CMake option. It talks to the kernel
+/// with the raw syscalls so there is no dependency on liburing.
+///
+/// Sending: the instructions a server sends in one call are added to a batch,
+/// which gathers them per destination socket. Flushing submits one sendmsg per
+/// destination and collects every completion with a single syscall. The sends
+/// don't wait for space, so each destination reports how much it took and the
+/// caller keeps the rest queued.
+///
+/// Recieving: a multishot recieve is kept posted for every connection, which
+/// picks a buffer from a ring of provided buffers as data arrives. The reciever
+/// event loop only makes a syscall when it has run out of completions.
+///
+/// If the backend wasn't built, or the kernel doesn't support it (recieving
+/// needs linux 6.0), wimp_uring_create() returns NULL and the callers keep to
+/// epoll and blocking sends.
+///
+
+#ifndef WIMP_URING_H
+#define WIMP_URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <plibsys.h>
+#include <wimp_core.h>
+
+#define WIMP_URING_ENTRIES 256
+#define WIMP_URING_BUFFER_COUNT 64 //Must be a power of two
+#define WIMP_URING_BUFFER_BYTES 16384
+#define WIMP_URING_MAX_SEND_BUFFERS 1024 //Most buffers to one socket in a batch (UIO_MAXIOV)
+
+/// @brief The result of WIMP io_uring operations
+enum WimpUringResult
+{
+	WIMP_URING_SUCCESS = 0, ///< Result if io_uring operation is successful
+	WIMP_URING_FAIL    = -1,///< Result if io_uring operation fails for an unspecified reason
+};
+
+/// @brief A handle to an io_uring instance, which must only be used by one thread
+typedef struct _WimpUring *WimpUring;
+
+///
+/// @brief A completed operation
+///
+/// @param user_data The user data the operation was posted with
+/// @param result The result of the operation, a negative errno if failed
+/// @param more Whether a multishot operation is still posted
+/// @param buffer The provided buffer holding recieved data, -1 if there is none
+///
+typedef struct _WimpUringCompletion
+{
+	uint64_t user_data;
+	int32_t result;
+	bool more;
+	int32_t buffer;
+} WimpUringCompletion;
+
+///
+/// @brief Called for each destination of a send flush with the bytes it took, or a negative errno if it failed
+///
+typedef void (*WIMP_URING_SEND_DONE)(void* context, void* tag, int32_t result);
+
+///
+/// @brief Checks if the io_uring backend was built
+///
+/// @return Returns true if built with WIMP_USE_IO_URING
+///
+WIMP_API bool wimp_uring_is_built(void);
+
+///
+/// @brief Creates an io_uring instance
+///
+/// @param buffer_count The amount of provided buffers to register for recieving, zero if only sending
+///
+/// @return Returns the instance, or NULL if io_uring isn't available
+///
+WIMP_API WimpUring wimp_uring_create(int32_t buffer_count);
+
+///
+/// @brief Frees the instance, cancelling anything still posted
+///
+/// @param uring The instance to free
+///
+WIMP_API void wimp_uring_free(WimpUring uring);
+
+///
+/// @brief Adds bytes to send to a socket in the current batch
+///
+/// The bytes must stay valid until wimp_uring_send_flush() returns. Bytes
+/// for the same socket are sent in the order they are added, and up to
+/// WIMP_URING_MAX_SEND_BUFFERS can be added per socket.
+///
+/// @param uring The instance to batch in
+/// @param socket The socket to send to
+/// @param data The bytes to send
+/// @param bytes The amount of bytes to send
+/// @param tag Passed to the callback if sending to the socket fails
+///
+/// @return Returns either WIMP_URING_SUCCESS or WIMP_URING_FAIL
+///
+WIMP_API int32_t wimp_uring_send_add(WimpUring uring, PSocket* socket, const uint8_t* data, size_t bytes, void* tag);
+
+///
+/// @brief Sends as much of the current batch as the sockets take without blocking
+///
+/// @param uring The instance to flush
+/// @param done Called with the tag of each socket and how much it took
+/// @param context Passed to the callback
+///
+/// @return Returns either WIMP_URING_SUCCESS or WIMP_URING_FAIL if any socket failed
+///
+WIMP_API int32_t wimp_uring_send_flush(WimpUring uring, WIMP_URING_SEND_DONE done, void* context);
+
+///
+/// @brief Posts a multishot recieve on a socket into the provided buffers
+///
+/// Completions have the user data given. Once one arrives with more unset
+/// the recieve is no longer posted.
+///
+/// @param uring The instance to post to
+/// @param fd The socket to recieve from
+/// @param user_data The user data of the completions, must not be zero
+///
+/// @return Returns either WIMP_URING_SUCCESS or WIMP_URING_FAIL
+///
+WIMP_API int32_t wimp_uring_recv_post(WimpUring uring, int fd, uint64_t user_data);
+
+///
+/// @brief Posts a single read into a buffer
+///
+/// @param uring The instance to post to
+/// @param fd The file to read from
+/// @param data The buffer to read into, which must stay valid until completion
+/// @param bytes The size of the buffer
+/// @param user_data The user data of the completion
+///
+/// @return Returns either WIMP_URING_SUCCESS or WIMP_URING_FAIL
+///
+WIMP_API int32_t wimp_uring_read_post(WimpUring uring, int fd, void* data, size_t bytes, uint64_t user_data);
+
+///
+/// @brief Cancels the operations posted with the user data
+///
+/// The cancelled operations still complete, with more unset.
+///
+/// @param uring The instance to cancel in
+/// @param user_data The user data of the operations to cancel
+///
+/// @return Returns either WIMP_URING_SUCCESS or WIMP_URING_FAIL
+///
+WIMP_API int32_t wimp_uring_cancel(WimpUring uring, uint64_t user_data);
+
+///
+/// @brief Submits everything posted and waits for completions
+///
+/// Completions of the cancellations themselves are skipped.
+///
+/// @param uring The instance to wait on
+/// @param completions Array to copy the completions to
+/// @param max The size of the array
+/// @param timeout Time to wait for the first completion in ms, -1 to wait indefinitely
+///
+/// @return Returns the amount of completions, zero if timed out, or WIMP_URING_FAIL
+///
+WIMP_API int32_t wimp_uring_wait(WimpUring uring, WimpUringCompletion* completions, int32_t max, int32_t timeout);
+
+///
+/// @brief Gets the data of a provided buffer from a completion
+///
+/// @param uring The instance the buffer belongs to
+/// @param buffer The buffer of the completion
+///
+/// @return Returns the start of the buffer
+///
+WIMP_API const uint8_t* wimp_uring_buffer_get(WimpUring uring, int32_t buffer);
+
+///
+/// @brief Gives a provided buffer back to the kernel once its data is used
+///
+/// @param uring The instance the buffer belongs to
+/// @param buffer The buffer to give back
+///
+WIMP_API void wimp_uring_buffer_release(WimpUring uring, int32_t buffer);
+
+#endif
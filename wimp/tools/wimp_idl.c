@@ -0,0 +1,872 @@
+/*
+* Generates C argument structs for instructions from a small IDL, so handlers
+* read their arguments with a cast instead of parsing them
+*
+* Usage: wimp_idl <input.idl> <output.h>
+*
+* The IDL is a list of instructions, each with typed fields:
+*
+*	//Comments run to the end of the line
+*	instruction player_move
+*	{
+*		int32 x;
+*		int32 y;
+*		float64 speed;
+*		char name[32];
+*	}
+*
+* An instruction without arguments can be written as "instruction name;". Field
+* types are int8-int64, uint8-uint64, float32, float64 and char, and any field
+* can be a fixed size array. Fields keep their order and are aligned to
+* their size with explicit padding, and the struct is padded to 8 bytes so it
+* keeps the alignment the instruction gives its arguments. The layout is the
+* same on every compiler, and the arguments are little-endian on the wire like
+* the rest of the instruction.
+*
+* The names also get a minimal perfect hash, so a name is recognised with one
+* hash and one compare, and a switch based dispatcher for them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WIMP_IDL_MAX_IDENTIFIER 64
+#define WIMP_IDL_MAX_FIELDS 64
+#define WIMP_IDL_MAX_INSTRUCTIONS 256
+#define WIMP_IDL_MAX_ARRAY (1024 * 1024)
+#define WIMP_IDL_ALIGN 8
+#define WIMP_IDL_MAX_DISPLACEMENT (1u << 24)
+
+typedef struct _WimpIdlType
+{
+	const char* name;
+	const char* ctype;
+	size_t bytes;
+} WimpIdlType;
+
+static const WimpIdlType WIMP_IDL_TYPES[] =
+{
+	{ "int8", "int8_t", 1 },
+	{ "int16", "int16_t", 2 },
+	{ "int32", "int32_t", 4 },
+	{ "int64", "int64_t", 8 },
+	{ "uint8", "uint8_t", 1 },
+	{ "uint16", "uint16_t", 2 },
+	{ "uint32", "uint32_t", 4 },
+	{ "uint64", "uint64_t", 8 },
+	{ "float32", "float", 4 },
+	{ "float64", "double", 8 },
+	{ "char", "char", 1 },
+};
+
+typedef struct _WimpIdlField
+{
+	const WimpIdlType* type;
+	char name[WIMP_IDL_MAX_IDENTIFIER];
+	size_t count;		//Zero if it isn't an array
+	size_t offset;
+} WimpIdlField;
+
+typedef struct _WimpIdlInstr
+{
+	char name[WIMP_IDL_MAX_IDENTIFIER];
+	WimpIdlField fields[WIMP_IDL_MAX_FIELDS];
+	size_t field_count;
+	size_t bytes;
+} WimpIdlInstr;
+
+typedef struct _WimpIdlParser
+{
+	const char* path;
+	const char* text;
+	size_t offset;
+	int32_t line;
+} WimpIdlParser;
+
+static WimpIdlInstr instrs[WIMP_IDL_MAX_INSTRUCTIONS];
+static size_t instr_count = 0;
+
+//The perfect hash of the names, the slot of each name is its index in slots
+static uint32_t displacements[WIMP_IDL_MAX_INSTRUCTIONS];
+static size_t bucket_count = 0;
+static int32_t slots[WIMP_IDL_MAX_INSTRUCTIONS];
+
+/*
+* Prints an error at the current line of the IDL
+*/
+static bool wimp_idl_error(WimpIdlParser* parser, const char* message, const char* detail)
+{
+	fprintf(stderr, "%s:%d: error: %s%s\n", parser->path, parser->line, message, detail);
+	return false;
+}
+
+/*
+* Skips whitespace and comments
+*/
+static void wimp_idl_skip(WimpIdlParser* parser)
+{
+	while (parser->text[parser->offset] != '\0')
+	{
+		char c = parser->text[parser->offset];
+		if (c == '\n')
+		{
+			parser->line++;
+			parser->offset++;
+		}
+		else if (isspace((unsigned char)c))
+		{
+			parser->offset++;
+		}
+		else if (c == '/' && parser->text[parser->offset + 1] == '/')
+		{
+			while (parser->text[parser->offset] != '\0' && parser->text[parser->offset] != '\n')
+			{
+				parser->offset++;
+			}
+		}
+		else
+		{
+			return;
+		}
+	}
+}
+
+/*
+* Reads an identifier, which has to start with a letter or underscore
+*/
+static bool wimp_idl_identifier(WimpIdlParser* parser, char* identifier)
+{
+	wimp_idl_skip(parser);
+	const char* start = &parser->text[parser->offset];
+	if (!isalpha((unsigned char)start[0]) && start[0] != '_')
+	{
+		return wimp_idl_error(parser, "expected an identifier", "");
+	}
+
+	size_t length = 0;
+	while (isalnum((unsigned char)start[length]) || start[length] == '_')
+	{
+		length++;
+	}
+	if (length >= WIMP_IDL_MAX_IDENTIFIER)
+	{
+		return wimp_idl_error(parser, "identifier is too long", "");
+	}
+
+	memcpy(identifier, start, length);
+	identifier[length] = '\0';
+	parser->offset += length;
+	return true;
+}
+
+/*
+* Reads a symbol, and fails if it is a different one
+*/
+static bool wimp_idl_expect(WimpIdlParser* parser, char symbol)
+{
+	wimp_idl_skip(parser);
+	if (parser->text[parser->offset] != symbol)
+	{
+		char expected[4] = { '\'', symbol, '\'', '\0' };
+		return wimp_idl_error(parser, "expected ", expected);
+	}
+	parser->offset++;
+	return true;
+}
+
+/*
+* Reads an array size, which has to be a positive number
+*/
+static bool wimp_idl_array_size(WimpIdlParser* parser, size_t* count)
+{
+	wimp_idl_skip(parser);
+	*count = 0;
+	if (!isdigit((unsigned char)parser->text[parser->offset]))
+	{
+		return wimp_idl_error(parser, "expected an array size", "");
+	}
+	while (isdigit((unsigned char)parser->text[parser->offset]))
+	{
+		*count = *count * 10 + (size_t)(parser->text[parser->offset] - '0');
+		if (*count > WIMP_IDL_MAX_ARRAY)
+		{
+			return wimp_idl_error(parser, "array size is too large", "");
+		}
+		parser->offset++;
+	}
+	if (*count == 0)
+	{
+		return wimp_idl_error(parser, "array size must be positive", "");
+	}
+	return wimp_idl_expect(parser, ']');
+}
+
+/*
+* Gets a field type by its IDL name
+*/
+static const WimpIdlType* wimp_idl_find_type(const char* name)
+{
+	for (size_t i = 0; i < sizeof(WIMP_IDL_TYPES) / sizeof(WIMP_IDL_TYPES[0]); ++i)
+	{
+		if (strcmp(WIMP_IDL_TYPES[i].name, name) == 0)
+		{
+			return &WIMP_IDL_TYPES[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+* Reads the fields of an instruction up to the closing brace, and lays them out
+*/
+static bool wimp_idl_fields(WimpIdlParser* parser, WimpIdlInstr* instr)
+{
+	size_t offset = 0;
+	wimp_idl_skip(parser);
+	while (parser->text[parser->offset] != '}')
+	{
+		if (instr->field_count == WIMP_IDL_MAX_FIELDS)
+		{
+			return wimp_idl_error(parser, "too many fields in ", instr->name);
+		}
+		WimpIdlField* field = &instr->fields[instr->field_count];
+
+		char type_name[WIMP_IDL_MAX_IDENTIFIER];
+		if (!wimp_idl_identifier(parser, type_name))
+		{
+			return false;
+		}
+		field->type = wimp_idl_find_type(type_name);
+		if (field->type == NULL)
+		{
+			return wimp_idl_error(parser, "unknown type ", type_name);
+		}
+		if (!wimp_idl_identifier(parser, field->name))
+		{
+			return false;
+		}
+		for (size_t i = 0; i < instr->field_count; ++i)
+		{
+			if (strcmp(instr->fields[i].name, field->name) == 0)
+			{
+				return wimp_idl_error(parser, "duplicate field ", field->name);
+			}
+		}
+
+		field->count = 0;
+		wimp_idl_skip(parser);
+		if (parser->text[parser->offset] == '[')
+		{
+			parser->offset++;
+			if (!wimp_idl_array_size(parser, &field->count))
+			{
+				return false;
+			}
+		}
+		if (!wimp_idl_expect(parser, ';'))
+		{
+			return false;
+		}
+
+		//Each field is aligned to the size of its type
+		size_t align = field->type->bytes;
+		offset = (offset + align - 1) & ~(align - 1);
+		field->offset = offset;
+		offset += field->type->bytes * (field->count > 0 ? field->count : 1);
+		if (offset > INT32_MAX / 2)
+		{
+			return wimp_idl_error(parser, "arguments are too large in ", instr->name);
+		}
+
+		instr->field_count++;
+		wimp_idl_skip(parser);
+		if (parser->text[parser->offset] == '\0')
+		{
+			return wimp_idl_error(parser, "missing '}' after ", instr->name);
+		}
+	}
+	parser->offset++;
+
+	instr->bytes = (offset + WIMP_IDL_ALIGN - 1) & ~((size_t)WIMP_IDL_ALIGN - 1);
+	return true;
+}
+
+/*
+* Reads every instruction in the IDL
+*/
+static bool wimp_idl_parse(WimpIdlParser* parser)
+{
+	wimp_idl_skip(parser);
+	while (parser->text[parser->offset] != '\0')
+	{
+		char keyword[WIMP_IDL_MAX_IDENTIFIER];
+		if (!wimp_idl_identifier(parser, keyword))
+		{
+			return false;
+		}
+		if (strcmp(keyword, "instruction") != 0)
+		{
+			return wimp_idl_error(parser, "expected 'instruction', not ", keyword);
+		}
+		if (instr_count == WIMP_IDL_MAX_INSTRUCTIONS)
+		{
+			return wimp_idl_error(parser, "too many instructions", "");
+		}
+
+		WimpIdlInstr* instr = &instrs[instr_count];
+		memset(instr, 0, sizeof(WimpIdlInstr));
+		if (!wimp_idl_identifier(parser, instr->name))
+		{
+			return false;
+		}
+		for (size_t i = 0; i < instr_count; ++i)
+		{
+			if (strcmp(instrs[i].name, instr->name) == 0)
+			{
+				return wimp_idl_error(parser, "duplicate instruction ", instr->name);
+			}
+		}
+		wimp_idl_skip(parser);
+		if (parser->text[parser->offset] == ';')
+		{
+			parser->offset++;
+		}
+		else if (!wimp_idl_expect(parser, '{') || !wimp_idl_fields(parser, instr))
+		{
+			return false;
+		}
+
+		instr_count++;
+		wimp_idl_skip(parser);
+	}
+	return true;
+}
+
+/*
+* Hashes a name with 64 bit FNV-1a, which the generated lookup does the same way
+*/
+static uint64_t wimp_idl_hash(const char* name)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (; *name != '\0'; ++name)
+	{
+		hash ^= (uint8_t)*name;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+* Mixes the low half of a hash with a displacement, so each displacement moves
+* the name to a different slot
+*/
+static uint32_t wimp_idl_mix(uint32_t value)
+{
+	value ^= value >> 16;
+	value *= 0x85ebca6bu;
+	value ^= value >> 13;
+	value *= 0xc2b2ae35u;
+	value ^= value >> 16;
+	return value;
+}
+
+/*
+* Finds a minimal perfect hash of the names by hash and displace. Names go in
+* buckets by the mixed high half of their hash, then each bucket, biggest first, is
+* given the first displacement that moves all of its names to free slots.
+* There are as many slots as names, so every slot ends up used.
+*/
+static bool wimp_idl_perfect_hash(const char* path)
+{
+	if (instr_count == 0)
+	{
+		return true;
+	}
+
+	uint64_t hashes[WIMP_IDL_MAX_INSTRUCTIONS];
+	size_t bucket_sizes[WIMP_IDL_MAX_INSTRUCTIONS];
+	bool bucket_done[WIMP_IDL_MAX_INSTRUCTIONS];
+	bucket_count = (instr_count + 1) / 2;
+	memset(bucket_sizes, 0, sizeof(bucket_sizes));
+	memset(bucket_done, 0, sizeof(bucket_done));
+	for (size_t i = 0; i < instr_count; ++i)
+	{
+		hashes[i] = wimp_idl_hash(instrs[i].name);
+		for (size_t j = 0; j < i; ++j)
+		{
+			if (hashes[j] == hashes[i])
+			{
+				fprintf(stderr, "%s: error: %s and %s have the same hash\n", path, instrs[j].name, instrs[i].name);
+				return false;
+			}
+		}
+		bucket_sizes[wimp_idl_mix((uint32_t)(hashes[i] >> 32)) % bucket_count]++;
+		slots[i] = -1;
+	}
+
+	for (size_t round = 0; round < bucket_count; ++round)
+	{
+		size_t bucket = 0;
+		for (size_t b = 0; b < bucket_count; ++b)
+		{
+			if (!bucket_done[b] && (bucket_done[bucket] || bucket_sizes[b] > bucket_sizes[bucket]))
+			{
+				bucket = b;
+			}
+		}
+		bucket_done[bucket] = true;
+		displacements[bucket] = 0;
+
+		size_t members[WIMP_IDL_MAX_INSTRUCTIONS];
+		size_t member_count = 0;
+		for (size_t i = 0; i < instr_count; ++i)
+		{
+			if (wimp_idl_mix((uint32_t)(hashes[i] >> 32)) % bucket_count == bucket)
+			{
+				members[member_count++] = i;
+			}
+		}
+
+		uint32_t chosen[WIMP_IDL_MAX_INSTRUCTIONS];
+		bool placed = member_count == 0;
+		for (uint32_t displacement = 0; !placed && displacement < WIMP_IDL_MAX_DISPLACEMENT; ++displacement)
+		{
+			placed = true;
+			for (size_t m = 0; placed && m < member_count; ++m)
+			{
+				chosen[m] = wimp_idl_mix((uint32_t)hashes[members[m]] ^ displacement) % (uint32_t)instr_count;
+				placed = slots[chosen[m]] == -1;
+				for (size_t k = 0; placed && k < m; ++k)
+				{
+					placed = chosen[k] != chosen[m];
+				}
+			}
+			if (placed)
+			{
+				displacements[bucket] = displacement;
+				for (size_t m = 0; m < member_count; ++m)
+				{
+					slots[chosen[m]] = (int32_t)members[m];
+				}
+			}
+		}
+		if (!placed)
+		{
+			fprintf(stderr, "%s: error: couldn't find a perfect hash for the names\n", path);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+* Writes an identifier in upper case
+*/
+static void wimp_idl_write_upper(FILE* out, const char* identifier)
+{
+	for (; *identifier != '\0'; ++identifier)
+	{
+		fputc(toupper((unsigned char)*identifier), out);
+	}
+}
+
+/*
+* Writes an identifier in camel case, so player_move is PlayerMove
+*/
+static void wimp_idl_write_camel(FILE* out, const char* identifier)
+{
+	bool upper = true;
+	for (; *identifier != '\0'; ++identifier)
+	{
+		if (*identifier == '_')
+		{
+			upper = true;
+			continue;
+		}
+		fputc(upper ? toupper((unsigned char)*identifier) : *identifier, out);
+		upper = false;
+	}
+}
+
+/*
+* Writes the struct, sizes and functions for an instruction
+*/
+static void wimp_idl_write_instr(FILE* out, const WimpIdlInstr* instr)
+{
+	const char* n = instr->name;
+
+	fprintf(out, "///\n/// @brief The name of the %s instruction\n///\n#define ", n);
+	wimp_idl_write_upper(out, n);
+	fprintf(out, "_INSTRUCTION \"%s\"\n\n", n);
+
+	//An instruction without fields only has its name and the functions to send it
+	if (instr->field_count == 0)
+	{
+		fprintf(out, "///\n/// @brief Sends the %s instruction, which has no arguments\n///\n", n);
+		fprintf(out, "/// @param dest The name of the destination process\n///\n");
+		fprintf(out, "static inline void %s_send(const char* dest)\n{\n", n);
+		fprintf(out, "\twimp_add_local_server(dest, \"%s\", NULL, 0);\n}\n\n", n);
+
+		fprintf(out, "///\n/// @brief Adds the %s instruction, which has no arguments, to a server outgoing queue\n///\n", n);
+		fprintf(out, "/// @param server The server to send from\n");
+		fprintf(out, "/// @param dest The name of the destination process\n///\n");
+		fprintf(out, "/// @return Returns either WIMP_SERVER_SUCCESS or WIMP_SERVER_FAIL\n///\n");
+		fprintf(out, "static inline int32_t %s_add(WimpServer* server, const char* dest)\n{\n", n);
+		fprintf(out, "\tif (wimp_server_add_begin(server, dest, \"%s\", 0) == NULL)\n\t{\n\t\treturn WIMP_SERVER_FAIL;\n\t}\n", n);
+		fprintf(out, "\treturn wimp_server_add_commit(server);\n}\n\n");
+		return;
+	}
+
+	fprintf(out, "///\n/// @brief The size in bytes of the %s arguments\n///\n#define ", n);
+	wimp_idl_write_upper(out, n);
+	fprintf(out, "_ARGS_BYTES %zu\n\n", instr->bytes);
+
+	//The struct, with the padding the compiler would add written out
+	fprintf(out, "///\n/// @brief The arguments of the %s instruction\n///\ntypedef struct _", n);
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args\n{\n");
+	size_t offset = 0;
+	int32_t pad = 0;
+	for (size_t i = 0; i < instr->field_count; ++i)
+	{
+		const WimpIdlField* field = &instr->fields[i];
+		if (field->offset > offset)
+		{
+			fprintf(out, "\tuint8_t _pad%d[%zu];\n", pad++, field->offset - offset);
+		}
+		if (field->count > 0)
+		{
+			fprintf(out, "\t%s %s[%zu];\n", field->type->ctype, field->name, field->count);
+		}
+		else
+		{
+			fprintf(out, "\t%s %s;\n", field->type->ctype, field->name);
+		}
+		offset = field->offset + field->type->bytes * (field->count > 0 ? field->count : 1);
+	}
+	if (instr->bytes > offset)
+	{
+		fprintf(out, "\tuint8_t _pad%d[%zu];\n", pad++, instr->bytes - offset);
+	}
+	fprintf(out, "} ");
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args;\n\n");
+
+	//Fails to compile if the compiler laid the struct out differently
+	fprintf(out, "typedef char _%s_args_size_check[(sizeof(", n);
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args) == ");
+	wimp_idl_write_upper(out, n);
+	fprintf(out, "_ARGS_BYTES) ? 1 : -1];\n\n");
+
+	//Swaps each field between little-endian and host order, only on big-endian hosts
+	fprintf(out, "#if WIMP_BIG_ENDIAN\nstatic inline void _%s_args_swap(", n);
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args* args)\n{\n");
+	for (size_t i = 0; i < instr->field_count; ++i)
+	{
+		const WimpIdlField* field = &instr->fields[i];
+		if (field->type->bytes > 1)
+		{
+			fprintf(out, "\t_wimp_idl_swap(&args->%s, %zu, %zu);\n", field->name, field->type->bytes, field->count > 0 ? field->count : 1);
+		}
+	}
+	fprintf(out, "}\n#endif\n\n");
+
+	fprintf(out, "///\n/// @brief Sends the %s instruction\n///\n", n);
+	fprintf(out, "/// The arguments are copied straight into the instruction.\n///\n");
+	fprintf(out, "/// @param dest The name of the destination process\n");
+	fprintf(out, "/// @param args The arguments to send\n///\n");
+	fprintf(out, "static inline void %s_send(const char* dest, const ", n);
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args* args)\n{\n#if WIMP_BIG_ENDIAN\n\t");
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args wire = *args;\n\t_%s_args_swap(&wire);\n\targs = &wire;\n#endif\n", n);
+	fprintf(out, "\twimp_add_local_server(dest, \"%s\", args, ", n);
+	wimp_idl_write_upper(out, n);
+	fprintf(out, "_ARGS_BYTES);\n}\n\n");
+
+	//Written straight into the instruction reserved on the server, so there is no copy to build first
+	fprintf(out, "///\n/// @brief Adds the %s instruction to a server outgoing queue\n///\n", n);
+	fprintf(out, "/// The arguments are written straight into the reserved instruction.\n///\n");
+	fprintf(out, "/// @param server The server to send from\n");
+	fprintf(out, "/// @param dest The name of the destination process\n");
+	fprintf(out, "/// @param args The arguments to send\n///\n");
+	fprintf(out, "/// @return Returns either WIMP_SERVER_SUCCESS or WIMP_SERVER_FAIL\n///\n");
+	fprintf(out, "static inline int32_t %s_add(WimpServer* server, const char* dest, const ", n);
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args* args)\n{\n\t");
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args* wire = (");
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args*)wimp_server_add_begin(server, dest, \"%s\", ", n);
+	wimp_idl_write_upper(out, n);
+	fprintf(out, "_ARGS_BYTES);\n\tif (wire == NULL)\n\t{\n\t\treturn WIMP_SERVER_FAIL;\n\t}\n");
+	fprintf(out, "\t*wire = *args;\n#if WIMP_BIG_ENDIAN\n\t_%s_args_swap(wire);\n#endif\n", n);
+	fprintf(out, "\treturn wimp_server_add_commit(server);\n}\n\n");
+
+	fprintf(out, "///\n/// @brief Gets the %s arguments of a recieved instruction\n///\n", n);
+	fprintf(out, "/// Points into the instruction, so is valid until the node is freed. On\n");
+	fprintf(out, "/// big-endian hosts the arguments are swapped in place, so only decode\n");
+	fprintf(out, "/// them once.\n///\n");
+	fprintf(out, "/// @param meta The metadata of the instruction\n///\n");
+	fprintf(out, "/// @return Returns the arguments, or NULL if they are the wrong size\n///\n");
+	fprintf(out, "static inline const ");
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args* %s_decode(WimpInstrMeta meta)\n{\n", n);
+	fprintf(out, "\tif (meta.args == NULL || meta.arg_bytes != ");
+	wimp_idl_write_upper(out, n);
+	fprintf(out, "_ARGS_BYTES)\n\t{\n\t\treturn NULL;\n\t}\n");
+	fprintf(out, "#if WIMP_BIG_ENDIAN\n\t_%s_args_swap((", n);
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args*)meta.args);\n#endif\n\treturn (const ");
+	wimp_idl_write_camel(out, n);
+	fprintf(out, "Args*)meta.args;\n}\n\n");
+}
+
+/*
+* Writes the enum of the instructions, the perfect hash lookup of their names
+* and the dispatcher that switches on it
+*/
+static void wimp_idl_write_lookup(FILE* out, const char* input_path, const char* prefix)
+{
+	fprintf(out, "///\n/// @brief The instructions in %s, as given by ", input_path);
+	fprintf(out, "%s_lookup()\n///\ntypedef enum _", prefix);
+	wimp_idl_write_camel(out, prefix);
+	fprintf(out, "Instr\n{\n\t");
+	wimp_idl_write_upper(out, prefix);
+	fprintf(out, "_UNKNOWN = -1, ///< Not an instruction in %s\n", input_path);
+	for (size_t i = 0; i < instr_count; ++i)
+	{
+		fprintf(out, "\t");
+		wimp_idl_write_upper(out, prefix);
+		fputc('_', out);
+		wimp_idl_write_upper(out, instrs[i].name);
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "\t");
+	wimp_idl_write_upper(out, prefix);
+	fprintf(out, "_COUNT\n} ");
+	wimp_idl_write_camel(out, prefix);
+	fprintf(out, "Instr;\n\n");
+
+	fprintf(out, "#ifndef WIMP_IDL_MIX\n#define WIMP_IDL_MIX\n");
+	fprintf(out, "static inline uint32_t _wimp_idl_mix(uint32_t value)\n{\n");
+	fprintf(out, "\tvalue ^= value >> 16;\n\tvalue *= 0x85ebca6bu;\n\tvalue ^= value >> 13;\n");
+	fprintf(out, "\tvalue *= 0xc2b2ae35u;\n\tvalue ^= value >> 16;\n\treturn value;\n}\n#endif\n\n");
+
+	fprintf(out, "static const uint32_t _%s_displacements[%zu] = {", prefix, bucket_count);
+	for (size_t b = 0; b < bucket_count; ++b)
+	{
+		fprintf(out, "%s %uu", b > 0 ? "," : "", displacements[b]);
+	}
+	fprintf(out, " };\n\nstatic const char* const _%s_names[%zu] =\n{\n", prefix, instr_count);
+	for (size_t slot = 0; slot < instr_count; ++slot)
+	{
+		fprintf(out, "\t\"%s\",\n", instrs[slots[slot]].name);
+	}
+	fprintf(out, "};\n\nstatic const ");
+	wimp_idl_write_camel(out, prefix);
+	fprintf(out, "Instr _%s_slots[%zu] =\n{\n", prefix, instr_count);
+	for (size_t slot = 0; slot < instr_count; ++slot)
+	{
+		fprintf(out, "\t");
+		wimp_idl_write_upper(out, prefix);
+		fputc('_', out);
+		wimp_idl_write_upper(out, instrs[slots[slot]].name);
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "///\n/// @brief Gets which instruction in %s a name is\n///\n", input_path);
+	fprintf(out, "/// Uses a minimal perfect hash of the names, so costs one hash and one\n");
+	fprintf(out, "/// compare however many instructions there are.\n///\n");
+	fprintf(out, "/// @param instr The name of the instruction, such as WimpInstrMeta.instr\n///\n");
+	fprintf(out, "/// @return Returns the instruction, or ");
+	wimp_idl_write_upper(out, prefix);
+	fprintf(out, "_UNKNOWN if it isn't one\n///\nstatic inline ");
+	wimp_idl_write_camel(out, prefix);
+	fprintf(out, "Instr %s_lookup(const char* instr)\n{\n", prefix);
+	fprintf(out, "\tuint64_t hash = 14695981039346656037ULL;\n");
+	fprintf(out, "\tfor (const char* c = instr; *c != '\\0'; ++c)\n\t{\n");
+	fprintf(out, "\t\thash ^= (uint8_t)*c;\n\t\thash *= 1099511628211ULL;\n\t}\n");
+	fprintf(out, "\tuint32_t slot = _wimp_idl_mix((uint32_t)hash ^ _%s_displacements[_wimp_idl_mix((uint32_t)(hash >> 32)) %% %zuu]) %% %zuu;\n", prefix, bucket_count, instr_count);
+	fprintf(out, "\treturn strcmp(instr, _%s_names[slot]) == 0 ? _%s_slots[slot] : ", prefix, prefix);
+	wimp_idl_write_upper(out, prefix);
+	fprintf(out, "_UNKNOWN;\n}\n\n");
+
+	fprintf(out, "///\n/// @brief Handlers for the instructions in %s, any of which can be NULL\n///\ntypedef struct _", input_path);
+	wimp_idl_write_camel(out, prefix);
+	fprintf(out, "Handlers\n{\n");
+	for (size_t i = 0; i < instr_count; ++i)
+	{
+		fprintf(out, "\tvoid (*%s)(WimpInstrMeta meta, void* context);\n", instrs[i].name);
+	}
+	fprintf(out, "} ");
+	wimp_idl_write_camel(out, prefix);
+	fprintf(out, "Handlers;\n\n");
+
+	fprintf(out, "///\n/// @brief Calls the handler for an instruction in %s\n///\n", input_path);
+	fprintf(out, "/// @param meta The metadata of the instruction\n");
+	fprintf(out, "/// @param handlers The handlers to pick from\n");
+	fprintf(out, "/// @param context Passed to the handler\n///\n");
+	fprintf(out, "/// @return Returns true if the instruction had a handler to call\n///\n");
+	fprintf(out, "static inline bool %s_dispatch(WimpInstrMeta meta, const ", prefix);
+	wimp_idl_write_camel(out, prefix);
+	fprintf(out, "Handlers* handlers, void* context)\n{\n");
+	fprintf(out, "\tif (meta.instr == NULL)\n\t{\n\t\treturn false;\n\t}\n\n");
+	fprintf(out, "\tswitch (%s_lookup(meta.instr))\n\t{\n", prefix);
+	for (size_t i = 0; i < instr_count; ++i)
+	{
+		const char* n = instrs[i].name;
+		fprintf(out, "\tcase ");
+		wimp_idl_write_upper(out, prefix);
+		fputc('_', out);
+		wimp_idl_write_upper(out, n);
+		fprintf(out, ":\n\t\tif (handlers->%s == NULL)\n\t\t{\n\t\t\treturn false;\n\t\t}\n", n);
+		fprintf(out, "\t\thandlers->%s(meta, context);\n\t\treturn true;\n", n);
+	}
+	fprintf(out, "\tdefault:\n\t\treturn false;\n\t}\n}\n\n");
+}
+
+/*
+* Writes the header for every instruction read
+*/
+static void wimp_idl_write(FILE* out, const char* input_path, const char* prefix)
+{
+	fprintf(out, "///\n/// @file\n///\n/// Generated by wimp_idl from %s, do not edit.\n///\n\n", input_path);
+	fprintf(out, "#ifndef WIMP_IDL_");
+	wimp_idl_write_upper(out, prefix);
+	fprintf(out, "_H\n#define WIMP_IDL_");
+	wimp_idl_write_upper(out, prefix);
+	fprintf(out, "_H\n\n#include <stdint.h>\n#include <stdbool.h>\n#include <stddef.h>\n#include <string.h>\n#include <wimp.h>\n\n");
+
+	fprintf(out, "#if WIMP_BIG_ENDIAN && !defined(WIMP_IDL_SWAP)\n#define WIMP_IDL_SWAP\n");
+	fprintf(out, "static inline void _wimp_idl_swap(void* value, size_t bytes, size_t count)\n{\n");
+	fprintf(out, "\tuint8_t* element = (uint8_t*)value;\n");
+	fprintf(out, "\tfor (size_t i = 0; i < count; ++i, element += bytes)\n\t{\n");
+	fprintf(out, "\t\tfor (size_t lo = 0, hi = bytes - 1; lo < hi; ++lo, --hi)\n\t\t{\n");
+	fprintf(out, "\t\t\tuint8_t byte = element[lo];\n\t\t\telement[lo] = element[hi];\n\t\t\telement[hi] = byte;\n\t\t}\n\t}\n}\n#endif\n\n");
+
+	for (size_t i = 0; i < instr_count; ++i)
+	{
+		wimp_idl_write_instr(out, &instrs[i]);
+	}
+
+	if (instr_count > 0)
+	{
+		wimp_idl_write_lookup(out, input_path, prefix);
+	}
+
+	fprintf(out, "///\n/// @brief Registers the names of every instruction in %s, so they are sent by ID\n///\n", input_path);
+	fprintf(out, "/// @return Returns false if the registry is full or not initialized\n///\n");
+	fprintf(out, "static inline bool %s_register(void)\n{\n\treturn true", prefix);
+	for (size_t i = 0; i < instr_count; ++i)
+	{
+		fprintf(out, "\n\t\t&& wimp_instr_register(\"%s\") != WIMP_INSTR_ID_NONE", instrs[i].name);
+	}
+	fprintf(out, ";\n}\n\n#endif\n");
+}
+
+/*
+* Reads a whole file, which must be freed
+*/
+static char* wimp_idl_read_file(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		return NULL;
+	}
+
+	size_t capacity = 4096;
+	size_t length = 0;
+	char* text = malloc(capacity);
+	while (text != NULL)
+	{
+		length += fread(&text[length], 1, capacity - length - 1, file);
+		if (length < capacity - 1)
+		{
+			break;
+		}
+		capacity *= 2;
+		char* grown = realloc(text, capacity);
+		if (grown == NULL)
+		{
+			free(text);
+		}
+		text = grown;
+	}
+	fclose(file);
+
+	if (text != NULL)
+	{
+		text[length] = '\0';
+	}
+	return text;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: wimp_idl <input.idl> <output.h>\n");
+		return 1;
+	}
+
+	char* text = wimp_idl_read_file(argv[1]);
+	if (text == NULL)
+	{
+		fprintf(stderr, "%s: error: couldn't read the file\n", argv[1]);
+		return 1;
+	}
+
+	WimpIdlParser parser = { argv[1], text, 0, 1 };
+	bool parsed = wimp_idl_parse(&parser);
+	free(text);
+	if (!parsed || !wimp_idl_perfect_hash(argv[1]))
+	{
+		return 1;
+	}
+
+	//The functions are prefixed with the name of the IDL file
+	const char* base = argv[1];
+	for (const char* c = argv[1]; *c != '\0'; ++c)
+	{
+		if (*c == '/' || *c == '\\')
+		{
+			base = c + 1;
+		}
+	}
+	char prefix[WIMP_IDL_MAX_IDENTIFIER];
+	size_t length = 0;
+	for (; base[length] != '\0' && base[length] != '.' && length < WIMP_IDL_MAX_IDENTIFIER - 1; ++length)
+	{
+		prefix[length] = isalnum((unsigned char)base[length]) ? base[length] : '_';
+	}
+	prefix[length] = '\0';
+	if (length == 0 || isdigit((unsigned char)prefix[0]))
+	{
+		fprintf(stderr, "%s: error: the file name must start like a C identifier\n", argv[1]);
+		return 1;
+	}
+
+	FILE* out = fopen(argv[2], "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "%s: error: couldn't write the file\n", argv[2]);
+		return 1;
+	}
+	wimp_idl_write(out, base, prefix);
+	if (fclose(out) != 0)
+	{
+		fprintf(stderr, "%s: error: couldn't write the file\n", argv[2]);
+		remove(argv[2]);
+		return 1;
+	}
+	return 0;
+}